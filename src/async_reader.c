@@ -0,0 +1,624 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef CONFIG_IO_URING
+#define CONFIG_IO_URING 0
+#endif
+
+#if CONFIG_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "async_reader.h"
+#include "common.h"
+#include "defs.h"
+#include "error.h"
+#include "mem.h"
+#include "thread.h"
+#include "threadpool.h"
+
+/* Buffer, offset and size alignment of O_DIRECT reads */
+#define ALIGNMENT 4096
+#define DEFAULT_BLOCK_SIZE (1 << 20)
+#define MAX_BLOCK_SIZE (1 << 28)
+#define DEFAULT_NB_BLOCKS 32
+#define MAX_NB_BLOCKS 4096
+#define DEFAULT_NB_THREADS 4
+
+enum BlockState {
+  BLOCK_FREE,
+  BLOCK_BUSY, ///< a read is in flight
+  BLOCK_DONE, ///< waiting for the preceding blocks of its file
+  BLOCK_HELD, ///< handed out to the caller
+};
+
+typedef struct Block {
+  FFAsyncReaderBuffer buf; ///< must be first, buffers handed out are blocks
+  FFAsyncReader *r;
+  uint8_t *mem;
+  enum BlockState state;
+  int fd;
+  int len;  ///< bytes of the file covered by the block
+  int done; ///< bytes read so far
+  int res;  ///< result of the last read, bytes or an AVERROR code
+  struct iovec iov;
+  struct Block *next; ///< in the completion list of the thread backend
+} Block;
+
+typedef struct File {
+  char *path; ///< freed once the file is opened
+  void *opaque;
+  int fd;
+  int64_t size;        ///< -1 until the file is opened
+  int64_t submit_pos;  ///< offset of the next read to start
+  int64_t deliver_pos; ///< offset of the next buffer to hand out
+  int nb_busy;         ///< reads in flight
+  int finished;        ///< its last buffer was handed out
+} File;
+
+#if CONFIG_IO_URING
+typedef struct URing {
+  int fd;
+  uint8_t *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size;
+  struct io_uring_sqe *sqes;
+  unsigned int nb_sqes;
+  struct io_uring_cqe *cqes;
+  atomic_uint *sq_tail, *cq_head, *cq_tail;
+  unsigned int sq_mask, cq_mask;
+  unsigned int nb_queued; ///< entries not yet submitted to the kernel
+} URing;
+#endif
+
+struct FFAsyncReader {
+  enum FFAsyncReaderBackend backend;
+  int block_size;
+  int direct;
+
+  Block *blocks;
+  int nb_blocks;
+  uint8_t *mem;
+  int nb_busy;
+
+  File *files;
+  unsigned int files_size;
+  int nb_files;
+  int next_file; ///< first file with reads left to start
+  int nb_finished;
+
+#if CONFIG_IO_URING
+  URing ring;
+#endif
+
+  FFThreadPool *pool;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  Block *completed; ///< reads completed by the pool, protected by lock
+};
+
+#if CONFIG_IO_URING
+static void uring_uninit(URing *u) {
+  if (u->sqes)
+    munmap(u->sqes, u->nb_sqes * sizeof(*u->sqes));
+  if (u->cq_ring && u->cq_ring != u->sq_ring)
+    munmap(u->cq_ring, u->cq_ring_size);
+  if (u->sq_ring)
+    munmap(u->sq_ring, u->sq_ring_size);
+  if (u->fd >= 0)
+    close(u->fd);
+  memset(u, 0, sizeof(*u));
+  u->fd = -1;
+}
+
+static int uring_init(URing *u, unsigned int entries) {
+  struct io_uring_params p = {0};
+  unsigned int *array;
+  void *ptr;
+  int single, ret;
+  unsigned int i;
+
+  u->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (u->fd < 0)
+    return AVERROR(errno);
+
+  u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(*u->cqes);
+  single = !!(p.features & IORING_FEAT_SINGLE_MMAP);
+  if (single)
+    u->sq_ring_size = u->cq_ring_size =
+        FFMAX(u->sq_ring_size, u->cq_ring_size);
+
+  ptr = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (ptr == MAP_FAILED)
+    goto fail;
+  u->sq_ring = ptr;
+  if (single) {
+    u->cq_ring = u->sq_ring;
+  } else {
+    ptr = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (ptr == MAP_FAILED)
+      goto fail;
+    u->cq_ring = ptr;
+  }
+  ptr = mmap(NULL, p.sq_entries * sizeof(*u->sqes), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (ptr == MAP_FAILED)
+    goto fail;
+  u->sqes = ptr;
+  u->nb_sqes = p.sq_entries;
+
+  u->sq_tail = (atomic_uint *)(u->sq_ring + p.sq_off.tail);
+  u->sq_mask = *(unsigned int *)(u->sq_ring + p.sq_off.ring_mask);
+  // Entries are submitted in order, so slot i always holds entry i.
+  array = (unsigned int *)(u->sq_ring + p.sq_off.array);
+  for (i = 0; i < p.sq_entries; i++)
+    array[i] = i;
+  u->cq_head = (atomic_uint *)(u->cq_ring + p.cq_off.head);
+  u->cq_tail = (atomic_uint *)(u->cq_ring + p.cq_off.tail);
+  u->cq_mask = *(unsigned int *)(u->cq_ring + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(u->cq_ring + p.cq_off.cqes);
+  return 0;
+
+fail:
+  ret = AVERROR(errno);
+  uring_uninit(u);
+  return ret;
+}
+
+static void uring_queue(URing *u, Block *b) {
+  unsigned int tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+  struct io_uring_sqe *sqe = &u->sqes[tail & u->sq_mask];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = b->fd;
+  sqe->addr = (uintptr_t)&b->iov;
+  sqe->len = 1;
+  sqe->off = b->buf.offset + b->done;
+  sqe->user_data = (uintptr_t)b;
+  atomic_store_explicit(u->sq_tail, tail + 1, memory_order_release);
+  u->nb_queued++;
+}
+#endif
+
+static void complete_read(FFAsyncReader *r, Block *b);
+
+static void close_file(File *f) {
+  if (f->fd >= 0)
+    close(f->fd);
+  f->fd = -1;
+}
+
+static void push_completed(FFAsyncReader *r, Block *b, int res) {
+  pthread_mutex_lock(&r->lock);
+  b->res = res;
+  b->next = r->completed;
+  r->completed = b;
+  pthread_cond_signal(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+static int pread_task(void *arg) {
+  Block *b = arg;
+  ssize_t n = pread(b->fd, b->iov.iov_base, b->iov.iov_len,
+                    b->buf.offset + b->done);
+
+  push_completed(b->r, b, n < 0 ? AVERROR(errno) : n);
+  return 0;
+}
+
+/**
+ * Start reading the rest of a block. The remaining size is rounded up, as
+ * O_DIRECT requires; reading past the end of the file is harmless.
+ */
+static void submit_read(FFAsyncReader *r, Block *b) {
+  int ret;
+
+  b->iov.iov_base = b->mem + b->done;
+  b->iov.iov_len = FFALIGN(b->len, ALIGNMENT) - b->done;
+#if CONFIG_IO_URING
+  if (r->backend == FF_ASYNC_READER_IO_URING) {
+    uring_queue(&r->ring, b);
+    return;
+  }
+#endif
+  ret = ff_threadpool_submit(r->pool, pread_task, b, NULL);
+  if (ret < 0)
+    push_completed(r, b, ret);
+}
+
+static int reap_threads(FFAsyncReader *r, int wait) {
+  Block *b;
+
+  pthread_mutex_lock(&r->lock);
+  while (wait && !r->completed)
+    pthread_cond_wait(&r->cond, &r->lock);
+  b = r->completed;
+  r->completed = NULL;
+  pthread_mutex_unlock(&r->lock);
+
+  while (b) {
+    Block *next = b->next;
+    complete_read(r, b);
+    b = next;
+  }
+  return 0;
+}
+
+#if CONFIG_IO_URING
+/**
+ * Submit the queued reads and process the completed ones, in a single
+ * system call that is skipped when there is nothing to submit or wait for.
+ */
+static int reap_uring(FFAsyncReader *r, int wait) {
+  URing *u = &r->ring;
+  unsigned int head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(u->cq_tail, memory_order_acquire);
+  int min_complete = wait && head == tail;
+  int ret;
+
+  if (u->nb_queued || min_complete) {
+    do {
+      ret = syscall(__NR_io_uring_enter, u->fd, u->nb_queued, min_complete,
+                    min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    // EBUSY: the completion queue is full, reaping makes room
+    if (ret < 0 && errno != EAGAIN && errno != EBUSY)
+      return AVERROR(errno);
+    if (ret > 0)
+      u->nb_queued -= ret;
+    tail = atomic_load_explicit(u->cq_tail, memory_order_acquire);
+  }
+
+  for (; head != tail; head++) {
+    const struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+    Block *b = (Block *)(uintptr_t)cqe->user_data;
+
+    b->res = cqe->res < 0 ? AVERROR(-cqe->res) : cqe->res;
+    atomic_store_explicit(u->cq_head, head + 1, memory_order_release);
+    complete_read(r, b);
+  }
+  return 0;
+}
+#endif
+
+static int reap(FFAsyncReader *r, int wait) {
+#if CONFIG_IO_URING
+  if (r->backend == FF_ASYNC_READER_IO_URING)
+    return reap_uring(r, wait);
+#endif
+  return reap_threads(r, wait);
+}
+
+static void complete_read(FFAsyncReader *r, Block *b) {
+  File *f = &r->files[b->buf.file];
+
+  if (!f->finished) {
+    if (b->res == AVERROR(EAGAIN) || b->res == AVERROR(EINTR)) {
+      submit_read(r, b);
+      return;
+    }
+    if (b->res > 0) {
+      b->done += b->res;
+      if (b->done < b->len) {
+        submit_read(r, b);
+        return;
+      }
+    }
+  }
+
+  r->nb_busy--;
+  f->nb_busy--;
+  if (f->finished) {
+    // the file ended with an earlier error
+    b->state = BLOCK_FREE;
+    if (!f->nb_busy)
+      close_file(f);
+    return;
+  }
+  // A read returning 0 early means the file was truncated meanwhile.
+  b->buf.size = FFMIN(b->done, b->len);
+  b->buf.error = FFMIN(b->res, 0);
+  memset(b->mem + b->buf.size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  b->state = BLOCK_DONE;
+}
+
+static int open_file(FFAsyncReader *r, File *f) {
+  struct stat st;
+  int fd, ret;
+
+  fd = open(f->path, O_RDONLY | O_CLOEXEC | (r->direct ? O_DIRECT : 0));
+  if (fd < 0 && r->direct && errno == EINVAL) // not supported by the fs
+    fd = open(f->path, O_RDONLY | O_CLOEXEC);
+  av_freep(&f->path);
+  if (fd < 0)
+    return AVERROR(errno);
+  if (fstat(fd, &st) < 0) {
+    ret = AVERROR(errno);
+    close(fd);
+    return ret;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    close(fd);
+    return AVERROR(EINVAL);
+  }
+  if (!r->direct)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  f->fd = fd;
+  f->size = st.st_size;
+  return 0;
+}
+
+/**
+ * Start the next read of the current file on a free block. Failing to open
+ * the file, or an empty file, completes the block at once. Files that already
+ * ended with an error are skipped.
+ */
+static void start_block(FFAsyncReader *r, Block *b) {
+  File *f = &r->files[r->next_file];
+  int ret = 0;
+
+  while (f->finished) {
+    if (++r->next_file == r->nb_files)
+      return;
+    f = &r->files[r->next_file];
+  }
+  if (f->size < 0)
+    ret = open_file(r, f);
+
+  b->buf.file = r->next_file;
+  b->buf.opaque = f->opaque;
+  b->buf.offset = f->submit_pos;
+  b->buf.last = ret < 0 || f->size - f->submit_pos <= r->block_size;
+  b->fd = f->fd;
+  b->len = ret < 0 ? 0 : FFMIN(r->block_size, f->size - f->submit_pos);
+  b->done = 0;
+  b->state = BLOCK_BUSY;
+  f->submit_pos += b->len;
+  f->nb_busy++;
+  r->nb_busy++;
+  if (b->buf.last)
+    r->next_file++;
+
+  if (ret < 0 || !b->len) {
+    b->res = ret;
+    complete_read(r, b);
+  } else {
+    submit_read(r, b);
+  }
+}
+
+static void fill(FFAsyncReader *r) {
+  int i;
+
+  for (i = 0; i < r->nb_blocks && r->next_file < r->nb_files; i++)
+    if (r->blocks[i].state == BLOCK_FREE)
+      start_block(r, &r->blocks[i]);
+}
+
+/**
+ * Find the completed block that comes next in its file, preferring the
+ * earliest file, and drop the blocks of files that ended with an error.
+ */
+static Block *next_block(FFAsyncReader *r) {
+  Block *best = NULL;
+  File *f;
+  int i;
+
+  for (i = 0; i < r->nb_blocks; i++) {
+    Block *b = &r->blocks[i];
+
+    if (b->state != BLOCK_DONE)
+      continue;
+    f = &r->files[b->buf.file];
+    if (f->finished)
+      b->state = BLOCK_FREE;
+    else if (b->buf.offset == f->deliver_pos &&
+             (!best || b->buf.file < best->buf.file))
+      best = b;
+  }
+  if (!best)
+    return NULL;
+
+  f = &r->files[best->buf.file];
+  f->deliver_pos += best->len;
+  best->buf.last |= best->buf.error < 0;
+  if (best->buf.last) {
+    f->finished = 1;
+    r->nb_finished++;
+    if (!f->nb_busy)
+      close_file(f);
+  }
+  best->state = BLOCK_HELD;
+  return best;
+}
+
+int ff_async_reader_read(FFAsyncReader *r, FFAsyncReaderBuffer **buf,
+                         int wait) {
+  Block *b;
+  int ret;
+
+  for (;;) {
+    fill(r);
+    ret = reap(r, 0);
+    if (ret < 0)
+      return ret;
+    b = next_block(r);
+    if (b) {
+      *buf = &b->buf;
+      return 0;
+    }
+    if (r->nb_finished == r->nb_files)
+      return AVERROR_EOF;
+    fill(r);
+    if (!wait || !r->nb_busy)
+      return AVERROR(EAGAIN);
+    ret = reap(r, 1);
+    if (ret < 0)
+      return ret;
+  }
+}
+
+void ff_async_reader_release(FFAsyncReader *r, FFAsyncReaderBuffer *buf) {
+  Block *b = (Block *)buf;
+
+  b->state = BLOCK_FREE;
+  fill(r);
+}
+
+int ff_async_reader_add_file(FFAsyncReader *r, const char *path,
+                             void *opaque) {
+  File *files, *f;
+
+  if (r->nb_files >= INT_MAX / sizeof(*files))
+    return AVERROR(ENOMEM);
+  files = av_fast_realloc(r->files, &r->files_size,
+                          (r->nb_files + 1) * sizeof(*files));
+  if (!files)
+    return AVERROR(ENOMEM);
+  r->files = files;
+
+  f = &files[r->nb_files];
+  memset(f, 0, sizeof(*f));
+  f->path = av_strdup(path);
+  if (!f->path)
+    return AVERROR(ENOMEM);
+  f->opaque = opaque;
+  f->fd = -1;
+  f->size = -1;
+  return r->nb_files++;
+}
+
+int ff_async_reader_init(FFAsyncReader **pr, const FFAsyncReaderOptions *opts) {
+  FFAsyncReaderOptions o = {0};
+  FFAsyncReader *r;
+  size_t stride;
+  int i, ret;
+
+  if (opts)
+    o = *opts;
+  if (o.block_size < 0 || o.block_size > MAX_BLOCK_SIZE || o.nb_blocks < 0)
+    return AVERROR(EINVAL);
+
+  r = av_mallocz(sizeof(*r));
+  if (!r)
+    return AVERROR(ENOMEM);
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->cond, NULL);
+#if CONFIG_IO_URING
+  r->ring.fd = -1;
+#endif
+  r->block_size =
+      o.block_size ? FFALIGN(o.block_size, ALIGNMENT) : DEFAULT_BLOCK_SIZE;
+  r->nb_blocks = o.nb_blocks ? FFMIN(o.nb_blocks, MAX_NB_BLOCKS)
+                             : DEFAULT_NB_BLOCKS;
+  r->direct = o.direct;
+
+  r->blocks = av_calloc(r->nb_blocks, sizeof(*r->blocks));
+  if (!r->blocks) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+  // Keep every block aligned, with its padding in between.
+  stride = r->block_size + FFALIGN(AV_INPUT_BUFFER_PADDING_SIZE, ALIGNMENT);
+  r->mem = av_malloc_class((size_t)r->nb_blocks * stride, AV_ALLOC_HUGEPAGE,
+                           AV_NUMA_NODE_ANY);
+  if (!r->mem) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+  for (i = 0; i < r->nb_blocks; i++) {
+    Block *b = &r->blocks[i];
+
+    b->r = r;
+    b->mem = r->mem + i * stride;
+    b->buf.data = b->mem;
+  }
+
+#if CONFIG_IO_URING
+  if (o.backend != FF_ASYNC_READER_THREADS) {
+    ret = uring_init(&r->ring, r->nb_blocks);
+    if (ret >= 0)
+      r->backend = FF_ASYNC_READER_IO_URING;
+    else if (o.backend == FF_ASYNC_READER_IO_URING)
+      goto fail;
+  }
+#else
+  if (o.backend == FF_ASYNC_READER_IO_URING) {
+    ret = AVERROR(ENOSYS);
+    goto fail;
+  }
+#endif
+  if (r->backend != FF_ASYNC_READER_IO_URING) {
+    ret = ff_threadpool_init(&r->pool, o.nb_threads > 0 ? o.nb_threads
+                                                        : DEFAULT_NB_THREADS);
+    if (ret < 0)
+      goto fail;
+    r->backend = FF_ASYNC_READER_THREADS;
+  }
+
+  *pr = r;
+  return r->backend;
+
+fail:
+  ff_async_reader_free(&r);
+  return ret;
+}
+
+void ff_async_reader_free(FFAsyncReader **pr) {
+  FFAsyncReader *r = *pr;
+  int i;
+
+  if (!r)
+    return;
+
+  // Wait for the reads in flight, they write into the blocks.
+  for (i = 0; i < r->nb_files; i++)
+    r->files[i].finished = 1;
+  while (r->nb_busy > 0 && reap(r, 1) >= 0)
+    ;
+  ff_threadpool_free(&r->pool);
+#if CONFIG_IO_URING
+  uring_uninit(&r->ring);
+#endif
+
+  for (i = 0; i < r->nb_files; i++) {
+    close_file(&r->files[i]);
+    av_free(r->files[i].path);
+  }
+  av_free(r->files);
+  av_free_class(r->mem);
+  av_free(r->blocks);
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->cond);
+  av_freep(pr);
+}
@@ -0,0 +1,114 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Asynchronous reader for many files.
+ *
+ * The reader owns a fixed set of page aligned buffers. Every buffer that is
+ * not held by the caller has a read in flight, for the current file or the
+ * ones queued after it, so the device sees a deep queue while the caller
+ * parses. Completed buffers are handed out in file order within each file,
+ * and files are interleaved as their reads complete.
+ *
+ * Reads go through io_uring when the kernel allows it: one system call
+ * submits the refilled buffers and reaps the completions. Otherwise they
+ * are run as pread() tasks on a thread pool.
+ *
+ * A reader is used from one thread at a time.
+ */
+
+#ifndef AVCODEC_ASYNC_READER_H
+#define AVCODEC_ASYNC_READER_H
+
+#include <stdint.h>
+
+enum FFAsyncReaderBackend {
+  FF_ASYNC_READER_AUTO,     ///< io_uring if available, else threads
+  FF_ASYNC_READER_IO_URING, ///< io_uring, fail if it is not available
+  FF_ASYNC_READER_THREADS,  ///< pread() on a thread pool
+};
+
+typedef struct FFAsyncReaderOptions {
+  enum FFAsyncReaderBackend backend;
+  int block_size; ///< bytes per read, rounded up to 4 KiB; 0 for 1 MiB
+  int nb_blocks;  ///< buffers, in flight or held by the caller; 0 for 32
+  int nb_threads; ///< threads of the pread() backend, 0 for 4
+  int direct;     ///< open the files with O_DIRECT where supported
+} FFAsyncReaderOptions;
+
+typedef struct FFAsyncReaderBuffer {
+  /**
+   * Followed by AV_INPUT_BUFFER_PADDING_SIZE zeroed bytes. Valid until the
+   * buffer is released.
+   */
+  const uint8_t *data;
+  int size;
+  int64_t offset; ///< of data in the file
+  int file;       ///< index returned by ff_async_reader_add_file()
+  void *opaque;   ///< opaque of the file
+  int last;       ///< last buffer of the file
+  /**
+   * 0, or the AVERROR code of a failed open or read. The buffer is then
+   * the last of the file and holds the data read before the error.
+   */
+  int error;
+} FFAsyncReaderBuffer;
+
+typedef struct FFAsyncReader FFAsyncReader;
+
+/**
+ * @param opts NULL for the defaults
+ * @return the backend in use, a negative AVERROR code on error
+ */
+int ff_async_reader_init(FFAsyncReader **r, const FFAsyncReaderOptions *opts);
+
+/**
+ * Wait for the reads in flight and free the reader. Buffers still held by the
+ * caller become invalid.
+ */
+void ff_async_reader_free(FFAsyncReader **r);
+
+/**
+ * Queue a regular file. Files are opened in the order they are added, once
+ * buffers are free for them, so at most nb_blocks of them are open at a
+ * time.
+ *
+ * @return the index of the file, a negative AVERROR code on error
+ */
+int ff_async_reader_add_file(FFAsyncReader *r, const char *path, void *opaque);
+
+/**
+ * Get the next completed buffer. Each file yields at least one buffer, the
+ * last one flagged, and an empty file yields an empty one.
+ *
+ * @param wait if nonzero, block until a buffer completes
+ * @return 0 on success,
+ *         AVERROR(EAGAIN) if no buffer is complete and wait is 0, or if
+ *         the caller holds every buffer,
+ *         AVERROR_EOF once every queued file was read
+ */
+int ff_async_reader_read(FFAsyncReader *r, FFAsyncReaderBuffer **buf,
+                         int wait);
+
+/**
+ * Give a buffer back to the reader, to be reused for the next read.
+ */
+void ff_async_reader_release(FFAsyncReader *r, FFAsyncReaderBuffer *buf);
+
+#endif /* AVCODEC_ASYNC_READER_H */
@@ -21,6 +21,8 @@
 
 #include "atsc_a53.h"
 #include "get_bits.h"
+#include "macros.h"
+#include "mem.h"
 
 // int ff_alloc_a53_sei(const AVFrame *frame, size_t prefix_len,
 //                      void **data, size_t *sei_size)
@@ -116,3 +118,81 @@ int ff_parse_a53_cc(AVBufferRef **pbuf, const uint8_t *data, int size) {
 
   return cc_count;
 }
+
+int ff_a53_cc_ring_init(A53CCRing *ring, unsigned int nb_entries) {
+  unsigned int size = 1;
+
+  if (!nb_entries || nb_entries > INT_MAX / sizeof(*ring->entries))
+    return AVERROR(EINVAL);
+  while (size < nb_entries)
+    size <<= 1;
+
+  ring->entries = av_malloc_array(size, sizeof(*ring->entries));
+  if (!ring->entries)
+    return AVERROR(ENOMEM);
+  ring->mask = size - 1;
+  atomic_init(&ring->write, 0);
+  atomic_init(&ring->read, 0);
+  atomic_init(&ring->dropped, 0);
+  return 0;
+}
+
+void ff_a53_cc_ring_uninit(A53CCRing *ring) {
+  av_freep(&ring->entries);
+  ring->mask = 0;
+}
+
+int ff_parse_a53_cc_ring(A53CCRing *ring, const uint8_t *data, int size,
+                         int64_t pts) {
+  unsigned int w, r;
+  int cc_count;
+
+  if (size < 3)
+    return AVERROR_INVALIDDATA;
+
+  if (data[0] != 0x3) // user_data_type_code
+    return 0;
+  if (!(data[1] & 0x40)) // process_cc_data_flag
+    return 0;
+  cc_count = data[1] & 0x1f;
+  if (!cc_count)
+    return 0;
+
+  /* 3 bytes per CC plus one byte marker_bits at the end */
+  data += 3; // header and em_data
+  size -= 3;
+  if (cc_count * 3 >= size)
+    return AVERROR_INVALIDDATA;
+
+  w = atomic_load_explicit(&ring->write, memory_order_relaxed);
+  r = atomic_load_explicit(&ring->read, memory_order_acquire);
+  if (ring->mask + 1 - (w - r) < cc_count) {
+    atomic_fetch_add_explicit(&ring->dropped, cc_count, memory_order_relaxed);
+    return AVERROR(EAGAIN);
+  }
+
+  /* the triplets are byte aligned, no need for a bit reader */
+  for (int i = 0; i < cc_count; i++, w++, data += 3) {
+    A53CCEntry *e = &ring->entries[w & ring->mask];
+    e->pts = pts;
+    e->data[0] = data[0];
+    e->data[1] = data[1];
+    e->data[2] = data[2];
+  }
+  atomic_store_explicit(&ring->write, w, memory_order_release);
+
+  return cc_count;
+}
+
+unsigned int ff_a53_cc_ring_drain(A53CCRing *ring, A53CCEntry *entries,
+                                  unsigned int nb_entries) {
+  unsigned int r = atomic_load_explicit(&ring->read, memory_order_relaxed);
+  unsigned int w = atomic_load_explicit(&ring->write, memory_order_acquire);
+  unsigned int n = FFMIN(w - r, nb_entries);
+
+  for (unsigned int i = 0; i < n; i++)
+    entries[i] = ring->entries[(r + i) & ring->mask];
+  atomic_store_explicit(&ring->read, r + n, memory_order_release);
+
+  return n;
+}
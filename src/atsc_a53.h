@@ -19,6 +19,7 @@
 #ifndef AVCODEC_ATSC_A53_H
 #define AVCODEC_ATSC_A53_H
 
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -55,4 +56,52 @@
  */
 int ff_parse_a53_cc(AVBufferRef **pbuf, const uint8_t *data, int size);
 
+/**
+ * One cc_data triplet: cc_valid/cc_type byte followed by cc_data_1 and
+ * cc_data_2, tagged with the access unit it came from.
+ */
+typedef struct A53CCEntry {
+  int64_t pts; ///< AU index or PTS, as passed to ff_parse_a53_cc_ring()
+  uint8_t data[3];
+} A53CCEntry;
+
+/**
+ * Single producer, single consumer ring of cc_data triplets. The parser
+ * thread appends with ff_parse_a53_cc_ring(), one caption consumer thread
+ * drains with ff_a53_cc_ring_drain(); no locks are taken.
+ */
+typedef struct A53CCRing {
+  A53CCEntry *entries;
+  unsigned int mask;  ///< number of entries - 1, a power of two minus 1
+  atomic_uint write;  ///< next entry to write, owned by the producer
+  atomic_uint read;   ///< next entry to read, owned by the consumer
+  atomic_uint dropped; ///< triplets dropped because the ring was full
+} A53CCRing;
+
+/**
+ * Allocate a ring holding at least nb_entries triplets.
+ */
+int ff_a53_cc_ring_init(A53CCRing *ring, unsigned int nb_entries);
+
+void ff_a53_cc_ring_uninit(A53CCRing *ring);
+
+/**
+ * Parse A53 Part 4 cc_data like ff_parse_a53_cc() and append the triplets
+ * to the ring. The triplets of one field are appended all or none.
+ *
+ * @return number of triplets appended, AVERROR(EAGAIN) if the ring is full
+ *         (the triplets are counted as dropped), other negative error code
+ *         on invalid data
+ */
+int ff_parse_a53_cc_ring(A53CCRing *ring, const uint8_t *data, int size,
+                         int64_t pts);
+
+/**
+ * Move up to nb_entries triplets out of the ring, oldest first.
+ *
+ * @return number of triplets written to entries
+ */
+unsigned int ff_a53_cc_ring_drain(A53CCRing *ring, A53CCEntry *entries,
+                                  unsigned int nb_entries);
+
 #endif /* AVCODEC_ATSC_A53_H */
@@ -31,7 +31,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 // #include "avutil.h"
-// #include "log.h"
+#include "log.h"
 
 /**
  * assert() equivalent, that is always enabled.
@@ -39,8 +39,8 @@
 #define av_assert0(cond)                                                       \
   do {                                                                         \
     if (!(cond)) {                                                             \
-      printf("Assertion %s failed at %s:%d\n", AV_STRINGIFY(cond), __FILE__,   \
-             __LINE__);                                                        \
+      av_log(NULL, AV_LOG_PANIC, "Assertion %s failed at %s:%d\n",          \
+             AV_STRINGIFY(cond), __FILE__, __LINE__);                          \
       exit(1);                                                                 \
     }                                                                          \
   } while (0)
@@ -241,50 +241,112 @@ int av_buffer_replace(AVBufferRef **pdst, const AVBufferRef *src) {
   return 0;
 }
 
+/* Pools often outlive the code creating them, so they are charged to
+ * FF_MEM_TAG_POOL like their idle buffers. */
+static AVBufferPool *pool_create(size_t size) {
+  enum FFMemTag tag = ff_mem_set_tag(FF_MEM_TAG_POOL);
+  FFMemStats *stream = ff_mem_set_stream(NULL);
+  AVBufferPool *pool = av_mallocz(sizeof(*pool));
+
+  ff_mem_set_tag(tag);
+  ff_mem_set_stream(stream);
+  if (!pool)
+    return NULL;
+
+  pool->size = size;
+  atomic_init(&pool->refcount, 1);
+
+  return pool;
+}
+
 AVBufferPool *av_buffer_pool_init2(size_t size, void *opaque,
                                    AVBufferRef *(*alloc)(void *opaque,
                                                          size_t size),
                                    void (*pool_free)(void *opaque)) {
-  AVBufferPool *pool = av_mallocz(sizeof(*pool));
+  AVBufferPool *pool = pool_create(size);
   if (!pool)
     return NULL;
 
-  ff_mutex_init(&pool->mutex, NULL);
-
-  pool->size = size;
   pool->opaque = opaque;
   pool->alloc2 = alloc;
   pool->alloc = av_buffer_alloc; // fallback
   pool->pool_free = pool_free;
 
-  atomic_init(&pool->refcount, 1);
-
   return pool;
 }
 
 AVBufferPool *av_buffer_pool_init(size_t size,
                                   AVBufferRef *(*alloc)(size_t size)) {
-  AVBufferPool *pool = av_mallocz(sizeof(*pool));
+  AVBufferPool *pool = pool_create(size);
   if (!pool)
     return NULL;
 
-  ff_mutex_init(&pool->mutex, NULL);
-
-  pool->size = size;
   pool->alloc = alloc ? alloc : av_buffer_alloc;
 
-  atomic_init(&pool->refcount, 1);
-
   return pool;
 }
 
-static void buffer_pool_flush(AVBufferPool *pool) {
-  while (pool->pool) {
-    BufferPoolEntry *buf = pool->pool;
-    pool->pool = buf->next;
+/* Get the entry of an index, allocating its chunk if needed. */
+static BufferPoolEntry *pool_entry(AVBufferPool *pool, unsigned int index,
+                                   int alloc) {
+  unsigned int k = av_log2((index >> POOL_CHUNK_BITS) + 1);
+  BufferPoolEntry *chunk, *expected = NULL;
+
+  if (k >= POOL_MAX_CHUNKS)
+    return NULL;
+  chunk = atomic_load_explicit(&pool->chunks[k], memory_order_acquire);
+  if (!chunk && alloc) {
+    chunk = av_calloc((size_t)1 << (k + POOL_CHUNK_BITS), sizeof(*chunk));
+    if (!chunk)
+      return NULL;
+    if (!atomic_compare_exchange_strong_explicit(&pool->chunks[k], &expected,
+                                                 chunk, memory_order_acq_rel,
+                                                 memory_order_acquire)) {
+      av_free(chunk);
+      chunk = expected;
+    }
+  }
+  return chunk + index - (((1U << k) - 1) << POOL_CHUNK_BITS);
+}
+
+static void pool_push(atomic_uint_least64_t *list, BufferPoolEntry *buf) {
+  uint64_t head = atomic_load_explicit(list, memory_order_relaxed);
+  uint64_t new;
+
+  do {
+    atomic_store_explicit(&buf->next, (uint32_t)head, memory_order_relaxed);
+    new = ((head >> 32) + 1) << 32 | (buf->index + 1);
+  } while (!atomic_compare_exchange_weak_explicit(
+      list, &head, new, memory_order_release, memory_order_relaxed));
+}
+
+static BufferPoolEntry *pool_pop(AVBufferPool *pool,
+                                 atomic_uint_least64_t *list) {
+  uint64_t head = atomic_load_explicit(list, memory_order_acquire);
+  BufferPoolEntry *buf;
+  uint64_t new;
+
+  do {
+    if (!(uint32_t)head)
+      return NULL;
+    // The entry may be popped by another thread meanwhile, then its next
+    // is stale but the tag of the head has changed.
+    buf = pool_entry(pool, (uint32_t)head - 1, 0);
+    new = ((head >> 32) + 1) << 32 |
+          atomic_load_explicit(&buf->next, memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit(
+      list, &head, new, memory_order_acquire, memory_order_acquire));
+  return buf;
+}
+
+void ff_buffer_pool_trim(AVBufferPool *pool) {
+  BufferPoolEntry *buf;
 
+  if (!pool)
+    return;
+  while ((buf = pool_pop(pool, &pool->head))) {
     buf->free(buf->opaque, buf->data);
-    av_freep(&buf);
+    pool_push(&pool->spare, buf);
   }
 }
 
@@ -293,8 +355,11 @@ static void buffer_pool_flush(AVBufferPool *pool) {
  * all the buffers returned to it.
  */
 static void buffer_pool_free(AVBufferPool *pool) {
-  buffer_pool_flush(pool);
-  ff_mutex_destroy(&pool->mutex);
+  int i;
+
+  ff_buffer_pool_trim(pool);
+  for (i = 0; i < POOL_MAX_CHUNKS; i++)
+    av_free(atomic_load_explicit(&pool->chunks[i], memory_order_relaxed));
 
   if (pool->pool_free)
     pool->pool_free(pool->opaque);
@@ -310,9 +375,7 @@ void av_buffer_pool_uninit(AVBufferPool **ppool) {
   pool = *ppool;
   *ppool = NULL;
 
-  ff_mutex_lock(&pool->mutex);
-  buffer_pool_flush(pool);
-  ff_mutex_unlock(&pool->mutex);
+  ff_buffer_pool_trim(pool);
 
   if (atomic_fetch_sub_explicit(&pool->refcount, 1, memory_order_acq_rel) == 1)
     buffer_pool_free(pool);
@@ -325,10 +388,10 @@ static void pool_release_buffer(void *opaque, uint8_t *data) {
   // if(CONFIG_MEMORY_POISONING)
   //     memset(buf->data, FF_MEMORY_POISON, pool->size);
 
-  ff_mutex_lock(&pool->mutex);
-  buf->next = pool->pool;
-  pool->pool = buf;
-  ff_mutex_unlock(&pool->mutex);
+#if CONFIG_MEMORY_ACCOUNTING
+  ff_mem_account_pool_release(buf->mem_owner, pool->size);
+#endif
+  pool_push(&pool->head, buf);
 
   if (atomic_fetch_sub_explicit(&pool->refcount, 1, memory_order_acq_rel) == 1)
     buffer_pool_free(pool);
@@ -339,18 +402,32 @@ static void pool_release_buffer(void *opaque, uint8_t *data) {
 static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool) {
   BufferPoolEntry *buf;
   AVBufferRef *ret;
+  unsigned int index;
+  enum FFMemTag tag;
+  FFMemStats *stream;
 
   av_assert0(pool->alloc || pool->alloc2);
 
+  // Pool memory, entries included, is charged to the pool until it is
+  // taken out.
+  tag = ff_mem_set_tag(FF_MEM_TAG_POOL);
+  stream = ff_mem_set_stream(NULL);
+
   ret = pool->alloc2 ? pool->alloc2(pool->opaque, pool->size)
                      : pool->alloc(pool->size);
   if (!ret)
-    return NULL;
+    goto end;
 
-  buf = av_mallocz(sizeof(*buf));
+  buf = pool_pop(pool, &pool->spare);
   if (!buf) {
-    av_buffer_unref(&ret);
-    return NULL;
+    index = atomic_fetch_add_explicit(&pool->nb_entries, 1,
+                                      memory_order_relaxed);
+    buf = pool_entry(pool, index, 1);
+    if (!buf) {
+      av_buffer_unref(&ret);
+      goto end;
+    }
+    buf->index = index;
   }
 
   buf->data = ret->buffer->data;
@@ -361,35 +438,108 @@ static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool) {
   ret->buffer->opaque = buf;
   ret->buffer->free = pool_release_buffer;
 
+end:
+  ff_mem_set_tag(tag);
+  ff_mem_set_stream(stream);
   return ret;
 }
 
 AVBufferRef *av_buffer_pool_get(AVBufferPool *pool) {
   AVBufferRef *ret;
-  BufferPoolEntry *buf;
+  BufferPoolEntry *buf = pool_pop(pool, &pool->head);
 
-  ff_mutex_lock(&pool->mutex);
-  buf = pool->pool;
   if (buf) {
     memset(&buf->buffer, 0, sizeof(buf->buffer));
     ret = buffer_create(&buf->buffer, buf->data, pool->size,
                         pool_release_buffer, buf, 0);
-    if (ret) {
-      pool->pool = buf->next;
-      buf->next = NULL;
+    if (ret)
       buf->buffer.flags_internal |= BUFFER_FLAG_NO_FREE;
-    }
+    else
+      pool_push(&pool->head, buf);
   } else {
     ret = pool_alloc_buffer(pool);
   }
-  ff_mutex_unlock(&pool->mutex);
 
-  if (ret)
+  if (ret) {
     atomic_fetch_add_explicit(&pool->refcount, 1, memory_order_relaxed);
+#if CONFIG_MEMORY_ACCOUNTING
+    buf = ret->buffer->opaque;
+    buf->mem_owner = ff_mem_account_pool_get(pool->size);
+#endif
+  }
+
+  return ret;
+}
+
+#define SIZE_POOL_MIN_BITS 12
+#define SIZE_POOL_MAX_BITS 26
+#define SIZE_POOL_MAX_NODES 8
+
+/* One set of size classes per NUMA node, so that a buffer recycled by a
+ * thread stays on the node it was placed on. */
+static AVBufferPool *size_pools[SIZE_POOL_MAX_NODES]
+                               [SIZE_POOL_MAX_BITS - SIZE_POOL_MIN_BITS + 1];
+static int nb_size_pool_nodes;
+static AVOnce size_pools_once = AV_ONCE_INIT;
+
+static void size_pool_free(void *opaque, uint8_t *data) {
+  av_free_class(data);
+}
+
+static AVBufferRef *size_pool_alloc(void *opaque, size_t size) {
+  int node = (intptr_t)opaque;
+  uint8_t *data;
+  AVBufferRef *ret;
 
+  data = av_malloc_class(size, av_alloc_class_for_size(size), node);
+  if (!data)
+    return NULL;
+  ret = av_buffer_create(data, size, size_pool_free, NULL, 0);
+  if (!ret)
+    av_free_class(data);
   return ret;
 }
 
+static void size_pools_init(void) {
+  nb_size_pool_nodes = FFMIN(av_numa_nb_nodes(), SIZE_POOL_MAX_NODES);
+  for (int n = 0; n < nb_size_pool_nodes; n++) {
+    // A single node needs no placement.
+    void *node = (void *)(intptr_t)(nb_size_pool_nodes > 1 ? n
+                                                           : AV_NUMA_NODE_ANY);
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(size_pools[n]); i++)
+      size_pools[n][i] =
+          av_buffer_pool_init2((size_t)1 << (i + SIZE_POOL_MIN_BITS), node,
+                               size_pool_alloc, NULL);
+  }
+}
+
+AVBufferRef *ff_buffer_pool_get_size(size_t size) {
+  int bits = SIZE_POOL_MIN_BITS;
+  AVBufferPool *pool;
+  int node;
+
+  while (bits <= SIZE_POOL_MAX_BITS && ((size_t)1 << bits) < size)
+    bits++;
+  if (bits > SIZE_POOL_MAX_BITS)
+    return size_pool_alloc((void *)(intptr_t)AV_NUMA_NODE_ANY, size);
+  if (ff_thread_once(&size_pools_once, size_pools_init))
+    return NULL;
+  node = av_numa_node_current();
+  if (node >= nb_size_pool_nodes)
+    node = 0;
+  pool = size_pools[node][bits - SIZE_POOL_MIN_BITS];
+  return pool ? av_buffer_pool_get(pool) : NULL;
+}
+
+void ff_buffer_pool_trim_size(void) {
+  if (ff_thread_once(&size_pools_once, size_pools_init))
+    return;
+  for (int n = 0; n < nb_size_pool_nodes; n++)
+    for (int i = 0; i < FF_ARRAY_ELEMS(size_pools[n]); i++)
+      ff_buffer_pool_trim(size_pools[n][i]);
+}
+
 void *av_buffer_pool_buffer_get_opaque(const AVBufferRef *ref) {
   BufferPoolEntry *buf = ref->buffer->opaque;
   av_assert0(buf);
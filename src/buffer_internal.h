@@ -24,6 +24,7 @@
 
 // #include "internal.h"
 #include "buffer.h"
+#include "memstats.h"
 #include "thread.h"
 
 /**
@@ -77,7 +78,14 @@ typedef struct BufferPoolEntry {
   void (*free)(void *opaque, uint8_t *data);
 
   AVBufferPool *pool;
-  struct BufferPoolEntry *next;
+  unsigned int index; ///< position of the entry in the pool chunks
+  FFMemOwner mem_owner; ///< holder of the buffer taken out of the pool
+
+  /*
+   * index + 1 of the next entry of the free list, 0 for none. Read by
+   * concurrent poppers even while the entry is in use.
+   */
+  atomic_uint next;
 
   /*
    * An AVBuffer structure to (re)use as AVBuffer for subsequent uses
@@ -86,9 +94,29 @@ typedef struct BufferPoolEntry {
   AVBuffer buffer;
 } BufferPoolEntry;
 
+/*
+ * Entries are stored in chunks of 16 << k entries, chunk k holding the
+ * indices from 16 * ((1 << k) - 1) on. Chunks are only freed with the pool,
+ * so an entry can always be read through a stale free list head.
+ */
+#define POOL_CHUNK_BITS 4
+#define POOL_MAX_CHUNKS 27
+
 struct AVBufferPool {
-  AVMutex mutex;
-  BufferPoolEntry *pool;
+  /*
+   * Free list head, a Treiber stack: index + 1 of the first entry in the
+   * low 32 bits, 0 if empty, and a counter bumped by every update in the
+   * high 32 bits, so that a pop racing with a pop and push of the same
+   * entry fails its compare and swap (ABA).
+   */
+  atomic_uint_least64_t head;
+  /*
+   * Entries whose buffer was freed by ff_buffer_pool_trim(), in the same
+   * form, reused before new indices are taken.
+   */
+  atomic_uint_least64_t spare;
+  atomic_uint nb_entries;
+  _Atomic(BufferPoolEntry *) chunks[POOL_MAX_CHUNKS];
 
   /*
    * This is used to track when the pool is to be freed.
@@ -108,4 +136,29 @@ struct AVBufferPool {
   void (*pool_free)(void *opaque);
 };
 
+/**
+ * Get a buffer of at least size bytes from process-wide pools of power of 2
+ * sizes, from 4 KiB to 64 MiB; larger buffers are not pooled. The buffer
+ * is not zeroed, and ref->size is the size of its class. Released buffers
+ * are kept for reuse until ff_buffer_pool_trim_size().
+ *
+ * The buffers are allocated with the class av_alloc_class_for_size() picks,
+ * on the NUMA node of the calling thread, and go back to the pool of that
+ * node.
+ *
+ * @return the buffer, NULL on error
+ */
+AVBufferRef *ff_buffer_pool_get_size(size_t size);
+
+/**
+ * Free the buffers idle in a pool. Buffers in use are not affected and
+ * return to the pool when released. pool may be NULL.
+ */
+void ff_buffer_pool_trim(AVBufferPool *pool);
+
+/**
+ * Free the buffers idle in the pools of ff_buffer_pool_get_size().
+ */
+void ff_buffer_pool_trim_size(void);
+
 #endif /* AVUTIL_BUFFER_INTERNAL_H */
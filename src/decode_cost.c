@@ -0,0 +1,351 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Decode cost estimation and decoder slot scheduling
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "decode_cost.h"
+#include "error.h"
+#include "macros.h"
+#include "mem.h"
+
+/* H.264 Table A-1, MaxMBPS */
+static const struct {
+  int level_idc;
+  int max_mbps;
+} h264_levels[] = {
+    {9, 1485},       {10, 1485},      {11, 3000},       {12, 6000},
+    {13, 11880},     {20, 11880},     {21, 19800},      {22, 20250},
+    {30, 40500},     {31, 108000},    {32, 216000},     {40, 245760},
+    {41, 245760},    {42, 522240},    {50, 589824},     {51, 983040},
+    {52, 2073600},   {60, 4177920},   {61, 8355840},    {62, 16711680},
+};
+
+/* HEVC Table A.8, MaxLumaSr */
+static const struct {
+  int level_idc;
+  int64_t max_luma_sr;
+} hevc_levels[] = {
+    {30, 552960},      {60, 3686400},     {63, 7372800},
+    {90, 16588800},    {93, 33177600},    {120, 66846720},
+    {123, 133693440},  {150, 267386880},  {153, 534773760},
+    {156, 1069547520}, {180, 1069547520}, {183, 2139095040},
+    {186, 4278190080LL},
+};
+
+void ff_decode_cost_model_default(DecodeCostModel *m) {
+  m->sample_weight = 1.0;
+  m->high_depth_weight = 1.25;
+  m->bit_weight = 4.0;
+}
+
+static void set_frame_rate(DecodeCostInfo *info, int timing, uint32_t num,
+                           uint32_t den) {
+  if (timing && num && den)
+    info->frame_rate = (double)num / den;
+  else if (info->max_luma_sample_rate && info->luma_samples)
+    info->frame_rate =
+        (double)info->max_luma_sample_rate / info->luma_samples;
+  else
+    info->frame_rate = 0;
+}
+
+int ff_decode_cost_from_h264_sps(DecodeCostInfo *info, const SPS *sps) {
+  int i;
+
+  memset(info, 0, sizeof(*info));
+  info->luma_samples = (int64_t)sps->mb_width * sps->mb_height * 256;
+  info->bit_depth = sps->bit_depth_luma;
+  info->chroma_format_idc = sps->chroma_format_idc;
+  for (i = 0; i < FF_ARRAY_ELEMS(h264_levels); i++) {
+    if (h264_levels[i].level_idc == sps->level_idc) {
+      info->max_luma_sample_rate = h264_levels[i].max_mbps * 256LL;
+      break;
+    }
+  }
+  /* one clock tick is a field period */
+  set_frame_rate(info, sps->timing_info_present_flag, sps->time_scale,
+                 2 * sps->num_units_in_tick);
+  return info->luma_samples ? 0 : AVERROR_INVALIDDATA;
+}
+
+int ff_decode_cost_from_hevc_sps(DecodeCostInfo *info, const HEVCSPS *sps) {
+  int level_idc = sps->ptl.general_ptl.level_idc;
+  int i;
+
+  memset(info, 0, sizeof(*info));
+  info->luma_samples = ((int64_t)sps->ctb_width * sps->ctb_height)
+                       << (2 * sps->log2_ctb_size);
+  info->bit_depth = sps->bit_depth;
+  info->chroma_format_idc = sps->chroma_format_idc;
+  for (i = 0; i < FF_ARRAY_ELEMS(hevc_levels); i++) {
+    if (hevc_levels[i].level_idc == level_idc) {
+      info->max_luma_sample_rate = hevc_levels[i].max_luma_sr;
+      break;
+    }
+  }
+  set_frame_rate(info, sps->vui.vui_timing_info_present_flag,
+                 sps->vui.vui_time_scale, sps->vui.vui_num_units_in_tick);
+  return info->luma_samples ? 0 : AVERROR_INVALIDDATA;
+}
+
+void ff_decode_cost_add_au(DecodeCostInfo *info, int64_t size) {
+  info->nb_au++;
+  info->nb_bytes += size;
+}
+
+double ff_decode_cost_bitrate(const DecodeCostInfo *info) {
+  if (!info->nb_au)
+    return 0;
+  return 8.0 * info->nb_bytes * info->frame_rate / info->nb_au;
+}
+
+double ff_decode_cost_estimate(const DecodeCostModel *m,
+                               const DecodeCostInfo *info) {
+  static const double chroma_factor[4] = {1.0, 1.5, 2.0, 3.0};
+  double sample_rate = info->luma_samples * info->frame_rate;
+  double cost;
+
+  if (info->max_luma_sample_rate && sample_rate > info->max_luma_sample_rate)
+    sample_rate = info->max_luma_sample_rate;
+
+  cost = sample_rate * m->sample_weight *
+         chroma_factor[info->chroma_format_idc & 3];
+  if (info->bit_depth > 8)
+    cost *= m->high_depth_weight;
+  return cost + ff_decode_cost_bitrate(info) * m->bit_weight;
+}
+
+DecodeScheduler *ff_decode_sched_alloc(int nb_slots, const double *capacity) {
+  DecodeScheduler *s;
+  int i;
+
+  if (nb_slots <= 0)
+    return NULL;
+  s = av_mallocz(sizeof(*s));
+  if (!s)
+    return NULL;
+  s->slots = av_calloc(nb_slots, sizeof(*s->slots));
+  if (!s->slots) {
+    av_free(s);
+    return NULL;
+  }
+  s->nb_slots = nb_slots;
+  for (i = 0; i < nb_slots; i++)
+    s->slots[i].capacity = capacity[i];
+  return s;
+}
+
+void ff_decode_sched_free(DecodeScheduler **ps) {
+  DecodeScheduler *s = *ps;
+
+  if (!s)
+    return;
+  av_freep(&s->slots);
+  av_freep(&s->streams);
+  av_freep(ps);
+}
+
+static void place(DecodeScheduler *s, int id, int slot) {
+  DecodeSchedStream *st = &s->streams[id];
+
+  if (st->slot >= 0) {
+    s->slots[st->slot].load -= st->cost;
+    s->slots[st->slot].nb_streams--;
+  }
+  st->slot = slot;
+  if (slot >= 0) {
+    s->slots[slot].load += st->cost;
+    s->slots[slot].nb_streams++;
+  }
+}
+
+/* slot with the least remaining capacity that still fits cost */
+static int best_fit(const DecodeScheduler *s, double cost, int exclude) {
+  double best_left = 0;
+  int i, best = -1;
+
+  for (i = 0; i < s->nb_slots; i++) {
+    double left = s->slots[i].capacity - s->slots[i].load - cost;
+    if (i == exclude || left < 0)
+      continue;
+    if (best < 0 || left < best_left) {
+      best = i;
+      best_left = left;
+    }
+  }
+  return best;
+}
+
+typedef struct SortEntry {
+  double cost;
+  int id;
+} SortEntry;
+
+static int cmp_cost_desc(const void *a, const void *b) {
+  const SortEntry *ea = a, *eb = b;
+  if (ea->cost != eb->cost)
+    return (ea->cost < eb->cost) - (ea->cost > eb->cost);
+  return ea->id - eb->id;
+}
+
+int ff_decode_sched_repack(DecodeScheduler *s) {
+  double *load = NULL;
+  SortEntry *order = NULL;
+  int *slot = NULL, *prev = NULL;
+  int i, n = 0, moved = 0, ret = 0;
+
+  order = av_malloc_array(s->nb_streams + 1, sizeof(*order));
+  prev = av_malloc_array(s->nb_streams + 1, sizeof(*prev));
+  slot = av_malloc_array(s->nb_streams + 1, sizeof(*slot));
+  load = av_calloc(s->nb_slots, sizeof(*load));
+  if (!order || !prev || !slot || !load) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for (i = 0; i < s->nb_streams; i++) {
+    prev[i] = s->streams[i].slot;
+    if (s->streams[i].used) {
+      order[n].cost = s->streams[i].cost;
+      order[n++].id = i;
+    }
+  }
+  qsort(order, n, sizeof(*order), cmp_cost_desc);
+
+  /* first fit decreasing, preferring the current slot of each stream so
+   * that a repack migrates as few streams as possible */
+  for (i = 0; i < n; i++) {
+    const DecodeSchedStream *st = &s->streams[order[i].id];
+    int j, target = -1;
+
+    if (st->slot >= 0 &&
+        load[st->slot] + st->cost <= s->slots[st->slot].capacity)
+      target = st->slot;
+    for (j = 0; target < 0 && j < s->nb_slots; j++)
+      if (load[j] + st->cost <= s->slots[j].capacity)
+        target = j;
+    if (target < 0) {
+      ret = AVERROR(ENOSPC);
+      goto end;
+    }
+    load[target] += st->cost;
+    slot[order[i].id] = target;
+  }
+
+  for (i = 0; i < n; i++) {
+    int id = order[i].id;
+    if (slot[id] != prev[id]) {
+      place(s, id, slot[id]);
+      moved += prev[id] >= 0;
+    }
+  }
+  ret = moved;
+
+end:
+  av_free(order);
+  av_free(prev);
+  av_free(slot);
+  av_free(load);
+  return ret;
+}
+
+int ff_decode_sched_add_stream(DecodeScheduler *s, double cost) {
+  DecodeSchedStream *st;
+  int id, slot, ret;
+
+  for (id = 0; id < s->nb_streams; id++)
+    if (!s->streams[id].used)
+      break;
+  if (id == s->nb_streams) {
+    st = av_fast_realloc(s->streams, &s->streams_allocated,
+                         (s->nb_streams + 1) * sizeof(*s->streams));
+    if (!st)
+      return AVERROR(ENOMEM);
+    s->streams = st;
+    s->nb_streams++;
+  }
+  st = &s->streams[id];
+  st->used = 1;
+  st->slot = -1;
+  st->cost = cost;
+
+  slot = best_fit(s, cost, -1);
+  if (slot >= 0) {
+    place(s, id, slot);
+    return id;
+  }
+  ret = ff_decode_sched_repack(s);
+  if (ret < 0) {
+    st->used = 0;
+    return ret;
+  }
+  return id;
+}
+
+void ff_decode_sched_remove_stream(DecodeScheduler *s, int id) {
+  if (id < 0 || id >= s->nb_streams || !s->streams[id].used)
+    return;
+  place(s, id, -1);
+  s->streams[id].used = 0;
+}
+
+int ff_decode_sched_update_stream(DecodeScheduler *s, int id, double cost) {
+  DecodeSchedStream *st;
+  double old_cost;
+  int cur, slot, ret;
+
+  if (id < 0 || id >= s->nb_streams || !s->streams[id].used)
+    return AVERROR(EINVAL);
+  st = &s->streams[id];
+  cur = st->slot;
+  old_cost = st->cost;
+
+  /* re-account the stream with its new cost on its current slot */
+  place(s, id, -1);
+  st->cost = cost;
+  if (s->slots[cur].load + cost <= s->slots[cur].capacity) {
+    place(s, id, cur);
+    return 0;
+  }
+  slot = best_fit(s, cost, cur);
+  if (slot >= 0) {
+    place(s, id, slot);
+    return 1;
+  }
+
+  place(s, id, cur);
+  ret = ff_decode_sched_repack(s);
+  if (ret < 0) {
+    place(s, id, -1);
+    st->cost = old_cost;
+    place(s, id, cur);
+  }
+  return ret;
+}
+
+int ff_decode_sched_get_slot(const DecodeScheduler *s, int id) {
+  if (id < 0 || id >= s->nb_streams || !s->streams[id].used)
+    return -1;
+  return s->streams[id].slot;
+}
@@ -0,0 +1,152 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Decode cost estimation from parameter sets and access unit statistics,
+ * and placement of streams onto a fixed set of decoder slots.
+ */
+
+#ifndef AVCODEC_DECODE_COST_H
+#define AVCODEC_DECODE_COST_H
+
+#include <stdint.h>
+
+#include "h264_ps.h"
+#include "hevc_ps.h"
+
+/**
+ * Weights turning stream properties into cost units. With the default
+ * weights one 8-bit luma sample of a monochrome (4:0:0) stream costs 1.0,
+ * and its chroma samples raise that to 1.5, 2.0 and 3.0 for 4:2:0, 4:2:2
+ * and 4:4:4. Calibrate the weights per decoder.
+ */
+typedef struct DecodeCostModel {
+  double sample_weight;      ///< per luma sample, scaled by the chroma factor
+  double high_depth_weight;  ///< multiplier for bit depths above 8
+  double bit_weight;         ///< per coded bit (entropy decoding)
+} DecodeCostModel;
+
+typedef struct DecodeCostInfo {
+  int64_t luma_samples;  ///< coded luma samples per picture
+  int bit_depth;
+  int chroma_format_idc;
+  double frame_rate;     ///< from VUI timing, or the level limit
+  int64_t max_luma_sample_rate; ///< level limit, 0 if unknown
+
+  int64_t nb_au;         ///< observed access units
+  int64_t nb_bytes;      ///< observed bytes
+} DecodeCostInfo;
+
+/**
+ * Default model weights.
+ */
+void ff_decode_cost_model_default(DecodeCostModel *m);
+
+/**
+ * Initialize the cost info from an H.264 SPS. Observed statistics are
+ * reset.
+ */
+int ff_decode_cost_from_h264_sps(DecodeCostInfo *info, const SPS *sps);
+
+/**
+ * Initialize the cost info from an HEVC SPS. Observed statistics are reset.
+ */
+int ff_decode_cost_from_hevc_sps(DecodeCostInfo *info, const HEVCSPS *sps);
+
+/**
+ * Account one access unit of the given size in bytes.
+ */
+void ff_decode_cost_add_au(DecodeCostInfo *info, int64_t size);
+
+/**
+ * Bitrate in bits per second, 0 before the first AU. It is the mean AU
+ * size times frame_rate, the rate signalled in the VUI or derived from the
+ * level, not a rate measured from timestamps.
+ */
+double ff_decode_cost_bitrate(const DecodeCostInfo *info);
+
+/**
+ * @return the estimated decode cost per second of the stream
+ */
+double ff_decode_cost_estimate(const DecodeCostModel *m,
+                               const DecodeCostInfo *info);
+
+typedef struct DecodeSchedSlot {
+  double capacity; ///< cost units per second the slot can sustain
+  double load;
+  int nb_streams;
+} DecodeSchedSlot;
+
+typedef struct DecodeSchedStream {
+  int used;
+  int slot; ///< index of the slot, -1 if unplaced
+  double cost;
+} DecodeSchedStream;
+
+typedef struct DecodeScheduler {
+  DecodeSchedSlot *slots;
+  int nb_slots;
+  DecodeSchedStream *streams;
+  int nb_streams;
+  unsigned int streams_allocated;
+} DecodeScheduler;
+
+/**
+ * Allocate a scheduler with nb_slots decoder slots.
+ *
+ * @param capacity per slot capacity in cost units per second
+ */
+DecodeScheduler *ff_decode_sched_alloc(int nb_slots, const double *capacity);
+
+void ff_decode_sched_free(DecodeScheduler **s);
+
+/**
+ * Place a new stream on the slot with the least remaining capacity that
+ * still fits it, repacking all streams if no slot does.
+ *
+ * @return the stream id, AVERROR(ENOSPC) if the stream does not fit
+ */
+int ff_decode_sched_add_stream(DecodeScheduler *s, double cost);
+
+void ff_decode_sched_remove_stream(DecodeScheduler *s, int id);
+
+/**
+ * Change the cost of a stream, e.g. after a resolution change. The stream
+ * stays on its slot if it still fits; otherwise it is moved, and as a last
+ * resort all streams are repacked.
+ *
+ * @return the number of streams that changed slot, AVERROR(ENOSPC) if the
+ *         new cost cannot be placed (the previous placement is kept)
+ */
+int ff_decode_sched_update_stream(DecodeScheduler *s, int id, double cost);
+
+/**
+ * Repack all streams first-fit decreasing.
+ *
+ * @return the number of streams that changed slot, AVERROR(ENOSPC) if they
+ *         do not fit (the previous placement is kept)
+ */
+int ff_decode_sched_repack(DecodeScheduler *s);
+
+/**
+ * @return the slot of a stream, -1 if the id is not in use
+ */
+int ff_decode_sched_get_slot(const DecodeScheduler *s, int id);
+
+#endif /* AVCODEC_DECODE_COST_H */
@@ -18,6 +18,7 @@
 
 #include "dynamic_hdr10_plus.h"
 #include "get_bits.h"
+#include "put_bits.h"
 
 static const int64_t luminance_den = 1;
 static const int32_t peak_luminance_den = 15;
@@ -187,3 +188,190 @@ int ff_parse_itu_t_t35_to_dynamic_hdr10_plus(AVDynamicHDRPlus *s,
 
   return 0;
 }
+
+/**
+ * Check the fields the writer puts without conversion against the range of
+ * their syntax elements; the rational values are checked while writing.
+ */
+static int check_dynamic_hdr10_plus(const AVDynamicHDRPlus *s) {
+  if (s->num_windows < 1 || s->num_windows > 3)
+    return AVERROR(EINVAL);
+  if (s->targeted_system_display_actual_peak_luminance_flag > 1 ||
+      s->mastering_display_actual_peak_luminance_flag > 1)
+    return AVERROR(EINVAL);
+  if (s->targeted_system_display_actual_peak_luminance_flag) {
+    int rows = s->num_rows_targeted_system_display_actual_peak_luminance;
+    int cols = s->num_cols_targeted_system_display_actual_peak_luminance;
+    if (rows < 2 || rows > 25 || cols < 2 || cols > 25)
+      return AVERROR(EINVAL);
+  }
+  if (s->mastering_display_actual_peak_luminance_flag) {
+    int rows = s->num_rows_mastering_display_actual_peak_luminance;
+    int cols = s->num_cols_mastering_display_actual_peak_luminance;
+    if (rows < 2 || rows > 25 || cols < 2 || cols > 25)
+      return AVERROR(EINVAL);
+  }
+  for (int w = 0; w < s->num_windows; w++) {
+    const AVHDRPlusColorTransformParams *params = &s->params[w];
+    if (params->num_distribution_maxrgb_percentiles > 15 ||
+        params->num_bezier_curve_anchors > 15 ||
+        params->tone_mapping_flag > 1 ||
+        params->color_saturation_mapping_flag > 1)
+      return AVERROR(EINVAL);
+    for (int i = 0; i < params->num_distribution_maxrgb_percentiles; i++)
+      if (params->distribution_maxrgb[i].percentage > 100)
+        return AVERROR(EINVAL);
+    if (w > 0 && (params->rotation_angle > 180 ||
+                  (unsigned)params->overlap_process_option > 1))
+      return AVERROR(EINVAL);
+  }
+  return 0;
+}
+
+int ff_dynamic_hdr10_plus_size(const AVDynamicHDRPlus *s) {
+  int64_t bits = 8 + 2;
+  int ret = check_dynamic_hdr10_plus(s);
+  if (ret < 0)
+    return ret;
+
+  bits += (19 * 8 + 1) * (s->num_windows - 1);
+  bits += 27 + 1;
+  if (s->targeted_system_display_actual_peak_luminance_flag)
+    bits += 10 + 4 * s->num_rows_targeted_system_display_actual_peak_luminance *
+                     s->num_cols_targeted_system_display_actual_peak_luminance;
+  for (int w = 0; w < s->num_windows; w++)
+    bits += 3 * 17 + 17 + 4 +
+            24 * s->params[w].num_distribution_maxrgb_percentiles + 10;
+  bits += 1;
+  if (s->mastering_display_actual_peak_luminance_flag)
+    bits += 10 + 4 * s->num_rows_mastering_display_actual_peak_luminance *
+                     s->num_cols_mastering_display_actual_peak_luminance;
+  for (int w = 0; w < s->num_windows; w++) {
+    const AVHDRPlusColorTransformParams *params = &s->params[w];
+    bits += 1;
+    if (params->tone_mapping_flag)
+      bits += 28 + 10 * params->num_bezier_curve_anchors;
+    bits += 1;
+    if (params->color_saturation_mapping_flag)
+      bits += 6;
+  }
+
+  return (bits + 7) / 8;
+}
+
+/**
+ * Convert q to a fixed point value with denominator den and check that it
+ * fits in the given number of bits.
+ */
+static int put_rational(PutBitContext *pb, AVRational q, int64_t den,
+                        int bits) {
+  int64_t v;
+
+  if (!q.num) // also accepts a zeroed AVRational
+    v = 0;
+  else if (q.den <= 0)
+    return AVERROR(EINVAL);
+  else
+    v = q.den == den ? q.num : (int64_t)q.num * den / q.den;
+  if (v < 0 || v >= (INT64_C(1) << bits))
+    return AVERROR(EINVAL);
+  put_bits(pb, bits, v);
+  return 0;
+}
+
+#define PUT_Q(q, den, bits)                                                    \
+  do {                                                                         \
+    if ((ret = put_rational(pb, q, den, bits)) < 0)                            \
+      return ret;                                                              \
+  } while (0)
+
+int ff_write_dynamic_hdr10_plus_to_itu_t_t35(const AVDynamicHDRPlus *s,
+                                             uint8_t *data, int size) {
+  PutBitContext pbc, *pb = &pbc;
+  int ret, needed;
+
+  needed = ff_dynamic_hdr10_plus_size(s);
+  if (needed < 0)
+    return needed;
+  if (size < needed)
+    return AVERROR(ENOSPC);
+
+  init_put_bits(pb, data, size);
+
+  put_bits(pb, 8, s->application_version);
+  put_bits(pb, 2, s->num_windows);
+
+  for (int w = 1; w < s->num_windows; w++) {
+    // Window corners are written as absolute coordinates, as returned by
+    // the parser.
+    const AVHDRPlusColorTransformParams *params = &s->params[w];
+    PUT_Q(params->window_upper_left_corner_x, 1, 16);
+    PUT_Q(params->window_upper_left_corner_y, 1, 16);
+    PUT_Q(params->window_lower_right_corner_x, 1, 16);
+    PUT_Q(params->window_lower_right_corner_y, 1, 16);
+
+    put_bits(pb, 16, params->center_of_ellipse_x);
+    put_bits(pb, 16, params->center_of_ellipse_y);
+    put_bits(pb, 8, params->rotation_angle);
+    put_bits(pb, 16, params->semimajor_axis_internal_ellipse);
+    put_bits(pb, 16, params->semimajor_axis_external_ellipse);
+    put_bits(pb, 16, params->semiminor_axis_external_ellipse);
+    put_bits(pb, 1, params->overlap_process_option);
+  }
+
+  PUT_Q(s->targeted_system_display_maximum_luminance, luminance_den, 27);
+  put_bits(pb, 1, s->targeted_system_display_actual_peak_luminance_flag);
+  if (s->targeted_system_display_actual_peak_luminance_flag) {
+    int rows = s->num_rows_targeted_system_display_actual_peak_luminance;
+    int cols = s->num_cols_targeted_system_display_actual_peak_luminance;
+    put_bits(pb, 5, rows);
+    put_bits(pb, 5, cols);
+    for (int i = 0; i < rows; i++)
+      for (int j = 0; j < cols; j++)
+        PUT_Q(s->targeted_system_display_actual_peak_luminance[i][j],
+              peak_luminance_den, 4);
+  }
+
+  for (int w = 0; w < s->num_windows; w++) {
+    const AVHDRPlusColorTransformParams *params = &s->params[w];
+    for (int i = 0; i < 3; i++)
+      PUT_Q(params->maxscl[i], rgb_den, 17);
+    PUT_Q(params->average_maxrgb, rgb_den, 17);
+    put_bits(pb, 4, params->num_distribution_maxrgb_percentiles);
+    for (int i = 0; i < params->num_distribution_maxrgb_percentiles; i++) {
+      put_bits(pb, 7, params->distribution_maxrgb[i].percentage);
+      PUT_Q(params->distribution_maxrgb[i].percentile, rgb_den, 17);
+    }
+    PUT_Q(params->fraction_bright_pixels, fraction_pixel_den, 10);
+  }
+
+  put_bits(pb, 1, s->mastering_display_actual_peak_luminance_flag);
+  if (s->mastering_display_actual_peak_luminance_flag) {
+    int rows = s->num_rows_mastering_display_actual_peak_luminance;
+    int cols = s->num_cols_mastering_display_actual_peak_luminance;
+    put_bits(pb, 5, rows);
+    put_bits(pb, 5, cols);
+    for (int i = 0; i < rows; i++)
+      for (int j = 0; j < cols; j++)
+        PUT_Q(s->mastering_display_actual_peak_luminance[i][j],
+              peak_luminance_den, 4);
+  }
+
+  for (int w = 0; w < s->num_windows; w++) {
+    const AVHDRPlusColorTransformParams *params = &s->params[w];
+    put_bits(pb, 1, params->tone_mapping_flag);
+    if (params->tone_mapping_flag) {
+      PUT_Q(params->knee_point_x, knee_point_den, 12);
+      PUT_Q(params->knee_point_y, knee_point_den, 12);
+      put_bits(pb, 4, params->num_bezier_curve_anchors);
+      for (int i = 0; i < params->num_bezier_curve_anchors; i++)
+        PUT_Q(params->bezier_curve_anchors[i], bezier_anchor_den, 10);
+    }
+    put_bits(pb, 1, params->color_saturation_mapping_flag);
+    if (params->color_saturation_mapping_flag)
+      PUT_Q(params->color_saturation_weight, saturation_weight_den, 6);
+  }
+
+  flush_put_bits(pb);
+  return needed;
+}
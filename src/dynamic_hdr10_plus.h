@@ -32,4 +32,23 @@
 int ff_parse_itu_t_t35_to_dynamic_hdr10_plus(AVDynamicHDRPlus *s,
                                              const uint8_t *data, int size);
 
+/**
+ * @return the exact size in bytes of the serialized payload of s, or a
+ *         negative AVERROR code if s does not describe valid metadata.
+ */
+int ff_dynamic_hdr10_plus_size(const AVDynamicHDRPlus *s);
+
+/**
+ * Serialize AVDynamicHDRPlus to user data registered ITU-T T.35, the inverse
+ * of ff_parse_itu_t_t35_to_dynamic_hdr10_plus(). Only the payload following
+ * the T.35 header and application_identifier is written.
+ * @param data Output buffer, see ff_dynamic_hdr10_plus_size().
+ * @param size Size of the data array in bytes.
+ *
+ * @return the number of bytes written, AVERROR(ENOSPC) if data is too
+ *         small, AVERROR(EINVAL) if a value does not fit its syntax element.
+ */
+int ff_write_dynamic_hdr10_plus_to_itu_t_t35(const AVDynamicHDRPlus *s,
+                                             uint8_t *data, int size);
+
 #endif /* AVCODEC_DYNAMIC_HDR10_PLUS_H */
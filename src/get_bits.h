@@ -31,7 +31,7 @@
 
 #include "common.h"
 #include "intreadwrite.h"
-// #include "libavutil/log.h"
+#include "log.h"
 #include "avassert.h"
 #include "defs.h"
 #include "error.h"
@@ -54,11 +54,26 @@
  * Boundary checking causes a minor performance penalty so for
  * applications that won't want/need this, it can be disabled
  * globally using "#define CONFIG_SAFE_BITSTREAM_READER 0".
+ *
+ * This tree never defines CONFIG_SAFE_BITSTREAM_READER, so the reader is
+ * unchecked by default. The parameter set and SEI parsers validate once per
+ * context instead: each one has a worst case overread, the number of bits
+ * it can read past the end of a hostile NAL unit, and reads unchecked when
+ * get_bits_trusted() finds that many bits of padding behind the buffer.
+ * Otherwise it falls back to a twin built from the same source with
+ * UNCHECKED_BITSTREAM_READER 0 (h264_ps_checked.c and friends).
  */
 #ifndef UNCHECKED_BITSTREAM_READER
 #define UNCHECKED_BITSTREAM_READER !CONFIG_SAFE_BITSTREAM_READER
 #endif
 
+/*
+ * The 64-bit cached reader (refill_64()/get_val()) is selected for the whole
+ * build with the CACHED_BITSTREAM_READER CMake option. It changes the layout
+ * of GetBitContext, which is shared between the parsers, so it cannot be
+ * selected per file, per context or per workload; a build for SEI heavy
+ * workloads enables it for every parser.
+ */
 #ifndef CACHED_BITSTREAM_READER
 #define CACHED_BITSTREAM_READER 0
 #endif
@@ -72,6 +87,7 @@ typedef struct GetBitContext {
   int index;
   int size_in_bits;
   int size_in_bits_plus8;
+  int padding; ///< readable bytes after buffer_end
 } GetBitContext;
 
 static inline unsigned int get_bits(GetBitContext *s, int n);
@@ -599,8 +615,8 @@ static inline int check_marker(void *logctx, GetBitContext *s,
                                const char *msg) {
   int bit = get_bits1(s);
   if (!bit)
-    printf("Marker bit missing at %d of %d %s\n", get_bits_count(s) - 1,
-           s->size_in_bits, msg);
+    av_log(logctx, AV_LOG_INFO, "Marker bit missing at %d of %d %s\n",
+           get_bits_count(s) - 1, s->size_in_bits, msg);
 
   return bit;
 }
@@ -623,6 +639,7 @@ static inline int init_get_bits_xe(GetBitContext *s, const uint8_t *buffer,
   s->size_in_bits = bit_size;
   s->size_in_bits_plus8 = bit_size + 8;
   s->buffer_end = buffer + buffer_size;
+  s->padding = AV_INPUT_BUFFER_PADDING_SIZE;
   s->index = 0;
 
 #if CACHED_BITSTREAM_READER
@@ -827,6 +844,17 @@ static inline int get_bits_left(GetBitContext *gb) {
   return gb->size_in_bits - get_bits_count(gb);
 }
 
+/**
+ * Check that gb can be read without overread checks.
+ *
+ * @param overread the most bits the parser reads past the end of the buffer
+ * @return nonzero if the padding after buffer_end covers overread
+ */
+static inline int get_bits_trusted(GetBitContext *gb, int64_t overread) {
+  // the cache refills load up to 16 bytes ahead of the bit position
+  return get_bits_left(gb) >= 0 && overread <= 8LL * (gb->padding - 16);
+}
+
 static inline int skip_1stop_8data_bits(GetBitContext *gb) {
   if (get_bits_left(gb) <= 0)
     return AVERROR_INVALIDDATA;
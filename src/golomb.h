@@ -118,12 +118,129 @@ static inline unsigned get_ue_golomb_long(GetBitContext *gb) {
   unsigned buf, log;
 
   buf = show_bits_long(gb, 32);
+  if (buf >= 1U << 16) {
+    // the whole code is in buf
+    int len = 2 * ff_clz(buf) + 1;
+    skip_bits_long(gb, len);
+    return (buf >> (32 - len)) - 1;
+  }
   log = 31 - av_log2(buf);
   skip_bits_long(gb, log);
 
   return get_bits_long(gb, log + 1) - 1;
 }
 
+/**
+ * 64-bit window for reading runs of Exp-Golomb codes and flags with one
+ * load per refill instead of one per syntax element. The bitstream must
+ * be padded by at least 9 bytes, which AV_INPUT_BUFFER_PADDING_SIZE covers.
+ */
+typedef struct GolombWindow {
+  uint64_t bits; ///< next bits of the stream, MSB first
+  int left;      ///< valid bits in bits
+  int used;      ///< bits consumed since the last refill
+} GolombWindow;
+
+static inline void golomb_window_refill(GetBitContext *gb, GolombWindow *w) {
+  int index;
+
+  skip_bits_long(gb, w->used);
+  // Past the end the window reloads the padding at the clamped position of
+  // the checked reader, the caller sees the overread in get_bits_left().
+  index = FFMIN(get_bits_count(gb), gb->size_in_bits_plus8);
+  w->bits = AV_RB64(gb->buffer + (index >> 3)) << (index & 7);
+  w->left = 57;
+  w->used = 0;
+}
+
+static inline void golomb_window_open(GetBitContext *gb, GolombWindow *w) {
+  w->used = 0;
+  golomb_window_refill(gb, w);
+}
+
+/**
+ * Resynchronize gb with the window. The window must be opened again
+ * before reading from it after gb has been used directly.
+ */
+static inline void golomb_window_close(GetBitContext *gb, GolombWindow *w) {
+  skip_bits_long(gb, w->used);
+  w->used = w->left = 0;
+}
+
+static inline unsigned golomb_window_ue(GetBitContext *gb, GolombWindow *w) {
+  int len = 2 * ff_clzll(w->bits | 1) + 1;
+  unsigned ret;
+
+  if (len > w->left) {
+    golomb_window_refill(gb, w);
+    len = 2 * ff_clzll(w->bits | 1) + 1;
+    if (len > w->left) {
+      // 29 or more leading zeros, beyond any window
+      ret = get_ue_golomb_long(gb);
+      golomb_window_refill(gb, w);
+      return ret;
+    }
+  }
+  ret = (w->bits >> (64 - len)) - 1;
+  w->bits <<= len;
+  w->left -= len;
+  w->used += len;
+  return ret;
+}
+
+static inline int golomb_window_se(GetBitContext *gb, GolombWindow *w) {
+  unsigned buf = golomb_window_ue(gb, w);
+  int sign = (buf & 1) - 1;
+
+  return ((buf >> 1) ^ sign) + 1;
+}
+
+static inline unsigned golomb_window_bit(GetBitContext *gb, GolombWindow *w) {
+  unsigned ret;
+
+  if (!w->left)
+    golomb_window_refill(gb, w);
+  ret = w->bits >> 63;
+  w->bits <<= 1;
+  w->left--;
+  w->used++;
+  return ret;
+}
+
+/**
+ * Read n consecutive ue(v) values.
+ *
+ * @return 0, or AVERROR_INVALIDDATA if the codes run past the end of gb
+ */
+static inline int get_ue_golomb_n(GetBitContext *gb, unsigned *dst, int n) {
+  GolombWindow w;
+  int i;
+
+  golomb_window_open(gb, &w);
+  for (i = 0; i < n; i++)
+    dst[i] = golomb_window_ue(gb, &w);
+  golomb_window_close(gb, &w);
+
+  return get_bits_left(gb) < 0 ? AVERROR_INVALIDDATA : 0;
+}
+
+/**
+ * Read n consecutive se(v) values.
+ *
+ * @return 0, or AVERROR_INVALIDDATA if the codes run past the end of gb
+ */
+static inline int get_se_golomb_n(GetBitContext *gb, int *dst, int n) {
+  GolombWindow w;
+  int i;
+
+  golomb_window_open(gb, &w);
+  for (i = 0; i < n; i++)
+    dst[i] = golomb_window_se(gb, &w);
+  golomb_window_close(gb, &w);
+
+  return get_bits_left(gb) < 0 ? AVERROR_INVALIDDATA : 0;
+}
+
 /**
  * read unsigned exp golomb code, constraint to a max of 31.
  * If the value encountered is not in 0..31, the return value
@@ -28,6 +28,7 @@
  */
 
 #include "h263.h"
+#include "buffer_internal.h"
 #include "bytestream.h"
 #include "h263data.h"
 #include "thread.h"
@@ -69,12 +70,36 @@ int ff_h263_find_frame_end(ParseContext *pc, const uint8_t *buf, int buf_size) {
   return END_NOT_FOUND;
 }
 
+int ff_parse_realloc(ParseContext *pc, unsigned int size) {
+  enum FFMemTag tag = ff_mem_set_tag(FF_MEM_TAG_H263_PARSE);
+  AVBufferRef *ref = ff_buffer_pool_get_size(size);
+
+  ff_mem_set_tag(tag);
+  if (!ref)
+    return AVERROR(ENOMEM);
+  if (pc->buffer)
+    memcpy(ref->data, pc->buffer, FFMIN(pc->buffer_size, size));
+  av_buffer_unref(&pc->buffer_ref);
+  pc->buffer_ref = ref;
+  pc->buffer = ref->data;
+  pc->buffer_size = FFMIN(ref->size, UINT_MAX);
+  return 0;
+}
+
+void ff_parse_close(ParseContext *pc) {
+  av_buffer_unref(&pc->buffer_ref);
+  pc->buffer = NULL;
+  pc->buffer_size = 0;
+}
+
 int ff_combine_frame(ParseContext *pc, int next, const uint8_t *buf,
                      int buf_size) {
   if (pc->overread) {
-    printf("overread %d, state:%" PRIX32 " next:%d index:%d o_index:%d\n",
+    av_log(NULL, AV_LOG_DEBUG,
+           "overread %d, state:%" PRIX32 " next:%d index:%d o_index:%d\n",
            pc->overread, pc->state, next, pc->index, pc->overread_index);
-    printf("%X %X %X %X\n", (buf)[0], (buf)[1], (buf)[2], (buf)[3]);
+    av_log(NULL, AV_LOG_DEBUG, "%X %X %X %X\n", (buf)[0], (buf)[1], (buf)[2],
+           (buf)[3]);
   }
 
   /* Copy overread bytes from last frame into buffer. */
@@ -92,21 +117,14 @@ int ff_combine_frame(ParseContext *pc, int next, const uint8_t *buf,
 
   /* copy into buffer end return */
   if (next == END_NOT_FOUND) {
-    void *new_buffer = NULL;
-    if (pc->buffer_size < buf_size + pc->index + AV_INPUT_BUFFER_PADDING_SIZE) {
-      pc->buffer_size = buf_size + pc->index + AV_INPUT_BUFFER_PADDING_SIZE;
-      new_buffer = realloc(pc->buffer, pc->buffer_size);
-    } else {
-      new_buffer = pc->buffer;
-    }
-
-    if (!new_buffer) {
-      printf("Failed to reallocate parser buffer to %d\n",
+    if (pc->buffer_size < buf_size + pc->index + AV_INPUT_BUFFER_PADDING_SIZE &&
+        ff_parse_realloc(pc, buf_size + pc->index +
+                                 AV_INPUT_BUFFER_PADDING_SIZE) < 0) {
+      av_log(NULL, AV_LOG_ERROR, "Failed to reallocate parser buffer to %d\n",
              buf_size + pc->index + AV_INPUT_BUFFER_PADDING_SIZE);
       pc->index = 0;
       return AVERROR(ENOMEM);
     }
-    pc->buffer = new_buffer;
     memcpy(pc->buffer + pc->index, buf, buf_size);
     pc->index += buf_size;
     return -1;
@@ -118,21 +136,14 @@ int ff_combine_frame(ParseContext *pc, int next, const uint8_t *buf,
 
   /* append to buffer */
   if (pc->index >= 0) {
-    void *new_buffer = NULL;
-    if (pc->buffer_size < next + pc->index + AV_INPUT_BUFFER_PADDING_SIZE) {
-      pc->buffer_size = next + pc->index + AV_INPUT_BUFFER_PADDING_SIZE;
-      new_buffer = realloc(pc->buffer, pc->buffer_size);
-    } else {
-      new_buffer = pc->buffer;
-    }
-
-    if (!new_buffer) {
-      printf("Failed to reallocate parser buffer to %d\n",
+    if (pc->buffer_size < next + pc->index + AV_INPUT_BUFFER_PADDING_SIZE &&
+        ff_parse_realloc(pc, next + pc->index + AV_INPUT_BUFFER_PADDING_SIZE) <
+            0) {
+      av_log(NULL, AV_LOG_ERROR, "Failed to reallocate parser buffer to %d\n",
              next + pc->index + AV_INPUT_BUFFER_PADDING_SIZE);
       pc->overread_index = pc->index = 0;
       return AVERROR(ENOMEM);
     }
-    pc->buffer = new_buffer;
 
     if (next > 0)
       memcpy(pc->buffer + pc->index, buf, next);
@@ -142,18 +153,13 @@ int ff_combine_frame(ParseContext *pc, int next, const uint8_t *buf,
     // *buf = pc->buffer;
   }
 
-  /*Tell me, why?*/
-  // if (next < -8) {
-  //   pc->overread += -8 - next;
-  //   next = -8;
-  // }
-
-  /* store overread bytes */
-  // for (; next < 0; next++) {
-  //   pc->state = pc->state << 8 | pc->buffer[pc->last_index + next];
-  //   pc->state64 = pc->state64 << 8 | pc->buffer[pc->last_index + next];
-  //   pc->overread++;
-  // }
+  /* The start code of the next picture began in the buffered data: keep
+   * its bytes for the next call, which continues the search in buf. */
+  for (; next < 0; next++) {
+    pc->state = pc->state << 8 | pc->buffer[pc->last_index + next];
+    pc->state64 = pc->state64 << 8 | pc->buffer[pc->last_index + next];
+    pc->overread++;
+  }
 
   // if (pc->overread) {
   //   printf("overread %d, state:%" PRIX32 " next:%d index:%d o_index:%d\n",
@@ -185,48 +191,37 @@ static char av_get_picture_type_char(enum AVPictureType pict_type) {
   }
 }
 
-static void ff_h263_show_pict_info(H263Packet *pic) {
-  int debug = 1;
-  H263Pic *s = &pic->picture;
-  if (debug) {
-    printf("qp:%d %c size:%d rnd:%d%s%s%s%s%s%s%s%s%s %d/%d\n", s->qscale,
-           av_get_picture_type_char(s->pict_type), s->gb.size_in_bits,
-           1 - s->no_rounding, s->obmc ? " AP" : "", s->umvplus ? " UMV" : "",
-           s->h263_long_vectors ? " LONG" : "", s->h263_plus ? " +" : "",
-           s->h263_aic ? " AIC" : "", s->alt_inter_vlc ? " AIV" : "",
-           s->modified_quant ? " MQ" : "", s->loop_filter ? " LOOP" : "",
-           s->h263_slice_structured ? " SS" : "", s->framerate.num,
-           s->framerate.den);
-  }
+static void ff_h263_show_pict_info(const H263PictureHeader *h,
+                                   const GetBitContext *gb) {
+  av_log(NULL, AV_LOG_DEBUG,
+         "qp:%d %c size:%d rnd:%d%s%s%s%s%s%s%s%s%s %d/%d\n", h->qscale,
+         av_get_picture_type_char(h->pict_type), gb->size_in_bits,
+         1 - h->no_rounding, h->obmc ? " AP" : "", h->umvplus ? " UMV" : "",
+         h->h263_long_vectors ? " LONG" : "", h->h263_plus ? " +" : "",
+         h->h263_aic ? " AIC" : "", h->alt_inter_vlc ? " AIV" : "",
+         h->modified_quant ? " MQ" : "", h->loop_filter ? " LOOP" : "",
+         h->h263_slice_structured ? " SS" : "", h->framerate.num,
+         h->framerate.den);
 }
 
-static int ff_h263_decode_mba(H263Pic *s) {
-  int i, mb_pos;
+static int ff_h263_decode_mba(const H263PictureHeader *h, GetBitContext *gb) {
+  int i, mb_num = ((h->width + 15) / 16) * ((h->height + 15) / 16);
 
   for (i = 0; i < 6; i++)
-    if (s->mb_num - 1 <= ff_mba_max[i])
+    if (mb_num - 1 <= ff_mba_max[i])
       break;
-  mb_pos = get_bits(&s->gb, ff_mba_length[i]);
-  s->mb_x = mb_pos % s->mb_width;
-  s->mb_y = mb_pos / s->mb_width;
-
-  return mb_pos;
+  return get_bits(gb, ff_mba_length[i]);
 }
 
 /* Most is hardcoded; should extend to handle all H.263 streams. */
-int ff_h263_decode_picture_header(H263Packet *s) {
-  int format, width, height, i, ret;
+int ff_h263_decode_picture_header(H263PictureHeader *h, GetBitContext *gb) {
+  int format, width, height, i;
   uint32_t startcode;
 
-  GetBitContext *gb;
-  H263Pic *pic;
-  gb = &s->picture.gb;
-  pic = &s->picture;
-
   align_get_bits(gb);
 
   if (show_bits(gb, 2) == 2) {
-    printf("Header looks like RTP instead of H.263\n");
+    av_log(NULL, AV_LOG_ERROR, "Header looks like RTP instead of H.263\n");
   }
 
   startcode = get_bits(gb, 22 - 8);
@@ -239,23 +234,19 @@ int ff_h263_decode_picture_header(H263Packet *s) {
   }
 
   if (startcode != 0x20) {
-    printf("Bad picture start code\n");
+    av_log(NULL, AV_LOG_ERROR, "Bad picture start code\n");
     return -1;
   }
 
   /* temporal reference */
-  i = get_bits(gb, 8); /* picture timestamp */
-
-  // i -= (i - (s->picture_number & 0xFF) + 128) & ~0xFF;
-
-  // s->picture_number= (s->picture_number&~0xFF) + i;
+  h->temporal_reference = get_bits(gb, 8); /* picture timestamp */
 
   /* PTYPE starts here */
   if (check_marker(NULL, gb, "in PTYPE") != 1) {
     return -1;
   }
   if (get_bits1(gb) != 0) {
-    printf("Bad H.263 id\n");
+    av_log(NULL, AV_LOG_ERROR, "Bad H.263 id\n");
     return -1; /* H.263 id */
   }
   skip_bits1(gb); /* split screen off */
@@ -277,98 +268,110 @@ int ff_h263_decode_picture_header(H263Packet *s) {
     if (!width)
       return -1;
 
-    pic->pict_type = AV_PICTURE_TYPE_I + get_bits1(gb);
-
-    pic->h263_long_vectors = get_bits1(gb);
+    /* clear what an earlier H.263+ header left, PLUSPTYPE only fields */
+    h->h263_plus = 0;
+    h->no_rounding = 0;
+    h->custom_pcf = 0;
+    h->umvplus = 0;
+    h->h263_aic = 0;
+    h->loop_filter = 0;
+    h->h263_slice_structured = 0;
+    h->alt_inter_vlc = 0;
+    h->modified_quant = 0;
+    h->aspect_ratio_info = 0;
+    h->sample_aspect_ratio = (AVRational){12, 11};
+    h->pict_type = AV_PICTURE_TYPE_I + get_bits1(gb);
+
+    h->h263_long_vectors = get_bits1(gb);
 
     if (get_bits1(gb) != 0) {
-      printf("H.263 SAC not supported\n");
+      av_log(NULL, AV_LOG_ERROR, "H.263 SAC not supported\n");
       return -1; /* SAC: off */
     }
-    pic->obmc = get_bits1(gb); /* Advanced prediction mode */
-    pic->unrestricted_mv = pic->h263_long_vectors || pic->obmc;
+    h->obmc = get_bits1(gb); /* Advanced prediction mode */
 
-    pic->pb_frame = get_bits1(gb);
-    pic->chroma_qscale = pic->qscale = get_bits(gb, 5);
+    h->pb_frame = get_bits1(gb);
+    h->qscale = get_bits(gb, 5);
     skip_bits1(gb); /* Continuous Presence Multipoint mode: off */
 
-    pic->width = width;
-    pic->height = height;
-    pic->framerate = (AVRational){30000, 1001};
+    h->width = width;
+    h->height = height;
+    h->framerate = (AVRational){30000, 1001};
   } else {
     int ufep;
 
     /* H.263v2 */
-    pic->h263_plus = 1;
+    h->h263_plus = 1;
+    h->h263_long_vectors = 0;
+    h->pb_frame = 0;
     ufep = get_bits(gb, 3); /* Update Full Extended PTYPE */
 
     /* ufep other than 0 and 1 are reserved */
     if (ufep == 1) {
       /* OPPTYPE */
       format = get_bits(gb, 3);
-      printf("ufep=1, format: %d\n", format);
-      pic->custom_pcf = get_bits1(gb);
-      pic->umvplus = get_bits1(gb); /* Unrestricted Motion Vector */
+      av_log(NULL, AV_LOG_DEBUG, "ufep=1, format: %d\n", format);
+      h->custom_pcf = get_bits1(gb);
+      h->umvplus = get_bits1(gb); /* Unrestricted Motion Vector */
       if (get_bits1(gb) != 0) {
-        printf("Syntax-based Arithmetic Coding (SAC) not supported\n");
+        av_log(NULL, AV_LOG_ERROR,
+               "Syntax-based Arithmetic Coding (SAC) not supported\n");
       }
-      pic->obmc = get_bits1(gb);     /* Advanced prediction mode */
-      pic->h263_aic = get_bits1(gb); /* Advanced Intra Coding (AIC) */
-      pic->loop_filter = get_bits1(gb);
-      pic->unrestricted_mv = pic->umvplus || pic->obmc || pic->loop_filter;
+      h->obmc = get_bits1(gb);     /* Advanced prediction mode */
+      h->h263_aic = get_bits1(gb); /* Advanced Intra Coding (AIC) */
+      h->loop_filter = get_bits1(gb);
 
-      pic->h263_slice_structured = get_bits1(gb);
+      h->h263_slice_structured = get_bits1(gb);
       if (get_bits1(gb) != 0) {
-        printf("Reference Picture Selection not supported\n");
+        av_log(NULL, AV_LOG_ERROR,
+               "Reference Picture Selection not supported\n");
       }
       if (get_bits1(gb) != 0) {
-        printf("Independent Segment Decoding not supported\n");
+        av_log(NULL, AV_LOG_ERROR,
+               "Independent Segment Decoding not supported\n");
       }
-      pic->alt_inter_vlc = get_bits1(gb);
-      pic->modified_quant = get_bits1(gb);
-      if (pic->modified_quant)
-        pic->chroma_qscale_table = ff_h263_chroma_qscale_table;
+      h->alt_inter_vlc = get_bits1(gb);
+      h->modified_quant = get_bits1(gb);
 
       skip_bits(gb, 1); /* Prevent start code emulation */
 
       skip_bits(gb, 3); /* Reserved */
     } else if (ufep != 0) {
-      printf("Bad UFEP type (%d)\n", ufep);
+      av_log(NULL, AV_LOG_ERROR, "Bad UFEP type (%d)\n", ufep);
       return -1;
     }
 
     /* MPPTYPE */
-    pic->pict_type = get_bits(gb, 3);
-    switch (pic->pict_type) {
+    switch (get_bits(gb, 3)) {
     case 0:
-      pic->pict_type = AV_PICTURE_TYPE_I;
+      h->pict_type = AV_PICTURE_TYPE_I;
       break;
     case 1:
-      pic->pict_type = AV_PICTURE_TYPE_P;
+      h->pict_type = AV_PICTURE_TYPE_P;
       break;
     case 2:
-      pic->pict_type = AV_PICTURE_TYPE_P;
-      pic->pb_frame = 3;
+      h->pict_type = AV_PICTURE_TYPE_P;
+      h->pb_frame = 3;
       break;
     case 3:
-      pic->pict_type = AV_PICTURE_TYPE_B;
+      h->pict_type = AV_PICTURE_TYPE_B;
       break;
     case 7:
-      pic->pict_type = AV_PICTURE_TYPE_I;
+      h->pict_type = AV_PICTURE_TYPE_I;
       break; // ZYGO
     default:
       return -1;
     }
     skip_bits(gb, 2);
-    pic->no_rounding = get_bits1(gb);
+    h->no_rounding = get_bits1(gb);
     skip_bits(gb, 4);
 
     /* Get the picture dimensions */
     if (ufep) {
       if (format == 6) {
         /* Custom Picture Format (CPFMT) */
-        pic->aspect_ratio_info = get_bits(gb, 4);
-        printf("aspect: %d\n", pic->aspect_ratio_info);
+        h->aspect_ratio_info = get_bits(gb, 4);
+        av_log(NULL, AV_LOG_DEBUG, "aspect: %d\n", h->aspect_ratio_info);
         /* aspect ratios:
         0 - forbidden
         1 - 1:1
@@ -381,62 +384,58 @@ int ff_h263_decode_picture_header(H263Packet *s) {
         width = (get_bits(gb, 9) + 1) * 4;
         check_marker(NULL, gb, "in dimensions");
         height = get_bits(gb, 9) * 4;
-        printf("\nH.263+ Custom picture: %dx%d\n", width, height);
-        if (pic->aspect_ratio_info == FF_ASPECT_EXTENDED) {
+        av_log(NULL, AV_LOG_DEBUG, "H.263+ Custom picture: %dx%d\n", width,
+               height);
+        if (h->aspect_ratio_info == FF_ASPECT_EXTENDED) {
           /* expected dimensions */
-          pic->sample_aspect_ratio.num = get_bits(gb, 8);
-          pic->sample_aspect_ratio.den = get_bits(gb, 8);
+          h->sample_aspect_ratio.num = get_bits(gb, 8);
+          h->sample_aspect_ratio.den = get_bits(gb, 8);
         } else {
-          pic->sample_aspect_ratio =
-              ff_h263_pixel_aspect[pic->aspect_ratio_info];
+          h->sample_aspect_ratio = ff_h263_pixel_aspect[h->aspect_ratio_info];
         }
       } else {
         width = ff_h263_format[format][0];
         height = ff_h263_format[format][1];
-        pic->sample_aspect_ratio = (AVRational){12, 11};
+        h->sample_aspect_ratio = (AVRational){12, 11};
       }
-      pic->sample_aspect_ratio.den <<= pic->ehc_mode;
       if ((width == 0) || (height == 0))
         return -1;
-      pic->width = width;
-      pic->height = height;
-
-      if (pic->custom_pcf) {
-        int gcd;
-        pic->framerate.num = 1800000;
-        pic->framerate.den = 1000 + get_bits1(gb);
-        pic->framerate.den *= get_bits(gb, 7);
-        if (pic->framerate.den == 0) {
-          printf("zero framerate\n");
+      h->width = width;
+      h->height = height;
+
+      if (h->custom_pcf) {
+        // Not reduced, there is no av_gcd() here.
+        h->framerate.num = 1800000;
+        h->framerate.den = 1000 + get_bits1(gb);
+        h->framerate.den *= get_bits(gb, 7);
+        if (h->framerate.den == 0) {
+          av_log(NULL, AV_LOG_ERROR, "zero framerate\n");
           return -1;
         }
-        // gcd = av_gcd(pic->framerate.den, pic->framerate.num);
-        pic->framerate.den /= gcd;
-        pic->framerate.num /= gcd;
       } else {
-        pic->framerate = (AVRational){30000, 1001};
+        h->framerate = (AVRational){30000, 1001};
       }
     }
 
-    if (pic->custom_pcf) {
+    if (h->custom_pcf) {
       skip_bits(gb, 2); // extended Temporal reference
     }
 
     if (ufep) {
-      if (pic->umvplus) {
+      if (h->umvplus) {
         if (get_bits1(gb) ==
             0) /* Unlimited Unrestricted Motion Vectors Indicator (UUI) */
           skip_bits1(gb);
       }
-      if (pic->h263_slice_structured) {
+      if (h->h263_slice_structured) {
         if (get_bits1(gb) != 0) {
-          printf("rectangular slices not supported\n");
+          av_log(NULL, AV_LOG_ERROR, "rectangular slices not supported\n");
         }
         if (get_bits1(gb) != 0) {
-          printf("unordered slices not supported\n");
+          av_log(NULL, AV_LOG_ERROR, "unordered slices not supported\n");
         }
       }
-      if (pic->pict_type == AV_PICTURE_TYPE_B) {
+      if (h->pict_type == AV_PICTURE_TYPE_B) {
         skip_bits(gb, 4); // ELNUM
         if (ufep == 1) {
           skip_bits(gb, 4); // RLNUM
@@ -444,122 +443,225 @@ int ff_h263_decode_picture_header(H263Packet *s) {
       }
     }
 
-    pic->qscale = get_bits(gb, 5);
+    h->qscale = get_bits(gb, 5);
   } // if
 
-  // if ((ret = av_image_check_size(pic->width, pic->height, 0, s)) < 0)`
+  // if ((ret = av_image_check_size(h->width, h->height, 0, s)) < 0)`
   //   return ret;
 
   int AV_CODEC_FLAG2_CHUNKS = 0;
   if (!(AV_CODEC_FLAG2_CHUNKS)) {
-    if ((pic->width * pic->height / 256 / 8) > get_bits_left(gb))
+    if ((h->width * h->height / 256 / 8) > get_bits_left(gb))
       return AVERROR_INVALIDDATA;
   }
 
-  pic->mb_width = (pic->width + 15) / 16;
-  pic->mb_height = (pic->height + 15) / 16;
-  pic->mb_num = pic->mb_width * pic->mb_height;
-
-  if (pic->pb_frame) {
+  if (h->pb_frame) {
     skip_bits(gb, 3); /* Temporal reference for B-pictures */
-    if (pic->custom_pcf)
+    if (h->custom_pcf)
       skip_bits(gb, 2); // extended Temporal reference
     skip_bits(gb, 2);   /* Quantization information for B-pictures */
   }
 
-  if (pic->pict_type != AV_PICTURE_TYPE_B) {
-    pic->time = pic->picture_number;
-    pic->pp_time = pic->time - pic->last_non_b_time;
-    pic->last_non_b_time = pic->time;
-  } else {
-    pic->time = pic->picture_number;
-    pic->pb_time = pic->pp_time - (pic->last_non_b_time - pic->time);
-    if (pic->pp_time <= pic->pb_time ||
-        pic->pp_time <= pic->pp_time - pic->pb_time || pic->pp_time <= 0) {
-      pic->pp_time = 2;
-      pic->pb_time = 1;
-    }
-    // ff_mpeg4_init_direct_mv(s);
-  }
-
   /* PEI */
   if (skip_1stop_8data_bits(gb) < 0)
     return AVERROR_INVALIDDATA;
 
-  if (pic->h263_slice_structured) {
+  if (h->h263_slice_structured) {
     if (check_marker(NULL, gb, "SEPB1") != 1) {
       return -1;
     }
 
-    ff_h263_decode_mba(&s->picture);
+    ff_h263_decode_mba(h, gb);
 
     if (check_marker(NULL, gb, "SEPB2") != 1) {
       return -1;
     }
   }
-  // pic->f_code = 1;
 
-  if (pic->pict_type == AV_PICTURE_TYPE_B)
+  ff_h263_show_pict_info(h, gb);
+
+  return 0;
+}
+
+/* Fill the fields of a legacy H263Pic that the header determines. */
+static int decode_legacy_header(H263Packet *pkt) {
+  H263Pic *pic = &pkt->picture;
+  H263PictureHeader h = {
+      .width = pic->width,
+      .height = pic->height,
+      .framerate = pic->framerate,
+      .sample_aspect_ratio = pic->sample_aspect_ratio,
+      .pb_frame = pic->pb_frame,
+      .aspect_ratio_info = pic->aspect_ratio_info,
+      .custom_pcf = pic->custom_pcf,
+      .umvplus = pic->umvplus,
+      .obmc = pic->obmc,
+      .h263_aic = pic->h263_aic,
+      .loop_filter = pic->loop_filter,
+      .h263_slice_structured = pic->h263_slice_structured,
+      .alt_inter_vlc = pic->alt_inter_vlc,
+      .modified_quant = pic->modified_quant,
+  };
+  int ret = ff_h263_decode_picture_header(&h, &pic->gb);
+
+  pic->width = h.width;
+  pic->height = h.height;
+  pic->framerate = h.framerate;
+  pic->sample_aspect_ratio = h.sample_aspect_ratio;
+  pic->pict_type = h.pict_type;
+  pic->chroma_qscale = pic->qscale = h.qscale;
+  pic->pb_frame = h.pb_frame;
+  pic->h263_plus = h.h263_plus;
+  pic->aspect_ratio_info = h.aspect_ratio_info;
+  pic->custom_pcf = h.custom_pcf;
+  pic->umvplus = h.umvplus;
+  pic->obmc = h.obmc;
+  pic->h263_aic = h.h263_aic;
+  pic->loop_filter = h.loop_filter;
+  pic->h263_slice_structured = h.h263_slice_structured;
+  pic->alt_inter_vlc = h.alt_inter_vlc;
+  pic->modified_quant = h.modified_quant;
+  pic->h263_long_vectors = h.h263_long_vectors;
+  pic->no_rounding = h.no_rounding;
+  pic->unrestricted_mv = h.h263_plus
+                             ? h.umvplus || h.obmc || h.loop_filter
+                             : h.h263_long_vectors || h.obmc;
+  pic->chroma_qscale_table = h.modified_quant ? ff_h263_chroma_qscale_table
+                                              : NULL;
+  pic->y_dc_scale_table = pic->c_dc_scale_table =
+      h.h263_aic ? ff_aic_dc_scale_table : NULL;
+  if (h.pict_type == AV_PICTURE_TYPE_B)
     pic->low_delay = 0;
+  pic->mb_width = (h.width + 15) / 16;
+  pic->mb_height = (h.height + 15) / 16;
+  pic->mb_num = pic->mb_width * pic->mb_height;
+  return ret;
+}
 
-  if (pic->h263_aic) {
-    pic->y_dc_scale_table = pic->c_dc_scale_table = ff_aic_dc_scale_table;
-  } else {
-    // pic->y_dc_scale_table = pic->c_dc_scale_table = ff_mpeg1_dc_scale_table;
-  }
+/*
+ * Find the end of the picture in buf. A picture whole in buf is not copied,
+ * one started in earlier input is completed in pc->buffer.
+ *
+ * @return the position in buf after the picture, buf_size if it does not
+ *         end in buf
+ */
+static int split_frame(ParseContext *pc, const uint8_t *buf, int buf_size,
+                       const uint8_t **data, int *size) {
+  int next;
 
-  ff_h263_show_pict_info(s);
-  if (pic->pict_type == AV_PICTURE_TYPE_I &&
-      pic->codec_tag == AV_RL32("ZYGO") &&
-      get_bits_left(gb) >= 85 + 13 * 3 * 16 + 50) {
-    int i, j;
-    for (i = 0; i < 85; i++)
-      printf("%d", get_bits1(gb));
-    printf("\n");
-    for (i = 0; i < 13; i++) {
-      for (j = 0; j < 3; j++) {
-        int v = get_bits(gb, 8);
-        v |= get_sbits(gb, 8) * (1 << 8);
-        printf(" %5d", v);
-      }
-      printf("\n");
+  *data = NULL;
+  *size = 0;
+
+  if (buf_size == 0) {
+    av_log(NULL, AV_LOG_DEBUG, "---flush stream---\n");
+    if (pc->index > 0) {
+      *data = pc->buffer;
+      *size = pc->index;
     }
-    for (i = 0; i < 50; i++)
-      printf("%d", get_bits1(gb));
+    pc->index = 0;
+    pc->overread = 0;
+    pc->frame_start_found = 0;
+    pc->state = -1;
+    return 0;
   }
 
-  return 0;
+  next = ff_h263_find_frame_end(pc, buf, buf_size);
+  if (next >= 0 && !pc->index && !pc->overread) {
+    *data = buf;
+    *size = next;
+    return next;
+  }
+  if (ff_combine_frame(pc, next, buf, buf_size) < 0)
+    return buf_size;
+
+  *data = pc->buffer;
+  *size = pc->last_index + next;
+  return next;
 }
 
 int ff_h263_packet_split_and_parse(ParseContext *pc, H263Packet *pkt,
                                    const uint8_t *buf, int buf_size) {
-  GetByteContext bc;
-  int consumed, ret = 0;
   int next;
   av_assert0(pc);
   av_assert0(pkt);
   av_assert0(buf);
   av_assert0(buf_size >= 0);
 
-  if (buf_size == 0) {
-    next = 0;
-    printf("---flush stream---\n");
-    goto end;
+  next = split_frame(pc, buf, buf_size, &pkt->picture.data,
+                     &pkt->picture.size);
+  pkt->got_pic = !!pkt->picture.data;
+  if (pkt->got_pic) {
+    init_get_bits8(&pkt->picture.gb, pkt->picture.data, pkt->picture.size);
+    decode_legacy_header(pkt);
   }
+  return next;
+}
 
-  next = ff_h263_find_frame_end(pc, buf, buf_size);
-  if (ff_combine_frame(pc, next, buf, buf_size) < 0) {
-    pkt->picture.data = NULL;
-    pkt->picture.size = 0;
-    pkt->got_pic = 0;
-    return buf_size;
+int ff_h263_split_frame(ParseContext *pc, H263Frame *frame, const uint8_t *buf,
+                        int buf_size) {
+  GetBitContext gb;
+  int next;
+  av_assert0(pc);
+  av_assert0(frame);
+  av_assert0(buf);
+  av_assert0(buf_size >= 0);
+
+  next = split_frame(pc, buf, buf_size, &frame->data, &frame->size);
+  if (!frame->data)
+    return next;
+
+  init_get_bits8(&gb, frame->data, frame->size);
+  frame->header_ret = ff_h263_decode_picture_header(&frame->hdr, &gb);
+  return next;
+}
+
+int ff_h263_ring_split_and_parse(ParseContext *pc, H263Packet *pkt,
+                                 FFSPSCRing *ring, int wait) {
+  const uint8_t *buf;
+  int avail, next;
+  av_assert0(pc);
+  av_assert0(pkt);
+  av_assert0(ring);
+
+  pkt->picture.data = NULL;
+  pkt->picture.size = 0;
+  pkt->got_pic = 0;
+
+  for (;;) {
+    avail = wait ? ff_spsc_ring_read_wait(ring, pc->index + 1, &buf)
+                 : ff_spsc_ring_read_reserve(ring, &buf);
+    if (avail < 0)
+      return avail;
+
+    // pc->index counts the bytes already scanned
+    if (avail > pc->index) {
+      next = ff_h263_find_frame_end(pc, buf + pc->index, avail - pc->index);
+      if (next != END_NOT_FOUND) {
+        next += pc->index;
+        break;
+      }
+      pc->index = avail;
+    }
+
+    // The last frame ends with the stream.
+    if (ff_spsc_ring_eof(ring) &&
+        ff_spsc_ring_read_reserve(ring, &buf) == avail) {
+      next = avail;
+      pc->frame_start_found = 0;
+      pc->state = -1;
+      break;
+    }
+    if (avail == ff_spsc_ring_capacity(ring))
+      return AVERROR(ENOSPC);
+    if (!wait)
+      return AVERROR(EAGAIN);
   }
+  pc->index = 0;
 
-end:
-  pkt->picture.data = pc->buffer;
-  pkt->picture.size = pc->buffer_size;
+  pkt->picture.data = buf;
+  pkt->picture.size = next;
   pkt->got_pic = 1;
-  init_get_bits(&pkt->picture.gb, pkt->picture.data, pkt->picture.size);
-  ff_h263_decode_picture_header(pkt);
+  init_get_bits8(&pkt->picture.gb, pkt->picture.data, pkt->picture.size);
+  decode_legacy_header(pkt);
   return next;
-}
\ No newline at end of file
+}
@@ -20,10 +20,12 @@
 #ifndef AVCODEC_H263_H
 #define AVCODEC_H263_H
 
+#include "buffer.h"
 #include "codec_id.h"
 #include "get_bits.h"
 #include "h263data.h"
 #include "rational.h"
+#include "spsc_ring.h"
 #include <stdint.h>
 
 #define FF_ASPECT_EXTENDED 15
@@ -32,6 +34,7 @@
 
 typedef struct ParseContext {
   uint8_t *buffer;
+  AVBufferRef *buffer_ref; ///< owns buffer, from the shared size class pools
   int index;
   int last_index;
   unsigned int buffer_size;
@@ -44,6 +47,23 @@ typedef struct ParseContext {
   uint64_t state64;   ///< contains the last 8 bytes in MSB order
 } ParseContext;
 
+/**
+ * Replace the buffer of a parse context with a pooled one of at least size
+ * bytes, keeping as much of its content as fits.
+ */
+int ff_parse_realloc(ParseContext *pc, unsigned int size);
+
+/**
+ * Return the buffer of a parse context to its pool.
+ */
+void ff_parse_close(ParseContext *pc);
+
+/**
+ * Legacy picture context, inherited from MpegEncContext. Only the fields
+ * set from an H263PictureHeader are filled, by
+ * ff_h263_packet_split_and_parse() and ff_h263_ring_split_and_parse().
+ * New code uses H263Frame.
+ */
 typedef struct H263Pic {
   const uint8_t *data;
   int size;
@@ -250,4 +270,92 @@ typedef struct H263Packet {
 int ff_h263_packet_split_and_parse(ParseContext *pc, H263Packet *pkt,
                                    const uint8_t *buf, int buf_size);
 
+/**
+ * The fields of an H.263 picture header, for parsing only.
+ *
+ * H.263+ pictures without UFEP (Update Full Extended PTYPE) do not repeat
+ * the picture format and coding modes, so the header of a stream is kept
+ * from one picture to the next. Zero it before the first one.
+ */
+typedef struct H263PictureHeader {
+  int width, height;
+  AVRational framerate;
+  AVRational sample_aspect_ratio;
+  uint8_t pict_type; ///< an AVPictureType
+  uint8_t qscale;
+  uint8_t pb_frame; ///< PB-frame mode (0 = none, 1 = base, 3 = improved)
+  uint8_t temporal_reference;
+  uint8_t h263_plus; ///< the picture has a PLUSPTYPE
+  uint8_t aspect_ratio_info;
+
+  /* coding modes, updated by pictures with UFEP in H.263+ */
+  uint8_t custom_pcf;
+  uint8_t umvplus; ///< unrestricted motion vectors
+  uint8_t obmc;    ///< advanced prediction
+  uint8_t h263_aic;
+  uint8_t loop_filter;
+  uint8_t h263_slice_structured;
+  uint8_t alt_inter_vlc;
+  uint8_t modified_quant;
+  uint8_t h263_long_vectors; ///< H.263v1 only
+  uint8_t no_rounding;       ///< H.263+ only
+} H263PictureHeader;
+
+/**
+ * Parse a picture header, starting at the picture start code.
+ *
+ * @param h the header of the previous picture of the stream, updated
+ * @return 0 on success, < 0 on error
+ */
+int ff_h263_decode_picture_header(H263PictureHeader *h, GetBitContext *gb);
+
+/**
+ * A picture split from the input, with its header.
+ */
+typedef struct H263Frame {
+  /**
+   * The picture, without padding. Points into the input when the picture
+   * is whole in it, into ParseContext.buffer when it was assembled from
+   * several inputs. Valid until the next call.
+   */
+  const uint8_t *data;
+  int size;
+
+  int header_ret; ///< 0 if the picture header was parsed, < 0 otherwise
+  H263PictureHeader hdr; ///< kept between the pictures of a stream
+} H263Frame;
+
+/**
+ * Split the next picture from the input and parse its header. The picture
+ * is only copied when it straddles several inputs.
+ *
+ * buf must be followed by AV_INPUT_BUFFER_PADDING_SIZE readable bytes, as
+ * the header reader may read past the end of the picture.
+ *
+ * @param frame    frame->data is set to NULL if no picture ended in buf,
+ *                 frame->hdr is to be kept between calls
+ * @param buf_size 0 to flush the last picture at the end of the stream
+ * @return the position in buf after the picture, buf_size if no picture
+ *         ended in it; negative if the picture ended in the data buffered
+ *         before buf, which is then to be split again from its start
+ */
+int ff_h263_split_frame(ParseContext *pc, H263Frame *frame, const uint8_t *buf,
+                        int buf_size);
+
+/**
+ * Split the next picture from the committed data of a ring and parse its
+ * header. The picture is not copied: pkt->picture.data points into the
+ * ring, and the caller releases it with ff_spsc_ring_read_commit() of the
+ * returned size once done with it. pc->buffer is not used; pc->index
+ * counts the data already scanned for the next start code.
+ *
+ * @param wait block until a whole picture or the end of the stream is
+ *             committed
+ * @return the size of the picture, AVERROR(EAGAIN) if more data is needed
+ *         and wait is 0, AVERROR(ENOSPC) if the picture does not fit in the
+ *         ring, AVERROR_EOF at the end of the stream
+ */
+int ff_h263_ring_split_and_parse(ParseContext *pc, H263Packet *pkt,
+                                 FFSPSCRing *ring, int wait);
+
 #endif /* AVCODEC_H263_H */
@@ -0,0 +1,476 @@
+/*
+ * H.264 / HEVC Annex B <-> length prefixed conversion
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include "defs.h"
+#include "error.h"
+#include "get_bits.h"
+#include "golomb.h"
+#include "h2645_convert.h"
+#include "h2645_parse.h"
+#include "h264.h"
+#include "h264_ps.h"
+#include "hevc.h"
+#include "hevc_ps.h"
+#include "intreadwrite.h"
+#include "mem.h"
+#include "sei.h"
+
+int ff_h2645_convert_init(H2645ConvertContext *s, enum AVCodecID codec_id,
+                          int in_length_size, int out_length_size,
+                          const void *ps) {
+  if (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC)
+    return AVERROR(EINVAL);
+  if ((in_length_size && in_length_size != 1 && in_length_size != 2 &&
+       in_length_size != 4) ||
+      (out_length_size && out_length_size != 1 && out_length_size != 2 &&
+       out_length_size != 4))
+    return AVERROR(EINVAL);
+
+  memset(s, 0, sizeof(*s));
+  s->codec_id = codec_id;
+  s->in_length_size = in_length_size;
+  s->out_length_size = out_length_size;
+  s->ps = ps;
+  return 0;
+}
+
+static int nal_type(const H2645ConvertContext *s, const uint8_t *nal) {
+  if (s->codec_id == AV_CODEC_ID_HEVC)
+    return (nal[0] >> 1) & 0x3F;
+  return nal[0] & 0x1F;
+}
+
+static int is_ps(const H2645ConvertContext *s, int type) {
+  if (s->codec_id == AV_CODEC_ID_HEVC)
+    return type >= HEVC_NAL_VPS && type <= HEVC_NAL_PPS;
+  return type == H264_NAL_SPS || type == H264_NAL_PPS;
+}
+
+/* Reads the RBSP bytes of an escaped NAL unit, one at a time. */
+typedef struct RBSPReader {
+  const uint8_t *p, *end;
+  int zeros;
+} RBSPReader;
+
+/**
+ * @return the next RBSP byte, -1 at the end of the NAL unit
+ */
+static int rbsp_byte(RBSPReader *r) {
+  int b;
+
+  if (r->p == r->end)
+    return -1;
+  b = *r->p++;
+  if (r->zeros >= 2 && b == 3) {
+    if (r->p == r->end)
+      return -1;
+    b = *r->p++;
+    r->zeros = 0;
+  }
+  r->zeros = b ? 0 : r->zeros + 1;
+  return b;
+}
+
+/**
+ * @return 1 if the H.264 SEI NAL unit carries a recovery point message
+ */
+static int h264_sei_has_recovery_point(const H2645ConvertNAL *nal) {
+  RBSPReader r = {nal->data + 1, nal->data + nal->size};
+
+  for (;;) {
+    int b, type = 0, size = 0;
+
+    // The trailing bits, or nothing, end the message list.
+    if (r.p == r.end || (r.end - r.p == 1 && *r.p == 0x80))
+      return 0;
+    do {
+      if ((b = rbsp_byte(&r)) < 0)
+        return 0;
+      type += b;
+    } while (b == 0xFF);
+    do {
+      if ((b = rbsp_byte(&r)) < 0)
+        return 0;
+      size += b;
+    } while (b == 0xFF);
+    if (type == SEI_TYPE_RECOVERY_POINT)
+      return 1;
+    while (size--)
+      if (rbsp_byte(&r) < 0)
+        return 0;
+  }
+}
+
+/**
+ * @return 1 if the H.264 slice NAL unit holds an I or SI slice
+ */
+static int h264_is_intra_slice(const H2645ConvertNAL *nal) {
+  // first_mb_in_slice and slice_type fit in 8 bytes
+  uint8_t buf[8 + AV_INPUT_BUFFER_PADDING_SIZE] = {0};
+  RBSPReader r = {nal->data + 1, nal->data + nal->size};
+  GetBitContext gb;
+  unsigned slice_type;
+  int i, b;
+
+  for (i = 0; i < 8 && (b = rbsp_byte(&r)) >= 0; i++)
+    buf[i] = b;
+  init_get_bits8(&gb, buf, 8);
+  get_ue_golomb_long(&gb); // first_mb_in_slice
+  slice_type = get_ue_golomb_long(&gb);
+  if (slice_type > 9)
+    return 0;
+  slice_type %= 5;
+  return slice_type == 2 || slice_type == 4; // I, SI
+}
+
+/**
+ * Whether a decoder may start at this NAL unit: an IRAP picture for HEVC;
+ * for H.264 an IDR picture, a recovery point SEI or an intra coded slice,
+ * which is where streams without IDRs are entered.
+ */
+static int is_random_access(const H2645ConvertContext *s,
+                            const H2645ConvertNAL *nal) {
+  int type = nal_type(s, nal->data);
+
+  if (s->codec_id == AV_CODEC_ID_HEVC)
+    return type >= HEVC_NAL_BLA_W_LP && type <= HEVC_NAL_RSV_IRAP_VCL23;
+  switch (type) {
+  case H264_NAL_IDR_SLICE:
+    return 1;
+  case H264_NAL_SEI:
+    return h264_sei_has_recovery_point(nal);
+  case H264_NAL_SLICE:
+    return h264_is_intra_slice(nal);
+  }
+  return 0;
+}
+
+static int is_aud(const H2645ConvertContext *s, int type) {
+  return type == (s->codec_id == AV_CODEC_ID_HEVC ? HEVC_NAL_AUD : H264_NAL_AUD);
+}
+
+/**
+ * Get the NAL unit stored in parameter set n of the current lists.
+ *
+ * @return the RBSP size, 0 if the slot is empty
+ */
+static int get_ps_data(enum AVCodecID codec_id, const void *lists, int n,
+                       const uint8_t **data) {
+  const AVBufferRef *ref;
+
+  if (codec_id == AV_CODEC_ID_H264) {
+    const H264ParamSets *ps = lists;
+
+    if (n < MAX_SPS_COUNT) {
+      ref = ps->sps_list[n];
+      if (!ref)
+        return 0;
+      *data = ((const SPS *)ref->data)->data;
+      return ((const SPS *)ref->data)->data_size;
+    }
+    n -= MAX_SPS_COUNT;
+    if (n < MAX_PPS_COUNT) {
+      ref = ps->pps_list[n];
+      if (!ref)
+        return 0;
+      *data = ((const PPS *)ref->data)->data;
+      return ((const PPS *)ref->data)->data_size;
+    }
+    return 0;
+  } else {
+    const HEVCParamSets *ps = lists;
+
+    if (n < HEVC_MAX_VPS_COUNT) {
+      ref = ps->vps_list[n];
+      if (!ref)
+        return 0;
+      *data = ((const HEVCVPS *)ref->data)->data;
+      return ((const HEVCVPS *)ref->data)->data_size;
+    }
+    n -= HEVC_MAX_VPS_COUNT;
+    if (n < HEVC_MAX_SPS_COUNT) {
+      ref = ps->sps_list[n];
+      if (!ref)
+        return 0;
+      *data = ((const HEVCSPS *)ref->data)->data;
+      return ((const HEVCSPS *)ref->data)->data_size;
+    }
+    n -= HEVC_MAX_SPS_COUNT;
+    if (n < HEVC_MAX_PPS_COUNT) {
+      ref = ps->pps_list[n];
+      if (!ref)
+        return 0;
+      *data = ((const HEVCPPS *)ref->data)->data;
+      return ((const HEVCPPS *)ref->data)->data_size;
+    }
+    return 0;
+  }
+}
+
+/**
+ * get_ps_data() without the trailing_zero_8bits.
+ */
+static int get_ps(enum AVCodecID codec_id, const void *lists, int n,
+                  const uint8_t **data) {
+  int size = get_ps_data(codec_id, lists, n, data);
+
+  while (size > 0 && !(*data)[size - 1])
+    size--;
+  return size;
+}
+
+/**
+ * Write the parameter sets of lists as Annex B NAL units to dst, or only
+ * compute their size if dst is NULL.
+ */
+static int write_ps(enum AVCodecID codec_id, const void *lists, uint8_t *dst) {
+  const uint8_t *data;
+  int n, size, total = 0;
+
+  for (n = 0; n < H2645_CONVERT_MAX_PS; n++) {
+    size = get_ps(codec_id, lists, n, &data);
+    if (!size)
+      continue;
+    if (!dst) {
+      if ((size = ff_h2645_escaped_size(data, size)) < 0 ||
+          size > INT_MAX - total - 5)
+        return AVERROR(ERANGE);
+      total += 4 + size;
+      continue;
+    }
+    AV_WB32(dst + total, 1);
+    total += 4;
+    total += ff_h2645_escape_rbsp(dst + total, data, size);
+  }
+  return total;
+}
+
+int ff_h2645_ps_to_annexb(enum AVCodecID codec_id, const void *ps,
+                          uint8_t *dst, int size) {
+  int ret = write_ps(codec_id, ps, NULL);
+
+  if (ret < 0 || !dst)
+    return ret;
+  if (ret > size)
+    return AVERROR(ENOSPC);
+  return write_ps(codec_id, ps, dst);
+}
+
+/**
+ * Build the Annex B parameter set blob from the current lists.
+ */
+static int build_ps(H2645ConvertContext *s) {
+  int ret;
+
+  s->ps_annexb_size = 0;
+  if ((ret = write_ps(s->codec_id, s->ps, NULL)) < 0)
+    return ret;
+  av_fast_malloc(&s->ps_annexb, &s->ps_annexb_alloc, ret);
+  if (!s->ps_annexb)
+    return AVERROR(ENOMEM);
+  s->ps_annexb_size = write_ps(s->codec_id, s->ps, s->ps_annexb);
+  return 0;
+}
+
+static int add_nal(H2645ConvertContext *s, const uint8_t *data, int size) {
+  if (s->nb_nals >= s->nals_alloc / sizeof(*s->nals)) {
+    H2645ConvertNAL *nals = av_fast_realloc(
+        s->nals, &s->nals_alloc, (s->nb_nals + 1) * 2 * sizeof(*s->nals));
+    if (!nals)
+      return AVERROR(ENOMEM);
+    s->nals = nals;
+  }
+  s->nals[s->nb_nals].data = data;
+  s->nals[s->nb_nals].size = size;
+  s->nb_nals++;
+  return 0;
+}
+
+/**
+ * Split an Annex B access unit.
+ *
+ * @param in_place set if every NAL unit is preceded by exactly one 4 byte
+ *                 start code and nothing else
+ */
+static int split_annexb(H2645ConvertContext *s, const uint8_t *buf, int size,
+                        int *in_place) {
+  const uint8_t *end = buf + size;
+  const uint8_t *sc = ff_h2645_find_start_code(buf, end);
+  int ret;
+
+  *in_place = sc == buf + 1 && !buf[0];
+
+  while (sc < end) {
+    const uint8_t *nal = sc + 3;
+    const uint8_t *next = ff_h2645_find_start_code(nal, end);
+    const uint8_t *nal_end = next;
+
+    while (nal_end > nal && !nal_end[-1])
+      nal_end--;
+    // An empty NAL unit leaves its start code behind in place.
+    if (nal_end == nal || nal_end != (next < end ? next - 1 : end))
+      *in_place = 0;
+
+    if (nal_end > nal) {
+      if ((ret = add_nal(s, nal, nal_end - nal)) < 0)
+        return ret;
+    }
+    sc = next;
+  }
+  return 0;
+}
+
+static int split_length(H2645ConvertContext *s, const uint8_t *buf, int size,
+                        int *in_place) {
+  const int ls = s->in_length_size;
+  int pos = 0, ret;
+
+  *in_place = ls == 4;
+
+  while (pos < size) {
+    uint32_t nal_size = 0;
+    int i;
+
+    if (size - pos < ls)
+      return AVERROR_INVALIDDATA;
+    for (i = 0; i < ls; i++)
+      nal_size = (nal_size << 8) | buf[pos++];
+    if (nal_size > (unsigned)(size - pos))
+      return AVERROR_INVALIDDATA;
+
+    if (nal_size) {
+      if ((ret = add_nal(s, buf + pos, nal_size)) < 0)
+        return ret;
+    } else {
+      *in_place = 0;
+    }
+    pos += nal_size;
+  }
+  return 0;
+}
+
+/**
+ * @return the index of the NAL unit before which the parameter sets are
+ *         inserted, -1 if the access unit needs none
+ */
+static int inject_position(const H2645ConvertContext *s) {
+  int i, irap = 0;
+
+  for (i = 0; i < s->nb_nals; i++) {
+    int type = nal_type(s, s->nals[i].data);
+
+    if (is_ps(s, type))
+      return -1;
+    irap |= is_random_access(s, &s->nals[i]);
+  }
+  if (!irap)
+    return -1;
+  return s->nb_nals && is_aud(s, nal_type(s, s->nals[0].data));
+}
+
+int ff_h2645_convert(H2645ConvertContext *s, uint8_t *buf, int size,
+                     const uint8_t **out, int *out_size) {
+  const int ls = s->out_length_size;
+  const int prefix = ls ? ls : 4;
+  int i, ret, in_place, inject = -1;
+  int64_t total;
+  uint8_t *dst;
+
+  if (size < 0)
+    return AVERROR(EINVAL);
+
+  s->nb_nals = 0;
+  ret = s->in_length_size ? split_length(s, buf, size, &in_place)
+                          : split_annexb(s, buf, size, &in_place);
+  if (ret < 0)
+    return ret;
+
+  if (!ls && s->ps && (inject = inject_position(s)) >= 0) {
+    // Only random access points get the parameter sets, and they are copied
+    // anyway, so the blob is rebuilt from the current lists every time.
+    if ((ret = build_ps(s)) < 0)
+      return ret;
+    if (!s->ps_annexb_size)
+      inject = -1;
+  }
+
+  if (in_place && (ls == 4 || !ls) && inject < 0) {
+    if (ls == s->in_length_size) {
+      // Same format, nothing to rewrite.
+    } else if (ls) {
+      for (i = 0; i < s->nb_nals; i++)
+        AV_WB32((uint8_t *)s->nals[i].data - 4, s->nals[i].size);
+    } else {
+      for (i = 0; i < s->nb_nals; i++)
+        AV_WB32((uint8_t *)s->nals[i].data - 4, 1);
+    }
+    *out = buf;
+    *out_size = size;
+    return 0;
+  }
+
+  total = inject >= 0 ? s->ps_annexb_size : 0;
+  for (i = 0; i < s->nb_nals; i++) {
+    if ((ls == 1 && s->nals[i].size > 0xFF) ||
+        (ls == 2 && s->nals[i].size > 0xFFFF))
+      return AVERROR(ERANGE);
+    total += prefix + s->nals[i].size;
+  }
+  if (total > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+    return AVERROR(ERANGE);
+
+  dst = av_fast_realloc(s->out, &s->out_alloc,
+                        total + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (!dst)
+    return AVERROR(ENOMEM);
+  s->out = dst;
+
+  for (i = 0; i < s->nb_nals; i++) {
+    if (i == inject) {
+      memcpy(dst, s->ps_annexb, s->ps_annexb_size);
+      dst += s->ps_annexb_size;
+    }
+    if (ls == 1)
+      *dst = s->nals[i].size;
+    else if (ls == 2)
+      AV_WB16(dst, s->nals[i].size);
+    else
+      AV_WB32(dst, ls ? s->nals[i].size : 1);
+    dst += prefix;
+    memcpy(dst, s->nals[i].data, s->nals[i].size);
+    dst += s->nals[i].size;
+  }
+  memset(dst, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+  *out = s->out;
+  *out_size = total;
+  return 0;
+}
+
+void ff_h2645_convert_uninit(H2645ConvertContext *s) {
+  av_freep(&s->ps_annexb);
+  av_freep(&s->nals);
+  av_freep(&s->out);
+  s->ps_annexb_alloc = s->nals_alloc = s->out_alloc = 0;
+  s->ps_annexb_size = s->nb_nals = 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Conversion of H.264 / HEVC access units between Annex B start codes and
+ * 1, 2 or 4 byte NAL unit length prefixes (avcC / hvcC sample format).
+ */
+
+#ifndef AVCODEC_H2645_CONVERT_H
+#define AVCODEC_H2645_CONVERT_H
+
+#include <stdint.h>
+
+#include "buffer.h"
+#include "codec_id.h"
+
+/* max(MAX_SPS_COUNT + MAX_PPS_COUNT, VPS + SPS + PPS count of HEVC) */
+#define H2645_CONVERT_MAX_PS (32 + 256)
+
+typedef struct H2645ConvertNAL {
+  const uint8_t *data; ///< NAL unit, without start code or length prefix
+  int size;
+} H2645ConvertNAL;
+
+typedef struct H2645ConvertContext {
+  enum AVCodecID codec_id;
+  int in_length_size;  ///< 0 for Annex B input, else 1, 2 or 4
+  int out_length_size; ///< 0 for Annex B output, else 1, 2 or 4
+
+  /**
+   * H264ParamSets or HEVCParamSets whose parameter sets are inserted
+   * before random access points that do not carry their own, when
+   * converting to Annex B: HEVC IRAP access units, and H.264 access units
+   * with an IDR picture, a recovery point SEI or an I or SI slice.
+   * NULL to disable.
+   */
+  const void *ps;
+  uint8_t *ps_annexb; ///< escaped parameter sets with start codes
+  int ps_annexb_size;
+  unsigned int ps_annexb_alloc;
+
+  H2645ConvertNAL *nals;
+  int nb_nals;
+  unsigned int nals_alloc;
+
+  uint8_t *out;
+  unsigned int out_alloc;
+} H2645ConvertContext;
+
+int ff_h2645_convert_init(H2645ConvertContext *s, enum AVCodecID codec_id,
+                          int in_length_size, int out_length_size,
+                          const void *ps);
+
+/**
+ * Convert one access unit.
+ *
+ * NAL units are never unescaped. When the prefix sizes match (4 byte start
+ * codes and 4 byte lengths) and no parameter set has to be inserted, the
+ * prefixes are rewritten in place in buf and *out is buf. Otherwise the
+ * access unit is written to a buffer of the context, sized exactly, which
+ * stays valid until the next call.
+ *
+ * @return 0 on success, a negative AVERROR code on error
+ */
+int ff_h2645_convert(H2645ConvertContext *s, uint8_t *buf, int size,
+                     const uint8_t **out, int *out_size);
+
+void ff_h2645_convert_uninit(H2645ConvertContext *s);
+
+/**
+ * Write every parameter set of ps, an H264ParamSets or HEVCParamSets, as
+ * Annex B NAL units with 4 byte start codes, as they are inserted by
+ * ff_h2645_convert().
+ *
+ * @param dst NULL to only compute the size
+ * @return the number of bytes written or needed, AVERROR(ENOSPC) if size is
+ *         too small, another negative AVERROR code on error
+ */
+int ff_h2645_ps_to_annexb(enum AVCodecID codec_id, const void *ps,
+                          uint8_t *dst, int size);
+
+#endif /* AVCODEC_H2645_CONVERT_H */
@@ -0,0 +1,328 @@
+/*
+ * avcC / hvcC generation
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <limits.h>
+
+#include "error.h"
+#include "h2645_extradata.h"
+#include "h2645_parse.h"
+#include "h264.h"
+#include "hevc.h"
+#include "intreadwrite.h"
+#include "macros.h"
+#include "put_bits.h"
+
+#define HVCC_HEADER_SIZE 23
+
+/**
+ * Add a parameter set NAL unit, as a 16 bit size followed by the escaped
+ * NAL unit, to the record being sized or written.
+ *
+ * @param p write position, NULL to only compute the size
+ * @return the number of bytes added, a negative AVERROR code on error
+ */
+static int add_nal(uint8_t **p, const uint8_t *data, size_t size) {
+  int escaped;
+
+  while (size > 0 && !data[size - 1]) // trailing_zero_8bits
+    size--;
+  if (!size)
+    return 0;
+  if (size > INT_MAX)
+    return AVERROR(ERANGE);
+
+  escaped = ff_h2645_escaped_size(data, size);
+  if (escaped < 0 || escaped > UINT16_MAX)
+    return AVERROR(ERANGE);
+
+  if (*p) {
+    AV_WB16(*p, escaped);
+    ff_h2645_escape_rbsp(*p + 2, data, size);
+    *p += 2 + escaped;
+  }
+  return 2 + escaped;
+}
+
+static int h264_high_profile(int profile_idc) {
+  return profile_idc == 100 || profile_idc == 110 || profile_idc == 122 ||
+         profile_idc == 144 || profile_idc == 244;
+}
+
+/**
+ * Size or write an avcC record.
+ *
+ * @param data output buffer, NULL to only compute the size
+ */
+static int h264_avcc(const H264ParamSets *ps, int nal_length_size,
+                     uint8_t *data) {
+  const SPS *first = NULL;
+  uint8_t *p = data ? data + 6 : NULL;
+  uint8_t *nb_pps_pos = NULL;
+  int i, ret, nb_sps = 0, nb_pps = 0, total = 7;
+
+  for (i = 0; i < MAX_SPS_COUNT; i++) {
+    const SPS *sps;
+
+    if (!ps->sps_list[i])
+      continue;
+    sps = (const SPS *)ps->sps_list[i]->data;
+    if ((ret = add_nal(&p, sps->data, sps->data_size)) < 0)
+      return ret;
+    if (!ret)
+      continue;
+    if (!first)
+      first = sps;
+    total += ret;
+    nb_sps++;
+  }
+
+  if (p) {
+    nb_pps_pos = p;
+    p++;
+  }
+  for (i = 0; i < MAX_PPS_COUNT; i++) {
+    const PPS *pps;
+
+    if (!ps->pps_list[i])
+      continue;
+    pps = (const PPS *)ps->pps_list[i]->data;
+    if ((ret = add_nal(&p, pps->data, pps->data_size)) < 0)
+      return ret;
+    if (!ret)
+      continue;
+    total += ret;
+    nb_pps++;
+  }
+
+  if (!nb_sps || !nb_pps)
+    return AVERROR(EINVAL);
+  if (nb_sps > 31 || nb_pps > 255)
+    return AVERROR(ERANGE);
+  if (h264_high_profile(first->profile_idc))
+    total += 4;
+  if (!data)
+    return total;
+
+  data[0] = 1; // configurationVersion
+  data[1] = first->profile_idc;
+  data[2] = 0;
+  for (i = 0; i < 6; i++) // constraint_set0_flag is the MSB
+    data[2] |= ((first->constraint_set_flags >> i) & 1) << (7 - i);
+  data[3] = first->level_idc;
+  data[4] = 0xFC | (nal_length_size - 1);
+  data[5] = 0xE0 | nb_sps;
+  *nb_pps_pos = nb_pps;
+
+  if (h264_high_profile(first->profile_idc)) {
+    *p++ = 0xFC | first->chroma_format_idc;
+    *p++ = 0xF8 | (first->bit_depth_luma - 8);
+    *p++ = 0xF8 | (first->bit_depth_chroma - 8);
+    *p++ = 0; // numOfSequenceParameterSetExt
+  }
+  return total;
+}
+
+int ff_h264_avcc_size(const H264ParamSets *ps) {
+  return h264_avcc(ps, 4, NULL);
+}
+
+int ff_h264_write_avcc(const H264ParamSets *ps, int nal_length_size,
+                       uint8_t *data, int size) {
+  int ret;
+
+  if (nal_length_size != 1 && nal_length_size != 2 && nal_length_size != 4)
+    return AVERROR(EINVAL);
+  if ((ret = ff_h264_avcc_size(ps)) < 0)
+    return ret;
+  if (ret > size)
+    return AVERROR(ENOSPC);
+  return h264_avcc(ps, nal_length_size, data);
+}
+
+/**
+ * general_profile_space to general_level_idc of profile_tier_level(),
+ * the inverse of decode_profile_tier_level().
+ */
+static void put_ptl(PutBitContext *pb, const PTLCommon *ptl) {
+  int i;
+
+#define check_profile_idc(idc)                                                 \
+  (ptl->profile_idc == idc || ptl->profile_compatibility_flag[idc])
+
+  put_bits(pb, 2, ptl->profile_space);
+  put_bits(pb, 1, ptl->tier_flag);
+  put_bits(pb, 5, ptl->profile_idc);
+  for (i = 0; i < 32; i++)
+    put_bits(pb, 1, ptl->profile_compatibility_flag[i]);
+  put_bits(pb, 1, ptl->progressive_source_flag);
+  put_bits(pb, 1, ptl->interlaced_source_flag);
+  put_bits(pb, 1, ptl->non_packed_constraint_flag);
+  put_bits(pb, 1, ptl->frame_only_constraint_flag);
+
+  if (check_profile_idc(4) || check_profile_idc(5) || check_profile_idc(6) ||
+      check_profile_idc(7) || check_profile_idc(8) || check_profile_idc(9) ||
+      check_profile_idc(10)) {
+    put_bits(pb, 1, ptl->max_12bit_constraint_flag);
+    put_bits(pb, 1, ptl->max_10bit_constraint_flag);
+    put_bits(pb, 1, ptl->max_8bit_constraint_flag);
+    put_bits(pb, 1, ptl->max_422chroma_constraint_flag);
+    put_bits(pb, 1, ptl->max_420chroma_constraint_flag);
+    put_bits(pb, 1, ptl->max_monochrome_constraint_flag);
+    put_bits(pb, 1, ptl->intra_constraint_flag);
+    put_bits(pb, 1, ptl->one_picture_only_constraint_flag);
+    put_bits(pb, 1, ptl->lower_bit_rate_constraint_flag);
+    if (check_profile_idc(5) || check_profile_idc(9) || check_profile_idc(10)) {
+      put_bits(pb, 1, ptl->max_14bit_constraint_flag);
+      put_bits64(pb, 33, 0);
+    } else {
+      put_bits64(pb, 34, 0);
+    }
+  } else if (check_profile_idc(2)) {
+    put_bits(pb, 7, 0);
+    put_bits(pb, 1, ptl->one_picture_only_constraint_flag);
+    put_bits64(pb, 35, 0);
+  } else {
+    put_bits64(pb, 43, 0);
+  }
+  put_bits(pb, 1, ptl->inbld_flag);
+  put_bits(pb, 8, ptl->level_idc);
+#undef check_profile_idc
+}
+
+static int hevc_ps_data(const AVBufferRef *ref, int type, const uint8_t **data) {
+  switch (type) {
+  case HEVC_NAL_VPS:
+    *data = ((const HEVCVPS *)ref->data)->data;
+    return ((const HEVCVPS *)ref->data)->data_size;
+  case HEVC_NAL_SPS:
+    *data = ((const HEVCSPS *)ref->data)->data;
+    return ((const HEVCSPS *)ref->data)->data_size;
+  default:
+    *data = ((const HEVCPPS *)ref->data)->data;
+    return ((const HEVCPPS *)ref->data)->data_size;
+  }
+}
+
+/**
+ * Size or write an hvcC record.
+ *
+ * @param data output buffer, NULL to only compute the size
+ */
+static int hevc_hvcc(const HEVCParamSets *ps, int nal_length_size,
+                     uint8_t *data) {
+  static const int types[3] = {HEVC_NAL_VPS, HEVC_NAL_SPS, HEVC_NAL_PPS};
+  AVBufferRef *const *lists[3] = {ps->vps_list, ps->sps_list, ps->pps_list};
+  const int counts[3] = {HEVC_MAX_VPS_COUNT, HEVC_MAX_SPS_COUNT,
+                         HEVC_MAX_PPS_COUNT};
+  const HEVCSPS *sps = NULL;
+  const HEVCPPS *pps = NULL;
+  uint8_t *p = data ? data + HVCC_HEADER_SIZE : NULL;
+  int i, j, ret, total = HVCC_HEADER_SIZE;
+  int min_spatial_segmentation, parallelism_type;
+  PutBitContext pb;
+
+  for (j = 0; j < 3; j++) {
+    uint8_t *array = p;
+    int nb_nals = 0;
+
+    if (p)
+      p += 3;
+    for (i = 0; i < counts[j]; i++) {
+      const uint8_t *nal;
+      int size;
+
+      if (!lists[j][i])
+        continue;
+      size = hevc_ps_data(lists[j][i], types[j], &nal);
+      if ((ret = add_nal(&p, nal, size)) < 0)
+        return ret;
+      if (!ret)
+        continue;
+      if (types[j] == HEVC_NAL_SPS && !sps)
+        sps = (const HEVCSPS *)lists[j][i]->data;
+      if (types[j] == HEVC_NAL_PPS && !pps)
+        pps = (const HEVCPPS *)lists[j][i]->data;
+      total += ret;
+      nb_nals++;
+    }
+    if (!nb_nals)
+      return AVERROR(EINVAL);
+    total += 3;
+
+    if (array) {
+      array[0] = 1 << 7 | types[j]; // array_completeness, NAL_unit_type
+      AV_WB16(array + 1, nb_nals);
+    }
+  }
+  if (!data)
+    return total;
+
+  min_spatial_segmentation = FFMIN(sps->vui.min_spatial_segmentation_idc, 4095);
+  if (!min_spatial_segmentation)
+    parallelism_type = 0; // mixed or unknown
+  else if (pps->entropy_coding_sync_enabled_flag && pps->tiles_enabled_flag)
+    parallelism_type = 0;
+  else if (pps->entropy_coding_sync_enabled_flag)
+    parallelism_type = 3; // wavefront
+  else if (pps->tiles_enabled_flag)
+    parallelism_type = 2; // tiles
+  else
+    parallelism_type = 1; // slices
+
+  init_put_bits(&pb, data, HVCC_HEADER_SIZE);
+  put_bits(&pb, 8, 1); // configurationVersion
+  put_ptl(&pb, &sps->ptl.general_ptl);
+  put_bits(&pb, 4, 0xF);
+  put_bits(&pb, 12, min_spatial_segmentation);
+  put_bits(&pb, 6, 0x3F);
+  put_bits(&pb, 2, parallelism_type);
+  put_bits(&pb, 6, 0x3F);
+  put_bits(&pb, 2, sps->chroma_format_idc);
+  put_bits(&pb, 5, 0x1F);
+  put_bits(&pb, 3, sps->bit_depth - 8);
+  put_bits(&pb, 5, 0x1F);
+  put_bits(&pb, 3, sps->bit_depth_chroma - 8);
+  put_bits(&pb, 16, 0); // avgFrameRate
+  put_bits(&pb, 2, 0);  // constantFrameRate
+  put_bits(&pb, 3, sps->max_sub_layers);
+  put_bits(&pb, 1, sps->temporal_id_nesting_flag);
+  put_bits(&pb, 2, nal_length_size - 1);
+  put_bits(&pb, 8, 3); // numOfArrays
+  flush_put_bits(&pb);
+
+  return total;
+}
+
+int ff_hevc_hvcc_size(const HEVCParamSets *ps) {
+  return hevc_hvcc(ps, 4, NULL);
+}
+
+int ff_hevc_write_hvcc(const HEVCParamSets *ps, int nal_length_size,
+                       uint8_t *data, int size) {
+  int ret;
+
+  if (nal_length_size != 1 && nal_length_size != 2 && nal_length_size != 4)
+    return AVERROR(EINVAL);
+  if ((ret = ff_hevc_hvcc_size(ps)) < 0)
+    return ret;
+  if (ret > size)
+    return AVERROR(ENOSPC);
+  return hevc_hvcc(ps, nal_length_size, data);
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * AVCDecoderConfigurationRecord (avcC) and HEVCDecoderConfigurationRecord
+ * (hvcC) generation from parsed parameter sets, ISO/IEC 14496-15.
+ */
+
+#ifndef AVCODEC_H2645_EXTRADATA_H
+#define AVCODEC_H2645_EXTRADATA_H
+
+#include <stdint.h>
+
+#include "h264_ps.h"
+#include "hevc_ps.h"
+
+/**
+ * @return the size of the avcC record of ps, AVERROR(EINVAL) if ps has no
+ *         SPS or PPS, AVERROR(ERANGE) if it has too many
+ */
+int ff_h264_avcc_size(const H264ParamSets *ps);
+
+/**
+ * Write the avcC record of every SPS and PPS of ps. Profile, level and the
+ * High profile chroma / bit depth fields are taken from the first SPS.
+ *
+ * @param nal_length_size size of the NAL unit length prefix of the samples,
+ *                        1, 2 or 4
+ * @return the number of bytes written, AVERROR(ENOSPC) if size is too small
+ *         or an error of ff_h264_avcc_size()
+ */
+int ff_h264_write_avcc(const H264ParamSets *ps, int nal_length_size,
+                       uint8_t *data, int size);
+
+/**
+ * @return the size of the hvcC record of ps, AVERROR(EINVAL) if ps has no
+ *         VPS, SPS or PPS
+ */
+int ff_hevc_hvcc_size(const HEVCParamSets *ps);
+
+/**
+ * Write the hvcC record of every VPS, SPS and PPS of ps. The general
+ * profile / tier / level, chroma format and bit depths are those of the
+ * first SPS, the parallelism type that of the first PPS.
+ *
+ * @return the number of bytes written, AVERROR(ENOSPC) if size is too small
+ *         or an error of ff_hevc_hvcc_size()
+ */
+int ff_hevc_write_hvcc(const HEVCParamSets *ps, int nal_length_size,
+                       uint8_t *data, int size);
+
+#endif /* AVCODEC_H2645_EXTRADATA_H */
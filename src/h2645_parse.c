@@ -18,11 +18,13 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <limits.h>
 #include <string.h>
 
 // #include "config.h"
 
 // #include "libavutil/intmath.h"
+#include "buffer_internal.h"
 #include "bytestream.h"
 #include "h264.h"
 #include "h2645_parse.h"
@@ -139,6 +141,61 @@ nsc:
   return si;
 }
 
+/**
+ * @return the position, at or after the previous escape at from, of the
+ *         next byte to be preceded by an emulation prevention byte, size if
+ *         there is none
+ */
+static int find_escape(const uint8_t *src, int size, int from) {
+  int k = from; // start of a candidate 00 00 pair
+
+  while (k + 2 < size) {
+    if (k + 8 <= size) {
+      uint64_t w = AV_RN64(src + k);
+      // No zero byte, so no pair starts in these 8 bytes.
+      if (!((w - 0x0101010101010101ULL) & ~w & 0x8080808080808080ULL)) {
+        k += 8;
+        continue;
+      }
+    }
+    if (src[k + 1]) {
+      k += 2;
+      continue;
+    }
+    if (!src[k] && src[k + 2] <= 3)
+      return k + 2;
+    k++;
+  }
+  return size;
+}
+
+int ff_h2645_escaped_size(const uint8_t *src, int size) {
+  int64_t escaped = size;
+  int i = 0;
+
+  while ((i = find_escape(src, size, i)) < size)
+    escaped++;
+  if (size && !src[size - 1])
+    escaped++;
+  return escaped > INT_MAX ? AVERROR(ERANGE) : escaped;
+}
+
+int ff_h2645_escape_rbsp(uint8_t *dst, const uint8_t *src, int size) {
+  int si = 0, di = 0, i;
+
+  while ((i = find_escape(src, size, si)) < size) {
+    memcpy(dst + di, src + si, i - si);
+    di += i - si;
+    dst[di++] = 3;
+    si = i;
+  }
+  memcpy(dst + di, src + si, size - si);
+  di += size - si;
+  if (size && !src[size - 1])
+    dst[di++] = 3;
+  return di;
+}
+
 static const char *const hevc_nal_type_name[64] = {
     "TRAIL_N",        // HEVC_NAL_TRAIL_N
     "TRAIL_R",        // HEVC_NAL_TRAIL_R
@@ -292,7 +349,8 @@ static int hevc_parse_nal_header(H2645NAL *nal, void *logctx) {
   if (nal->temporal_id < 0)
     return AVERROR_INVALIDDATA;
 
-  printf("nal_unit_type: %d(%s), nuh_layer_id: %d, temporal_id: %d\n",
+  av_log(logctx, AV_LOG_DEBUG,
+         "nal_unit_type: %d(%s), nuh_layer_id: %d, temporal_id: %d\n",
          nal->type, hevc_nal_unit_name(nal->type), nal->nuh_layer_id,
          nal->temporal_id);
 
@@ -308,8 +366,8 @@ static int h264_parse_nal_header(H2645NAL *nal, void *logctx) {
   nal->ref_idc = get_bits(gb, 2);
   nal->type = get_bits(gb, 5);
 
-  printf("nal_unit_type: %d(%s), nal_ref_idc: %d\n", nal->type,
-         h264_nal_unit_name(nal->type), nal->ref_idc);
+  av_log(logctx, AV_LOG_DEBUG, "nal_unit_type: %d(%s), nal_ref_idc: %d\n",
+         nal->type, h264_nal_unit_name(nal->type), nal->ref_idc);
 
   return 0;
 }
@@ -330,6 +388,7 @@ static int find_next_start_code(const uint8_t *buf, const uint8_t *next_avc) {
 
 static void alloc_rbsp_buffer(H2645RBSP *rbsp, unsigned int size, int use_ref) {
   int min_size = size;
+  enum FFMemTag tag;
 
   if (size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
     goto fail;
@@ -350,17 +409,18 @@ static void alloc_rbsp_buffer(H2645RBSP *rbsp, unsigned int size, int use_ref) {
   else
     av_free(rbsp->rbsp_buffer);
 
-  rbsp->rbsp_buffer = av_mallocz(size);
-  if (!rbsp->rbsp_buffer)
+  // Drawn from the shared pools whether use_ref is set or not, so that
+  // streams reuse each other's buffers.
+  tag = ff_mem_set_tag(FF_MEM_TAG_RBSP);
+  rbsp->rbsp_buffer_ref = ff_buffer_pool_get_size(size);
+  ff_mem_set_tag(tag);
+  if (!rbsp->rbsp_buffer_ref) {
+    rbsp->rbsp_buffer = NULL;
     goto fail;
-  rbsp->rbsp_buffer_alloc_size = size;
-
-  if (use_ref) {
-    rbsp->rbsp_buffer_ref =
-        av_buffer_create(rbsp->rbsp_buffer, size, NULL, NULL, 0);
-    if (!rbsp->rbsp_buffer_ref)
-      goto fail;
   }
+  rbsp->rbsp_buffer = rbsp->rbsp_buffer_ref->data;
+  rbsp->rbsp_buffer_alloc_size = FFMIN(rbsp->rbsp_buffer_ref->size, INT_MAX);
+  memset(rbsp->rbsp_buffer + min_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
 
   return;
 
@@ -375,10 +435,10 @@ fail:
   return;
 }
 
-int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
-                          void *logctx, int is_nalff, int nal_length_size,
-                          enum AVCodecID codec_id, int small_padding,
-                          int use_ref) {
+static int packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
+                        void *logctx, int is_nalff, int nal_length_size,
+                        enum AVCodecID codec_id, int small_padding,
+                        int use_ref) {
   GetByteContext bc;
   int consumed, ret = 0;
   int next_avc = is_nalff ? 0 : length;
@@ -411,7 +471,8 @@ int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
       int buf_index;
 
       if (bytestream2_tell(&bc) > next_avc)
-        printf("Exceeded next NALFF position, re-syncing.\n");
+        av_log(logctx, AV_LOG_DEBUG,
+               "Exceeded next NALFF position, re-syncing.\n");
 
       /* search start code */
       buf_index = find_next_start_code(bc.buffer, buf + next_avc);
@@ -424,7 +485,7 @@ int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
           // bytes at the end of the packet.
           return 0;
         } else {
-          printf("No start code is found.\n");
+          av_log(logctx, AV_LOG_ERROR, "No start code is found.\n");
           return AVERROR_INVALIDDATA;
         }
       }
@@ -472,7 +533,8 @@ int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
       return consumed;
 
     if (is_nalff && (extract_length != consumed) && extract_length)
-      printf("NALFF: Consumed only %d bytes instead of %d\n", consumed,
+      av_log(logctx, AV_LOG_DEBUG,
+             "NALFF: Consumed only %d bytes instead of %d\n", consumed,
              extract_length);
 
     bytestream2_skip(&bc, consumed);
@@ -490,6 +552,13 @@ int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
     ret = init_get_bits(&nal->gb, nal->data, nal->size_bits);
     if (ret < 0)
       return ret;
+    // what really follows the NAL unit, for get_bits_trusted()
+    if (nal->data == nal->raw_data)
+      nal->gb.padding =
+          buf + length - nal->gb.buffer_end + AV_INPUT_BUFFER_PADDING_SIZE;
+    else
+      nal->gb.padding = pkt->rbsp.rbsp_buffer +
+                        pkt->rbsp.rbsp_buffer_alloc_size - nal->gb.buffer_end;
 
     /* Reset type in case it contains a stale value from a previously parsed NAL
      */
@@ -500,7 +569,8 @@ int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
     else
       ret = h264_parse_nal_header(nal, logctx);
     if (ret < 0) {
-      printf("Invalid NAL unit %d, skipping.\n", nal->type);
+      av_log(logctx, AV_LOG_WARNING, "Invalid NAL unit %d, skipping.\n",
+             nal->type);
       continue;
     }
 
@@ -510,6 +580,18 @@ int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
   return 0;
 }
 
+int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
+                          void *logctx, int is_nalff, int nal_length_size,
+                          enum AVCodecID codec_id, int small_padding,
+                          int use_ref) {
+  enum FFMemTag tag = ff_mem_set_tag(FF_MEM_TAG_SPLITTER);
+  int ret = packet_split(pkt, buf, length, logctx, is_nalff, nal_length_size,
+                         codec_id, small_padding, use_ref);
+
+  ff_mem_set_tag(tag);
+  return ret;
+}
+
 void ff_h2645_packet_uninit(H2645Packet *pkt) {
   int i;
   for (i = 0; i < pkt->nals_allocated; i++) {
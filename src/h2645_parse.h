@@ -25,7 +25,7 @@
 
 #include "buffer.h"
 #include "error.h"
-// #include "libavutil/log.h"
+#include "log.h"
 #include "codec_id.h"
 #include "get_bits.h"
 
@@ -95,6 +95,21 @@ typedef struct H2645Packet {
 int ff_h2645_extract_rbsp(const uint8_t *src, int length, H2645RBSP *rbsp,
                           H2645NAL *nal, int small_padding);
 
+/**
+ * @return the size of src once escaped by ff_h2645_escape_rbsp(),
+ *         AVERROR(ERANGE) if it does not fit in an int
+ */
+int ff_h2645_escaped_size(const uint8_t *src, int size);
+
+/**
+ * Insert the emulation prevention bytes of a NAL unit, the reverse of
+ * ff_h2645_extract_rbsp(). A 0x03 byte is also appended if src ends with a
+ * zero byte (cabac_zero_word). dst must hold ff_h2645_escaped_size() bytes.
+ *
+ * @return the number of bytes written
+ */
+int ff_h2645_escape_rbsp(uint8_t *dst, const uint8_t *src, int size);
+
 /**
  * Split an input packet into NAL units.
  *
@@ -106,8 +121,8 @@ int ff_h2645_extract_rbsp(const uint8_t *src, int length, H2645RBSP *rbsp,
  *
  * If the packet's rbsp_buffer_ref is not NULL, the underlying AVBuffer must
  * own rbsp_buffer. If not and rbsp_buffer is not NULL, use_ref must be 0.
- * If use_ref is set, rbsp_buffer will be reference-counted and owned by
- * the underlying AVBuffer of rbsp_buffer_ref.
+ * When the buffer grows, it is drawn from the shared size class pools and
+ * is always owned by rbsp_buffer_ref, so use_ref is implied.
  */
 int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
                           void *logctx, int is_nalff, int nal_length_size,
@@ -119,6 +134,37 @@ int ff_h2645_packet_split(H2645Packet *pkt, const uint8_t *buf, int length,
  */
 void ff_h2645_packet_uninit(H2645Packet *pkt);
 
+/**
+ * @return a pointer to the next 00 00 01 start code in [p, end), or end
+ */
+static inline const uint8_t *ff_h2645_find_start_code(const uint8_t *p,
+                                                      const uint8_t *end) {
+  while (end - p >= 3) {
+    if (p[2] > 1)
+      p += 3;
+    else if (p[1])
+      p += 2;
+    else if (p[0] || p[2] != 1)
+      p++;
+    else
+      return p;
+  }
+  return end;
+}
+
+/**
+ * Size of the RBSP being read by gb, for keeping a copy of the NAL unit.
+ * ff_h2645_packet_split() leaves the rbsp_trailing_bits out of the reader;
+ * this puts back the byte holding the stop bit when it was left out whole.
+ */
+static inline int ff_h2645_rbsp_size(const GetBitContext *gb) {
+  int size = gb->buffer_end - gb->buffer;
+
+  if (!(gb->size_in_bits & 7) && gb->buffer_end[0] == 0x80)
+    size++;
+  return size;
+}
+
 static inline int get_nalsize(int nal_length_size, const uint8_t *buf,
                               int buf_size, int *buf_index, void *logctx) {
   int i, nalsize = 0;
@@ -131,8 +177,8 @@ static inline int get_nalsize(int nal_length_size, const uint8_t *buf,
   for (i = 0; i < nal_length_size; i++)
     nalsize = ((unsigned)nalsize << 8) | buf[(*buf_index)++];
   if (nalsize <= 0 || nalsize > buf_size - *buf_index) {
-    printf("Invalid NAL unit size (%d > %d).\n", nalsize,
-           buf_size - *buf_index);
+    av_log(logctx, AV_LOG_ERROR, "Invalid NAL unit size (%d > %d).\n",
+           nalsize, buf_size - *buf_index);
     return AVERROR_INVALIDDATA;
   }
   return nalsize;
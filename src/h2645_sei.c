@@ -0,0 +1,275 @@
+/*
+ * H.264/HEVC common SEI message parsing
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <limits.h>
+
+#include "atsc_a53.h"
+#include "dynamic_hdr10_plus.h"
+#include "error.h"
+#include "h2645_sei.h"
+#include "macros.h"
+#include "mem.h"
+
+int ff_h2645_sei_message_header(GetBitContext *gb, int *type, int *size) {
+  int payload_type = 0;
+  int payload_size = 0;
+  int byte = 0xFF;
+
+  while (byte == 0xFF) {
+    if (get_bits_left(gb) < 16 || payload_type > INT_MAX - 255)
+      return AVERROR_INVALIDDATA;
+    byte = get_bits(gb, 8);
+    payload_type += byte;
+  }
+  byte = 0xFF;
+  while (byte == 0xFF) {
+    if (get_bits_left(gb) < 8 + 8LL * payload_size)
+      return AVERROR_INVALIDDATA;
+    byte = get_bits(gb, 8);
+    payload_size += byte;
+  }
+  if (get_bits_left(gb) < 8LL * payload_size)
+    return AVERROR_INVALIDDATA;
+
+  *type = payload_type;
+  *size = payload_size;
+  return 0;
+}
+
+int ff_h2645_sei_t35_header(GetBitContext *gb, void *logctx, int *psize) {
+  int country_code, provider_code;
+  int size = *psize;
+
+  if (size < 3)
+    return AVERROR_INVALIDDATA;
+  size -= 3;
+
+  country_code = get_bits(gb, 8);
+  if (country_code == 0xFF) {
+    if (size < 1)
+      return AVERROR_INVALIDDATA;
+
+    skip_bits(gb, 8);
+    size--;
+  }
+
+  if (country_code != 0xB5) { // usa_country_code
+    av_log(logctx, AV_LOG_VERBOSE,
+           "Unsupported User Data Registered ITU-T T35 SEI message "
+           "(country_code = %d)\n", country_code);
+    *psize = size + 2;
+    return H2645_SEI_T35_UNKNOWN;
+  }
+
+  provider_code = get_bits(gb, 16);
+
+  switch (provider_code) {
+  case 0x3C: { // smpte_provider_code
+    // A/341 Amendment - 2094-40
+    const uint16_t smpte2094_40_provider_oriented_code = 0x0001;
+    const uint8_t smpte2094_40_application_identifier = 0x04;
+    uint16_t provider_oriented_code;
+    uint8_t application_identifier;
+
+    if (size < 3)
+      return AVERROR_INVALIDDATA;
+    size -= 3;
+
+    provider_oriented_code = get_bits(gb, 16);
+    application_identifier = get_bits(gb, 8);
+    *psize = size;
+    if (provider_oriented_code == smpte2094_40_provider_oriented_code &&
+        application_identifier == smpte2094_40_application_identifier)
+      return H2645_SEI_T35_HDR10_PLUS;
+    break;
+  }
+  case 0x31: { // atsc_provider_code
+    uint32_t user_identifier;
+
+    if (size < 4)
+      return AVERROR_INVALIDDATA;
+    size -= 4;
+
+    user_identifier = get_bits_long(gb, 32);
+    *psize = size;
+    switch (user_identifier) {
+    case MKBETAG('G', 'A', '9', '4'):
+      return H2645_SEI_T35_A53_CC;
+    default:
+      av_log(logctx, AV_LOG_VERBOSE,
+             "Unsupported User Data Registered ITU-T T35 SEI message (atsc "
+             "user_identifier = 0x%04x)\n", user_identifier);
+      break;
+    }
+    break;
+  }
+  default:
+    av_log(logctx, AV_LOG_VERBOSE,
+           "Unsupported User Data Registered ITU-T T35 SEI message "
+           "(provider_code = %d)\n", provider_code);
+    *psize = size;
+    break;
+  }
+
+  return H2645_SEI_T35_UNKNOWN;
+}
+
+int ff_h2645_sei_a53_caption(H2645SEIA53Caption *s, GetBitContext *gb,
+                             int size) {
+  int ret;
+
+  ret = ff_parse_a53_cc(&s->buf_ref, gb->buffer + get_bits_count(gb) / 8, size);
+
+  if (ret < 0)
+    return ret;
+
+  skip_bits_long(gb, size * 8);
+
+  return 0;
+}
+
+int ff_h2645_sei_a53_caption_ring(A53CCRing *ring, int64_t pts,
+                                  GetBitContext *gb, int size) {
+  int ret;
+
+  ret = ff_parse_a53_cc_ring(ring, gb->buffer + get_bits_count(gb) / 8, size,
+                             pts);
+  if (ret < 0 && ret != AVERROR(EAGAIN))
+    return ret;
+
+  skip_bits_long(gb, size * 8);
+
+  return 0;
+}
+
+int ff_h2645_sei_dynamic_hdr_plus(H2645SEIDynamicHDRPlus *s,
+                                  GetBitContext *gb, int size) {
+  size_t meta_size;
+  int err;
+  AVDynamicHDRPlus *metadata = av_dynamic_hdr_plus_alloc(&meta_size);
+  if (!metadata)
+    return AVERROR(ENOMEM);
+
+  err = ff_parse_itu_t_t35_to_dynamic_hdr10_plus(
+      metadata, gb->buffer + get_bits_count(gb) / 8, size);
+  if (err < 0) {
+    av_free(metadata);
+    return err;
+  }
+
+  av_buffer_unref(&s->info);
+  s->info = av_buffer_create((uint8_t *)metadata, meta_size, NULL, NULL, 0);
+  if (!s->info) {
+    av_free(metadata);
+    return AVERROR(ENOMEM);
+  }
+
+  skip_bits_long(gb, size * 8);
+
+  return 0;
+}
+
+int ff_h2645_sei_unregistered(H2645SEIUnregistered *s, GetBitContext *gb,
+                              int size) {
+  AVBufferRef *buf_ref, **tmp;
+
+  if (size < 16 || size >= INT_MAX - 1)
+    return AVERROR_INVALIDDATA;
+
+  tmp = av_realloc_array(s->buf_ref, s->nb_buf_ref + 1, sizeof(*s->buf_ref));
+  if (!tmp)
+    return AVERROR(ENOMEM);
+  s->buf_ref = tmp;
+
+  buf_ref = av_buffer_alloc(size + 1);
+  if (!buf_ref)
+    return AVERROR(ENOMEM);
+
+  for (int i = 0; i < size; i++)
+    buf_ref->data[i] = get_bits(gb, 8);
+  buf_ref->data[size] = 0;
+  buf_ref->size = size;
+  s->buf_ref[s->nb_buf_ref++] = buf_ref;
+
+  return 0;
+}
+
+int ff_h2645_sei_mastering_display(H2645SEIMasteringDisplay *s,
+                                   GetBitContext *gb, int size) {
+  int i;
+
+  if (size < 24)
+    return AVERROR_INVALIDDATA;
+
+  // Mastering primaries
+  for (i = 0; i < 3; i++) {
+    s->display_primaries[i][0] = get_bits(gb, 16);
+    s->display_primaries[i][1] = get_bits(gb, 16);
+  }
+  // White point (x, y)
+  s->white_point[0] = get_bits(gb, 16);
+  s->white_point[1] = get_bits(gb, 16);
+
+  // Max and min luminance of mastering display
+  s->max_luminance = get_bits_long(gb, 32);
+  s->min_luminance = get_bits_long(gb, 32);
+  size -= 24;
+
+  // As this SEI message comes before the first frame that references it,
+  // initialize the flag to 2 and decrement on IRAP access unit so it
+  // persists for the coded video sequence (e.g., between two IRAPs)
+  s->present = 2;
+
+  skip_bits_long(gb, 8 * size);
+  return 0;
+}
+
+int ff_h2645_sei_content_light(H2645SEIContentLight *s, GetBitContext *gb,
+                               int size) {
+  if (size < 4)
+    return AVERROR_INVALIDDATA;
+
+  // Max and average light levels
+  s->max_content_light_level = get_bits(gb, 16);
+  s->max_pic_average_light_level = get_bits(gb, 16);
+  size -= 4;
+  // As this SEI message comes before the first frame that references it,
+  // initialize the flag to 2 and decrement on IRAP access unit so it
+  // persists for the coded video sequence (e.g., between two IRAPs)
+  s->present = 2;
+
+  skip_bits_long(gb, 8 * size);
+  return 0;
+}
+
+void ff_h2645_sei_a53_caption_reset(H2645SEIA53Caption *s) {
+  av_buffer_unref(&s->buf_ref);
+}
+
+void ff_h2645_sei_unregistered_reset(H2645SEIUnregistered *s) {
+  for (int i = 0; i < s->nb_buf_ref; i++)
+    av_buffer_unref(&s->buf_ref[i]);
+  s->nb_buf_ref = 0;
+  av_freep(&s->buf_ref);
+}
+
+void ff_h2645_sei_dynamic_hdr_plus_reset(H2645SEIDynamicHDRPlus *s) {
+  av_buffer_unref(&s->info);
+}
@@ -0,0 +1,119 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * SEI message framing and payloads common to H.264 and HEVC
+ */
+
+#ifndef AVCODEC_H2645_SEI_H
+#define AVCODEC_H2645_SEI_H
+
+#include <stdint.h>
+
+#include "atsc_a53.h"
+#include "buffer.h"
+#include "get_bits.h"
+#include "sei.h"
+
+typedef struct H2645SEIA53Caption {
+  AVBufferRef *buf_ref;
+} H2645SEIA53Caption;
+
+typedef struct H2645SEIUnregistered {
+  AVBufferRef **buf_ref;
+  int nb_buf_ref;
+} H2645SEIUnregistered;
+
+typedef struct H2645SEIMasteringDisplay {
+  int present;
+  uint16_t display_primaries[3][2];
+  uint16_t white_point[2];
+  uint32_t max_luminance;
+  uint32_t min_luminance;
+} H2645SEIMasteringDisplay;
+
+typedef struct H2645SEIDynamicHDRPlus {
+  AVBufferRef *info;
+} H2645SEIDynamicHDRPlus;
+
+typedef struct H2645SEIContentLight {
+  int present;
+  uint16_t max_content_light_level;
+  uint16_t max_pic_average_light_level;
+} H2645SEIContentLight;
+
+/**
+ * Payloads carried in user data registered by ITU-T T.35 SEI.
+ */
+enum H2645SEIT35Type {
+  H2645_SEI_T35_UNKNOWN,
+  H2645_SEI_T35_A53_CC,     ///< ATSC A/53 closed captions
+  H2645_SEI_T35_HDR10_PLUS, ///< SMPTE ST 2094-40
+};
+
+/**
+ * Read the payload type and size of the next SEI message.
+ *
+ * @return 0 on success, AVERROR_INVALIDDATA if the message does not fit
+ */
+int ff_h2645_sei_message_header(GetBitContext *gb, int *type, int *size);
+
+static inline int ff_h2645_sei_more_rbsp_data(GetBitContext *gb) {
+  return get_bits_left(gb) > 0 && show_bits(gb, 8) != 0x80;
+}
+
+/**
+ * Read the T.35 header of a user data registered payload.
+ *
+ * @param size payload size, updated to the bytes left after the header
+ * @return an enum H2645SEIT35Type, negative AVERROR code on error. The
+ *         reader is left at the start of the embedded payload.
+ */
+int ff_h2645_sei_t35_header(GetBitContext *gb, void *logctx, int *size);
+
+int ff_h2645_sei_a53_caption(H2645SEIA53Caption *s, GetBitContext *gb,
+                             int size);
+
+/**
+ * Append the A53 cc_data triplets to a caption ring instead of a buffer.
+ * A full ring drops the triplets (see A53CCRing.dropped) without failing.
+ */
+int ff_h2645_sei_a53_caption_ring(A53CCRing *ring, int64_t pts,
+                                  GetBitContext *gb, int size);
+
+int ff_h2645_sei_dynamic_hdr_plus(H2645SEIDynamicHDRPlus *s,
+                                  GetBitContext *gb, int size);
+
+int ff_h2645_sei_unregistered(H2645SEIUnregistered *s, GetBitContext *gb,
+                              int size);
+
+int ff_h2645_sei_mastering_display(H2645SEIMasteringDisplay *s,
+                                   GetBitContext *gb, int size);
+
+int ff_h2645_sei_content_light(H2645SEIContentLight *s, GetBitContext *gb,
+                               int size);
+
+/**
+ * Drop the buffers held by the common payloads.
+ */
+void ff_h2645_sei_a53_caption_reset(H2645SEIA53Caption *s);
+void ff_h2645_sei_unregistered_reset(H2645SEIUnregistered *s);
+void ff_h2645_sei_dynamic_hdr_plus_reset(H2645SEIDynamicHDRPlus *s);
+
+#endif /* AVCODEC_H2645_SEI_H */
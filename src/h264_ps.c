@@ -25,6 +25,14 @@
  * @author Michael Niedermayer <michaelni@gmx.at>
  */
 
+#ifdef FF_CHECKED_READER
+#define UNCHECKED_BITSTREAM_READER 0
+#define ff_h264_decode_seq_parameter_set                                       \
+  ff_h264_decode_seq_parameter_set_checked
+#define ff_h264_decode_picture_parameter_set                                   \
+  ff_h264_decode_picture_parameter_set_checked
+#endif
+
 #include <inttypes.h>
 
 // #include "libavutil/imgutils.h"
@@ -32,13 +40,17 @@
 #include "mathops.h"
 // #include "avcodec.h"
 #include "buffer.h"
+#include "buffer_internal.h"
 #include "golomb.h"
 #include "h264.h"
 #include "h264_ps.h"
+#include "h2645_parse.h"
 #include "h264data.h"
 #include "macros.h"
 #include "mem.h"
+#include "memstats.h"
 #include "string.h"
+#include "thread.h"
 
 #define MIN_LOG2_MAX_FRAME_NUM 4
 
@@ -66,8 +78,16 @@ static const int level_max_dpb_mbs[][2] = {
     {42, 34816}, {50, 110400}, {51, 184320}, {52, 184320},
 };
 
+/* Drop a PPS reference. The last one also drops the SPS reference of the
+ * PPS, so that an object back in its pool does not keep the SPS alive. */
+static void pps_unref(AVBufferRef **ref) {
+  if (*ref && av_buffer_get_ref_count(*ref) == 1)
+    av_buffer_unref(&((PPS *)(*ref)->data)->sps_ref);
+  av_buffer_unref(ref);
+}
+
 static void remove_pps(H264ParamSets *s, int id) {
-  av_buffer_unref(&s->pps_list[id]);
+  pps_unref(&s->pps_list[id]);
 }
 
 static void remove_sps(H264ParamSets *s, int id) {
@@ -84,21 +104,22 @@ static void remove_sps(H264ParamSets *s, int id) {
 }
 
 static inline int decode_hrd_parameters(GetBitContext *gb, void *logctx,
-                                        SPS *sps) {
+                                        SPS *sps, H264HRDParams *hrd) {
   int cpb_count, i;
   cpb_count = get_ue_golomb_31(gb) + 1;
 
   if (cpb_count > 32U) {
-    printf("cpb_count %d invalid\n", cpb_count);
+    av_log(logctx, AV_LOG_ERROR, "cpb_count %d invalid\n", cpb_count);
     return AVERROR_INVALIDDATA;
   }
 
-  get_bits(gb, 4); /* bit_rate_scale */
-  get_bits(gb, 4); /* cpb_size_scale */
+  hrd->cpb_cnt = cpb_count;
+  hrd->bit_rate_scale = get_bits(gb, 4);
+  hrd->cpb_size_scale = get_bits(gb, 4);
   for (i = 0; i < cpb_count; i++) {
-    get_ue_golomb_long(gb); /* bit_rate_value_minus1 */
-    get_ue_golomb_long(gb); /* cpb_size_value_minus1 */
-    get_bits1(gb);          /* cbr_flag */
+    hrd->bit_rate_value[i] = get_ue_golomb_long(gb) + 1;
+    hrd->cpb_size_value[i] = get_ue_golomb_long(gb) + 1;
+    hrd->cbr_flag[i] = get_bits1(gb);
   }
   sps->initial_cpb_removal_delay_length = get_bits(gb, 5) + 1;
   sps->cpb_removal_delay_length = get_bits(gb, 5) + 1;
@@ -108,7 +129,8 @@ static inline int decode_hrd_parameters(GetBitContext *gb, void *logctx,
   return 0;
 }
 
-static inline int decode_vui_parameters(GetBitContext *gb, SPS *sps) {
+static inline int decode_vui_parameters(GetBitContext *gb, void *logctx,
+                                        SPS *sps) {
   int aspect_ratio_info_present_flag;
   unsigned int aspect_ratio_idc;
 
@@ -122,7 +144,7 @@ static inline int decode_vui_parameters(GetBitContext *gb, SPS *sps) {
     } else if (aspect_ratio_idc < FF_ARRAY_ELEMS(ff_h264_pixel_aspect)) {
       sps->sar = ff_h264_pixel_aspect[aspect_ratio_idc];
     } else {
-      printf("illegal aspect ratio\n");
+      av_log(logctx, AV_LOG_ERROR, "illegal aspect ratio\n");
       return AVERROR_INVALIDDATA;
     }
   } else {
@@ -162,7 +184,7 @@ static inline int decode_vui_parameters(GetBitContext *gb, SPS *sps) {
     sps->chroma_location = AVCHROMA_LOC_LEFT;
 
   if (show_bits1(gb) && get_bits_left(gb) < 10) {
-    printf("Truncated VUI (%d)\n", get_bits_left(gb));
+    av_log(logctx, AV_LOG_WARNING, "Truncated VUI (%d)\n", get_bits_left(gb));
     return 0;
   }
 
@@ -171,7 +193,8 @@ static inline int decode_vui_parameters(GetBitContext *gb, SPS *sps) {
     unsigned num_units_in_tick = get_bits_long(gb, 32);
     unsigned time_scale = get_bits_long(gb, 32);
     if (!num_units_in_tick || !time_scale) {
-      printf("time_scale/num_units_in_tick invalid or unsupported (%u/%u)\n",
+      av_log(logctx, AV_LOG_ERROR,
+             "time_scale/num_units_in_tick invalid or unsupported (%u/%u)\n",
              time_scale, num_units_in_tick);
       sps->timing_info_present_flag = 0;
     } else {
@@ -183,15 +206,15 @@ static inline int decode_vui_parameters(GetBitContext *gb, SPS *sps) {
 
   sps->nal_hrd_parameters_present_flag = get_bits1(gb);
   if (sps->nal_hrd_parameters_present_flag)
-    if (decode_hrd_parameters(gb, NULL, sps) < 0)
+    if (decode_hrd_parameters(gb, logctx, sps, &sps->nal_hrd) < 0)
       return AVERROR_INVALIDDATA;
   sps->vcl_hrd_parameters_present_flag = get_bits1(gb);
   if (sps->vcl_hrd_parameters_present_flag)
-    if (decode_hrd_parameters(gb, NULL, sps) < 0)
+    if (decode_hrd_parameters(gb, logctx, sps, &sps->vcl_hrd) < 0)
       return AVERROR_INVALIDDATA;
   if (sps->nal_hrd_parameters_present_flag ||
       sps->vcl_hrd_parameters_present_flag)
-    get_bits1(gb); /* low_delay_hrd_flag */
+    sps->low_delay_hrd_flag = get_bits1(gb);
   sps->pic_struct_present_flag = get_bits1(gb);
   if (!get_bits_left(gb))
     return 0;
@@ -212,7 +235,7 @@ static inline int decode_vui_parameters(GetBitContext *gb, SPS *sps) {
 
     if (sps->num_reorder_frames > 16U
         /* max_dec_frame_buffering || max_dec_frame_buffering > 16 */) {
-      printf("Clipping illegal num_reorder_frames %d\n",
+      av_log(logctx, AV_LOG_WARNING, "Clipping illegal num_reorder_frames %d\n",
              sps->num_reorder_frames);
       sps->num_reorder_frames = 16;
       return AVERROR_INVALIDDATA;
@@ -234,7 +257,7 @@ static int decode_scaling_list(GetBitContext *gb, uint8_t *factors, int size,
       if (next) {
         int v = get_se_golomb(gb);
         if (v < -128 || v > 127) {
-          printf("delta scale %d is invalid\n", v);
+          av_log(NULL, AV_LOG_ERROR, "delta scale %d is invalid\n", v);
           return AVERROR_INVALIDDATA;
         }
         next = (last + v) & 0xff;
@@ -300,6 +323,7 @@ static int decode_scaling_matrices(GetBitContext *gb, const SPS *sps,
   return ret;
 }
 
+#ifndef FF_CHECKED_READER
 void ff_h264_ps_uninit(H264ParamSets *ps) {
   int i;
 
@@ -307,34 +331,80 @@ void ff_h264_ps_uninit(H264ParamSets *ps) {
     av_buffer_unref(&ps->sps_list[i]);
 
   for (i = 0; i < MAX_PPS_COUNT; i++)
-    av_buffer_unref(&ps->pps_list[i]);
+    pps_unref(&ps->pps_list[i]);
 
-  av_buffer_unref(&ps->pps_ref);
+  pps_unref(&ps->pps_ref);
 
   ps->pps = NULL;
   ps->sps = NULL;
 }
 
-int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
-                                     int ignore_truncation) {
+/* Parameter sets are shared by all streams of the process. Pool buffers
+ * start zeroed, so the sps_ref of a PPS is always either NULL or owned by
+ * it. */
+static AVBufferPool *sps_pool, *pps_pool;
+static AVOnce ps_pool_once = AV_ONCE_INIT;
+
+static void ps_pool_init(void) {
+  sps_pool = av_buffer_pool_init(sizeof(SPS), av_buffer_allocz);
+  pps_pool = av_buffer_pool_init(sizeof(PPS), av_buffer_allocz);
+}
+
+AVBufferRef *ff_h264_ps_pool_get(int type) {
+  AVBufferPool **pool = type == H264_NAL_SPS ? &sps_pool : &pps_pool;
+
+  if (ff_thread_once(&ps_pool_once, ps_pool_init) || !*pool)
+    return NULL;
+  return av_buffer_pool_get(*pool);
+}
+
+void ff_h264_ps_pool_trim(void) {
+  if (ff_thread_once(&ps_pool_once, ps_pool_init))
+    return;
+  ff_buffer_pool_trim(sps_pool);
+  ff_buffer_pool_trim(pps_pool);
+}
+#endif
+
+/**
+ * Copy the NAL unit being read by gb to data, with its header. When gb
+ * starts after the header, as in the raw NAL retry of decode_extradata_ps(),
+ * the header is rebuilt with nal_ref_idc 3.
+ *
+ * @return the number of bytes stored, at most size
+ */
+static size_t store_nal(uint8_t *data, size_t size, const GetBitContext *gb,
+                        int type) {
+  size_t rbsp_size = ff_h2645_rbsp_size(gb);
+  int hdr = !get_bits_count(gb);
+
+  if (hdr)
+    data[0] = 3 << 5 | type;
+  rbsp_size = FFMIN(rbsp_size, size - hdr);
+  memcpy(data + hdr, gb->buffer, rbsp_size);
+  return hdr + rbsp_size;
+}
+
+static int decode_sps(GetBitContext *gb, void *logctx, H264ParamSets *ps,
+                      int ignore_truncation) {
   AVBufferRef *sps_buf;
   int profile_idc, level_idc, constraint_set_flags = 0;
   unsigned int sps_id;
   int i, log2_max_frame_num_minus4;
   SPS *sps;
   int ret;
+  // data always starts with the header, gb may start after it
+  const int hdr_bits = get_bits_count(gb) ? 0 : 8;
 
-  sps_buf = av_buffer_allocz(sizeof(*sps));
+  sps_buf = ff_h264_ps_pool_get(H264_NAL_SPS);
   if (!sps_buf)
     return AVERROR(ENOMEM);
   sps = (SPS *)sps_buf->data;
+  memset(sps, 0, sizeof(*sps));
 
-  sps->data_size = gb->buffer_end - gb->buffer;
-  if (sps->data_size > sizeof(sps->data)) {
-    printf("Truncating likely oversized SPS\n");
-    sps->data_size = sizeof(sps->data);
-  }
-  memcpy(sps->data, gb->buffer, sps->data_size);
+  sps->data_size = store_nal(sps->data, sizeof(sps->data), gb, H264_NAL_SPS);
+  if (sps->data_size == sizeof(sps->data))
+    av_log(logctx, AV_LOG_DEBUG, "Truncating likely oversized SPS\n");
 
   profile_idc = get_bits(gb, 8);
   constraint_set_flags |= get_bits1(gb) << 0; // constraint_set0_flag
@@ -348,7 +418,7 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
   sps_id = get_ue_golomb_31(gb);
 
   if (sps_id >= MAX_SPS_COUNT) {
-    printf("sps_id %u out of range\n", sps_id);
+    av_log(logctx, AV_LOG_ERROR, "sps_id %u out of range\n", sps_id);
     goto fail;
   }
 
@@ -377,25 +447,27 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
       sps->profile_idc == 144) { // old High444 profile
     sps->chroma_format_idc = get_ue_golomb_31(gb);
     if (sps->chroma_format_idc > 3U) {
-      printf("chroma_format_idc %u", sps->chroma_format_idc);
+      av_log(logctx, AV_LOG_ERROR, "chroma_format_idc %u\n",
+             sps->chroma_format_idc);
       goto fail;
     } else if (sps->chroma_format_idc == 3) {
       sps->residual_color_transform_flag = get_bits1(gb);
       if (sps->residual_color_transform_flag) {
-        printf("separate color planes are not supported\n");
+        av_log(logctx, AV_LOG_ERROR,
+               "separate color planes are not supported\n");
         goto fail;
       }
     }
     sps->bit_depth_luma = get_ue_golomb_31(gb) + 8;
     sps->bit_depth_chroma = get_ue_golomb_31(gb) + 8;
     if (sps->bit_depth_chroma != sps->bit_depth_luma) {
-      printf("Different chroma and luma bit depth");
+      av_log(logctx, AV_LOG_ERROR, "Different chroma and luma bit depth\n");
       goto fail;
     }
     if (sps->bit_depth_luma < 8 || sps->bit_depth_luma > 14 ||
         sps->bit_depth_chroma < 8 || sps->bit_depth_chroma > 14) {
-      printf("illegal bit depth value (%d, %d)\n", sps->bit_depth_luma,
-             sps->bit_depth_chroma);
+      av_log(logctx, AV_LOG_ERROR, "illegal bit depth value (%d, %d)\n",
+             sps->bit_depth_luma, sps->bit_depth_chroma);
       goto fail;
     }
     sps->transform_bypass = get_bits1(gb);
@@ -413,7 +485,8 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
   log2_max_frame_num_minus4 = get_ue_golomb_31(gb);
   if (log2_max_frame_num_minus4 < MIN_LOG2_MAX_FRAME_NUM - 4 ||
       log2_max_frame_num_minus4 > MAX_LOG2_MAX_FRAME_NUM - 4) {
-    printf("log2_max_frame_num_minus4 out of range (0-12): %d\n",
+    av_log(logctx, AV_LOG_ERROR,
+           "log2_max_frame_num_minus4 out of range (0-12): %d\n",
            log2_max_frame_num_minus4);
     goto fail;
   }
@@ -424,7 +497,8 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
   if (sps->poc_type == 0) { // FIXME #define
     unsigned t = get_ue_golomb_31(gb);
     if (t > 12) {
-      printf("log2_max_poc_lsb (%d) is out of range\n", t);
+      av_log(logctx, AV_LOG_ERROR, "log2_max_poc_lsb (%d) is out of range\n",
+             t);
       goto fail;
     }
     sps->log2_max_poc_lsb = t + 4;
@@ -435,7 +509,8 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
 
     if (sps->offset_for_non_ref_pic == INT32_MIN ||
         sps->offset_for_top_to_bottom_field == INT32_MIN) {
-      printf("offset_for_non_ref_pic or offset_for_top_to_bottom_field is out "
+      av_log(logctx, AV_LOG_ERROR,
+             "offset_for_non_ref_pic or offset_for_top_to_bottom_field is out "
              "of range\n");
       goto fail;
     }
@@ -444,19 +519,20 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
 
     if ((unsigned)sps->poc_cycle_length >=
         FF_ARRAY_ELEMS(sps->offset_for_ref_frame)) {
-      printf("poc_cycle_length overflow %d\n", sps->poc_cycle_length);
+      av_log(logctx, AV_LOG_ERROR, "poc_cycle_length overflow %d\n",
+             sps->poc_cycle_length);
       goto fail;
     }
 
     for (i = 0; i < sps->poc_cycle_length; i++) {
       sps->offset_for_ref_frame[i] = get_se_golomb_long(gb);
       if (sps->offset_for_ref_frame[i] == INT32_MIN) {
-        printf("offset_for_ref_frame is out of range\n");
+        av_log(logctx, AV_LOG_ERROR, "offset_for_ref_frame is out of range\n");
         goto fail;
       }
     }
   } else if (sps->poc_type != 2) {
-    printf("illegal POC type %d\n", sps->poc_type);
+    av_log(logctx, AV_LOG_ERROR, "illegal POC type %d\n", sps->poc_type);
     goto fail;
   }
 
@@ -474,7 +550,7 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
   sps->frame_mbs_only_flag = get_bits1(gb);
 
   if (sps->mb_height >= INT_MAX / 2U) {
-    printf("height overflow\n");
+    av_log(logctx, AV_LOG_ERROR, "height overflow\n");
     goto fail;
   }
   sps->mb_height *= 2 - sps->frame_mbs_only_flag;
@@ -486,10 +562,11 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
 
   if ((unsigned)sps->mb_width <= INT_MAX / 16 ||
       (unsigned)sps->mb_height <= INT_MAX / 16) {
-    printf("sps parse width:%d,height:%d\n", 16 * sps->mb_width,
-           16 * sps->mb_height);
+    av_log(logctx, AV_LOG_DEBUG, "sps parse width:%d,height:%d\n",
+           16 * sps->mb_width, 16 * sps->mb_height);
   } else {
-    printf("sps parse mb_width:%d,mb_height:%d too big.\n", sps->mb_width,
+    av_log(logctx, AV_LOG_ERROR,
+           "sps parse mb_width:%d,mb_height:%d too big.\n", sps->mb_width,
            sps->mb_height);
     goto fail;
   }
@@ -498,7 +575,8 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
 
 #ifndef ALLOW_INTERLACE
   if (sps->mb_aff)
-    printf("MBAFF support not included; enable it at compile-time.\n");
+    av_log(logctx, AV_LOG_ERROR,
+           "MBAFF support not included; enable it at compile-time.\n");
 #endif
   sps->crop = get_bits1(gb);
   if (sps->crop) {
@@ -511,9 +589,9 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
 
     int ignore_crop = 0;
     if (ignore_crop) {
-      printf("discarding sps cropping, original "
-             "values are l:%d r:%d t:%d b:%d\n",
-             crop_left, crop_right, crop_top, crop_bottom);
+      av_log(logctx, AV_LOG_DEBUG,
+             "discarding sps cropping, original values are l:%d r:%d t:%d "
+             "b:%d\n", crop_left, crop_right, crop_top, crop_bottom);
 
       sps->crop_left = sps->crop_right = sps->crop_top = sps->crop_bottom = 0;
     } else {
@@ -529,7 +607,8 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
           crop_bottom > (unsigned)INT_MAX / 4 / step_y ||
           (crop_left + crop_right) * step_x >= width ||
           (crop_top + crop_bottom) * step_y >= height) {
-        printf("crop values invalid %d %d %d %d / %d %d\n", crop_left,
+        av_log(logctx, AV_LOG_ERROR,
+               "crop values invalid %d %d %d %d / %d %d\n", crop_left,
                crop_right, crop_top, crop_bottom, width, height);
         goto fail;
       }
@@ -544,15 +623,16 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
         sps->crop = 0;
   }
 
+  sps->vui_flag_pos = get_bits_count(gb) + hdr_bits;
   sps->vui_parameters_present_flag = get_bits1(gb);
   if (sps->vui_parameters_present_flag) {
-    int ret = decode_vui_parameters(gb, sps);
+    int ret = decode_vui_parameters(gb, logctx, sps);
     if (ret < 0)
       goto fail;
   }
 
   if (get_bits_left(gb) < 0) {
-    printf("Overread %s by %d bits\n",
+    av_log(logctx, AV_LOG_ERROR, "Overread %s by %d bits\n",
            sps->vui_parameters_present_flag ? "VUI" : "SPS",
            -get_bits_left(gb));
     if (!ignore_truncation)
@@ -576,24 +656,22 @@ int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
   if (!sps->sar.den)
     sps->sar.den = 1;
 
-  int debug = 1;
-  if (debug) {
-    static const char csp[4][5] = {"Gray", "420", "422", "444"};
-    printf("sps:%u profile:%d/%d poc:%d ref:%d %dx%d %s %s crop:%u/%u/%u/%u %s "
-           "%s %" PRId32 "/%" PRId32 " b%d reo:%d\n",
-           sps_id, sps->profile_idc, sps->level_idc, sps->poc_type,
-           sps->ref_frame_count, sps->mb_width, sps->mb_height,
-           sps->frame_mbs_only_flag ? "FRM"
-                                    : (sps->mb_aff ? "MB-AFF" : "PIC-AFF"),
-           sps->direct_8x8_inference_flag ? "8B8" : "", sps->crop_left,
-           sps->crop_right, sps->crop_top, sps->crop_bottom,
-           sps->vui_parameters_present_flag ? "VUI" : "",
-           csp[sps->chroma_format_idc],
-           sps->timing_info_present_flag ? sps->num_units_in_tick : 0,
-           sps->timing_info_present_flag ? sps->time_scale : 0,
-           sps->bit_depth_luma,
-           sps->bitstream_restriction_flag ? sps->num_reorder_frames : -1);
-  }
+  static const char csp[4][5] = {"Gray", "420", "422", "444"};
+  av_log(logctx, AV_LOG_DEBUG,
+         "sps:%u profile:%d/%d poc:%d ref:%d %dx%d %s %s crop:%u/%u/%u/%u %s "
+         "%s %" PRId32 "/%" PRId32 " b%d reo:%d\n",
+         sps_id, sps->profile_idc, sps->level_idc, sps->poc_type,
+         sps->ref_frame_count, sps->mb_width, sps->mb_height,
+         sps->frame_mbs_only_flag ? "FRM"
+                                  : (sps->mb_aff ? "MB-AFF" : "PIC-AFF"),
+         sps->direct_8x8_inference_flag ? "8B8" : "", sps->crop_left,
+         sps->crop_right, sps->crop_top, sps->crop_bottom,
+         sps->vui_parameters_present_flag ? "VUI" : "",
+         csp[sps->chroma_format_idc],
+         sps->timing_info_present_flag ? sps->num_units_in_tick : 0,
+         sps->timing_info_present_flag ? sps->time_scale : 0,
+         sps->bit_depth_luma,
+         sps->bitstream_restriction_flag ? sps->num_reorder_frames : -1);
 
   /* check if this is a repeat of an already parsed SPS, then keep the
    * original one.
@@ -613,6 +691,22 @@ fail:
   return AVERROR_INVALIDDATA;
 }
 
+int ff_h264_decode_seq_parameter_set(GetBitContext *gb, void *logctx,
+                                     H264ParamSets *ps, int ignore_truncation) {
+  enum FFMemTag tag;
+  int ret;
+
+#ifndef FF_CHECKED_READER
+  if (!get_bits_trusted(gb, H264_SPS_MAX_OVERREAD_BITS))
+    return ff_h264_decode_seq_parameter_set_checked(gb, logctx, ps,
+                                                    ignore_truncation);
+#endif
+  tag = ff_mem_set_tag(FF_MEM_TAG_H264_PS);
+  ret = decode_sps(gb, logctx, ps, ignore_truncation);
+  ff_mem_set_tag(tag);
+  return ret;
+}
+
 static void init_dequant8_coeff_table(PPS *pps, const SPS *sps) {
   int i, j, q, x;
   const int max_qp = 51 + 6 * (sps->bit_depth_luma - 8);
@@ -700,23 +794,16 @@ static int more_rbsp_data_in_pps(const SPS *sps, void *logctx) {
 
   if ((profile_idc == 66 || profile_idc == 77 || profile_idc == 88) &&
       (sps->constraint_set_flags & 7)) {
-    printf("Current profile doesn't provide more RBSP data in PPS, skipping\n");
+    av_log(logctx, AV_LOG_VERBOSE,
+           "Current profile doesn't provide more RBSP data in PPS, skipping\n");
     return 0;
   }
 
   return 1;
 }
 
-static void pps_free(void *opaque, uint8_t *data) {
-  PPS *pps = (PPS *)data;
-
-  av_buffer_unref(&pps->sps_ref);
-
-  av_freep(&data);
-}
-
-int ff_h264_decode_picture_parameter_set(GetBitContext *gb, H264ParamSets *ps,
-                                         int bit_length) {
+static int decode_pps(GetBitContext *gb, void *logctx, H264ParamSets *ps,
+                      int bit_length) {
   AVBufferRef *pps_buf;
   const SPS *sps;
   unsigned int pps_id = get_ue_golomb(gb);
@@ -726,31 +813,23 @@ int ff_h264_decode_picture_parameter_set(GetBitContext *gb, H264ParamSets *ps,
   int ret;
 
   if (pps_id >= MAX_PPS_COUNT) {
-    printf("pps_id %u out of range\n", pps_id);
+    av_log(logctx, AV_LOG_ERROR, "pps_id %u out of range\n", pps_id);
     return AVERROR_INVALIDDATA;
   }
 
-  pps = av_mallocz(sizeof(*pps));
-  if (!pps)
+  pps_buf = ff_h264_ps_pool_get(H264_NAL_PPS);
+  if (!pps_buf)
     return AVERROR(ENOMEM);
-  pps_buf = av_buffer_create((uint8_t *)pps, sizeof(*pps), pps_free, NULL, 0);
-  if (!pps_buf) {
-    av_freep(&pps);
-    return AVERROR(ENOMEM);
-  }
+  pps = (PPS *)pps_buf->data;
+  av_buffer_unref(&pps->sps_ref);
+  memset(pps, 0, sizeof(*pps));
 
-  pps->data_size = gb->buffer_end - gb->buffer;
-  if (pps->data_size > sizeof(pps->data)) {
-    // printf("Truncating likely oversized PPS "
-    //        "(%"SIZE_SPECIFIER" > %"SIZE_SPECIFIER")\n",
-    //        pps->data_size, sizeof(pps->data));
-    pps->data_size = sizeof(pps->data);
-  }
-  memcpy(pps->data, gb->buffer, pps->data_size);
+  pps->data_size = store_nal(pps->data, sizeof(pps->data), gb, H264_NAL_PPS);
 
   pps->sps_id = get_ue_golomb_31(gb);
-  if ((unsigned)pps->sps_id >= MAX_SPS_COUNT) {
-    printf("sps_id %u out of range\n", pps->sps_id);
+  if ((unsigned)pps->sps_id >= MAX_SPS_COUNT ||
+      !ps->sps_list[pps->sps_id]) {
+    av_log(logctx, AV_LOG_ERROR, "sps_id %u out of range\n", pps->sps_id);
     ret = AVERROR_INVALIDDATA;
     goto fail;
   }
@@ -764,11 +843,13 @@ int ff_h264_decode_picture_parameter_set(GetBitContext *gb, H264ParamSets *ps,
   sps = pps->sps;
 
   if (sps->bit_depth_luma > 14) {
-    printf("Invalid luma bit depth=%d\n", sps->bit_depth_luma);
+    av_log(logctx, AV_LOG_ERROR, "Invalid luma bit depth=%d\n",
+           sps->bit_depth_luma);
     ret = AVERROR_INVALIDDATA;
     goto fail;
   } else if (sps->bit_depth_luma == 11 || sps->bit_depth_luma == 13) {
-    printf("Unimplemented luma bit depth=%d", sps->bit_depth_luma);
+    av_log(logctx, AV_LOG_ERROR, "Unimplemented luma bit depth=%d\n",
+           sps->bit_depth_luma);
     ret = AVERROR_PATCHWELCOME;
     goto fail;
   }
@@ -778,14 +859,14 @@ int ff_h264_decode_picture_parameter_set(GetBitContext *gb, H264ParamSets *ps,
   pps->slice_group_count = get_ue_golomb(gb) + 1;
   if (pps->slice_group_count > 1) {
     pps->mb_slice_group_map_type = get_ue_golomb(gb);
-    printf("miss feature FMO");
+    av_log(logctx, AV_LOG_ERROR, "miss feature FMO\n");
     ret = AVERROR_PATCHWELCOME;
     goto fail;
   }
   pps->ref_count[0] = get_ue_golomb(gb) + 1;
   pps->ref_count[1] = get_ue_golomb(gb) + 1;
   if (pps->ref_count[0] - 1 > 32 - 1 || pps->ref_count[1] - 1 > 32 - 1) {
-    printf("reference overflow (pps)\n");
+    av_log(logctx, AV_LOG_ERROR, "reference overflow (pps)\n");
     ret = AVERROR_INVALIDDATA;
     goto fail;
   }
@@ -814,7 +895,7 @@ int ff_h264_decode_picture_parameter_set(GetBitContext *gb, H264ParamSets *ps,
          sizeof(pps->scaling_matrix8));
 
   bits_left = bit_length - get_bits_count(gb);
-  if (bits_left > 0 && more_rbsp_data_in_pps(sps, NULL)) {
+  if (bits_left > 0 && more_rbsp_data_in_pps(sps, logctx)) {
     pps->transform_8x8_mode = get_bits1(gb);
     ret = decode_scaling_matrices(gb, sps, pps, 0, pps->scaling_matrix4,
                                   pps->scaling_matrix8);
@@ -839,19 +920,16 @@ int ff_h264_decode_picture_parameter_set(GetBitContext *gb, H264ParamSets *ps,
   if (pps->chroma_qp_index_offset[0] != pps->chroma_qp_index_offset[1])
     pps->chroma_qp_diff = 1;
 
-  int debug = 1;
-  if (debug) {
-    printf("pps:%u sps:%u %s slice_groups:%d ref:%u/%u %s qp:%d/%d/%d/%d %s %s "
-           "%s %s\n",
-           pps_id, pps->sps_id, pps->cabac ? "CABAC" : "CAVLC",
-           pps->slice_group_count, pps->ref_count[0], pps->ref_count[1],
-           pps->weighted_pred ? "weighted" : "", pps->init_qp, pps->init_qs,
-           pps->chroma_qp_index_offset[0], pps->chroma_qp_index_offset[1],
-           pps->deblocking_filter_parameters_present ? "LPAR" : "",
-           pps->constrained_intra_pred ? "CONSTR" : "",
-           pps->redundant_pic_cnt_present ? "REDU" : "",
-           pps->transform_8x8_mode ? "8x8DCT" : "");
-  }
+  av_log(logctx, AV_LOG_DEBUG,
+         "pps:%u sps:%u %s slice_groups:%d ref:%u/%u %s qp:%d/%d/%d/%d %s %s "
+         "%s %s\n", pps_id, pps->sps_id, pps->cabac ? "CABAC" : "CAVLC",
+         pps->slice_group_count, pps->ref_count[0], pps->ref_count[1],
+         pps->weighted_pred ? "weighted" : "", pps->init_qp, pps->init_qs,
+         pps->chroma_qp_index_offset[0], pps->chroma_qp_index_offset[1],
+         pps->deblocking_filter_parameters_present ? "LPAR" : "",
+         pps->constrained_intra_pred ? "CONSTR" : "",
+         pps->redundant_pic_cnt_present ? "REDU" : "",
+         pps->transform_8x8_mode ? "8x8DCT" : "");
 
   remove_pps(ps, pps_id);
   ps->pps_list[pps_id] = pps_buf;
@@ -859,6 +937,22 @@ int ff_h264_decode_picture_parameter_set(GetBitContext *gb, H264ParamSets *ps,
   return 0;
 
 fail:
-  av_buffer_unref(&pps_buf);
+  pps_unref(&pps_buf);
+  return ret;
+}
+
+int ff_h264_decode_picture_parameter_set(GetBitContext *gb, void *logctx,
+                                         H264ParamSets *ps, int bit_length) {
+  enum FFMemTag tag;
+  int ret;
+
+#ifndef FF_CHECKED_READER
+  if (!get_bits_trusted(gb, H264_PPS_MAX_OVERREAD_BITS))
+    return ff_h264_decode_picture_parameter_set_checked(gb, logctx, ps,
+                                                        bit_length);
+#endif
+  tag = ff_mem_set_tag(FF_MEM_TAG_H264_PS);
+  ret = decode_pps(gb, logctx, ps, bit_length);
+  ff_mem_set_tag(tag);
   return ret;
 }
@@ -38,6 +38,33 @@
 #define MAX_PPS_COUNT 256
 #define MAX_LOG2_MAX_FRAME_NUM (12 + 4)
 
+/* Most bits the parsers below read from a hostile NAL unit, past its end if
+ * it is short; see get_bits_trusted(). An Exp-Golomb code counts 63 bits,
+ * get_ue_golomb_31() 9. */
+#define H264_SCALING_MATRICES_MAX_BITS                                         \
+  (1 + 6 * (1 + 16 * 63) + 6 * (1 + 64 * 63))
+#define H264_HRD_MAX_BITS (9 + 8 + H264_MAX_CPB_CNT * (63 + 63 + 1) + 20)
+#define H264_VUI_MAX_BITS                                                      \
+  (41 + 2 + 30 + 19 + 66 + 2 * (1 + H264_HRD_MAX_BITS) + 2 + (1 + 1 + 6 * 9))
+#define H264_SPS_MAX_OVERREAD_BITS                                             \
+  (33 + 29 + H264_SCALING_MATRICES_MAX_BITS + 18 + (1 + 3 * 63 + 255 * 63) + \
+   9 + 1 + 2 * 63 + 3 + (1 + 4 * 63) + 1 + H264_VUI_MAX_BITS)
+#define H264_PPS_MAX_OVERREAD_BITS                                             \
+  (63 + 9 + 2 + 2 * 63 + 2 * 63 + 3 + 3 * 63 + 3 + 1 +                         \
+   H264_SCALING_MATRICES_MAX_BITS + 63)
+
+/**
+ * HRD parameters, see H.264 E.1.2
+ */
+typedef struct H264HRDParams {
+  int cpb_cnt;        ///< cpb_cnt_minus1 + 1
+  int bit_rate_scale;
+  int cpb_size_scale;
+  uint32_t bit_rate_value[H264_MAX_CPB_CNT]; ///< bit_rate_value_minus1 + 1
+  uint32_t cpb_size_value[H264_MAX_CPB_CNT]; ///< cpb_size_value_minus1 + 1
+  uint8_t cbr_flag[H264_MAX_CPB_CNT];
+} H264HRDParams;
+
 /**
  * Sequence parameter set
  */
@@ -70,6 +97,7 @@ typedef struct SPS {
   unsigned int crop_top;    ///< frame_cropping_rect_top_offset
   unsigned int crop_bottom; ///< frame_cropping_rect_bottom_offset
   int vui_parameters_present_flag;
+  int vui_flag_pos; ///< bit offset of vui_parameters_present_flag in data
   AVRational sar;
   int video_signal_type_present_flag;
   int full_range;
@@ -91,6 +119,9 @@ typedef struct SPS {
   uint8_t scaling_matrix8[6][64];
   int nal_hrd_parameters_present_flag;
   int vcl_hrd_parameters_present_flag;
+  H264HRDParams nal_hrd;
+  H264HRDParams vcl_hrd;
+  int low_delay_hrd_flag;
   int pic_struct_present_flag;
   int time_offset_length;
   int cpb_cnt;                          ///< See H.264 E.1.2
@@ -158,18 +189,45 @@ typedef struct H264ParamSets {
 /**
  * Decode SPS
  */
-int ff_h264_decode_seq_parameter_set(GetBitContext *gb, H264ParamSets *ps,
-                                     int ignore_truncation);
+int ff_h264_decode_seq_parameter_set(GetBitContext *gb, void *logctx,
+                                     H264ParamSets *ps, int ignore_truncation);
 
 /**
  * Decode PPS
  */
-int ff_h264_decode_picture_parameter_set(GetBitContext *gb, H264ParamSets *ps,
-                                         int bit_length);
+int ff_h264_decode_picture_parameter_set(GetBitContext *gb, void *logctx,
+                                         H264ParamSets *ps, int bit_length);
+
+/**
+ * Decode SPS with overread checks, for NAL units without the padding
+ * ff_h264_decode_seq_parameter_set() needs to read them unchecked.
+ */
+int ff_h264_decode_seq_parameter_set_checked(GetBitContext *gb, void *logctx,
+                                             H264ParamSets *ps,
+                                             int ignore_truncation);
+
+/**
+ * Decode PPS with overread checks.
+ */
+int ff_h264_decode_picture_parameter_set_checked(GetBitContext *gb,
+                                                 void *logctx,
+                                                 H264ParamSets *ps,
+                                                 int bit_length);
 
 /**
  * Uninit H264 param sets structure.
  */
 void ff_h264_ps_uninit(H264ParamSets *ps);
 
+/**
+ * Free the idle parameter set buffers kept for reuse by all streams.
+ */
+void ff_h264_ps_pool_trim(void);
+
+/**
+ * Get an SPS (type H264_NAL_SPS) or PPS buffer from the pools shared by all
+ * streams.
+ */
+AVBufferRef *ff_h264_ps_pool_get(int type);
+
 #endif /* AVCODEC_H264_PS_H */
@@ -0,0 +1,336 @@
+/*
+ * H.26L/H.264/AVC/JVT/14496-10/... SEI decoding
+ * Copyright (c) 2003 Michael Niedermayer <michaelni@gmx.at>
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * H.264 / AVC / MPEG-4 part10 SEI decoding.
+ * @author Michael Niedermayer <michaelni@gmx.at>
+ */
+
+#ifdef FF_CHECKED_READER
+#define UNCHECKED_BITSTREAM_READER 0
+#define ff_h264_sei_decode ff_h264_sei_decode_checked
+#endif
+
+#include <assert.h>
+#include <string.h>
+
+#include "h264_sei.h"
+#include "defs.h"
+#include "error.h"
+#include "golomb.h"
+#include "memstats.h"
+
+static const uint8_t sei_num_clock_ts_table[9] = {1, 1, 1, 2, 2, 3, 3, 2, 3};
+
+#ifndef FF_CHECKED_READER
+void ff_h264_sei_reset(H264SEI *h) {
+  h->recovery_point.recovery_frame_cnt = -1;
+
+  h->picture_timing.dpb_output_delay = 0;
+  h->picture_timing.cpb_removal_delay = -1;
+
+  h->picture_timing.present = 0;
+  h->picture_timing.payload_size = 0;
+  h->buffering_period.present = 0;
+
+  ff_h2645_sei_a53_caption_reset(&h->a53_caption);
+  ff_h2645_sei_unregistered_reset(&h->unregistered);
+  ff_h2645_sei_dynamic_hdr_plus_reset(&h->dynamic_hdr_plus);
+}
+
+void ff_h264_sei_uninit(H264SEI *h) {
+  ff_h264_sei_reset(h);
+  h->mastering_display.present = 0;
+  h->content_light.present = 0;
+}
+#endif
+
+/* The SPS of a picture timing SEI, NULL if not known before the slices */
+static const SPS *pic_timing_sps(const H264SEI *h, const H264ParamSets *ps) {
+  if (ps->sps)
+    return ps->sps;
+  if (h->buffering_period.present &&
+      ps->sps_list[h->buffering_period.seq_parameter_set_id])
+    return (const SPS *)ps->sps_list[h->buffering_period.seq_parameter_set_id]
+        ->data;
+  return NULL;
+}
+
+static int parse_picture_timing(H264SEIPictureTiming *h, GetBitContext *gb,
+                                const SPS *sps) {
+  if (sps->nal_hrd_parameters_present_flag ||
+      sps->vcl_hrd_parameters_present_flag) {
+    h->cpb_removal_delay = get_bits_long(gb, sps->cpb_removal_delay_length);
+    h->dpb_output_delay = get_bits_long(gb, sps->dpb_output_delay_length);
+  }
+  if (sps->pic_struct_present_flag) {
+    unsigned int i, num_clock_ts;
+
+    h->pic_struct = get_bits(gb, 4);
+    h->ct_type = 0;
+
+    if (h->pic_struct > H264_SEI_PIC_STRUCT_FRAME_TRIPLING)
+      return AVERROR_INVALIDDATA;
+
+    num_clock_ts = sei_num_clock_ts_table[h->pic_struct];
+    h->timecode_cnt = 0;
+    for (i = 0; i < num_clock_ts; i++) {
+      if (get_bits(gb, 1)) { /* clock_timestamp_flag */
+        H264SEITimeCode *tc = &h->timecode[h->timecode_cnt++];
+        unsigned int full_timestamp_flag;
+        unsigned int counting_type, cnt_dropped_flag;
+        h->ct_type |= 1 << get_bits(gb, 2);
+        skip_bits(gb, 1);                 /* nuit_field_based_flag */
+        counting_type = get_bits(gb, 5);
+        full_timestamp_flag = get_bits(gb, 1);
+        skip_bits(gb, 1);                 /* discontinuity_flag */
+        cnt_dropped_flag = get_bits(gb, 1);
+        tc->dropframe =
+            cnt_dropped_flag && counting_type > 1 && counting_type < 7;
+        tc->frame = get_bits(gb, 8); /* n_frames */
+        if (full_timestamp_flag) {
+          tc->full = 1;
+          tc->seconds = get_bits(gb, 6); /* seconds_value 0..59 */
+          tc->minutes = get_bits(gb, 6); /* minutes_value 0..59 */
+          tc->hours = get_bits(gb, 5);   /* hours_value 0..23 */
+        } else {
+          tc->seconds = tc->minutes = tc->hours = tc->full = 0;
+          if (get_bits(gb, 1)) { /* seconds_flag */
+            tc->seconds = get_bits(gb, 6);
+            if (get_bits(gb, 1)) { /* minutes_flag */
+              tc->minutes = get_bits(gb, 6);
+              if (get_bits(gb, 1)) /* hours_flag */
+                tc->hours = get_bits(gb, 5);
+            }
+          }
+        }
+
+        if (sps->time_offset_length > 0)
+          skip_bits(gb, sps->time_offset_length); /* time_offset */
+      }
+    }
+  }
+  h->present = 1;
+  return 0;
+}
+
+static int decode_picture_timing(H264SEIPictureTiming *h, GetBitContext *gb,
+                                 const SPS *sps, void *logctx, int size) {
+  if (sps) {
+    h->payload_size = 0;
+    return parse_picture_timing(h, gb, sps);
+  }
+
+  // Parsed once a slice names the SPS; guessing it would silently give
+  // wrong delays with several SPS.
+  if (size > sizeof(h->payload)) {
+    av_log(logctx, AV_LOG_ERROR, "Picture timing SEI payload too large\n");
+    return AVERROR_INVALIDDATA;
+  }
+  memcpy(h->payload, gb->buffer + get_bits_count(gb) / 8, size);
+  h->payload_size = size;
+  h->present = 0;
+  skip_bits_long(gb, 8 * size);
+  return 0;
+}
+
+#ifndef FF_CHECKED_READER
+// the kept payload is read unchecked from buf
+static_assert(H264_SEI_PIC_TIMING_MAX_BITS <=
+                  8 * (AV_INPUT_BUFFER_PADDING_SIZE - 16),
+              "padding too small for the picture timing SEI");
+
+int ff_h264_sei_process_picture_timing(H264SEIPictureTiming *h,
+                                       const SPS *sps, void *logctx) {
+  uint8_t buf[sizeof(h->payload) + AV_INPUT_BUFFER_PADDING_SIZE] = {0};
+  GetBitContext gb;
+  int ret;
+
+  if (!h->payload_size)
+    return 0;
+  memcpy(buf, h->payload, h->payload_size);
+  ret = init_get_bits8(&gb, buf, h->payload_size);
+  h->payload_size = 0;
+  if (ret < 0)
+    return ret;
+  ret = parse_picture_timing(h, &gb, sps);
+  if (ret >= 0 && get_bits_left(&gb) < 0) {
+    av_log(logctx, AV_LOG_ERROR, "Picture timing SEI overread\n");
+    ret = AVERROR_INVALIDDATA;
+  }
+  if (ret < 0)
+    h->present = 0;
+  return ret;
+}
+#endif
+
+static int decode_buffering_period(H264SEIBufferingPeriod *h,
+                                   GetBitContext *gb, const H264ParamSets *ps,
+                                   void *logctx) {
+  unsigned int sps_id;
+  int sched_sel_idx;
+  const SPS *sps;
+
+  sps_id = get_ue_golomb_31(gb);
+  if (sps_id > 31 || !ps->sps_list[sps_id]) {
+    av_log(logctx, AV_LOG_ERROR,
+           "non-existing SPS %d referenced in buffering period\n", sps_id);
+    return sps_id > 31 ? AVERROR_INVALIDDATA : AVERROR_PS_NOT_FOUND;
+  }
+  sps = (const SPS *)ps->sps_list[sps_id]->data;
+
+  // NOTE: This is really so duplicated in the standard... See H.264, D.1.1
+  h->nb_cpb = sps->cpb_cnt;
+  if (sps->nal_hrd_parameters_present_flag) {
+    for (sched_sel_idx = 0; sched_sel_idx < sps->cpb_cnt; sched_sel_idx++) {
+      h->nal_initial_cpb_removal_delay[sched_sel_idx] =
+          get_bits_long(gb, sps->initial_cpb_removal_delay_length);
+      // initial_cpb_removal_delay_offset
+      h->nal_initial_cpb_removal_delay_offset[sched_sel_idx] =
+          get_bits_long(gb, sps->initial_cpb_removal_delay_length);
+    }
+  }
+  if (sps->vcl_hrd_parameters_present_flag) {
+    for (sched_sel_idx = 0; sched_sel_idx < sps->cpb_cnt; sched_sel_idx++) {
+      h->vcl_initial_cpb_removal_delay[sched_sel_idx] =
+          get_bits_long(gb, sps->initial_cpb_removal_delay_length);
+      // initial_cpb_removal_delay_offset
+      h->vcl_initial_cpb_removal_delay_offset[sched_sel_idx] =
+          get_bits_long(gb, sps->initial_cpb_removal_delay_length);
+    }
+  }
+
+  h->seq_parameter_set_id = sps_id;
+  h->present = 1;
+  return 0;
+}
+
+static int decode_recovery_point(H264SEIRecoveryPoint *h, GetBitContext *gb,
+                                 void *logctx) {
+  unsigned recovery_frame_cnt = get_ue_golomb_long(gb);
+
+  if (recovery_frame_cnt >= (1 << MAX_LOG2_MAX_FRAME_NUM)) {
+    av_log(logctx, AV_LOG_ERROR, "recovery_frame_cnt %u is out of range\n",
+           recovery_frame_cnt);
+    return AVERROR_INVALIDDATA;
+  }
+
+  h->recovery_frame_cnt = recovery_frame_cnt;
+  h->exact_match_flag = get_bits1(gb);
+  h->broken_link_flag = get_bits1(gb);
+  skip_bits(gb, 2); // changing_slice_group_idc
+
+  return 0;
+}
+
+static int decode_registered_user_data(H264SEI *h, GetBitContext *gb,
+                                       void *logctx, int size) {
+  int ret = ff_h2645_sei_t35_header(gb, logctx, &size);
+
+  switch (ret) {
+  case H2645_SEI_T35_HDR10_PLUS:
+    return ff_h2645_sei_dynamic_hdr_plus(&h->dynamic_hdr_plus, gb, size);
+  case H2645_SEI_T35_A53_CC:
+    if (h->cc_ring)
+      return ff_h2645_sei_a53_caption_ring(h->cc_ring, h->cc_pts, gb, size);
+    return ff_h2645_sei_a53_caption(&h->a53_caption, gb, size);
+  case H2645_SEI_T35_UNKNOWN:
+    skip_bits_long(gb, size * 8);
+    return 0;
+  default:
+    return ret;
+  }
+}
+
+static int decode_sei(H264SEI *h, GetBitContext *gb, const H264ParamSets *ps,
+                      void *logctx) {
+  int master_ret = 0;
+
+  while (get_bits_left(gb) > 16 && show_bits(gb, 16)) {
+    int type, size, start, ret;
+
+    ret = ff_h2645_sei_message_header(gb, &type, &size);
+    if (ret < 0) {
+      av_log(logctx, AV_LOG_ERROR, "SEI truncated\n");
+      return ret;
+    }
+    start = get_bits_count(gb);
+
+    switch (type) {
+    case SEI_TYPE_PIC_TIMING: // Picture timing SEI
+      ret = decode_picture_timing(&h->picture_timing, gb,
+                                  pic_timing_sps(h, ps), logctx, size);
+      break;
+    case SEI_TYPE_USER_DATA_REGISTERED_ITU_T_T35:
+      ret = decode_registered_user_data(h, gb, logctx, size);
+      break;
+    case SEI_TYPE_USER_DATA_UNREGISTERED:
+      ret = ff_h2645_sei_unregistered(&h->unregistered, gb, size);
+      break;
+    case SEI_TYPE_RECOVERY_POINT:
+      ret = decode_recovery_point(&h->recovery_point, gb, logctx);
+      break;
+    case SEI_TYPE_BUFFERING_PERIOD:
+      ret = decode_buffering_period(&h->buffering_period, gb, ps, logctx);
+      break;
+    case SEI_TYPE_MASTERING_DISPLAY_COLOUR_VOLUME:
+      ret = ff_h2645_sei_mastering_display(&h->mastering_display, gb, size);
+      break;
+    case SEI_TYPE_CONTENT_LIGHT_LEVEL_INFO:
+      ret = ff_h2645_sei_content_light(&h->content_light, gb, size);
+      break;
+    default:
+      av_log(logctx, AV_LOG_DEBUG, "unknown SEI type %d\n", type);
+    }
+    if (ret < 0 && ret != AVERROR_PS_NOT_FOUND)
+      return ret;
+    if (ret < 0)
+      master_ret = ret;
+
+    if (get_bits_count(gb) - start > 8 * size) {
+      av_log(logctx, AV_LOG_ERROR, "SEI type %d overread by %d bits\n", type,
+             get_bits_count(gb) - start - 8 * size);
+      return AVERROR_INVALIDDATA;
+    }
+    skip_bits_long(gb, start + 8 * size - get_bits_count(gb));
+
+    // FIXME check bits here
+    align_get_bits(gb);
+  }
+
+  return master_ret;
+}
+
+int ff_h264_sei_decode(H264SEI *h, GetBitContext *gb, const H264ParamSets *ps,
+                       void *logctx) {
+  enum FFMemTag tag;
+  int ret;
+
+#ifndef FF_CHECKED_READER
+  if (!get_bits_trusted(gb, H264_SEI_MAX_OVERREAD_BITS))
+    return ff_h264_sei_decode_checked(h, gb, ps, logctx);
+#endif
+  tag = ff_mem_set_tag(FF_MEM_TAG_SEI);
+  ret = decode_sei(h, gb, ps, logctx);
+  ff_mem_set_tag(tag);
+  return ret;
+}
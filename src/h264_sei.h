@@ -0,0 +1,173 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVCODEC_H264_SEI_H
+#define AVCODEC_H264_SEI_H
+
+#include "get_bits.h"
+#include "h2645_sei.h"
+#include "h264_ps.h"
+#include "sei.h"
+
+#define AVERROR_PS_NOT_FOUND FFERRTAG(0xF8, '?', 'P', 'S')
+
+/* Most bits a message parser reads, past the end of a hostile NAL unit if it
+ * is short; see get_bits_trusted(). The buffering period reads the most. */
+#define H264_SEI_PIC_TIMING_MAX_BITS                                           \
+  (32 + 32 + 4 + 3 * (1 + 2 + 1 + 5 + 1 + 1 + 1 + 8 + 20 + 31))
+#define H264_SEI_MAX_OVERREAD_BITS (9 + 2 * H264_MAX_CPB_CNT * 2 * 32)
+
+/**
+ * pic_struct in picture timing SEI message
+ */
+typedef enum {
+  H264_SEI_PIC_STRUCT_FRAME = 0,        ///<  0: %frame
+  H264_SEI_PIC_STRUCT_TOP_FIELD = 1,    ///<  1: top field
+  H264_SEI_PIC_STRUCT_BOTTOM_FIELD = 2, ///<  2: bottom field
+  H264_SEI_PIC_STRUCT_TOP_BOTTOM = 3,   ///<  3: top field, bottom field, in that order
+  H264_SEI_PIC_STRUCT_BOTTOM_TOP = 4,   ///<  4: bottom field, top field, in that order
+  H264_SEI_PIC_STRUCT_TOP_BOTTOM_TOP = 5, ///<  5: top field, bottom field, top field repeated, in that order
+  H264_SEI_PIC_STRUCT_BOTTOM_TOP_BOTTOM = 6, ///<  6: bottom field, top field, bottom field repeated, in that order
+  H264_SEI_PIC_STRUCT_FRAME_DOUBLING = 7, ///<  7: %frame doubling
+  H264_SEI_PIC_STRUCT_FRAME_TRIPLING = 8  ///<  8: %frame tripling
+} H264_SEI_PicStructType;
+
+typedef struct H264SEITimeCode {
+  /* When not continuously receiving full timecodes, we have to reference
+     the previous timecode received */
+  int full;
+  int frame;
+  int seconds;
+  int minutes;
+  int hours;
+  int dropframe;
+} H264SEITimeCode;
+
+typedef struct H264SEIPictureTiming {
+  int present;
+  H264_SEI_PicStructType pic_struct;
+
+  /**
+   * Bit set of clock types for fields/frames in picture timing SEI message.
+   * For each found ct_type, appropriate bit is set (e.g., bit 1 for
+   * interlaced).
+   */
+  int ct_type;
+
+  /**
+   * dpb_output_delay in picture timing SEI message, see H.264 C.2.2
+   */
+  int dpb_output_delay;
+
+  /**
+   * cpb_removal_delay in picture timing SEI message, see H.264 C.1.2
+   */
+  int cpb_removal_delay;
+
+  /**
+   * Maximum three timecodes in a pic_timing SEI.
+   */
+  H264SEITimeCode timecode[3];
+
+  /**
+   * Number of timecode in use
+   */
+  int timecode_cnt;
+
+  /**
+   * Payload of a picture timing SEI read before its SPS was known, 0 bytes
+   * if none. Parsed by ff_h264_sei_process_picture_timing().
+   */
+  uint8_t payload[40];
+  int payload_size;
+} H264SEIPictureTiming;
+
+typedef struct H264SEIBufferingPeriod {
+  int present; ///< Buffering period SEI flag
+  int seq_parameter_set_id;
+  int nb_cpb;
+  uint32_t nal_initial_cpb_removal_delay[H264_MAX_CPB_CNT];
+  uint32_t nal_initial_cpb_removal_delay_offset[H264_MAX_CPB_CNT];
+  uint32_t vcl_initial_cpb_removal_delay[H264_MAX_CPB_CNT];
+  uint32_t vcl_initial_cpb_removal_delay_offset[H264_MAX_CPB_CNT];
+} H264SEIBufferingPeriod;
+
+typedef struct H264SEIRecoveryPoint {
+  /**
+   * recovery_frame_cnt
+   *
+   * Set to -1 if no recovery point SEI message found or to number of frames
+   * before playback synchronizes. Frames having recovery point are key
+   * frames.
+   */
+  int recovery_frame_cnt;
+  int exact_match_flag;
+  int broken_link_flag;
+} H264SEIRecoveryPoint;
+
+typedef struct H264SEI {
+  H264SEIPictureTiming picture_timing;
+  H264SEIBufferingPeriod buffering_period;
+  H264SEIRecoveryPoint recovery_point;
+  H2645SEIA53Caption a53_caption;
+  H2645SEIUnregistered unregistered;
+  H2645SEIMasteringDisplay mastering_display;
+  H2645SEIContentLight content_light;
+  H2645SEIDynamicHDRPlus dynamic_hdr_plus;
+
+  A53CCRing *cc_ring; ///< if set, captions go here instead of a53_caption
+  int64_t cc_pts;     ///< AU index or PTS tagged on the captions
+} H264SEI;
+
+/**
+ * Decode an SEI NAL unit.
+ *
+ * @param ps parameter sets; picture timing is parsed with the active SPS,
+ *           or the SPS named by a buffering period of the same access unit.
+ *           Otherwise its payload is kept in picture_timing.payload until
+ *           a slice names the SPS.
+ */
+int ff_h264_sei_decode(H264SEI *h, GetBitContext *gb,
+                       const H264ParamSets *ps, void *logctx);
+
+/**
+ * ff_h264_sei_decode() with overread checks, for NAL units without the
+ * padding it needs to read them unchecked.
+ */
+int ff_h264_sei_decode_checked(H264SEI *h, GetBitContext *gb,
+                               const H264ParamSets *ps, void *logctx);
+
+/**
+ * Parse the picture timing payload kept by ff_h264_sei_decode(), with the
+ * SPS of the slices of the access unit. Does nothing if none is kept.
+ */
+int ff_h264_sei_process_picture_timing(H264SEIPictureTiming *h,
+                                       const SPS *sps, void *logctx);
+
+/**
+ * Reset SEI values at the beginning of the frame, and before the first one.
+ * Mastering display and content light level persist until replaced.
+ */
+void ff_h264_sei_reset(H264SEI *h);
+
+/**
+ * Release the buffers held by the SEI state and forget every message.
+ */
+void ff_h264_sei_uninit(H264SEI *h);
+
+#endif /* AVCODEC_H264_SEI_H */
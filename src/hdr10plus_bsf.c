@@ -0,0 +1,304 @@
+/*
+ * HDR10+ SEI insertion / replacement for H.264 and HEVC
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "dynamic_hdr10_plus.h"
+#include "error.h"
+#include "h2645_parse.h"
+#include "h264.h"
+#include "hdr10plus_bsf.h"
+#include "hevc.h"
+#include "intreadwrite.h"
+#include "mem.h"
+#include "sei.h"
+
+/* usa_country_code, smpte_provider_code, provider_oriented_code,
+ * application_identifier */
+static const uint8_t hdr10plus_t35_header[6] = {0xB5, 0x00, 0x3C,
+                                                0x00, 0x01, 0x04};
+
+int ff_hdr10plus_bsf_init(HDR10PlusBSFContext *s, enum AVCodecID codec_id) {
+  if (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC)
+    return AVERROR(EINVAL);
+
+  memset(s, 0, sizeof(*s));
+  s->codec_id = codec_id;
+  return 0;
+}
+
+static int nal_header_size(const HDR10PlusBSFContext *s) {
+  return s->codec_id == AV_CODEC_ID_HEVC ? 2 : 1;
+}
+
+static int set_metadata(HDR10PlusBSFContext *s, const AVDynamicHDRPlus *meta) {
+  uint8_t *rbsp;
+  int payload_size, size, pos = 0, ret;
+
+  s->sei_size = 0;
+  if (!meta)
+    return 0;
+
+  ret = ff_dynamic_hdr10_plus_size(meta);
+  if (ret < 0)
+    return ret;
+  payload_size = sizeof(hdr10plus_t35_header) + ret;
+
+  // NAL header, payload type, payload size, payload, rbsp trailing bits
+  size = nal_header_size(s) + 1 + payload_size / 255 + 1 + payload_size + 1;
+  av_fast_malloc(&s->rbsp, &s->rbsp_alloc, size);
+  if (!s->rbsp)
+    return AVERROR(ENOMEM);
+  rbsp = s->rbsp;
+
+  if (s->codec_id == AV_CODEC_ID_HEVC) {
+    rbsp[pos++] = HEVC_NAL_SEI_PREFIX << 1;
+    rbsp[pos++] = 1; // nuh_layer_id 0, nuh_temporal_id_plus1 1
+  } else {
+    rbsp[pos++] = H264_NAL_SEI;
+  }
+  rbsp[pos++] = SEI_TYPE_USER_DATA_REGISTERED_ITU_T_T35;
+  for (ret = payload_size; ret >= 255; ret -= 255)
+    rbsp[pos++] = 0xFF;
+  rbsp[pos++] = ret;
+  memcpy(rbsp + pos, hdr10plus_t35_header, sizeof(hdr10plus_t35_header));
+  pos += sizeof(hdr10plus_t35_header);
+  ret = ff_write_dynamic_hdr10_plus_to_itu_t_t35(meta, rbsp + pos, size - pos);
+  if (ret < 0)
+    return ret;
+  pos += ret;
+  rbsp[pos++] = 0x80;
+
+  ret = ff_h2645_escaped_size(rbsp, pos);
+  if (ret < 0)
+    return ret;
+  av_fast_malloc(&s->sei, &s->sei_alloc, 4 + ret);
+  if (!s->sei)
+    return AVERROR(ENOMEM);
+  AV_WB32(s->sei, 1);
+  s->sei_size = 4 + ff_h2645_escape_rbsp(s->sei + 4, rbsp, pos);
+
+  return 0;
+}
+
+int ff_hdr10plus_bsf_set_metadata(HDR10PlusBSFContext *s,
+                                  const AVDynamicHDRPlus *meta) {
+  s->error = set_metadata(s, meta);
+  return s->error;
+}
+
+static int add_segment(HDR10PlusBSFContext *s, const uint8_t *data, int size,
+                       int offset) {
+  if (s->nb_segs >= s->segs_alloc / sizeof(*s->segs)) {
+    HDR10PlusBSFSegment *segs;
+    int *seg_offset;
+
+    segs = av_fast_realloc(s->segs, &s->segs_alloc,
+                           (s->nb_segs + 1) * 2 * sizeof(*s->segs));
+    if (!segs)
+      return AVERROR(ENOMEM);
+    s->segs = segs;
+    seg_offset = av_fast_realloc(s->seg_offset, &s->seg_offset_alloc,
+                                 (s->nb_segs + 1) * 2 * sizeof(*s->seg_offset));
+    if (!seg_offset)
+      return AVERROR(ENOMEM);
+    s->seg_offset = seg_offset;
+  }
+  s->segs[s->nb_segs].data = data;
+  s->segs[s->nb_segs].size = size;
+  s->seg_offset[s->nb_segs] = offset;
+  s->nb_segs++;
+  return 0;
+}
+
+static int is_vcl(const HDR10PlusBSFContext *s, int type) {
+  if (s->codec_id == AV_CODEC_ID_HEVC)
+    return type < 32;
+  return type >= H264_NAL_SLICE && type <= H264_NAL_IDR_SLICE;
+}
+
+static int is_sei(const HDR10PlusBSFContext *s, const uint8_t *nal, int size) {
+  if (s->codec_id == AV_CODEC_ID_HEVC)
+    return size >= 2 && ((nal[0] >> 1) & 0x3F) == HEVC_NAL_SEI_PREFIX &&
+           !(((nal[0] & 1) << 5) | (nal[1] >> 3)); // base layer only
+  return size >= 1 && (nal[0] & 0x1F) == H264_NAL_SEI;
+}
+
+/**
+ * Remove the HDR10+ messages of an SEI NAL unit.
+ *
+ * @param seg the NAL unit segment, including its start code
+ * @param nal the NAL unit, after the start code
+ */
+static int filter_sei(HDR10PlusBSFContext *s, const uint8_t *seg, int seg_size,
+                      const uint8_t *nal, int size) {
+  const int hdr = nal_header_size(s);
+  uint8_t *rbsp;
+  int i, len = 0, zeros = 0, pos, out, found = 0;
+
+  av_fast_malloc(&s->rbsp, &s->rbsp_alloc, size);
+  if (!s->rbsp)
+    return AVERROR(ENOMEM);
+  rbsp = s->rbsp;
+
+  for (i = 0; i < size; i++) {
+    if (zeros == 2 && nal[i] == 3) {
+      zeros = 0;
+      continue;
+    }
+    rbsp[len++] = nal[i];
+    zeros = nal[i] ? 0 : zeros + 1;
+  }
+  while (len > hdr && !rbsp[len - 1]) // trailing_zero_8bits
+    len--;
+
+  // Compact the messages to keep in place, after the NAL header.
+  pos = out = hdr;
+  while (pos < len && !(pos == len - 1 && rbsp[pos] == 0x80)) {
+    int start = pos, type = 0, payload_size = 0;
+
+    do
+      type += rbsp[pos];
+    while (rbsp[pos++] == 0xFF && pos < len);
+    while (pos < len) {
+      payload_size += rbsp[pos];
+      if (rbsp[pos++] != 0xFF)
+        break;
+    }
+    if (payload_size > len - pos) {
+      // Unparsable, leave the NAL unit alone.
+      return add_segment(s, seg, seg_size, -1);
+    }
+    pos += payload_size;
+
+    if (type == SEI_TYPE_USER_DATA_REGISTERED_ITU_T_T35 &&
+        payload_size >= (int)sizeof(hdr10plus_t35_header) &&
+        !memcmp(rbsp + pos - payload_size, hdr10plus_t35_header,
+                sizeof(hdr10plus_t35_header))) {
+      found = 1;
+      continue;
+    }
+    memmove(rbsp + out, rbsp + start, pos - start);
+    out += pos - start;
+  }
+
+  if (!found)
+    return add_segment(s, seg, seg_size, -1);
+  if (out == hdr)
+    return 0;
+
+  rbsp[out++] = 0x80;
+  if ((i = ff_h2645_escaped_size(rbsp, out)) < 0)
+    return i;
+  {
+    uint8_t *rewrite = av_fast_realloc(s->rewrite, &s->rewrite_alloc,
+                                       s->rewrite_size + 4 + i);
+    if (!rewrite)
+      return AVERROR(ENOMEM);
+    s->rewrite = rewrite;
+  }
+  AV_WB32(s->rewrite + s->rewrite_size, 1);
+  i = 4 + ff_h2645_escape_rbsp(s->rewrite + s->rewrite_size + 4, rbsp, out);
+  s->rewrite_size += i;
+  return add_segment(s, NULL, i, s->rewrite_size - i);
+}
+
+int ff_hdr10plus_bsf_filter(HDR10PlusBSFContext *s, const uint8_t *buf,
+                            int size) {
+  const uint8_t *end = buf + size;
+  const uint8_t *sc = ff_h2645_find_start_code(buf, end);
+  const uint8_t *seg = sc > buf && sc < end && !sc[-1] ? sc - 1 : sc;
+  int i, ret, inserted = !s->sei_size, total = 0;
+
+  // Passing the access unit through would silently strip its HDR10+.
+  if (s->error < 0)
+    return s->error;
+  s->nb_segs = 0;
+  s->rewrite_size = 0;
+
+  // Bytes before the first start code are passed through.
+  if (seg > buf) {
+    if ((ret = add_segment(s, buf, seg - buf, -1)) < 0)
+      return ret;
+  }
+
+  while (sc < end) {
+    const uint8_t *nal = sc + 3;
+    const uint8_t *next = ff_h2645_find_start_code(nal, end);
+    const uint8_t *nal_end = next;
+    const uint8_t *seg_end = next;
+
+    if (seg_end < end && seg_end > nal && !seg_end[-1])
+      seg_end--; // zero_byte of a 4 byte start code
+    while (nal_end > nal && !nal_end[-1])
+      nal_end--;
+
+    if (nal_end > nal) {
+      int type = s->codec_id == AV_CODEC_ID_HEVC ? (nal[0] >> 1) & 0x3F
+                                                 : nal[0] & 0x1F;
+
+      if (!inserted && is_vcl(s, type)) {
+        if ((ret = add_segment(s, s->sei, s->sei_size, -1)) < 0)
+          return ret;
+        inserted = 1;
+      }
+      if (is_sei(s, nal, nal_end - nal))
+        ret = filter_sei(s, seg, seg_end - seg, nal, nal_end - nal);
+      else
+        ret = add_segment(s, seg, seg_end - seg, -1);
+      if (ret < 0)
+        return ret;
+    }
+
+    seg = seg_end;
+    sc = next;
+  }
+
+  for (i = 0; i < s->nb_segs; i++) {
+    if (s->seg_offset[i] >= 0)
+      s->segs[i].data = s->rewrite + s->seg_offset[i];
+    total += s->segs[i].size;
+  }
+  return total;
+}
+
+int ff_hdr10plus_bsf_write(const HDR10PlusBSFContext *s, uint8_t *dst,
+                           int size) {
+  int i, pos = 0;
+
+  for (i = 0; i < s->nb_segs; i++) {
+    if (s->segs[i].size > size - pos)
+      return AVERROR(ENOSPC);
+    memcpy(dst + pos, s->segs[i].data, s->segs[i].size);
+    pos += s->segs[i].size;
+  }
+  return pos;
+}
+
+void ff_hdr10plus_bsf_uninit(HDR10PlusBSFContext *s) {
+  av_freep(&s->sei);
+  av_freep(&s->rbsp);
+  av_freep(&s->rewrite);
+  av_freep(&s->segs);
+  av_freep(&s->seg_offset);
+  s->sei_alloc = s->rbsp_alloc = s->rewrite_alloc = 0;
+  s->segs_alloc = s->seg_offset_alloc = 0;
+  s->sei_size = s->nb_segs = s->error = 0;
+}
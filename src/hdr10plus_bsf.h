@@ -0,0 +1,99 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Insert, replace or strip the HDR10+ (SMPTE ST 2094-40) T.35 SEI of
+ * H.264 / HEVC Annex B access units.
+ *
+ * Only the NAL unit list of the access unit is rewritten: the output is a
+ * list of segments pointing into the input packet, plus the new SEI NAL
+ * unit and any SEI NAL unit that had to be rebuilt. Slice data is neither
+ * copied nor re-escaped.
+ */
+
+#ifndef AVCODEC_HDR10PLUS_BSF_H
+#define AVCODEC_HDR10PLUS_BSF_H
+
+#include <stdint.h>
+
+#include "codec_id.h"
+#include "hdr_dynamic_metadata.h"
+
+typedef struct HDR10PlusBSFSegment {
+  const uint8_t *data;
+  int size;
+} HDR10PlusBSFSegment;
+
+typedef struct HDR10PlusBSFContext {
+  enum AVCodecID codec_id;
+
+  uint8_t *sei; ///< new SEI NAL unit with start code, NULL to only strip
+  int sei_size;
+  unsigned int sei_alloc;
+  int error; ///< of the last ff_hdr10plus_bsf_set_metadata() call
+
+  uint8_t *rbsp; ///< unescaped input SEI NAL unit
+  unsigned int rbsp_alloc;
+  uint8_t *rewrite; ///< SEI NAL units rebuilt without their HDR10+ message
+  int rewrite_size;
+  unsigned int rewrite_alloc;
+
+  HDR10PlusBSFSegment *segs; ///< output of the last filtered access unit
+  int *seg_offset; ///< offset in rewrite for rebuilt segments, -1 otherwise
+  int nb_segs;
+  unsigned int segs_alloc;
+  unsigned int seg_offset_alloc;
+} HDR10PlusBSFContext;
+
+int ff_hdr10plus_bsf_init(HDR10PlusBSFContext *s, enum AVCodecID codec_id);
+
+/**
+ * Set the metadata inserted in the following access units.
+ *
+ * @param meta the metadata, NULL to strip HDR10+ SEI without inserting any
+ * @return 0 on success, a negative AVERROR code on error, AVERROR(EINVAL)
+ *         if a value does not fit its syntax element; the filter then
+ *         fails with the same code until metadata is set successfully
+ */
+int ff_hdr10plus_bsf_set_metadata(HDR10PlusBSFContext *s,
+                                  const AVDynamicHDRPlus *meta);
+
+/**
+ * Filter one Annex B access unit. HDR10+ messages are removed from the
+ * existing SEI NAL units and the current metadata is inserted before the
+ * first VCL NAL unit. On success s->segs holds the output access unit;
+ * it refers to buf and stays valid until the next call.
+ *
+ * @return the size of the output access unit, a negative AVERROR code on
+ *         error, including that of a failed ff_hdr10plus_bsf_set_metadata()
+ */
+int ff_hdr10plus_bsf_filter(HDR10PlusBSFContext *s, const uint8_t *buf,
+                            int size);
+
+/**
+ * Gather the segments of the last filtered access unit into dst.
+ *
+ * @return the number of bytes written, AVERROR(ENOSPC) if dst is too small
+ */
+int ff_hdr10plus_bsf_write(const HDR10PlusBSFContext *s, uint8_t *dst,
+                           int size);
+
+void ff_hdr10plus_bsf_uninit(HDR10PlusBSFContext *s);
+
+#endif /* AVCODEC_HDR10PLUS_BSF_H */
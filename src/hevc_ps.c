@@ -24,11 +24,23 @@
  */
 
 // #include "libavutil/imgutils.h"
+#ifdef FF_CHECKED_READER
+#define UNCHECKED_BITSTREAM_READER 0
+#define ff_hevc_decode_short_term_rps ff_hevc_decode_short_term_rps_checked
+#define ff_hevc_decode_nal_vps ff_hevc_decode_nal_vps_checked
+#define ff_hevc_parse_sps ff_hevc_parse_sps_checked
+#define ff_hevc_decode_nal_pps ff_hevc_decode_nal_pps_checked
+#endif
+
 #include "hevc_ps.h"
+#include "buffer_internal.h"
 #include "golomb.h"
+#include "h2645_parse.h"
 #include "hevc_data.h"
 #include "mem.h"
+#include "memstats.h"
 #include "pixdesc.h"
+#include "thread.h"
 //----codec.h---------------------
 
 #define FF_PROFILE_UNKNOWN -99
@@ -174,10 +186,32 @@ static const uint8_t hevc_sub_width_c[] = {1, 2, 2, 1};
 
 static const uint8_t hevc_sub_height_c[] = {1, 2, 1, 1};
 
+/* free the tables of a PPS */
+static void pps_release(HEVCPPS *pps) {
+  av_freep(&pps->column_width);
+  av_freep(&pps->row_height);
+  av_freep(&pps->col_bd);
+  av_freep(&pps->row_bd);
+  av_freep(&pps->col_idxX);
+  av_freep(&pps->ctb_addr_rs_to_ts);
+  av_freep(&pps->ctb_addr_ts_to_rs);
+  av_freep(&pps->tile_pos_rs);
+  av_freep(&pps->tile_id);
+  av_freep(&pps->min_tb_addr_zs_tab);
+}
+
+/* Drop a PPS reference. The last one also frees the tables of the PPS, so
+ * that an object back in its pool holds no more memory than its own. */
+static void pps_unref(AVBufferRef **ref) {
+  if (*ref && av_buffer_get_ref_count(*ref) == 1)
+    pps_release((HEVCPPS *)(*ref)->data);
+  av_buffer_unref(ref);
+}
+
 static void remove_pps(HEVCParamSets *s, int id) {
   if (s->pps_list[id] && s->pps == (const HEVCPPS *)s->pps_list[id]->data)
     s->pps = NULL;
-  av_buffer_unref(&s->pps_list[id]);
+  pps_unref(&s->pps_list[id]);
 }
 
 static void remove_sps(HEVCParamSets *s, int id) {
@@ -210,8 +244,9 @@ static void remove_vps(HEVCParamSets *s, int id) {
   av_buffer_unref(&s->vps_list[id]);
 }
 
-int ff_hevc_decode_short_term_rps(GetBitContext *gb, ShortTermRPS *rps,
-                                  const HEVCSPS *sps, int is_slice_header) {
+int ff_hevc_decode_short_term_rps(GetBitContext *gb, void *logctx,
+                                  ShortTermRPS *rps, const HEVCSPS *sps,
+                                  int is_slice_header) {
   uint8_t rps_predict = 0;
   int delta_poc;
   int k0 = 0;
@@ -219,6 +254,11 @@ int ff_hevc_decode_short_term_rps(GetBitContext *gb, ShortTermRPS *rps,
   int k = 0;
   int i;
 
+#ifndef FF_CHECKED_READER
+  if (!get_bits_trusted(gb, HEVC_ST_RPS_MAX_BITS))
+    return ff_hevc_decode_short_term_rps_checked(gb, logctx, rps, sps,
+                                                 is_slice_header);
+#endif
   if (rps != sps->st_rps && sps->nb_st_rps)
     rps_predict = get_bits1(gb);
 
@@ -232,7 +272,8 @@ int ff_hevc_decode_short_term_rps(GetBitContext *gb, ShortTermRPS *rps,
     if (is_slice_header) {
       unsigned int delta_idx = get_ue_golomb_long(gb) + 1;
       if (delta_idx > sps->nb_st_rps) {
-        printf("Invalid value of delta_idx in slice header RPS: %d > %d.\n",
+        av_log(logctx, AV_LOG_ERROR,
+               "Invalid value of delta_idx in slice header RPS: %d > %d.\n",
                delta_idx, sps->nb_st_rps);
         return AVERROR_INVALIDDATA;
       }
@@ -244,7 +285,8 @@ int ff_hevc_decode_short_term_rps(GetBitContext *gb, ShortTermRPS *rps,
     delta_rps_sign = get_bits1(gb);
     abs_delta_rps = get_ue_golomb_long(gb) + 1;
     if (abs_delta_rps < 1 || abs_delta_rps > 32768) {
-      printf("Invalid value of abs_delta_rps: %d\n", abs_delta_rps);
+      av_log(logctx, AV_LOG_ERROR, "Invalid value of abs_delta_rps: %d\n",
+             abs_delta_rps);
       return AVERROR_INVALIDDATA;
     }
     delta_rps = (1 - (delta_rps_sign << 1)) * abs_delta_rps;
@@ -269,7 +311,7 @@ int ff_hevc_decode_short_term_rps(GetBitContext *gb, ShortTermRPS *rps,
     }
 
     if (k >= FF_ARRAY_ELEMS(rps->used)) {
-      printf("Invalid num_delta_pocs: %d\n", k);
+      av_log(logctx, AV_LOG_ERROR, "Invalid num_delta_pocs: %d\n", k);
       return AVERROR_INVALIDDATA;
     }
 
@@ -307,46 +349,59 @@ int ff_hevc_decode_short_term_rps(GetBitContext *gb, ShortTermRPS *rps,
       }
     }
   } else {
-    unsigned int prev, nb_positive_pics;
-    rps->num_negative_pics = get_ue_golomb_long(gb);
-    nb_positive_pics = get_ue_golomb_long(gb);
+    unsigned int prev, nb_positive_pics, num_pics[2];
+    GolombWindow w;
+
+    // num_negative_pics, num_positive_pics
+    if (get_ue_golomb_n(gb, num_pics, 2) < 0)
+      return AVERROR_INVALIDDATA;
+    rps->num_negative_pics = num_pics[0];
+    nb_positive_pics = num_pics[1];
 
     if (rps->num_negative_pics >= HEVC_MAX_REFS ||
         nb_positive_pics >= HEVC_MAX_REFS) {
-      printf("Too many refs in a short term RPS.\n");
+      av_log(logctx, AV_LOG_ERROR, "Too many refs in a short term RPS.\n");
       return AVERROR_INVALIDDATA;
     }
 
     rps->num_delta_pocs = rps->num_negative_pics + nb_positive_pics;
     if (rps->num_delta_pocs) {
+      // delta_poc_sx_minus1 / used_by_curr_pic_sx_flag pairs
+      golomb_window_open(gb, &w);
       prev = 0;
       for (i = 0; i < rps->num_negative_pics; i++) {
-        delta_poc = get_ue_golomb_long(gb) + 1;
+        delta_poc = golomb_window_ue(gb, &w) + 1;
         if (delta_poc < 1 || delta_poc > 32768) {
-          printf("Invalid value of delta_poc: %d\n", delta_poc);
+          av_log(logctx, AV_LOG_ERROR, "Invalid value of delta_poc: %d\n",
+                 delta_poc);
+          golomb_window_close(gb, &w);
           return AVERROR_INVALIDDATA;
         }
         prev -= delta_poc;
         rps->delta_poc[i] = prev;
-        rps->used[i] = get_bits1(gb);
+        rps->used[i] = golomb_window_bit(gb, &w);
       }
       prev = 0;
       for (i = 0; i < nb_positive_pics; i++) {
-        delta_poc = get_ue_golomb_long(gb) + 1;
+        delta_poc = golomb_window_ue(gb, &w) + 1;
         if (delta_poc < 1 || delta_poc > 32768) {
-          printf("Invalid value of delta_poc: %d\n", delta_poc);
+          av_log(logctx, AV_LOG_ERROR, "Invalid value of delta_poc: %d\n",
+                 delta_poc);
+          golomb_window_close(gb, &w);
           return AVERROR_INVALIDDATA;
         }
         prev += delta_poc;
         rps->delta_poc[rps->num_negative_pics + i] = prev;
-        rps->used[rps->num_negative_pics + i] = get_bits1(gb);
+        rps->used[rps->num_negative_pics + i] = golomb_window_bit(gb, &w);
       }
+      golomb_window_close(gb, &w);
     }
   }
   return 0;
 }
 
-static int decode_profile_tier_level(GetBitContext *gb, PTLCommon *ptl) {
+static int decode_profile_tier_level(GetBitContext *gb, void *logctx,
+                                     PTLCommon *ptl) {
   int i;
 
   if (get_bits_left(gb) < 2 + 1 + 5 + 32 + 4 + 43 + 1)
@@ -356,15 +411,16 @@ static int decode_profile_tier_level(GetBitContext *gb, PTLCommon *ptl) {
   ptl->tier_flag = get_bits1(gb);
   ptl->profile_idc = get_bits(gb, 5);
   if (ptl->profile_idc == FF_PROFILE_HEVC_MAIN)
-    printf("Main profile bitstream\n");
+    av_log(logctx, AV_LOG_DEBUG, "Main profile bitstream\n");
   else if (ptl->profile_idc == FF_PROFILE_HEVC_MAIN_10)
-    printf("Main 10 profile bitstream\n");
+    av_log(logctx, AV_LOG_DEBUG, "Main 10 profile bitstream\n");
   else if (ptl->profile_idc == FF_PROFILE_HEVC_MAIN_STILL_PICTURE)
-    printf("Main Still Picture profile bitstream\n");
+    av_log(logctx, AV_LOG_DEBUG, "Main Still Picture profile bitstream\n");
   else if (ptl->profile_idc == FF_PROFILE_HEVC_REXT)
-    printf("Range Extension profile bitstream\n");
+    av_log(logctx, AV_LOG_DEBUG, "Range Extension profile bitstream\n");
   else
-    printf("Unknown HEVC profile: %d\n", ptl->profile_idc);
+    av_log(logctx, AV_LOG_WARNING, "Unknown HEVC profile: %d\n",
+           ptl->profile_idc);
 
   for (i = 0; i < 32; i++) {
     ptl->profile_compatibility_flag[i] = get_bits1(gb);
@@ -418,11 +474,12 @@ static int decode_profile_tier_level(GetBitContext *gb, PTLCommon *ptl) {
   return 0;
 }
 
-static int parse_ptl(GetBitContext *gb, PTL *ptl, int max_num_sub_layers) {
+static int parse_ptl(GetBitContext *gb, void *logctx, PTL *ptl,
+                     int max_num_sub_layers) {
   int i;
-  if (decode_profile_tier_level(gb, &ptl->general_ptl) < 0 ||
+  if (decode_profile_tier_level(gb, logctx, &ptl->general_ptl) < 0 ||
       get_bits_left(gb) < 8 + (8 * 2 * (max_num_sub_layers - 1 > 0))) {
-    printf("PTL information too short\n");
+    av_log(logctx, AV_LOG_ERROR, "PTL information too short\n");
     return -1;
   }
 
@@ -438,13 +495,15 @@ static int parse_ptl(GetBitContext *gb, PTL *ptl, int max_num_sub_layers) {
       skip_bits(gb, 2); // reserved_zero_2bits[i]
   for (i = 0; i < max_num_sub_layers - 1; i++) {
     if (ptl->sub_layer_profile_present_flag[i] &&
-        decode_profile_tier_level(gb, &ptl->sub_layer_ptl[i]) < 0) {
-      printf("PTL information for sublayer %i too short\n", i);
+        decode_profile_tier_level(gb, logctx, &ptl->sub_layer_ptl[i]) < 0) {
+      av_log(logctx, AV_LOG_ERROR,
+             "PTL information for sublayer %i too short\n", i);
       return -1;
     }
     if (ptl->sub_layer_level_present_flag[i]) {
       if (get_bits_left(gb) < 8) {
-        printf("Not enough data for sublayer %i level_idc\n", i);
+        av_log(logctx, AV_LOG_ERROR,
+               "Not enough data for sublayer %i level_idc\n", i);
         return -1;
       } else
         ptl->sub_layer_ptl[i].level_idc = get_bits(gb, 8);
@@ -455,96 +514,141 @@ static int parse_ptl(GetBitContext *gb, PTL *ptl, int max_num_sub_layers) {
 }
 
 static void decode_sublayer_hrd(GetBitContext *gb, unsigned int nb_cpb,
+                                HEVCSubLayerHRDParams *par,
                                 int subpic_params_present) {
   int i;
 
   for (i = 0; i < nb_cpb; i++) {
-    get_ue_golomb_long(gb); // bit_rate_value_minus1
-    get_ue_golomb_long(gb); // cpb_size_value_minus1
+    par->bit_rate_value[i] = get_ue_golomb_long(gb) + 1;
+    par->cpb_size_value[i] = get_ue_golomb_long(gb) + 1;
 
     if (subpic_params_present) {
-      get_ue_golomb_long(gb); // cpb_size_du_value_minus1
-      get_ue_golomb_long(gb); // bit_rate_du_value_minus1
+      par->cpb_size_du_value[i] = get_ue_golomb_long(gb) + 1;
+      par->bit_rate_du_value[i] = get_ue_golomb_long(gb) + 1;
     }
-    skip_bits1(gb); // cbr_flag
+    par->cbr_flag[i] = get_bits1(gb);
   }
 }
 
 static int decode_hrd(GetBitContext *gb, int common_inf_present,
-                      int max_sublayers) {
-  int nal_params_present = 0, vcl_params_present = 0;
-  int subpic_params_present = 0;
+                      HEVCHRDParams *hdr, int max_sublayers) {
   int i;
 
   if (common_inf_present) {
-    nal_params_present = get_bits1(gb);
-    vcl_params_present = get_bits1(gb);
-
-    if (nal_params_present || vcl_params_present) {
-      subpic_params_present = get_bits1(gb);
-
-      if (subpic_params_present) {
-        skip_bits(gb, 8); // tick_divisor_minus2
-        skip_bits(gb, 5); // du_cpb_removal_delay_increment_length_minus1
-        skip_bits(gb, 1); // sub_pic_cpb_params_in_pic_timing_sei_flag
-        skip_bits(gb, 5); // dpb_output_delay_du_length_minus1
+    hdr->nal_hrd_parameters_present_flag = get_bits1(gb);
+    hdr->vcl_hrd_parameters_present_flag = get_bits1(gb);
+    hdr->sub_pic_hrd_params_present_flag = 0;
+
+    /* E.3.2: lengths default to 24 bits when not present */
+    hdr->initial_cpb_removal_delay_length = 24;
+    hdr->au_cpb_removal_delay_length = 24;
+    hdr->dpb_output_delay_length = 24;
+
+    if (hdr->nal_hrd_parameters_present_flag ||
+        hdr->vcl_hrd_parameters_present_flag) {
+      hdr->sub_pic_hrd_params_present_flag = get_bits1(gb);
+
+      if (hdr->sub_pic_hrd_params_present_flag) {
+        hdr->tick_divisor = get_bits(gb, 8) + 2;
+        hdr->du_cpb_removal_delay_increment_length = get_bits(gb, 5) + 1;
+        hdr->sub_pic_cpb_params_in_pic_timing_sei_flag = get_bits1(gb);
+        hdr->dpb_output_delay_du_length = get_bits(gb, 5) + 1;
       }
 
-      skip_bits(gb, 4); // bit_rate_scale
-      skip_bits(gb, 4); // cpb_size_scale
+      hdr->bit_rate_scale = get_bits(gb, 4);
+      hdr->cpb_size_scale = get_bits(gb, 4);
 
-      if (subpic_params_present)
-        skip_bits(gb, 4); // cpb_size_du_scale
+      if (hdr->sub_pic_hrd_params_present_flag)
+        hdr->cpb_size_du_scale = get_bits(gb, 4);
 
-      skip_bits(gb, 5); // initial_cpb_removal_delay_length_minus1
-      skip_bits(gb, 5); // au_cpb_removal_delay_length_minus1
-      skip_bits(gb, 5); // dpb_output_delay_length_minus1
+      hdr->initial_cpb_removal_delay_length = get_bits(gb, 5) + 1;
+      hdr->au_cpb_removal_delay_length = get_bits(gb, 5) + 1;
+      hdr->dpb_output_delay_length = get_bits(gb, 5) + 1;
     }
   }
 
   for (i = 0; i < max_sublayers; i++) {
-    int low_delay = 0;
     unsigned int nb_cpb = 1;
-    int fixed_rate = get_bits1(gb);
 
-    if (!fixed_rate)
-      fixed_rate = get_bits1(gb);
+    hdr->fixed_pic_rate_general_flag[i] = get_bits1(gb);
+    hdr->fixed_pic_rate_within_cvs_flag[i] = 1;
+    if (!hdr->fixed_pic_rate_general_flag[i])
+      hdr->fixed_pic_rate_within_cvs_flag[i] = get_bits1(gb);
 
-    if (fixed_rate)
-      get_ue_golomb_long(gb); // elemental_duration_in_tc_minus1
+    hdr->elemental_duration_in_tc[i] = 0;
+    hdr->low_delay_hrd_flag[i] = 0;
+    if (hdr->fixed_pic_rate_within_cvs_flag[i])
+      hdr->elemental_duration_in_tc[i] = get_ue_golomb_long(gb) + 1;
     else
-      low_delay = get_bits1(gb);
+      hdr->low_delay_hrd_flag[i] = get_bits1(gb);
 
-    if (!low_delay) {
+    if (!hdr->low_delay_hrd_flag[i]) {
       nb_cpb = get_ue_golomb_long(gb) + 1;
-      if (nb_cpb < 1 || nb_cpb > 32) {
-        printf("nb_cpb %d invalid\n", nb_cpb);
+      if (nb_cpb < 1 || nb_cpb > HEVC_MAX_CPB_CNT) {
+        av_log(NULL, AV_LOG_ERROR, "nb_cpb %d invalid\n", nb_cpb);
         return AVERROR_INVALIDDATA;
       }
     }
+    hdr->cpb_cnt[i] = nb_cpb;
 
-    if (nal_params_present)
-      decode_sublayer_hrd(gb, nb_cpb, subpic_params_present);
-    if (vcl_params_present)
-      decode_sublayer_hrd(gb, nb_cpb, subpic_params_present);
+    if (hdr->nal_hrd_parameters_present_flag)
+      decode_sublayer_hrd(gb, nb_cpb, &hdr->nal_params[i],
+                          hdr->sub_pic_hrd_params_present_flag);
+    if (hdr->vcl_hrd_parameters_present_flag)
+      decode_sublayer_hrd(gb, nb_cpb, &hdr->vcl_params[i],
+                          hdr->sub_pic_hrd_params_present_flag);
   }
   return 0;
 }
 
-int ff_hevc_decode_nal_vps(GetBitContext *gb, HEVCParamSets *ps) {
+#ifndef FF_CHECKED_READER
+/* Parameter sets are shared by all streams of the process. Pool buffers
+ * start zeroed, so the tables a PPS points to are always either NULL or
+ * owned by it. */
+static AVBufferPool *vps_pool, *sps_pool, *pps_pool;
+static AVOnce ps_pool_once = AV_ONCE_INIT;
+
+static void ps_pool_init(void) {
+  vps_pool = av_buffer_pool_init(sizeof(HEVCVPS), av_buffer_allocz);
+  sps_pool = av_buffer_pool_init(sizeof(HEVCSPS), av_buffer_allocz);
+  pps_pool = av_buffer_pool_init(sizeof(HEVCPPS), av_buffer_allocz);
+}
+
+AVBufferRef *ff_hevc_ps_pool_get(int type) {
+  AVBufferPool **pool = type == HEVC_NAL_VPS   ? &vps_pool
+                        : type == HEVC_NAL_SPS ? &sps_pool
+                                               : &pps_pool;
+
+  if (ff_thread_once(&ps_pool_once, ps_pool_init) || !*pool)
+    return NULL;
+  return av_buffer_pool_get(*pool);
+}
+
+void ff_hevc_ps_pool_trim(void) {
+  if (ff_thread_once(&ps_pool_once, ps_pool_init))
+    return;
+  ff_buffer_pool_trim(vps_pool);
+  ff_buffer_pool_trim(sps_pool);
+  ff_buffer_pool_trim(pps_pool);
+}
+#endif
+
+static int decode_vps(GetBitContext *gb, void *logctx, HEVCParamSets *ps) {
   int i, j;
   int vps_id = 0;
   ptrdiff_t nal_size;
   HEVCVPS *vps;
-  AVBufferRef *vps_buf = av_buffer_allocz(sizeof(*vps));
+  HEVCHRDParams hrd_params = {0};
+  AVBufferRef *vps_buf = ff_hevc_ps_pool_get(HEVC_NAL_VPS);
 
   if (!vps_buf)
     return AVERROR(ENOMEM);
   vps = (HEVCVPS *)vps_buf->data;
+  memset(vps, 0, sizeof(*vps));
 
-  printf("Decoding VPS\n");
+  av_log(logctx, AV_LOG_DEBUG, "Decoding VPS\n");
 
-  nal_size = gb->buffer_end - gb->buffer;
+  nal_size = ff_h2645_rbsp_size(gb);
   if (nal_size > sizeof(vps->data)) {
     // printf( "Truncating likely oversized VPS "
     //        "(%"PTRDIFF_SPECIFIER" > %"SIZE_SPECIFIER")\n",
@@ -558,7 +662,7 @@ int ff_hevc_decode_nal_vps(GetBitContext *gb, HEVCParamSets *ps) {
   vps_id = get_bits(gb, 4);
 
   if (get_bits(gb, 2) != 3) { // vps_reserved_three_2bits
-    printf("vps_reserved_three_2bits is not three\n");
+    av_log(logctx, AV_LOG_ERROR, "vps_reserved_three_2bits is not three\n");
     goto err;
   }
 
@@ -567,16 +671,17 @@ int ff_hevc_decode_nal_vps(GetBitContext *gb, HEVCParamSets *ps) {
   vps->vps_temporal_id_nesting_flag = get_bits1(gb);
 
   if (get_bits(gb, 16) != 0xffff) { // vps_reserved_ffff_16bits
-    printf("vps_reserved_ffff_16bits is not 0xffff\n");
+    av_log(logctx, AV_LOG_ERROR, "vps_reserved_ffff_16bits is not 0xffff\n");
     goto err;
   }
 
   if (vps->vps_max_sub_layers > HEVC_MAX_SUB_LAYERS) {
-    printf("vps_max_sub_layers out of range: %d\n", vps->vps_max_sub_layers);
+    av_log(logctx, AV_LOG_ERROR, "vps_max_sub_layers out of range: %d\n",
+           vps->vps_max_sub_layers);
     goto err;
   }
 
-  if (parse_ptl(gb, &vps->ptl, vps->vps_max_sub_layers) < 0)
+  if (parse_ptl(gb, logctx, &vps->ptl, vps->vps_max_sub_layers) < 0)
     goto err;
 
   vps->vps_sub_layer_ordering_info_present_flag = get_bits1(gb);
@@ -591,12 +696,14 @@ int ff_hevc_decode_nal_vps(GetBitContext *gb, HEVCParamSets *ps) {
 
     if (vps->vps_max_dec_pic_buffering[i] > HEVC_MAX_DPB_SIZE ||
         !vps->vps_max_dec_pic_buffering[i]) {
-      printf("vps_max_dec_pic_buffering_minus1 out of range: %d\n",
+      av_log(logctx, AV_LOG_ERROR,
+             "vps_max_dec_pic_buffering_minus1 out of range: %d\n",
              vps->vps_max_dec_pic_buffering[i] - 1);
       goto err;
     }
     if (vps->vps_num_reorder_pics[i] > vps->vps_max_dec_pic_buffering[i] - 1) {
-      printf("vps_max_num_reorder_pics out of range: %d\n",
+      av_log(logctx, AV_LOG_ERROR,
+             "vps_max_num_reorder_pics out of range: %d\n",
              vps->vps_num_reorder_pics[i]);
       //   if (avctx->err_recognition & AV_EF_EXPLODE)
       //     goto err;
@@ -608,7 +715,7 @@ int ff_hevc_decode_nal_vps(GetBitContext *gb, HEVCParamSets *ps) {
   if (vps->vps_num_layer_sets < 1 || vps->vps_num_layer_sets > 1024 ||
       (vps->vps_num_layer_sets - 1LL) * (vps->vps_max_layer_id + 1LL) >
           get_bits_left(gb)) {
-    printf("too many layer_id_included_flags\n");
+    av_log(logctx, AV_LOG_ERROR, "too many layer_id_included_flags\n");
     goto err;
   }
 
@@ -625,23 +732,29 @@ int ff_hevc_decode_nal_vps(GetBitContext *gb, HEVCParamSets *ps) {
       vps->vps_num_ticks_poc_diff_one = get_ue_golomb_long(gb) + 1;
     vps->vps_num_hrd_parameters = get_ue_golomb_long(gb);
     if (vps->vps_num_hrd_parameters > (unsigned)vps->vps_num_layer_sets) {
-      printf("vps_num_hrd_parameters %d is invalid\n",
+      av_log(logctx, AV_LOG_ERROR, "vps_num_hrd_parameters %d is invalid\n",
              vps->vps_num_hrd_parameters);
       goto err;
     }
     for (i = 0; i < vps->vps_num_hrd_parameters; i++) {
       int common_inf_present = 1;
 
+      if (get_bits_left(gb) < 0)
+        break; // overread, reported below
       get_ue_golomb_long(gb); // hrd_layer_set_idx
       if (i)
         common_inf_present = get_bits1(gb);
-      decode_hrd(gb, common_inf_present, vps->vps_max_sub_layers);
+      /* common info not present is inherited from the previous set */
+      if (decode_hrd(gb, common_inf_present, &hrd_params,
+                     vps->vps_max_sub_layers) < 0)
+        goto err;
     }
   }
   get_bits1(gb); /* vps_extension_flag */
 
   if (get_bits_left(gb) < 0) {
-    printf("Overread VPS by %d bits\n", -get_bits_left(gb));
+    av_log(logctx, AV_LOG_ERROR, "Overread VPS by %d bits\n",
+           -get_bits_left(gb));
     if (ps->vps_list[vps_id])
       goto err;
   }
@@ -661,12 +774,27 @@ err:
   return AVERROR_INVALIDDATA;
 }
 
-static void decode_vui(GetBitContext *gb, int apply_defdispwin, HEVCSPS *sps) {
+int ff_hevc_decode_nal_vps(GetBitContext *gb, void *logctx, HEVCParamSets *ps) {
+  enum FFMemTag tag;
+  int ret;
+
+#ifndef FF_CHECKED_READER
+  if (!get_bits_trusted(gb, HEVC_VPS_MAX_OVERREAD_BITS))
+    return ff_hevc_decode_nal_vps_checked(gb, logctx, ps);
+#endif
+  tag = ff_mem_set_tag(FF_MEM_TAG_HEVC_PS);
+  ret = decode_vps(gb, logctx, ps);
+  ff_mem_set_tag(tag);
+  return ret;
+}
+
+static void decode_vui(GetBitContext *gb, void *logctx, int apply_defdispwin,
+                       HEVCSPS *sps) {
   VUI backup_vui, *vui = &sps->vui;
   GetBitContext backup;
   int sar_present, alt = 0;
 
-  printf("Decoding VUI\n");
+  av_log(logctx, AV_LOG_DEBUG, "Decoding VUI\n");
 
   sar_present = get_bits1(gb);
   if (sar_present) {
@@ -677,7 +805,7 @@ static void decode_vui(GetBitContext *gb, int apply_defdispwin, HEVCSPS *sps) {
       vui->sar.num = get_bits(gb, 16);
       vui->sar.den = get_bits(gb, 16);
     } else
-      printf("Unknown SAR index: %u.\n", sar_idx);
+      av_log(logctx, AV_LOG_WARNING, "Unknown SAR index: %u.\n", sar_idx);
   }
 
   vui->overscan_info_present_flag = get_bits1(gb);
@@ -734,7 +862,7 @@ static void decode_vui(GetBitContext *gb, int apply_defdispwin, HEVCSPS *sps) {
   memcpy(&backup_vui, vui, sizeof(backup_vui));
   if (get_bits_left(gb) >= 68 && show_bits_long(gb, 21) == 0x100000) {
     vui->default_display_window_flag = 0;
-    printf("Invalid default display window\n");
+    av_log(logctx, AV_LOG_WARNING, "Invalid default display window\n");
   } else
     vui->default_display_window_flag = get_bits1(gb);
 
@@ -747,10 +875,11 @@ static void decode_vui(GetBitContext *gb, int apply_defdispwin, HEVCSPS *sps) {
     vui->def_disp_win.bottom_offset = get_ue_golomb_long(gb) * vert_mult;
 
     if (apply_defdispwin /*&& avctx->flags2 & AV_CODEC_FLAG2_IGNORE_CROP*/) {
-      printf("discarding vui default display window, "
-             "original values are l:%u r:%u t:%u b:%u\n",
-             vui->def_disp_win.left_offset, vui->def_disp_win.right_offset,
-             vui->def_disp_win.top_offset, vui->def_disp_win.bottom_offset);
+      av_log(logctx, AV_LOG_DEBUG,
+             "discarding vui default display window, original values are l:%u "
+             "r:%u t:%u b:%u\n", vui->def_disp_win.left_offset,
+             vui->def_disp_win.right_offset, vui->def_disp_win.top_offset,
+             vui->def_disp_win.bottom_offset);
 
       vui->def_disp_win.left_offset = vui->def_disp_win.right_offset =
           vui->def_disp_win.top_offset = vui->def_disp_win.bottom_offset = 0;
@@ -764,7 +893,8 @@ timing_info:
     if (get_bits_left(gb) < 66 && !alt) {
       // The alternate syntax seem to have timing info located
       // at where def_disp_win is normally located
-      printf("Strange VUI timing information, retrying...\n");
+      av_log(logctx, AV_LOG_INFO,
+             "Strange VUI timing information, retrying...\n");
       memcpy(vui, &backup_vui, sizeof(backup_vui));
       memcpy(gb, &backup, sizeof(backup));
       alt = 1;
@@ -773,22 +903,23 @@ timing_info:
     vui->vui_num_units_in_tick = get_bits_long(gb, 32);
     vui->vui_time_scale = get_bits_long(gb, 32);
     if (alt) {
-      printf("Retry got %" PRIu32 "/%" PRIu32 " fps\n", vui->vui_time_scale,
-             vui->vui_num_units_in_tick);
+      av_log(logctx, AV_LOG_INFO, "Retry got %" PRIu32 "/%" PRIu32 " fps\n",
+             vui->vui_time_scale, vui->vui_num_units_in_tick);
     }
     vui->vui_poc_proportional_to_timing_flag = get_bits1(gb);
     if (vui->vui_poc_proportional_to_timing_flag)
       vui->vui_num_ticks_poc_diff_one_minus1 = get_ue_golomb_long(gb);
     vui->vui_hrd_parameters_present_flag = get_bits1(gb);
     if (vui->vui_hrd_parameters_present_flag)
-      decode_hrd(gb, 1, sps->max_sub_layers);
+      decode_hrd(gb, 1, &vui->hrd_params, sps->max_sub_layers);
   }
 
   vui->bitstream_restriction_flag = get_bits1(gb);
   if (vui->bitstream_restriction_flag) {
     if (get_bits_left(gb) < 8 && !alt) {
-      printf("Strange VUI bitstream restriction information, retrying"
-             " from timing information...\n");
+      av_log(logctx, AV_LOG_INFO,
+             "Strange VUI bitstream restriction information, retrying from "
+             "timing information...\n");
       memcpy(vui, &backup_vui, sizeof(backup_vui));
       memcpy(gb, &backup, sizeof(backup));
       alt = 1;
@@ -806,7 +937,8 @@ timing_info:
 
   if (get_bits_left(gb) < 1 && !alt) {
     // XXX: Alternate syntax when sps_range_extension_flag != 0?
-    printf("Overread in VUI, retrying from timing information...\n");
+    av_log(logctx, AV_LOG_WARNING,
+           "Overread in VUI, retrying from timing information...\n");
     memcpy(vui, &backup_vui, sizeof(backup_vui));
     memcpy(gb, &backup, sizeof(backup));
     alt = 1;
@@ -843,7 +975,8 @@ static void set_default_scaling_list_data(ScalingList *sl) {
   memcpy(sl->sl[3][5], default_scaling_list_inter, 64);
 }
 
-static int scaling_list_data(GetBitContext *gb, ScalingList *sl, HEVCSPS *sps) {
+static int scaling_list_data(GetBitContext *gb, void *logctx, ScalingList *sl,
+                             HEVCSPS *sps) {
   uint8_t scaling_list_pred_mode_flag;
   uint8_t scaling_list_dc_coef[2][6];
   int size_id, matrix_id, pos;
@@ -860,7 +993,8 @@ static int scaling_list_data(GetBitContext *gb, ScalingList *sl, HEVCSPS *sps) {
           // Copy from previous array.
           delta *= (size_id == 3) ? 3 : 1;
           if (matrix_id < delta) {
-            printf("Invalid delta in scaling list data: %d.\n", delta);
+            av_log(logctx, AV_LOG_ERROR,
+                   "Invalid delta in scaling list data: %d.\n", delta);
             return AVERROR_INVALIDDATA;
           }
 
@@ -914,7 +1048,7 @@ static int scaling_list_data(GetBitContext *gb, ScalingList *sl, HEVCSPS *sps) {
   return 0;
 }
 
-static int map_pixel_format(HEVCSPS *sps) {
+static int map_pixel_format(void *logctx, HEVCSPS *sps) {
   const AVPixFmtDescriptor *desc;
   switch (sps->bit_depth) {
   case 8:
@@ -958,9 +1092,9 @@ static int map_pixel_format(HEVCSPS *sps) {
       sps->pix_fmt = AV_PIX_FMT_YUV444P12;
     break;
   default:
-    printf("The following bit-depths are currently specified: 8, 9, 10 and 12 "
-           "bits, "
-           "chroma_format_idc is %d, depth is %d\n",
+    av_log(logctx, AV_LOG_ERROR,
+           "The following bit-depths are currently specified: 8, 9, 10 and 12 "
+           "bits, chroma_format_idc is %d, depth is %d\n",
            sps->chroma_format_idc, sps->bit_depth);
     return AVERROR_INVALIDDATA;
   }
@@ -979,42 +1113,51 @@ static int map_pixel_format(HEVCSPS *sps) {
 }
 
 int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
-                      int apply_defdispwin, AVBufferRef **vps_list) {
+                      int apply_defdispwin, AVBufferRef **vps_list,
+                      void *logctx) {
   HEVCWindow *ow;
   int ret = 0;
   int log2_diff_max_min_transform_block_size;
   int bit_depth_chroma, start, vui_present, sublayer_ordering_info;
   int i;
 
+#ifndef FF_CHECKED_READER
+  if (!get_bits_trusted(gb, HEVC_SPS_MAX_OVERREAD_BITS))
+    return ff_hevc_parse_sps_checked(sps, gb, sps_id, apply_defdispwin,
+                                     vps_list, logctx);
+#endif
+
   // Coded parameters
 
   sps->vps_id = get_bits(gb, 4);
 
   if (vps_list && !vps_list[sps->vps_id]) {
-    printf("VPS %d does not exist\n", sps->vps_id);
+    av_log(logctx, AV_LOG_ERROR, "VPS %d does not exist\n", sps->vps_id);
     return AVERROR_INVALIDDATA;
   }
 
   sps->max_sub_layers = get_bits(gb, 3) + 1;
   if (sps->max_sub_layers > HEVC_MAX_SUB_LAYERS) {
-    printf("sps_max_sub_layers out of range: %d\n", sps->max_sub_layers);
+    av_log(logctx, AV_LOG_ERROR, "sps_max_sub_layers out of range: %d\n",
+           sps->max_sub_layers);
     return AVERROR_INVALIDDATA;
   }
 
   sps->temporal_id_nesting_flag = get_bits(gb, 1);
 
-  if ((ret = parse_ptl(gb, &sps->ptl, sps->max_sub_layers)) < 0)
+  if ((ret = parse_ptl(gb, logctx, &sps->ptl, sps->max_sub_layers)) < 0)
     return ret;
 
   *sps_id = get_ue_golomb_long(gb);
   if (*sps_id >= HEVC_MAX_SPS_COUNT) {
-    printf("SPS id out of range: %d\n", *sps_id);
+    av_log(logctx, AV_LOG_ERROR, "SPS id out of range: %d\n", *sps_id);
     return AVERROR_INVALIDDATA;
   }
 
   sps->chroma_format_idc = get_ue_golomb_long(gb);
   if (sps->chroma_format_idc > 3U) {
-    printf("chroma_format_idc %d is invalid\n", sps->chroma_format_idc);
+    av_log(logctx, AV_LOG_ERROR, "chroma_format_idc %d is invalid\n",
+           sps->chroma_format_idc);
     return AVERROR_INVALIDDATA;
   }
 
@@ -1026,7 +1169,8 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
 
   sps->width = get_ue_golomb_long(gb);
   sps->height = get_ue_golomb_long(gb);
-  printf("hevc width:%d.height:%d\n", sps->width, sps->height);
+  av_log(logctx, AV_LOG_DEBUG, "hevc width:%d.height:%d\n", sps->width,
+         sps->height);
   //   if ((ret = av_image_check_size(sps->width, sps->height, 0, avctx)) < 0)
   //     return ret;
 
@@ -1041,10 +1185,11 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
     // if (avctx->flags2 & AV_CODEC_FLAG2_IGNORE_CROP)
     int AV_CODEC_FLAG2_IGNORE_CROP = 0;
     if (AV_CODEC_FLAG2_IGNORE_CROP) {
-      printf("discarding sps conformance window, "
-             "original values are l:%u r:%u t:%u b:%u\n",
-             sps->pic_conf_win.left_offset, sps->pic_conf_win.right_offset,
-             sps->pic_conf_win.top_offset, sps->pic_conf_win.bottom_offset);
+      av_log(logctx, AV_LOG_DEBUG,
+             "discarding sps conformance window, original values are l:%u r:%u "
+             "t:%u b:%u\n", sps->pic_conf_win.left_offset,
+             sps->pic_conf_win.right_offset, sps->pic_conf_win.top_offset,
+             sps->pic_conf_win.bottom_offset);
 
       sps->pic_conf_win.left_offset = sps->pic_conf_win.right_offset =
           sps->pic_conf_win.top_offset = sps->pic_conf_win.bottom_offset = 0;
@@ -1055,20 +1200,21 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
   sps->bit_depth = get_ue_golomb_long(gb) + 8;
   bit_depth_chroma = get_ue_golomb_long(gb) + 8;
   if (sps->chroma_format_idc && bit_depth_chroma != sps->bit_depth) {
-    printf("Luma bit depth (%d) is different from chroma bit depth (%d), "
-           "this is unsupported.\n",
-           sps->bit_depth, bit_depth_chroma);
+    av_log(logctx, AV_LOG_ERROR,
+           "Luma bit depth (%d) is different from chroma bit depth (%d), this "
+           "is unsupported.\n", sps->bit_depth, bit_depth_chroma);
     return AVERROR_INVALIDDATA;
   }
   sps->bit_depth_chroma = bit_depth_chroma;
 
-  ret = map_pixel_format(sps);
+  ret = map_pixel_format(logctx, sps);
   if (ret < 0)
     return ret;
 
   sps->log2_max_poc_lsb = get_ue_golomb_long(gb) + 4;
   if (sps->log2_max_poc_lsb > 16) {
-    printf("log2_max_pic_order_cnt_lsb_minus4 out range: %d\n",
+    av_log(logctx, AV_LOG_ERROR,
+           "log2_max_pic_order_cnt_lsb_minus4 out range: %d\n",
            sps->log2_max_poc_lsb - 4);
     return AVERROR_INVALIDDATA;
   }
@@ -1081,13 +1227,15 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
     sps->temporal_layer[i].max_latency_increase = get_ue_golomb_long(gb) - 1;
     if (sps->temporal_layer[i].max_dec_pic_buffering >
         (unsigned)HEVC_MAX_DPB_SIZE) {
-      printf("sps_max_dec_pic_buffering_minus1 out of range: %d\n",
+      av_log(logctx, AV_LOG_ERROR,
+             "sps_max_dec_pic_buffering_minus1 out of range: %d\n",
              sps->temporal_layer[i].max_dec_pic_buffering - 1U);
       return AVERROR_INVALIDDATA;
     }
     if (sps->temporal_layer[i].num_reorder_pics >
         sps->temporal_layer[i].max_dec_pic_buffering - 1) {
-      printf("sps_max_num_reorder_pics out of range: %d\n",
+      av_log(logctx, AV_LOG_ERROR,
+             "sps_max_num_reorder_pics out of range: %d\n",
              sps->temporal_layer[i].num_reorder_pics);
       //   if (avctx->err_recognition & AV_EF_EXPLODE ||
       //       sps->temporal_layer[i].num_reorder_pics > HEVC_MAX_DPB_SIZE - 1)
@@ -1118,25 +1266,28 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
       log2_diff_max_min_transform_block_size + sps->log2_min_tb_size;
 
   if (sps->log2_min_cb_size < 3 || sps->log2_min_cb_size > 30) {
-    printf("Invalid value %d for log2_min_cb_size", sps->log2_min_cb_size);
+    av_log(logctx, AV_LOG_ERROR, "Invalid value %d for log2_min_cb_size\n",
+           sps->log2_min_cb_size);
     return AVERROR_INVALIDDATA;
   }
 
   if (sps->log2_diff_max_min_coding_block_size > 30) {
-    printf("Invalid value %d for log2_diff_max_min_coding_block_size",
+    av_log(logctx, AV_LOG_ERROR,
+           "Invalid value %d for log2_diff_max_min_coding_block_size\n",
            sps->log2_diff_max_min_coding_block_size);
     return AVERROR_INVALIDDATA;
   }
 
   if (sps->log2_min_tb_size >= sps->log2_min_cb_size ||
       sps->log2_min_tb_size < 2) {
-    printf("Invalid value for log2_min_tb_size");
+    av_log(logctx, AV_LOG_ERROR, "Invalid value for log2_min_tb_size\n");
     return AVERROR_INVALIDDATA;
   }
 
   if (log2_diff_max_min_transform_block_size < 0 ||
       log2_diff_max_min_transform_block_size > 30) {
-    printf("Invalid value %d for log2_diff_max_min_transform_block_size",
+    av_log(logctx, AV_LOG_ERROR,
+           "Invalid value %d for log2_diff_max_min_transform_block_size\n",
            log2_diff_max_min_transform_block_size);
     return AVERROR_INVALIDDATA;
   }
@@ -1149,7 +1300,7 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
     set_default_scaling_list_data(&sps->scaling_list);
 
     if (get_bits1(gb)) {
-      ret = scaling_list_data(gb, &sps->scaling_list, sps);
+      ret = scaling_list_data(gb, logctx, &sps->scaling_list, sps);
       if (ret < 0)
         return ret;
     }
@@ -1166,7 +1317,8 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
     sps->pcm.log2_max_pcm_cb_size =
         sps->pcm.log2_min_pcm_cb_size + get_ue_golomb_long(gb);
     if (FFMAX(sps->pcm.bit_depth, sps->pcm.bit_depth_chroma) > sps->bit_depth) {
-      printf("PCM bit depth (%d, %d) is greater than normal bit depth (%d)\n",
+      av_log(logctx, AV_LOG_ERROR,
+             "PCM bit depth (%d, %d) is greater than normal bit depth (%d)\n",
              sps->pcm.bit_depth, sps->pcm.bit_depth_chroma, sps->bit_depth);
       return AVERROR_INVALIDDATA;
     }
@@ -1176,11 +1328,13 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
 
   sps->nb_st_rps = get_ue_golomb_long(gb);
   if (sps->nb_st_rps > HEVC_MAX_SHORT_TERM_REF_PIC_SETS) {
-    printf("Too many short term RPS: %d.\n", sps->nb_st_rps);
+    av_log(logctx, AV_LOG_ERROR, "Too many short term RPS: %d.\n",
+           sps->nb_st_rps);
     return AVERROR_INVALIDDATA;
   }
   for (i = 0; i < sps->nb_st_rps; i++) {
-    if ((ret = ff_hevc_decode_short_term_rps(gb, &sps->st_rps[i], sps, 0)) < 0)
+    if ((ret = ff_hevc_decode_short_term_rps(gb, logctx, &sps->st_rps[i], sps,
+                                             0)) < 0)
       return ret;
   }
 
@@ -1188,7 +1342,7 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
   if (sps->long_term_ref_pics_present_flag) {
     sps->num_long_term_ref_pics_sps = get_ue_golomb_long(gb);
     if (sps->num_long_term_ref_pics_sps > HEVC_MAX_LONG_TERM_REF_PICS) {
-      printf("Too many long term ref pics: %d.\n",
+      av_log(logctx, AV_LOG_ERROR, "Too many long term ref pics: %d.\n",
              sps->num_long_term_ref_pics_sps);
       return AVERROR_INVALIDDATA;
     }
@@ -1201,9 +1355,10 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
   sps->sps_temporal_mvp_enabled_flag = get_bits1(gb);
   sps->sps_strong_intra_smoothing_enable_flag = get_bits1(gb);
   sps->vui.sar = (AVRational){0, 1};
+  sps->vui_flag_pos = get_bits_count(gb);
   vui_present = get_bits1(gb);
   if (vui_present)
-    decode_vui(gb, apply_defdispwin, sps);
+    decode_vui(gb, logctx, apply_defdispwin, sps);
 
   if (get_bits1(gb)) { // sps_extension_flag
     sps->sps_range_extension_flag = get_bits1(gb);
@@ -1217,18 +1372,21 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
 
       sps->extended_precision_processing_flag = get_bits1(gb);
       if (sps->extended_precision_processing_flag)
-        printf("extended_precision_processing_flag not yet implemented\n");
+        av_log(logctx, AV_LOG_WARNING,
+               "extended_precision_processing_flag not yet implemented\n");
 
       sps->intra_smoothing_disabled_flag = get_bits1(gb);
       sps->high_precision_offsets_enabled_flag = get_bits1(gb);
       if (sps->high_precision_offsets_enabled_flag)
-        printf("high_precision_offsets_enabled_flag not yet implemented\n");
+        av_log(logctx, AV_LOG_WARNING,
+               "high_precision_offsets_enabled_flag not yet implemented\n");
 
       sps->persistent_rice_adaptation_enabled_flag = get_bits1(gb);
 
       sps->cabac_bypass_alignment_enabled_flag = get_bits1(gb);
       if (sps->cabac_bypass_alignment_enabled_flag)
-        printf("cabac_bypass_alignment_enabled_flag not yet implemented\n");
+        av_log(logctx, AV_LOG_WARNING,
+               "cabac_bypass_alignment_enabled_flag not yet implemented\n");
     }
   }
   if (apply_defdispwin) {
@@ -1243,12 +1401,13 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
       ow->top_offset >= INT_MAX - ow->bottom_offset ||
       ow->left_offset + ow->right_offset >= sps->width ||
       ow->top_offset + ow->bottom_offset >= sps->height) {
-    printf("Invalid cropping offsets: %u/%u/%u/%u\n", ow->left_offset,
-           ow->right_offset, ow->top_offset, ow->bottom_offset);
+    av_log(logctx, AV_LOG_WARNING, "Invalid cropping offsets: %u/%u/%u/%u\n",
+           ow->left_offset, ow->right_offset, ow->top_offset,
+           ow->bottom_offset);
     // if (avctx->err_recognition & AV_EF_EXPLODE) {
     //   return AVERROR_INVALIDDATA;//cai
     //}
-    printf("Displaying the whole video surface.\n");
+    av_log(logctx, AV_LOG_WARNING, "Displaying the whole video surface.\n");
     memset(ow, 0, sizeof(*ow));
     memset(&sps->pic_conf_win, 0, sizeof(sps->pic_conf_win));
   }
@@ -1259,13 +1418,15 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
   sps->log2_min_pu_size = sps->log2_min_cb_size - 1;
 
   if (sps->log2_ctb_size > HEVC_MAX_LOG2_CTB_SIZE) {
-    printf("CTB size out of range: 2^%d\n", sps->log2_ctb_size);
+    av_log(logctx, AV_LOG_ERROR, "CTB size out of range: 2^%d\n",
+           sps->log2_ctb_size);
     return AVERROR_INVALIDDATA;
   }
   if (sps->log2_ctb_size < 4) {
-    printf("log2_ctb_size %d differs from the bounds of any known profile\n",
+    av_log(logctx, AV_LOG_WARNING,
+           "log2_ctb_size %d differs from the bounds of any known profile\n",
            sps->log2_ctb_size);
-    printf("log2_ctb_size %d\n", sps->log2_ctb_size);
+    av_log(logctx, AV_LOG_DEBUG, "log2_ctb_size %d\n", sps->log2_ctb_size);
     return AVERROR_INVALIDDATA;
   }
 
@@ -1287,40 +1448,45 @@ int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
 
   if (av_mod_uintp2(sps->width, sps->log2_min_cb_size) ||
       av_mod_uintp2(sps->height, sps->log2_min_cb_size)) {
-    printf("Invalid coded frame dimensions.\n");
+    av_log(logctx, AV_LOG_ERROR, "Invalid coded frame dimensions.\n");
     return AVERROR_INVALIDDATA;
   }
 
   if (sps->max_transform_hierarchy_depth_inter >
       sps->log2_ctb_size - sps->log2_min_tb_size) {
-    printf("max_transform_hierarchy_depth_inter out of range: %d\n",
+    av_log(logctx, AV_LOG_ERROR,
+           "max_transform_hierarchy_depth_inter out of range: %d\n",
            sps->max_transform_hierarchy_depth_inter);
     return AVERROR_INVALIDDATA;
   }
   if (sps->max_transform_hierarchy_depth_intra >
       sps->log2_ctb_size - sps->log2_min_tb_size) {
-    printf("max_transform_hierarchy_depth_intra out of range: %d\n",
+    av_log(logctx, AV_LOG_ERROR,
+           "max_transform_hierarchy_depth_intra out of range: %d\n",
            sps->max_transform_hierarchy_depth_intra);
     return AVERROR_INVALIDDATA;
   }
   if (sps->log2_max_trafo_size > FFMIN(sps->log2_ctb_size, 5)) {
-    printf("max transform block size out of range: %d\n",
+    av_log(logctx, AV_LOG_ERROR, "max transform block size out of range: %d\n",
            sps->log2_max_trafo_size);
     return AVERROR_INVALIDDATA;
   }
 
   if (get_bits_left(gb) < 0) {
-    printf("Overread SPS by %d bits\n", -get_bits_left(gb));
+    av_log(logctx, AV_LOG_ERROR, "Overread SPS by %d bits\n",
+           -get_bits_left(gb));
     return AVERROR_INVALIDDATA;
   }
 
   return 0;
 }
 
-int ff_hevc_decode_nal_sps(GetBitContext *gb, HEVCParamSets *ps,
-                           int apply_defdispwin) {
+#ifndef FF_CHECKED_READER
+// ff_hevc_parse_sps() does all the reading
+static int decode_sps(GetBitContext *gb, void *logctx, HEVCParamSets *ps,
+                      int apply_defdispwin) {
   HEVCSPS *sps;
-  AVBufferRef *sps_buf = av_buffer_allocz(sizeof(*sps));
+  AVBufferRef *sps_buf = ff_hevc_ps_pool_get(HEVC_NAL_SPS);
   unsigned int sps_id;
   int ret;
   ptrdiff_t nal_size;
@@ -1328,10 +1494,11 @@ int ff_hevc_decode_nal_sps(GetBitContext *gb, HEVCParamSets *ps,
   if (!sps_buf)
     return AVERROR(ENOMEM);
   sps = (HEVCSPS *)sps_buf->data;
+  memset(sps, 0, sizeof(*sps));
 
-  printf("Decoding SPS\n");
+  av_log(logctx, AV_LOG_DEBUG, "Decoding SPS\n");
 
-  nal_size = gb->buffer_end - gb->buffer;
+  nal_size = ff_h2645_rbsp_size(gb);
   if (nal_size > sizeof(sps->data)) {
     // printf("Truncating likely oversized SPS "
     //        "(%" PTRDIFF_SPECIFIER " > %" SIZE_SPECIFIER ")\n",
@@ -1342,23 +1509,22 @@ int ff_hevc_decode_nal_sps(GetBitContext *gb, HEVCParamSets *ps,
   }
   memcpy(sps->data, gb->buffer, sps->data_size);
 
-  ret = ff_hevc_parse_sps(sps, gb, &sps_id, apply_defdispwin, ps->vps_list);
+  ret = ff_hevc_parse_sps(sps, gb, &sps_id, apply_defdispwin, ps->vps_list,
+                          logctx);
   if (ret < 0) {
     av_buffer_unref(&sps_buf);
     return ret;
   }
 
-  int debug = 1;
-  if (debug) {
-    printf("Parsed SPS: id %d; coded wxh: %dx%d; "
-           "cropped wxh: %dx%d; pix_fmt: %s.\n",
-           sps_id, sps->width, sps->height,
-           sps->width - (sps->output_window.left_offset +
-                         sps->output_window.right_offset),
-           sps->height - (sps->output_window.top_offset +
-                          sps->output_window.bottom_offset),
-           av_get_pix_fmt_name(sps->pix_fmt));
-  }
+  av_log(logctx, AV_LOG_DEBUG,
+         "Parsed SPS: id %d; coded wxh: %dx%d; cropped wxh: %dx%d; "
+         "pix_fmt: %s.\n",
+         sps_id, sps->width, sps->height,
+         sps->width -
+             (sps->output_window.left_offset + sps->output_window.right_offset),
+         sps->height -
+             (sps->output_window.top_offset + sps->output_window.bottom_offset),
+         av_get_pix_fmt_name(sps->pix_fmt));
 
   /* check if this is a repeat of an already parsed SPS, then keep the
    * original one.
@@ -1374,24 +1540,18 @@ int ff_hevc_decode_nal_sps(GetBitContext *gb, HEVCParamSets *ps,
   return 0;
 }
 
-static void hevc_pps_free(void *opaque, uint8_t *data) {
-  HEVCPPS *pps = (HEVCPPS *)data;
-
-  av_freep(&pps->column_width);
-  av_freep(&pps->row_height);
-  av_freep(&pps->col_bd);
-  av_freep(&pps->row_bd);
-  av_freep(&pps->col_idxX);
-  av_freep(&pps->ctb_addr_rs_to_ts);
-  av_freep(&pps->ctb_addr_ts_to_rs);
-  av_freep(&pps->tile_pos_rs);
-  av_freep(&pps->tile_id);
-  av_freep(&pps->min_tb_addr_zs_tab);
+int ff_hevc_decode_nal_sps(GetBitContext *gb, void *logctx, HEVCParamSets *ps,
+                           int apply_defdispwin) {
+  enum FFMemTag tag = ff_mem_set_tag(FF_MEM_TAG_HEVC_PS);
+  int ret = decode_sps(gb, logctx, ps, apply_defdispwin);
 
-  av_freep(&pps);
+  ff_mem_set_tag(tag);
+  return ret;
 }
+#endif
 
-static int pps_range_extensions(GetBitContext *gb, HEVCPPS *pps, HEVCSPS *sps) {
+static int pps_range_extensions(GetBitContext *gb, void *logctx, HEVCPPS *pps,
+                                HEVCSPS *sps) {
   int i;
 
   if (pps->transform_skip_enabled_flag) {
@@ -1403,18 +1563,19 @@ static int pps_range_extensions(GetBitContext *gb, HEVCPPS *pps, HEVCSPS *sps) {
     pps->diff_cu_chroma_qp_offset_depth = get_ue_golomb_long(gb);
     pps->chroma_qp_offset_list_len_minus1 = get_ue_golomb_long(gb);
     if (pps->chroma_qp_offset_list_len_minus1 > 5) {
-      printf(
-          "chroma_qp_offset_list_len_minus1 shall be in the range [0, 5].\n");
+      av_log(logctx, AV_LOG_ERROR,
+             "chroma_qp_offset_list_len_minus1 shall be in the range "
+             "[0, 5].\n");
       return AVERROR_INVALIDDATA;
     }
     for (i = 0; i <= pps->chroma_qp_offset_list_len_minus1; i++) {
       pps->cb_qp_offset_list[i] = get_se_golomb_long(gb);
       if (pps->cb_qp_offset_list[i]) {
-        printf("cb_qp_offset_list not tested yet.\n");
+        av_log(logctx, AV_LOG_WARNING, "cb_qp_offset_list not tested yet.\n");
       }
       pps->cr_qp_offset_list[i] = get_se_golomb_long(gb);
       if (pps->cr_qp_offset_list[i]) {
-        printf("cb_qp_offset_list not tested yet.\n");
+        av_log(logctx, AV_LOG_WARNING, "cb_qp_offset_list not tested yet.\n");
       }
     }
   }
@@ -1567,29 +1728,25 @@ static inline int setup_pps(GetBitContext *gb, HEVCPPS *pps, HEVCSPS *sps) {
   return 0;
 }
 
-int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
+static int decode_pps(GetBitContext *gb, void *logctx, HEVCParamSets *ps) {
   HEVCSPS *sps = NULL;
   int i, ret = 0;
   unsigned int pps_id = 0;
   ptrdiff_t nal_size;
   unsigned log2_parallel_merge_level_minus2;
 
-  AVBufferRef *pps_buf;
-  HEVCPPS *pps = av_mallocz(sizeof(*pps));
+  AVBufferRef *pps_buf = ff_hevc_ps_pool_get(HEVC_NAL_PPS);
+  HEVCPPS *pps;
 
-  if (!pps)
+  if (!pps_buf)
     return AVERROR(ENOMEM);
+  pps = (HEVCPPS *)pps_buf->data;
+  pps_release(pps);
+  memset(pps, 0, sizeof(*pps));
 
-  pps_buf =
-      av_buffer_create((uint8_t *)pps, sizeof(*pps), hevc_pps_free, NULL, 0);
-  if (!pps_buf) {
-    av_freep(&pps);
-    return AVERROR(ENOMEM);
-  }
-
-  printf("Decoding PPS\n");
+  av_log(logctx, AV_LOG_DEBUG, "Decoding PPS\n");
 
-  nal_size = gb->buffer_end - gb->buffer;
+  nal_size = ff_h2645_rbsp_size(gb);
   if (nal_size > sizeof(pps->data)) {
     // printf("Truncating likely oversized PPS "
     //        "(%" PTRDIFF_SPECIFIER " > %" SIZE_SPECIFIER ")\n",
@@ -1613,18 +1770,18 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
   // Coded parameters
   pps_id = get_ue_golomb_long(gb);
   if (pps_id >= HEVC_MAX_PPS_COUNT) {
-    printf("PPS id out of range: %d\n", pps_id);
+    av_log(logctx, AV_LOG_ERROR, "PPS id out of range: %d\n", pps_id);
     ret = AVERROR_INVALIDDATA;
     goto err;
   }
   pps->sps_id = get_ue_golomb_long(gb);
   if (pps->sps_id >= HEVC_MAX_SPS_COUNT) {
-    printf("SPS id out of range: %d\n", pps->sps_id);
+    av_log(logctx, AV_LOG_ERROR, "SPS id out of range: %d\n", pps->sps_id);
     ret = AVERROR_INVALIDDATA;
     goto err;
   }
   if (!ps->sps_list[pps->sps_id]) {
-    printf("SPS %u does not exist.\n", pps->sps_id);
+    av_log(logctx, AV_LOG_ERROR, "SPS %u does not exist.\n", pps->sps_id);
     ret = AVERROR_INVALIDDATA;
     goto err;
   }
@@ -1653,7 +1810,7 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
 
   if (pps->diff_cu_qp_delta_depth < 0 ||
       pps->diff_cu_qp_delta_depth > sps->log2_diff_max_min_coding_block_size) {
-    printf("diff_cu_qp_delta_depth %d is invalid\n",
+    av_log(logctx, AV_LOG_ERROR, "diff_cu_qp_delta_depth %d is invalid\n",
            pps->diff_cu_qp_delta_depth);
     ret = AVERROR_INVALIDDATA;
     goto err;
@@ -1661,13 +1818,15 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
 
   pps->cb_qp_offset = get_se_golomb(gb);
   if (pps->cb_qp_offset < -12 || pps->cb_qp_offset > 12) {
-    printf("pps_cb_qp_offset out of range: %d\n", pps->cb_qp_offset);
+    av_log(logctx, AV_LOG_ERROR, "pps_cb_qp_offset out of range: %d\n",
+           pps->cb_qp_offset);
     ret = AVERROR_INVALIDDATA;
     goto err;
   }
   pps->cr_qp_offset = get_se_golomb(gb);
   if (pps->cr_qp_offset < -12 || pps->cr_qp_offset > 12) {
-    printf("pps_cr_qp_offset out of range: %d\n", pps->cr_qp_offset);
+    av_log(logctx, AV_LOG_ERROR, "pps_cr_qp_offset out of range: %d\n",
+           pps->cr_qp_offset);
     ret = AVERROR_INVALIDDATA;
     goto err;
   }
@@ -1686,14 +1845,15 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
 
     if (num_tile_columns_minus1 < 0 ||
         num_tile_columns_minus1 >= sps->ctb_width) {
-      printf("num_tile_columns_minus1 out of range: %d\n",
+      av_log(logctx, AV_LOG_ERROR, "num_tile_columns_minus1 out of range: %d\n",
              num_tile_columns_minus1);
       ret = num_tile_columns_minus1 < 0 ? num_tile_columns_minus1
                                         : AVERROR_INVALIDDATA;
       goto err;
     }
     if (num_tile_rows_minus1 < 0 || num_tile_rows_minus1 >= sps->ctb_height) {
-      printf("num_tile_rows_minus1 out of range: %d\n", num_tile_rows_minus1);
+      av_log(logctx, AV_LOG_ERROR, "num_tile_rows_minus1 out of range: %d\n",
+             num_tile_rows_minus1);
       ret =
           num_tile_rows_minus1 < 0 ? num_tile_rows_minus1 : AVERROR_INVALIDDATA;
       goto err;
@@ -1714,11 +1874,16 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
     if (!pps->uniform_spacing_flag) {
       uint64_t sum = 0;
       for (i = 0; i < pps->num_tile_columns - 1; i++) {
+        if (get_bits_left(gb) < 0) {
+          av_log(logctx, AV_LOG_ERROR, "Overread PPS in the tile sizes\n");
+          ret = AVERROR_INVALIDDATA;
+          goto err;
+        }
         pps->column_width[i] = get_ue_golomb_long(gb) + 1;
         sum += pps->column_width[i];
       }
       if (sum >= sps->ctb_width) {
-        printf("Invalid tile widths.\n");
+        av_log(logctx, AV_LOG_ERROR, "Invalid tile widths.\n");
         ret = AVERROR_INVALIDDATA;
         goto err;
       }
@@ -1726,11 +1891,16 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
 
       sum = 0;
       for (i = 0; i < pps->num_tile_rows - 1; i++) {
+        if (get_bits_left(gb) < 0) {
+          av_log(logctx, AV_LOG_ERROR, "Overread PPS in the tile sizes\n");
+          ret = AVERROR_INVALIDDATA;
+          goto err;
+        }
         pps->row_height[i] = get_ue_golomb_long(gb) + 1;
         sum += pps->row_height[i];
       }
       if (sum >= sps->ctb_height) {
-        printf("Invalid tile heights.\n");
+        av_log(logctx, AV_LOG_ERROR, "Invalid tile heights.\n");
         ret = AVERROR_INVALIDDATA;
         goto err;
       }
@@ -1749,12 +1919,14 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
       int beta_offset_div2 = get_se_golomb(gb);
       int tc_offset_div2 = get_se_golomb(gb);
       if (beta_offset_div2 < -6 || beta_offset_div2 > 6) {
-        printf("pps_beta_offset_div2 out of range: %d\n", beta_offset_div2);
+        av_log(logctx, AV_LOG_ERROR, "pps_beta_offset_div2 out of range: %d\n",
+               beta_offset_div2);
         ret = AVERROR_INVALIDDATA;
         goto err;
       }
       if (tc_offset_div2 < -6 || tc_offset_div2 > 6) {
-        printf("pps_tc_offset_div2 out of range: %d\n", tc_offset_div2);
+        av_log(logctx, AV_LOG_ERROR, "pps_tc_offset_div2 out of range: %d\n",
+               tc_offset_div2);
         ret = AVERROR_INVALIDDATA;
         goto err;
       }
@@ -1766,14 +1938,15 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
   pps->scaling_list_data_present_flag = get_bits1(gb);
   if (pps->scaling_list_data_present_flag) {
     set_default_scaling_list_data(&pps->scaling_list);
-    ret = scaling_list_data(gb, &pps->scaling_list, sps);
+    ret = scaling_list_data(gb, logctx, &pps->scaling_list, sps);
     if (ret < 0)
       goto err;
   }
   pps->lists_modification_present_flag = get_bits1(gb);
   log2_parallel_merge_level_minus2 = get_ue_golomb_long(gb);
   if (log2_parallel_merge_level_minus2 > sps->log2_ctb_size) {
-    printf("log2_parallel_merge_level_minus2 out of range: %d\n",
+    av_log(logctx, AV_LOG_ERROR,
+           "log2_parallel_merge_level_minus2 out of range: %d\n",
            log2_parallel_merge_level_minus2);
     ret = AVERROR_INVALIDDATA;
     goto err;
@@ -1787,7 +1960,7 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
     skip_bits(gb, 7); // pps_extension_7bits
     if (sps->ptl.general_ptl.profile_idc == FF_PROFILE_HEVC_REXT &&
         pps->pps_range_extensions_flag) {
-      if ((ret = pps_range_extensions(gb, pps, sps)) < 0)
+      if ((ret = pps_range_extensions(gb, logctx, pps, sps)) < 0)
         goto err;
     }
   }
@@ -1797,7 +1970,8 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
     goto err;
 
   if (get_bits_left(gb) < 0) {
-    printf("Overread PPS by %d bits\n", -get_bits_left(gb));
+    av_log(logctx, AV_LOG_ERROR, "Overread PPS by %d bits\n",
+           -get_bits_left(gb));
     goto err;
   }
 
@@ -1807,10 +1981,25 @@ int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps) {
   return 0;
 
 err:
-  av_buffer_unref(&pps_buf);
+  pps_unref(&pps_buf);
+  return ret;
+}
+
+int ff_hevc_decode_nal_pps(GetBitContext *gb, void *logctx, HEVCParamSets *ps) {
+  enum FFMemTag tag;
+  int ret;
+
+#ifndef FF_CHECKED_READER
+  if (!get_bits_trusted(gb, HEVC_PPS_MAX_OVERREAD_BITS))
+    return ff_hevc_decode_nal_pps_checked(gb, logctx, ps);
+#endif
+  tag = ff_mem_set_tag(FF_MEM_TAG_HEVC_PS);
+  ret = decode_pps(gb, logctx, ps);
+  ff_mem_set_tag(tag);
   return ret;
 }
 
+#ifndef FF_CHECKED_READER
 void ff_hevc_ps_uninit(HEVCParamSets *ps) {
   int i;
 
@@ -1819,7 +2008,7 @@ void ff_hevc_ps_uninit(HEVCParamSets *ps) {
   for (i = 0; i < FF_ARRAY_ELEMS(ps->sps_list); i++)
     av_buffer_unref(&ps->sps_list[i]);
   for (i = 0; i < FF_ARRAY_ELEMS(ps->pps_list); i++)
-    av_buffer_unref(&ps->pps_list[i]);
+    pps_unref(&ps->pps_list[i]);
 
   ps->sps = NULL;
   ps->pps = NULL;
@@ -1848,3 +2037,4 @@ int ff_hevc_compute_poc(const HEVCSPS *sps, int pocTid0, int poc_lsb,
 
   return poc_msb + poc_lsb;
 }
+#endif
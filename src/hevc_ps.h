@@ -30,6 +30,35 @@
 #include "get_bits.h"
 #include "hevc.h"
 
+/* Most bits the parsers below read from a hostile NAL unit, past its end if
+ * it is short; see get_bits_trusted(). An Exp-Golomb code counts 63 bits.
+ * The PTL, the VPS layer flags and the PPS tile loops check get_bits_left()
+ * first and overread at most one code. */
+#define HEVC_HRD_MAX_BITS                                                      \
+  (49 + HEVC_MAX_SUB_LAYERS *                                                  \
+            (1 + 1 + 63 + 63 + 2 * HEVC_MAX_CPB_CNT * (4 * 63 + 1)))
+#define HEVC_VUI_MAX_BITS                                                      \
+  (41 + 2 + 30 + (1 + 2 * 63) + 3 + (1 + 4 * 63) +                             \
+   (1 + 64 + 1 + 63 + 1 + HEVC_HRD_MAX_BITS) + (1 + 3 + 5 * 63))
+#define HEVC_SCALING_LIST_MAX_BITS                                             \
+  (20 + 6 * 16 * 63 + 6 * 64 * 63 + 8 * (63 + 64 * 63))
+#define HEVC_ST_RPS_MAX_BITS (1 + 2 * 63 + 2 * (HEVC_MAX_REFS - 1) * (63 + 1))
+#define HEVC_VPS_MAX_OVERREAD_BITS                                             \
+  (32 + 1 + HEVC_MAX_SUB_LAYERS * 3 * 63 + 6 + 63 + (1 + 64 + 1 + 63) + 63 +   \
+   (63 + 1 + HEVC_HRD_MAX_BITS) + 1)
+#define HEVC_SPS_MAX_OVERREAD_BITS                                             \
+  (8 + 2 * 63 + 1 + 2 * 63 + (1 + 4 * 63) + 3 * 63 +                           \
+   (1 + HEVC_MAX_SUB_LAYERS * 3 * 63) + 6 * 63 + 2 +                           \
+   HEVC_SCALING_LIST_MAX_BITS + 2 + (1 + 8 + 2 * 63 + 1) + 63 +                \
+   HEVC_MAX_SHORT_TERM_REF_PIC_SETS * HEVC_ST_RPS_MAX_BITS +                   \
+   (1 + 63 + HEVC_MAX_LONG_TERM_REF_PICS * (16 + 1)) + 3 + HEVC_VUI_MAX_BITS + \
+   18)
+#define HEVC_PPS_MAX_OVERREAD_BITS                                             \
+  (2 * 63 + 7 + 2 * 63 + 63 + 2 + (1 + 63) + 2 * 63 + 6 +                      \
+   (2 * 63 + 1 + 2 * 63 + 1) + 1 + (3 + 2 * 63) + 1 +                          \
+   HEVC_SCALING_LIST_MAX_BITS + 1 + 63 + 1 + (9 + 63 + 2 + 2 * 63 + 12 * 63 +  \
+                                              2 * 63))
+
 typedef struct ShortTermRPS {
   unsigned int num_negative_pics;
   int num_delta_pocs;
@@ -45,6 +74,39 @@ typedef struct HEVCWindow {
   unsigned int bottom_offset;
 } HEVCWindow;
 
+typedef struct HEVCSubLayerHRDParams {
+  uint32_t bit_rate_value[HEVC_MAX_CPB_CNT];    ///< bit_rate_value_minus1 + 1
+  uint32_t cpb_size_value[HEVC_MAX_CPB_CNT];    ///< cpb_size_value_minus1 + 1
+  uint32_t cpb_size_du_value[HEVC_MAX_CPB_CNT]; ///< cpb_size_du_value_minus1 + 1
+  uint32_t bit_rate_du_value[HEVC_MAX_CPB_CNT]; ///< bit_rate_du_value_minus1 + 1
+  uint8_t cbr_flag[HEVC_MAX_CPB_CNT];
+} HEVCSubLayerHRDParams;
+
+typedef struct HEVCHRDParams {
+  uint8_t nal_hrd_parameters_present_flag;
+  uint8_t vcl_hrd_parameters_present_flag;
+  uint8_t sub_pic_hrd_params_present_flag;
+  uint8_t sub_pic_cpb_params_in_pic_timing_sei_flag;
+  int tick_divisor; ///< tick_divisor_minus2 + 2
+  uint8_t du_cpb_removal_delay_increment_length; ///< minus1 + 1
+  uint8_t dpb_output_delay_du_length;            ///< minus1 + 1
+  uint8_t bit_rate_scale;
+  uint8_t cpb_size_scale;
+  uint8_t cpb_size_du_scale;
+  uint8_t initial_cpb_removal_delay_length; ///< minus1 + 1
+  uint8_t au_cpb_removal_delay_length;      ///< minus1 + 1
+  uint8_t dpb_output_delay_length;          ///< minus1 + 1
+
+  uint8_t fixed_pic_rate_general_flag[HEVC_MAX_SUB_LAYERS];
+  uint8_t fixed_pic_rate_within_cvs_flag[HEVC_MAX_SUB_LAYERS];
+  int elemental_duration_in_tc[HEVC_MAX_SUB_LAYERS]; ///< minus1 + 1
+  uint8_t low_delay_hrd_flag[HEVC_MAX_SUB_LAYERS];
+  int cpb_cnt[HEVC_MAX_SUB_LAYERS]; ///< cpb_cnt_minus1 + 1
+
+  HEVCSubLayerHRDParams nal_params[HEVC_MAX_SUB_LAYERS];
+  HEVCSubLayerHRDParams vcl_params[HEVC_MAX_SUB_LAYERS];
+} HEVCHRDParams;
+
 typedef struct VUI {
   AVRational sar;
 
@@ -76,6 +138,7 @@ typedef struct VUI {
   int vui_poc_proportional_to_timing_flag;
   int vui_num_ticks_poc_diff_one_minus1;
   int vui_hrd_parameters_present_flag;
+  HEVCHRDParams hrd_params;
 
   int bitstream_restriction_flag;
   int tiles_fixed_structure_flag;
@@ -175,6 +238,7 @@ typedef struct HEVCSPS {
   uint8_t temporal_id_nesting_flag;
 
   VUI vui;
+  int vui_flag_pos; ///< bit offset of vui_parameters_present_flag in data
   PTL ptl;
 
   uint8_t scaling_list_enable_flag;
@@ -346,17 +410,48 @@ typedef struct HEVCParamSets {
  *                 to an existing VPS
  */
 int ff_hevc_parse_sps(HEVCSPS *sps, GetBitContext *gb, unsigned int *sps_id,
-                      int apply_defdispwin, AVBufferRef **vps_list);
+                      int apply_defdispwin, AVBufferRef **vps_list,
+                      void *logctx);
 
-int ff_hevc_decode_nal_vps(GetBitContext *gb, HEVCParamSets *ps);
-int ff_hevc_decode_nal_sps(GetBitContext *gb, HEVCParamSets *ps,
+int ff_hevc_decode_nal_vps(GetBitContext *gb, void *logctx,
+                           HEVCParamSets *ps);
+int ff_hevc_decode_nal_sps(GetBitContext *gb, void *logctx, HEVCParamSets *ps,
                            int apply_defdispwin);
-int ff_hevc_decode_nal_pps(GetBitContext *gb, HEVCParamSets *ps);
+int ff_hevc_decode_nal_pps(GetBitContext *gb, void *logctx,
+                           HEVCParamSets *ps);
+
+/*
+ * The same parsers with overread checks, for NAL units without the padding
+ * the functions above need to read them unchecked.
+ */
+int ff_hevc_parse_sps_checked(HEVCSPS *sps, GetBitContext *gb,
+                              unsigned int *sps_id, int apply_defdispwin,
+                              AVBufferRef **vps_list, void *logctx);
+int ff_hevc_decode_nal_vps_checked(GetBitContext *gb, void *logctx,
+                                   HEVCParamSets *ps);
+int ff_hevc_decode_nal_pps_checked(GetBitContext *gb, void *logctx,
+                                   HEVCParamSets *ps);
+int ff_hevc_decode_short_term_rps_checked(GetBitContext *gb, void *logctx,
+                                          ShortTermRPS *rps,
+                                          const HEVCSPS *sps,
+                                          int is_slice_header);
 
 void ff_hevc_ps_uninit(HEVCParamSets *ps);
 
-int ff_hevc_decode_short_term_rps(GetBitContext *gb, ShortTermRPS *rps,
-                                  const HEVCSPS *sps, int is_slice_header);
+/**
+ * Free the idle parameter set buffers kept for reuse by all streams.
+ */
+void ff_hevc_ps_pool_trim(void);
+
+/**
+ * Get a VPS, SPS or PPS buffer, by NAL unit type, from the pools shared by
+ * all streams.
+ */
+AVBufferRef *ff_hevc_ps_pool_get(int type);
+
+int ff_hevc_decode_short_term_rps(GetBitContext *gb, void *logctx,
+                                  ShortTermRPS *rps, const HEVCSPS *sps,
+                                  int is_slice_header);
 
 int ff_hevc_encode_nal_vps(HEVCVPS *vps, unsigned int id, uint8_t *buf,
                            int buf_size);
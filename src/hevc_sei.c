@@ -22,12 +22,18 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
-// #include "atsc_a53.h"
+#ifdef FF_CHECKED_READER
+#define UNCHECKED_BITSTREAM_READER 0
+#define ff_hevc_decode_nal_sei ff_hevc_decode_nal_sei_checked
+#endif
+
 #include "hevc_sei.h"
-#include "dynamic_hdr10_plus.h"
+#include "buffer_internal.h"
 #include "golomb.h"
 #include "hevc_ps.h"
 #include "mem.h"
+#include "memstats.h"
+#include "thread.h"
 
 //--------avcodec.h----------------
 enum AVPictureStructure {
@@ -39,6 +45,155 @@ enum AVPictureStructure {
 
 //--------------------------------
 
+#ifndef FF_CHECKED_READER
+static const size_t sei_msg_size[HEVC_SEI_MSG_NB] = {
+    [HEVC_SEI_MSG_PICTURE_HASH] = sizeof(HEVCSEIPictureHash),
+    [HEVC_SEI_MSG_FRAME_PACKING] = sizeof(HEVCSEIFramePacking),
+    [HEVC_SEI_MSG_DISPLAY_ORIENTATION] = sizeof(HEVCSEIDisplayOrientation),
+    [HEVC_SEI_MSG_BUFFERING_PERIOD] = sizeof(HEVCSEIBufferingPeriod),
+    [HEVC_SEI_MSG_PICTURE_TIMING] = sizeof(HEVCSEIPictureTiming),
+    [HEVC_SEI_MSG_A53_CAPTION] = sizeof(HEVCSEIA53Caption),
+    [HEVC_SEI_MSG_UNREGISTERED] = sizeof(HEVCSEIUnregistered),
+    [HEVC_SEI_MSG_MASTERING_DISPLAY] = sizeof(HEVCSEIMasteringDisplay),
+    [HEVC_SEI_MSG_DYNAMIC_HDR_PLUS] = sizeof(HEVCSEIDynamicHDRPlus),
+    [HEVC_SEI_MSG_CONTENT_LIGHT] = sizeof(HEVCSEIContentLight),
+    [HEVC_SEI_MSG_ALTERNATIVE_TRANSFER] = sizeof(HEVCSEIAlternativeTransfer),
+    [HEVC_SEI_MSG_TIMECODE] = sizeof(HEVCSEITimeCode),
+    [HEVC_SEI_MSG_FILM_GRAIN] = sizeof(HEVCSEIFilmGrainCharacteristics),
+};
+
+/* drop the buffers referenced by a message object */
+static void sei_msg_release(enum HEVCSEIMessage type, void *msg) {
+  switch (type) {
+  case HEVC_SEI_MSG_A53_CAPTION:
+    ff_h2645_sei_a53_caption_reset(msg);
+    break;
+  case HEVC_SEI_MSG_UNREGISTERED:
+    ff_h2645_sei_unregistered_reset(msg);
+    break;
+  case HEVC_SEI_MSG_DYNAMIC_HDR_PLUS:
+    ff_h2645_sei_dynamic_hdr_plus_reset(msg);
+    break;
+  default:
+    break;
+  }
+}
+
+/* Message objects are shared by all streams of the process. Pool buffers
+ * start zeroed, so the buffer references they embed are always either
+ * NULL or owned by the object. An object idle in its pool keeps them until
+ * it is reused or freed. */
+static AVBufferPool *sei_msg_pool[HEVC_SEI_MSG_NB];
+static AVOnce sei_msg_pool_once = AV_ONCE_INIT;
+
+static void sei_msg_free(void *opaque, uint8_t *data) {
+  sei_msg_release((intptr_t)opaque, data);
+  av_free(data);
+}
+
+static AVBufferRef *sei_msg_alloc(void *opaque, size_t size) {
+  uint8_t *data = av_mallocz(size);
+  AVBufferRef *ref;
+
+  if (!data)
+    return NULL;
+  ref = av_buffer_create(data, size, sei_msg_free, opaque, 0);
+  if (!ref)
+    av_free(data);
+  return ref;
+}
+
+static void sei_msg_pool_init(void) {
+  for (intptr_t i = 0; i < HEVC_SEI_MSG_NB; i++)
+    sei_msg_pool[i] =
+        av_buffer_pool_init2(sei_msg_size[i], (void *)i, sei_msg_alloc, NULL);
+}
+
+/* take new references to the buffers of src, a bytewise copy in dst */
+static int sei_msg_copy(enum HEVCSEIMessage type, void *dst, const void *src) {
+  memcpy(dst, src, sei_msg_size[type]);
+  switch (type) {
+  case HEVC_SEI_MSG_A53_CAPTION: {
+    HEVCSEIA53Caption *a53 = dst;
+    if (a53->buf_ref && !(a53->buf_ref = av_buffer_ref(a53->buf_ref)))
+      return AVERROR(ENOMEM);
+    break;
+  }
+  case HEVC_SEI_MSG_UNREGISTERED: {
+    HEVCSEIUnregistered *unreg = dst;
+    const HEVCSEIUnregistered *old = src;
+    unreg->buf_ref = NULL;
+    unreg->nb_buf_ref = 0;
+    if (!old->nb_buf_ref)
+      break;
+    unreg->buf_ref = av_calloc(old->nb_buf_ref, sizeof(*unreg->buf_ref));
+    if (!unreg->buf_ref)
+      return AVERROR(ENOMEM);
+    for (; unreg->nb_buf_ref < old->nb_buf_ref; unreg->nb_buf_ref++) {
+      unreg->buf_ref[unreg->nb_buf_ref] =
+          av_buffer_ref(old->buf_ref[unreg->nb_buf_ref]);
+      if (!unreg->buf_ref[unreg->nb_buf_ref])
+        return AVERROR(ENOMEM);
+    }
+    break;
+  }
+  case HEVC_SEI_MSG_DYNAMIC_HDR_PLUS: {
+    HEVCSEIDynamicHDRPlus *hdr = dst;
+    if (hdr->info && !(hdr->info = av_buffer_ref(hdr->info)))
+      return AVERROR(ENOMEM);
+    break;
+  }
+  default:
+    break;
+  }
+  return 0;
+}
+
+/**
+ * Get the message object of a slot for writing. The first message of a
+ * type in an access unit starts from a cleared object; further messages of
+ * the same type in that access unit update the same object. An object a
+ * caller still references is never written to, it is copied first.
+ */
+void *ff_hevc_sei_msg_get(HEVCSEI *s, enum HEVCSEIMessage type) {
+  AVBufferRef **ref = &s->msg[type];
+  int update = (s->received >> type) & 1;
+  AVBufferRef *old = NULL;
+
+  if (*ref && av_buffer_is_writable(*ref)) {
+    if (update)
+      return (*ref)->data;
+  } else {
+    if (update)
+      old = *ref;
+    else
+      av_buffer_unref(ref);
+    if (ff_thread_once(&sei_msg_pool_once, sei_msg_pool_init) ||
+        !sei_msg_pool[type] ||
+        !(*ref = av_buffer_pool_get(sei_msg_pool[type]))) {
+      if (!(*ref = old))
+        s->present &= ~(1U << type);
+      return NULL;
+    }
+  }
+  sei_msg_release(type, (*ref)->data);
+  memset((*ref)->data, 0, sei_msg_size[type]);
+  if (old) {
+    int ret = sei_msg_copy(type, (*ref)->data, old->data);
+    av_buffer_unref(&old);
+    if (ret < 0) {
+      sei_msg_release(type, (*ref)->data);
+      s->present &= ~(1U << type);
+      s->received &= ~(1U << type);
+      return NULL;
+    }
+  }
+  s->present |= 1U << type;
+  s->received |= 1U << type;
+  return (*ref)->data;
+}
+#endif
+
 static int decode_nal_sei_decoded_picture_hash(HEVCSEIPictureHash *s,
                                                GetBitContext *gb) {
   int cIdx, i;
@@ -64,54 +219,6 @@ static int decode_nal_sei_decoded_picture_hash(HEVCSEIPictureHash *s,
   return 0;
 }
 
-static int decode_nal_sei_mastering_display_info(HEVCSEIMasteringDisplay *s,
-                                                 GetBitContext *gb, int size) {
-  int i;
-
-  if (size < 24)
-    return AVERROR_INVALIDDATA;
-
-  // Mastering primaries
-  for (i = 0; i < 3; i++) {
-    s->display_primaries[i][0] = get_bits(gb, 16);
-    s->display_primaries[i][1] = get_bits(gb, 16);
-  }
-  // White point (x, y)
-  s->white_point[0] = get_bits(gb, 16);
-  s->white_point[1] = get_bits(gb, 16);
-
-  // Max and min luminance of mastering display
-  s->max_luminance = get_bits_long(gb, 32);
-  s->min_luminance = get_bits_long(gb, 32);
-  size -= 24;
-
-  // As this SEI message comes before the first frame that references it,
-  // initialize the flag to 2 and decrement on IRAP access unit so it
-  // persists for the coded video sequence (e.g., between two IRAPs)
-  s->present = 2;
-
-  skip_bits_long(gb, 8 * size);
-  return 0;
-}
-
-static int decode_nal_sei_content_light_info(HEVCSEIContentLight *s,
-                                             GetBitContext *gb, int size) {
-  if (size < 4)
-    return AVERROR_INVALIDDATA;
-
-  // Max and average light levels
-  s->max_content_light_level = get_bits(gb, 16);
-  s->max_pic_average_light_level = get_bits(gb, 16);
-  size -= 4;
-  // As this SEI message comes before the first frame that references it,
-  // initialize the flag to 2 and decrement on IRAP access unit so it
-  // persists for the coded video sequence (e.g., between two IRAPs)
-  s->present = 2;
-
-  skip_bits_long(gb, 8 * size);
-  return 0;
-}
-
 static int decode_nal_sei_frame_packing_arrangement(HEVCSEIFramePacking *s,
                                                     GetBitContext *gb) {
   get_ue_golomb_long(gb); // frame_packing_arrangement_id
@@ -152,106 +259,128 @@ static int decode_nal_sei_display_orientation(HEVCSEIDisplayOrientation *s,
   return 0;
 }
 
+static int decode_nal_sei_buffering_period(HEVCSEI *s, GetBitContext *gb,
+                                           const HEVCParamSets *ps,
+                                           void *logctx, int size) {
+  HEVCSEIBufferingPeriod *h;
+  const HEVCHRDParams *hrd;
+  const HEVCSPS *sps;
+  int start = get_bits_count(gb);
+  unsigned int sps_id;
+  int i, len;
+
+  sps_id = get_ue_golomb_31(gb);
+  if (sps_id >= HEVC_MAX_SPS_COUNT || !ps->sps_list[sps_id]) {
+    av_log(logctx, AV_LOG_ERROR,
+           "non-existing SPS %d referenced in buffering period\n", sps_id);
+    return AVERROR_INVALIDDATA;
+  }
+  sps = (const HEVCSPS *)ps->sps_list[sps_id]->data;
+  hrd = &sps->vui.hrd_params;
+
+  h = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_BUFFERING_PERIOD);
+  if (!h)
+    return AVERROR(ENOMEM);
+  h->seq_parameter_set_id = sps_id;
+  s->active_seq_parameter_set_id = sps_id;
+
+  if (!sps->vui.vui_hrd_parameters_present_flag) {
+    skip_bits_long(gb, 8 * size - (get_bits_count(gb) - start));
+    return 0;
+  }
+
+  h->irap_cpb_params_present_flag = 0;
+  if (!hrd->sub_pic_hrd_params_present_flag)
+    h->irap_cpb_params_present_flag = get_bits1(gb);
+  if (h->irap_cpb_params_present_flag) {
+    h->cpb_delay_offset = get_bits_long(gb, hrd->au_cpb_removal_delay_length);
+    h->dpb_delay_offset = get_bits_long(gb, hrd->dpb_output_delay_length);
+  }
+  h->concatenation_flag = get_bits1(gb);
+  h->au_cpb_removal_delay_delta =
+      get_bits_long(gb, hrd->au_cpb_removal_delay_length) + 1;
+
+  h->nb_cpb = hrd->cpb_cnt[sps->max_sub_layers - 1];
+  len = hrd->initial_cpb_removal_delay_length;
+  if (hrd->nal_hrd_parameters_present_flag) {
+    for (i = 0; i < h->nb_cpb; i++) {
+      h->nal_initial_cpb_removal_delay[i] = get_bits_long(gb, len);
+      h->nal_initial_cpb_removal_offset[i] = get_bits_long(gb, len);
+      if (hrd->sub_pic_hrd_params_present_flag ||
+          h->irap_cpb_params_present_flag)
+        skip_bits_long(gb, 2 * len); // nal_initial_alt_cpb_removal_*
+    }
+  }
+  if (hrd->vcl_hrd_parameters_present_flag) {
+    for (i = 0; i < h->nb_cpb; i++) {
+      h->vcl_initial_cpb_removal_delay[i] = get_bits_long(gb, len);
+      h->vcl_initial_cpb_removal_offset[i] = get_bits_long(gb, len);
+      if (hrd->sub_pic_hrd_params_present_flag ||
+          h->irap_cpb_params_present_flag)
+        skip_bits_long(gb, 2 * len); // vcl_initial_alt_cpb_removal_*
+    }
+  }
+
+  len = get_bits_count(gb) - start;
+  if (len > 8 * size)
+    return AVERROR_INVALIDDATA;
+  skip_bits_long(gb, 8 * size - len);
+  h->present = 1;
+
+  return 0;
+}
+
 static int decode_nal_sei_pic_timing(HEVCSEI *s, GetBitContext *gb,
                                      const HEVCParamSets *ps, void *logctx,
                                      int size) {
-  HEVCSEIPictureTiming *h = &s->picture_timing;
+  HEVCSEIPictureTiming *h;
+  const HEVCHRDParams *hrd;
   HEVCSPS *sps;
+  int start = get_bits_count(gb);
+  int len;
 
   if (!ps->sps_list[s->active_seq_parameter_set_id])
     return (AVERROR(ENOMEM));
   sps = (HEVCSPS *)ps->sps_list[s->active_seq_parameter_set_id]->data;
+  hrd = &sps->vui.hrd_params;
+
+  h = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_PICTURE_TIMING);
+  if (!h)
+    return AVERROR(ENOMEM);
 
   if (sps->vui.frame_field_info_present_flag) {
     int pic_struct = get_bits(gb, 4);
     h->picture_struct = AV_PICTURE_STRUCTURE_UNKNOWN;
     if (pic_struct == 2 || pic_struct == 10 || pic_struct == 12) {
-      printf("BOTTOM Field\n");
+      av_log(logctx, AV_LOG_DEBUG, "BOTTOM Field\n");
       h->picture_struct = AV_PICTURE_STRUCTURE_BOTTOM_FIELD;
     } else if (pic_struct == 1 || pic_struct == 9 || pic_struct == 11) {
-      printf("TOP Field\n");
+      av_log(logctx, AV_LOG_DEBUG, "TOP Field\n");
       h->picture_struct = AV_PICTURE_STRUCTURE_TOP_FIELD;
     } else if (pic_struct == 7) {
-      printf("Frame/Field Doubling\n");
+      av_log(logctx, AV_LOG_DEBUG, "Frame/Field Doubling\n");
       h->picture_struct = HEVC_SEI_PIC_STRUCT_FRAME_DOUBLING;
     } else if (pic_struct == 8) {
-      printf("Frame/Field Tripling\n");
+      av_log(logctx, AV_LOG_DEBUG, "Frame/Field Tripling\n");
       h->picture_struct = HEVC_SEI_PIC_STRUCT_FRAME_TRIPLING;
     }
     get_bits(gb, 2); // source_scan_type
     get_bits(gb, 1); // duplicate_flag
-    skip_bits1(gb);
-    size--;
-  }
-  skip_bits_long(gb, 8 * size);
-
-  return 0;
-}
-
-static int decode_registered_user_data_closed_caption(HEVCSEIA53Caption *s,
-                                                      GetBitContext *gb,
-                                                      int size) {
-  int ret;
-
-  ret = ff_parse_a53_cc(&s->buf_ref, gb->buffer + get_bits_count(gb) / 8, size);
-
-  if (ret < 0)
-    return ret;
-
-  skip_bits_long(gb, size * 8);
-
-  return 0;
-}
-
-static int decode_nal_sei_user_data_unregistered(HEVCSEIUnregistered *s,
-                                                 GetBitContext *gb, int size) {
-  AVBufferRef *buf_ref, **tmp;
-
-  if (size < 16 || size >= INT_MAX - 1)
-    return AVERROR_INVALIDDATA;
-
-  tmp = av_realloc_array(s->buf_ref, s->nb_buf_ref + 1, sizeof(*s->buf_ref));
-  if (!tmp)
-    return AVERROR(ENOMEM);
-  s->buf_ref = tmp;
-
-  buf_ref = av_buffer_alloc(size + 1);
-  if (!buf_ref)
-    return AVERROR(ENOMEM);
-
-  for (int i = 0; i < size; i++)
-    buf_ref->data[i] = get_bits(gb, 8);
-  buf_ref->data[size] = 0;
-  buf_ref->size = size;
-  s->buf_ref[s->nb_buf_ref++] = buf_ref;
-
-  return 0;
-}
-
-static int
-decode_registered_user_data_dynamic_hdr_plus(HEVCSEIDynamicHDRPlus *s,
-                                             GetBitContext *gb, int size) {
-  size_t meta_size;
-  int err;
-  AVDynamicHDRPlus *metadata = av_dynamic_hdr_plus_alloc(&meta_size);
-  if (!metadata)
-    return AVERROR(ENOMEM);
-
-  err = ff_parse_itu_t_t35_to_dynamic_hdr10_plus(
-      metadata, gb->buffer + get_bits_count(gb) / 8, size);
-  if (err < 0) {
-    av_free(metadata);
-    return err;
   }
 
-  av_buffer_unref(&s->info);
-  s->info = av_buffer_create((uint8_t *)metadata, meta_size, NULL, NULL, 0);
-  if (!s->info) {
-    av_free(metadata);
-    return AVERROR(ENOMEM);
+  if (sps->vui.vui_hrd_parameters_present_flag &&
+      (hrd->nal_hrd_parameters_present_flag ||
+       hrd->vcl_hrd_parameters_present_flag)) {
+    h->au_cpb_removal_delay =
+        get_bits_long(gb, hrd->au_cpb_removal_delay_length) + 1;
+    h->pic_dpb_output_delay = get_bits_long(gb, hrd->dpb_output_delay_length);
+    h->present = 1;
   }
 
-  skip_bits_long(gb, size * 8);
+  len = get_bits_count(gb) - start;
+  if (len > 8 * size)
+    return AVERROR_INVALIDDATA;
+  skip_bits_long(gb, 8 * size - len);
 
   return 0;
 }
@@ -260,81 +389,26 @@ static int decode_nal_sei_user_data_registered_itu_t_t35(HEVCSEI *s,
                                                          GetBitContext *gb,
                                                          void *logctx,
                                                          int size) {
-  int country_code, provider_code;
-
-  if (size < 3)
-    return AVERROR_INVALIDDATA;
-  size -= 3;
-
-  country_code = get_bits(gb, 8);
-  if (country_code == 0xFF) {
-    if (size < 1)
-      return AVERROR_INVALIDDATA;
-
-    skip_bits(gb, 8);
-    size--;
-  }
-
-  if (country_code != 0xB5) { // usa_country_code
-    printf("Unsupported User Data Registered ITU-T T35 SEI message "
-           "(country_code = %d)\n",
-           country_code);
-    goto end;
-  }
-
-  provider_code = get_bits(gb, 16);
-
-  switch (provider_code) {
-  case 0x3C: { // smpte_provider_code
-    // A/341 Amendment - 2094-40
-    const uint16_t smpte2094_40_provider_oriented_code = 0x0001;
-    const uint8_t smpte2094_40_application_identifier = 0x04;
-    uint16_t provider_oriented_code;
-    uint8_t application_identifier;
-
-    if (size < 3)
-      return AVERROR_INVALIDDATA;
-    size -= 3;
-
-    provider_oriented_code = get_bits(gb, 16);
-    application_identifier = get_bits(gb, 8);
-    if (provider_oriented_code == smpte2094_40_provider_oriented_code &&
-        application_identifier == smpte2094_40_application_identifier) {
-      return decode_registered_user_data_dynamic_hdr_plus(&s->dynamic_hdr_plus,
-                                                          gb, size);
-    }
-    break;
-  }
-  case 0x31: { // atsc_provider_code
-    uint32_t user_identifier;
-
-    if (size < 4)
-      return AVERROR_INVALIDDATA;
-    size -= 4;
-
-    user_identifier = get_bits_long(gb, 32);
-    switch (user_identifier) {
-    case MKBETAG('G', 'A', '9', '4'):
-      return decode_registered_user_data_closed_caption(&s->a53_caption, gb,
-                                                        size);
-    default:
-      printf("Unsupported User Data Registered ITU-T T35 SEI message (atsc "
-             "user_identifier = 0x%04x)\n",
-             user_identifier);
-      break;
-    }
-    break;
-  }
+  void *msg;
+  int ret = ff_h2645_sei_t35_header(gb, logctx, &size);
+
+  switch (ret) {
+  case H2645_SEI_T35_HDR10_PLUS:
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_DYNAMIC_HDR_PLUS)))
+      return AVERROR(ENOMEM);
+    return ff_h2645_sei_dynamic_hdr_plus(msg, gb, size);
+  case H2645_SEI_T35_A53_CC:
+    if (s->cc_ring)
+      return ff_h2645_sei_a53_caption_ring(s->cc_ring, s->cc_pts, gb, size);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_A53_CAPTION)))
+      return AVERROR(ENOMEM);
+    return ff_h2645_sei_a53_caption(msg, gb, size);
+  case H2645_SEI_T35_UNKNOWN:
+    skip_bits_long(gb, size * 8);
+    return 0;
   default:
-    printf("Unsupported User Data Registered ITU-T T35 SEI message "
-           "(provider_code = %d)\n",
-           provider_code);
-    break;
+    return ret;
   }
-
-end:
-  skip_bits_long(gb, size * 8);
-  return 0;
 }
 
 static int decode_nal_sei_active_parameter_sets(HEVCSEI *s, GetBitContext *gb,
@@ -349,13 +423,15 @@ static int decode_nal_sei_active_parameter_sets(HEVCSEI *s, GetBitContext *gb,
   num_sps_ids_minus1 = get_ue_golomb_long(gb); // num_sps_ids_minus1
 
   if (num_sps_ids_minus1 < 0 || num_sps_ids_minus1 > 15) {
-    printf("num_sps_ids_minus1 %d invalid\n", num_sps_ids_minus1);
+    av_log(logctx, AV_LOG_ERROR, "num_sps_ids_minus1 %d invalid\n",
+           num_sps_ids_minus1);
     return AVERROR_INVALIDDATA;
   }
 
   active_seq_parameter_set_id = get_ue_golomb_long(gb);
   if (active_seq_parameter_set_id >= HEVC_MAX_SPS_COUNT) {
-    printf("active_parameter_set_id %d invalid\n", active_seq_parameter_set_id);
+    av_log(logctx, AV_LOG_ERROR, "active_parameter_set_id %d invalid\n",
+           active_seq_parameter_set_id);
     return AVERROR_INVALIDDATA;
   }
   s->active_seq_parameter_set_id = active_seq_parameter_set_id;
@@ -468,36 +544,55 @@ static int decode_film_grain_characteristics(HEVCSEIFilmGrainCharacteristics *h,
 
 static int decode_nal_sei_prefix(GetBitContext *gb, void *logctx, HEVCSEI *s,
                                  const HEVCParamSets *ps, int type, int size) {
+  void *msg;
+
   switch (type) {
+  case SEI_TYPE_BUFFERING_PERIOD:
+    return decode_nal_sei_buffering_period(s, gb, ps, logctx, size);
   case 256: // Mismatched value from HM 8.1
-    return decode_nal_sei_decoded_picture_hash(&s->picture_hash, gb);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_PICTURE_HASH)))
+      return AVERROR(ENOMEM);
+    return decode_nal_sei_decoded_picture_hash(msg, gb);
   case SEI_TYPE_FRAME_PACKING_ARRANGEMENT:
-    return decode_nal_sei_frame_packing_arrangement(&s->frame_packing, gb);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_FRAME_PACKING)))
+      return AVERROR(ENOMEM);
+    return decode_nal_sei_frame_packing_arrangement(msg, gb);
   case SEI_TYPE_DISPLAY_ORIENTATION:
-    return decode_nal_sei_display_orientation(&s->display_orientation, gb);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_DISPLAY_ORIENTATION)))
+      return AVERROR(ENOMEM);
+    return decode_nal_sei_display_orientation(msg, gb);
   case SEI_TYPE_PIC_TIMING:
     return decode_nal_sei_pic_timing(s, gb, ps, logctx, size);
   case SEI_TYPE_MASTERING_DISPLAY_COLOUR_VOLUME:
-    return decode_nal_sei_mastering_display_info(&s->mastering_display, gb,
-                                                 size);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_MASTERING_DISPLAY)))
+      return AVERROR(ENOMEM);
+    return ff_h2645_sei_mastering_display(msg, gb, size);
   case SEI_TYPE_CONTENT_LIGHT_LEVEL_INFO:
-    return decode_nal_sei_content_light_info(&s->content_light, gb, size);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_CONTENT_LIGHT)))
+      return AVERROR(ENOMEM);
+    return ff_h2645_sei_content_light(msg, gb, size);
   case SEI_TYPE_ACTIVE_PARAMETER_SETS:
     return decode_nal_sei_active_parameter_sets(s, gb, logctx);
   case SEI_TYPE_USER_DATA_REGISTERED_ITU_T_T35:
     return decode_nal_sei_user_data_registered_itu_t_t35(s, gb, logctx, size);
   case SEI_TYPE_USER_DATA_UNREGISTERED:
-    return decode_nal_sei_user_data_unregistered(&s->unregistered, gb, size);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_UNREGISTERED)))
+      return AVERROR(ENOMEM);
+    return ff_h2645_sei_unregistered(msg, gb, size);
   case SEI_TYPE_ALTERNATIVE_TRANSFER_CHARACTERISTICS:
-    return decode_nal_sei_alternative_transfer(&s->alternative_transfer, gb,
-                                               size);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_ALTERNATIVE_TRANSFER)))
+      return AVERROR(ENOMEM);
+    return decode_nal_sei_alternative_transfer(msg, gb, size);
   case SEI_TYPE_TIME_CODE:
-    return decode_nal_sei_timecode(&s->timecode, gb);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_TIMECODE)))
+      return AVERROR(ENOMEM);
+    return decode_nal_sei_timecode(msg, gb);
   case SEI_TYPE_FILM_GRAIN_CHARACTERISTICS:
-    return decode_film_grain_characteristics(&s->film_grain_characteristics,
-                                             gb);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_FILM_GRAIN)))
+      return AVERROR(ENOMEM);
+    return decode_film_grain_characteristics(msg, gb);
   default:
-    printf("Skipped PREFIX SEI %d\n", type);
+    av_log(logctx, AV_LOG_DEBUG, "Skipped PREFIX SEI %d\n", type);
     skip_bits_long(gb, 8 * size);
     return 0;
   }
@@ -505,11 +600,15 @@ static int decode_nal_sei_prefix(GetBitContext *gb, void *logctx, HEVCSEI *s,
 
 static int decode_nal_sei_suffix(GetBitContext *gb, void *logctx, HEVCSEI *s,
                                  int type, int size) {
+  void *msg;
+
   switch (type) {
   case SEI_TYPE_DECODED_PICTURE_HASH:
-    return decode_nal_sei_decoded_picture_hash(&s->picture_hash, gb);
+    if (!(msg = ff_hevc_sei_msg_get(s, HEVC_SEI_MSG_PICTURE_HASH)))
+      return AVERROR(ENOMEM);
+    return decode_nal_sei_decoded_picture_hash(msg, gb);
   default:
-    printf("Skipped SUFFIX SEI %d\n", type);
+    av_log(logctx, AV_LOG_DEBUG, "Skipped SUFFIX SEI %d\n", type);
     skip_bits_long(gb, 8 * size);
     return 0;
   }
@@ -517,55 +616,91 @@ static int decode_nal_sei_suffix(GetBitContext *gb, void *logctx, HEVCSEI *s,
 
 static int decode_nal_sei_message(GetBitContext *gb, void *logctx, HEVCSEI *s,
                                   const HEVCParamSets *ps, int nal_unit_type) {
-  int payload_type = 0;
-  int payload_size = 0;
-  int byte = 0xFF;
-  printf("Decoding SEI\n");
-
-  while (byte == 0xFF) {
-    if (get_bits_left(gb) < 16 || payload_type > INT_MAX - 255)
-      return AVERROR_INVALIDDATA;
-    byte = get_bits(gb, 8);
-    payload_type += byte;
-  }
-  byte = 0xFF;
-  while (byte == 0xFF) {
-    if (get_bits_left(gb) < 8 + 8LL * payload_size)
-      return AVERROR_INVALIDDATA;
-    byte = get_bits(gb, 8);
-    payload_size += byte;
+  int payload_type, payload_size;
+  int start, ret;
+  av_log(logctx, AV_LOG_DEBUG, "Decoding SEI\n");
+
+  ret = ff_h2645_sei_message_header(gb, &payload_type, &payload_size);
+  if (ret < 0)
+    return ret;
+  if (s->filter) {
+    HEVCSEIFilter *f = s->filter;
+    if (ff_hevc_sei_mask_test(f->view, payload_type)) {
+      if (f->nb_views < f->max_views) {
+        HEVCSEIPayloadView *v = &f->views[f->nb_views];
+        v->type = payload_type;
+        v->nal_unit_type = nal_unit_type;
+        v->offset = get_bits_count(gb) >> 3;
+        v->size = payload_size;
+      }
+      f->nb_views++;
+    }
+    if (!ff_hevc_sei_mask_test(f->parse, payload_type)) {
+      skip_bits_long(gb, 8 * payload_size);
+      return 0;
+    }
   }
-  if (get_bits_left(gb) < 8LL * payload_size)
-    return AVERROR_INVALIDDATA;
+  start = get_bits_count(gb);
   if (nal_unit_type == HEVC_NAL_SEI_PREFIX) {
-    return decode_nal_sei_prefix(gb, logctx, s, ps, payload_type, payload_size);
+    ret = decode_nal_sei_prefix(gb, logctx, s, ps, payload_type, payload_size);
   } else { /* nal_unit_type == NAL_SEI_SUFFIX */
-    return decode_nal_sei_suffix(gb, logctx, s, payload_type, payload_size);
+    ret = decode_nal_sei_suffix(gb, logctx, s, payload_type, payload_size);
   }
+  /* resync on the payload size for parsers that stop short of it */
+  if (ret >= 0 && get_bits_count(gb) < start + 8 * payload_size)
+    skip_bits_long(gb, start + 8 * payload_size - get_bits_count(gb));
+  return ret;
 }
 
-static int more_rbsp_data(GetBitContext *gb) {
-  return get_bits_left(gb) > 0 && show_bits(gb, 8) != 0x80;
-}
-
-int ff_hevc_decode_nal_sei(GetBitContext *gb, void *logctx, HEVCSEI *s,
-                           const HEVCParamSets *ps, int type) {
+static int decode_sei(GetBitContext *gb, void *logctx, HEVCSEI *s,
+                      const HEVCParamSets *ps, int type) {
   int ret;
 
   do {
     ret = decode_nal_sei_message(gb, logctx, s, ps, type);
     if (ret < 0)
       return ret;
-  } while (more_rbsp_data(gb));
+  } while (ff_h2645_sei_more_rbsp_data(gb));
   return 1;
 }
 
+int ff_hevc_decode_nal_sei(GetBitContext *gb, void *logctx, HEVCSEI *s,
+                           const HEVCParamSets *ps, int type) {
+  enum FFMemTag tag;
+  int ret;
+
+#ifndef FF_CHECKED_READER
+  if (!get_bits_trusted(gb, HEVC_SEI_MAX_OVERREAD_BITS))
+    return ff_hevc_decode_nal_sei_checked(gb, logctx, s, ps, type);
+#endif
+  tag = ff_mem_set_tag(FF_MEM_TAG_SEI);
+  ret = decode_sei(gb, logctx, s, ps, type);
+  ff_mem_set_tag(tag);
+  return ret;
+}
+
+#ifndef FF_CHECKED_READER
 void ff_hevc_reset_sei(HEVCSEI *s) {
-  av_buffer_unref(&s->a53_caption.buf_ref);
+  if (s->filter)
+    s->filter->nb_views = 0;
+  s->present &= HEVC_SEI_MSG_PERSISTENT;
+  s->received = 0;
+}
+
+void ff_hevc_uninit_sei(HEVCSEI *s) {
+  for (int i = 0; i < HEVC_SEI_MSG_NB; i++) {
+    if (s->msg[i] && av_buffer_is_writable(s->msg[i]))
+      sei_msg_release(i, s->msg[i]->data);
+    av_buffer_unref(&s->msg[i]);
+  }
+  ff_hevc_reset_sei(s);
+  s->present = 0;
+}
 
-  for (int i = 0; i < s->unregistered.nb_buf_ref; i++)
-    av_buffer_unref(&s->unregistered.buf_ref[i]);
-  s->unregistered.nb_buf_ref = 0;
-  av_freep(&s->unregistered.buf_ref);
-  av_buffer_unref(&s->dynamic_hdr_plus.info);
+void ff_hevc_sei_pool_trim(void) {
+  if (ff_thread_once(&sei_msg_pool_once, sei_msg_pool_init))
+    return;
+  for (int i = 0; i < HEVC_SEI_MSG_NB; i++)
+    ff_buffer_pool_trim(sei_msg_pool[i]);
 }
+#endif
@@ -26,8 +26,16 @@
 #include "buffer.h"
 
 #include "get_bits.h"
+#include "h2645_sei.h"
+#include "hevc.h"
 #include "sei.h"
 
+/* Most bits a message parser reads, past the end of a hostile NAL unit if it
+ * is short; see get_bits_trusted(). Film grain characteristics read the
+ * most, the other messages at most 8299 bits. */
+#define HEVC_SEI_MAX_OVERREAD_BITS                                             \
+  (45 + 3 * (8 + 3 + 256 * (8 + 8 + 6 * 63)))
+
 typedef enum {
   HEVC_SEI_PIC_STRUCT_FRAME_DOUBLING = 7,
   HEVC_SEI_PIC_STRUCT_FRAME_TRIPLING = 8
@@ -52,36 +60,37 @@ typedef struct HEVCSEIDisplayOrientation {
   int hflip, vflip;
 } HEVCSEIDisplayOrientation;
 
+typedef struct HEVCSEIBufferingPeriod {
+  int present;
+  int seq_parameter_set_id;
+  int irap_cpb_params_present_flag;
+  uint32_t cpb_delay_offset;
+  uint32_t dpb_delay_offset;
+  int concatenation_flag;
+  uint32_t au_cpb_removal_delay_delta; ///< au_cpb_removal_delay_delta_minus1 + 1
+  int nb_cpb;
+  uint32_t nal_initial_cpb_removal_delay[HEVC_MAX_CPB_CNT];
+  uint32_t nal_initial_cpb_removal_offset[HEVC_MAX_CPB_CNT];
+  uint32_t vcl_initial_cpb_removal_delay[HEVC_MAX_CPB_CNT];
+  uint32_t vcl_initial_cpb_removal_offset[HEVC_MAX_CPB_CNT];
+} HEVCSEIBufferingPeriod;
+
 typedef struct HEVCSEIPictureTiming {
   int picture_struct;
+  int present;                   ///< CPB/DPB delays below are valid
+  uint32_t au_cpb_removal_delay; ///< au_cpb_removal_delay_minus1 + 1
+  uint32_t pic_dpb_output_delay;
 } HEVCSEIPictureTiming;
 
-typedef struct HEVCSEIA53Caption {
-  AVBufferRef *buf_ref;
-} HEVCSEIA53Caption;
+typedef H2645SEIA53Caption HEVCSEIA53Caption;
 
-typedef struct HEVCSEIUnregistered {
-  AVBufferRef **buf_ref;
-  int nb_buf_ref;
-} HEVCSEIUnregistered;
+typedef H2645SEIUnregistered HEVCSEIUnregistered;
 
-typedef struct HEVCSEIMasteringDisplay {
-  int present;
-  uint16_t display_primaries[3][2];
-  uint16_t white_point[2];
-  uint32_t max_luminance;
-  uint32_t min_luminance;
-} HEVCSEIMasteringDisplay;
+typedef H2645SEIMasteringDisplay HEVCSEIMasteringDisplay;
 
-typedef struct HEVCSEIDynamicHDRPlus {
-  AVBufferRef *info;
-} HEVCSEIDynamicHDRPlus;
+typedef H2645SEIDynamicHDRPlus HEVCSEIDynamicHDRPlus;
 
-typedef struct HEVCSEIContentLight {
-  int present;
-  uint16_t max_content_light_level;
-  uint16_t max_pic_average_light_level;
-} HEVCSEIContentLight;
+typedef H2645SEIContentLight HEVCSEIContentLight;
 
 typedef struct HEVCSEIAlternativeTransfer {
   int present;
@@ -129,34 +138,144 @@ typedef struct HEVCSEIFilmGrainCharacteristics {
   int persistence_flag;
 } HEVCSEIFilmGrainCharacteristics;
 
+/**
+ * Location of an SEI payload inside the SEI RBSP the parser was given.
+ */
+typedef struct HEVCSEIPayloadView {
+  int type;
+  int nal_unit_type; ///< HEVC_NAL_SEI_PREFIX or HEVC_NAL_SEI_SUFFIX
+  int offset;        ///< byte offset of the payload in the RBSP
+  int size;          ///< payload size in bytes
+} HEVCSEIPayloadView;
+
+/* types 0 - 255 one bit each, then one bit for all larger types */
+#define HEVC_SEI_MASK_WORDS 5
+
+/**
+ * Payload type interest mask. Types 0 - 255 have a bit each; the types
+ * from 256 on, all reserved, share one bit, so selecting any of them
+ * selects them all. Payloads not selected by either mask are skipped by
+ * size, unparsed.
+ */
+typedef struct HEVCSEIFilter {
+  uint64_t parse[HEVC_SEI_MASK_WORDS]; ///< types parsed into HEVCSEI
+  uint64_t view[HEVC_SEI_MASK_WORDS];  ///< types reported as views
+  HEVCSEIPayloadView *views;           ///< caller owned, max_views entries
+  int max_views;
+  int nb_views; ///< may exceed max_views, extra views are not stored
+} HEVCSEIFilter;
+
+static inline void ff_hevc_sei_mask_set(uint64_t *mask, int type) {
+  if (type < 0)
+    return;
+  type = FFMIN(type, 256);
+  mask[type >> 6] |= 1ULL << (type & 63);
+}
+
+static inline int ff_hevc_sei_mask_test(const uint64_t *mask, int type) {
+  if (type < 0)
+    return 0;
+  type = FFMIN(type, 256);
+  return (mask[type >> 6] >> (type & 63)) & 1;
+}
+
+/**
+ * Message slots of HEVCSEI, one per stored SEI message type.
+ */
+enum HEVCSEIMessage {
+  HEVC_SEI_MSG_PICTURE_HASH,         ///< HEVCSEIPictureHash
+  HEVC_SEI_MSG_FRAME_PACKING,        ///< HEVCSEIFramePacking
+  HEVC_SEI_MSG_DISPLAY_ORIENTATION,  ///< HEVCSEIDisplayOrientation
+  HEVC_SEI_MSG_BUFFERING_PERIOD,     ///< HEVCSEIBufferingPeriod
+  HEVC_SEI_MSG_PICTURE_TIMING,       ///< HEVCSEIPictureTiming
+  HEVC_SEI_MSG_A53_CAPTION,          ///< HEVCSEIA53Caption
+  HEVC_SEI_MSG_UNREGISTERED,         ///< HEVCSEIUnregistered
+  HEVC_SEI_MSG_MASTERING_DISPLAY,    ///< HEVCSEIMasteringDisplay
+  HEVC_SEI_MSG_DYNAMIC_HDR_PLUS,     ///< HEVCSEIDynamicHDRPlus
+  HEVC_SEI_MSG_CONTENT_LIGHT,        ///< HEVCSEIContentLight
+  HEVC_SEI_MSG_ALTERNATIVE_TRANSFER, ///< HEVCSEIAlternativeTransfer
+  HEVC_SEI_MSG_TIMECODE,             ///< HEVCSEITimeCode
+  HEVC_SEI_MSG_FILM_GRAIN,           ///< HEVCSEIFilmGrainCharacteristics
+  HEVC_SEI_MSG_NB
+};
+
+/**
+ * Messages that stay valid past their access unit until replaced by a
+ * message of the same type: frame packing and display orientation with
+ * their persistence flags, and the colour volume and film grain messages
+ * that apply to the whole CVS.
+ */
+#define HEVC_SEI_MSG_PERSISTENT                                                \
+  (1U << HEVC_SEI_MSG_FRAME_PACKING | 1U << HEVC_SEI_MSG_DISPLAY_ORIENTATION | \
+   1U << HEVC_SEI_MSG_MASTERING_DISPLAY | 1U << HEVC_SEI_MSG_CONTENT_LIGHT |   \
+   1U << HEVC_SEI_MSG_ALTERNATIVE_TRANSFER | 1U << HEVC_SEI_MSG_FILM_GRAIN)
+
+/**
+ * SEI state of a stream. Messages live in refcounted objects taken from a
+ * per type pool when a message arrives; a message is valid for the current
+ * access unit if its bit is set in present, which covers messages of this
+ * access unit and the HEVC_SEI_MSG_PERSISTENT ones of earlier access units.
+ * Callers may keep a message beyond ff_hevc_reset_sei() by taking a
+ * reference to its buffer; the parser then writes to a copy.
+ */
 typedef struct HEVCSEI {
-  HEVCSEIPictureHash picture_hash;
-  HEVCSEIFramePacking frame_packing;
-  HEVCSEIDisplayOrientation display_orientation;
-  HEVCSEIPictureTiming picture_timing;
-  HEVCSEIA53Caption a53_caption;
-  HEVCSEIUnregistered unregistered;
-  HEVCSEIMasteringDisplay mastering_display;
-  HEVCSEIDynamicHDRPlus dynamic_hdr_plus;
-  HEVCSEIContentLight content_light;
+  HEVCSEIFilter *filter; ///< NULL to parse every payload
+  uint32_t present;      ///< 1 << enum HEVCSEIMessage for each valid message
+  uint32_t received;     ///< messages received in the current access unit
   int active_seq_parameter_set_id;
-  HEVCSEIAlternativeTransfer alternative_transfer;
-  HEVCSEITimeCode timecode;
-  HEVCSEIFilmGrainCharacteristics film_grain_characteristics;
+  AVBufferRef *msg[HEVC_SEI_MSG_NB];
+
+  A53CCRing *cc_ring; ///< if set, captions go here instead of the A53 slot
+  int64_t cc_pts;     ///< AU index or PTS tagged on the captions
 } HEVCSEI;
 
+/**
+ * @return the message of the given slot, NULL if not valid for the
+ *         current access unit
+ */
+static inline void *ff_hevc_sei_get(const HEVCSEI *s,
+                                    enum HEVCSEIMessage type) {
+  return (s->present >> type) & 1 ? s->msg[type]->data : NULL;
+}
+
 struct HEVCParamSets;
 
 int ff_hevc_decode_nal_sei(GetBitContext *gb, void *logctx, HEVCSEI *s,
                            const struct HEVCParamSets *ps, int type);
 
+/**
+ * ff_hevc_decode_nal_sei() with overread checks, for NAL units without the
+ * padding it needs to read them unchecked.
+ */
+int ff_hevc_decode_nal_sei_checked(GetBitContext *gb, void *logctx,
+                                   HEVCSEI *s, const struct HEVCParamSets *ps,
+                                   int type);
+
+/**
+ * Get the message object of a slot for writing, shared by both builds of
+ * the parser.
+ */
+void *ff_hevc_sei_msg_get(HEVCSEI *s, enum HEVCSEIMessage type);
+
 /**
  * Reset SEI values that are stored on the Context.
  * e.g. Caption data that was extracted during NAL
- * parsing.
+ * parsing. Views collected by the filter are dropped too.
+ * HEVC_SEI_MSG_PERSISTENT messages stay valid, the other message objects
+ * are kept for reuse by the next access unit.
  *
  * @param s HEVCContext.
  */
 void ff_hevc_reset_sei(HEVCSEI *s);
 
+/**
+ * Release all message objects held by the SEI state.
+ */
+void ff_hevc_uninit_sei(HEVCSEI *s);
+
+/**
+ * Free the idle message objects kept for reuse by all streams.
+ */
+void ff_hevc_sei_pool_trim(void);
+
 #endif /* AVCODEC_HEVC_SEI_H */
@@ -0,0 +1,285 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Leaky bucket CPB simulator
+ */
+
+#include <string.h>
+
+#include "error.h"
+#include "hrd_sim.h"
+#include "macros.h"
+#include "mem.h"
+
+static int fifo_push(HRDSimFifo *f, double time, double bits) {
+  HRDSimEntry *e;
+
+  if (f->count == f->nb_alloc) {
+    unsigned int nb_alloc = f->nb_alloc ? 2 * f->nb_alloc : 64;
+    HRDSimEntry *entries;
+    unsigned int i;
+
+    entries = av_malloc_array(nb_alloc, sizeof(*entries));
+    if (!entries)
+      return AVERROR(ENOMEM);
+    for (i = 0; i < f->count; i++)
+      entries[i] = f->entries[(f->head + i) % f->nb_alloc];
+    av_free(f->entries);
+    f->entries = entries;
+    f->nb_alloc = nb_alloc;
+    f->head = 0;
+  }
+  e = &f->entries[(f->head + f->count) % f->nb_alloc];
+  e->time = time;
+  e->bits = bits;
+  f->count++;
+  return 0;
+}
+
+static const HRDSimEntry *fifo_peek(const HRDSimFifo *f) {
+  return f->count ? &f->entries[f->head] : NULL;
+}
+
+static void fifo_drop(HRDSimFifo *f) {
+  f->head = (f->head + 1) % f->nb_alloc;
+  f->count--;
+}
+
+int ff_hrd_sim_params_from_h264_sps(HRDSimParams *par, const SPS *sps,
+                                    int sched_sel_idx) {
+  const H264HRDParams *hrd;
+
+  memset(par, 0, sizeof(*par));
+  if (sps->nal_hrd_parameters_present_flag) {
+    hrd = &sps->nal_hrd;
+  } else if (sps->vcl_hrd_parameters_present_flag) {
+    hrd = &sps->vcl_hrd;
+    par->vcl = 1;
+  } else {
+    return AVERROR(EINVAL);
+  }
+  if (!sps->timing_info_present_flag || sched_sel_idx < 0 ||
+      sched_sel_idx >= hrd->cpb_cnt)
+    return AVERROR(EINVAL);
+
+  par->bit_rate = (uint64_t)hrd->bit_rate_value[sched_sel_idx]
+                  << (6 + hrd->bit_rate_scale);
+  par->cpb_size = (uint64_t)hrd->cpb_size_value[sched_sel_idx]
+                  << (4 + hrd->cpb_size_scale);
+  par->cbr = hrd->cbr_flag[sched_sel_idx];
+  par->low_delay = sps->low_delay_hrd_flag;
+  par->sched_sel_idx = sched_sel_idx;
+  par->num_units_in_tick = sps->num_units_in_tick;
+  par->time_scale = sps->time_scale;
+  /* one clock tick is a field period, see H.264 E.2.1 */
+  par->ticks_per_au = 2;
+  return 0;
+}
+
+int ff_hrd_sim_params_from_hevc_sps(HRDSimParams *par, const HEVCSPS *sps,
+                                    int sched_sel_idx) {
+  const HEVCHRDParams *hrd = &sps->vui.hrd_params;
+  const HEVCSubLayerHRDParams *sub;
+  int tid = sps->max_sub_layers - 1;
+
+  memset(par, 0, sizeof(*par));
+  if (!sps->vui.vui_timing_info_present_flag ||
+      !sps->vui.vui_hrd_parameters_present_flag)
+    return AVERROR(EINVAL);
+  if (hrd->nal_hrd_parameters_present_flag) {
+    sub = &hrd->nal_params[tid];
+  } else if (hrd->vcl_hrd_parameters_present_flag) {
+    sub = &hrd->vcl_params[tid];
+    par->vcl = 1;
+  } else {
+    return AVERROR(EINVAL);
+  }
+  if (sched_sel_idx < 0 || sched_sel_idx >= hrd->cpb_cnt[tid])
+    return AVERROR(EINVAL);
+
+  par->bit_rate = (uint64_t)sub->bit_rate_value[sched_sel_idx]
+                  << (6 + hrd->bit_rate_scale);
+  par->cpb_size = (uint64_t)sub->cpb_size_value[sched_sel_idx]
+                  << (4 + hrd->cpb_size_scale);
+  par->cbr = sub->cbr_flag[sched_sel_idx];
+  par->low_delay = hrd->low_delay_hrd_flag[tid];
+  par->sched_sel_idx = sched_sel_idx;
+  par->num_units_in_tick = sps->vui.vui_num_units_in_tick;
+  par->time_scale = sps->vui.vui_time_scale;
+  par->ticks_per_au = hrd->elemental_duration_in_tc[tid]
+                          ? hrd->elemental_duration_in_tc[tid]
+                          : 1;
+  return 0;
+}
+
+void ff_hrd_sim_au_from_h264_sei(HRDSimAU *au, const HRDSimParams *par,
+                                 const H264SEI *sei) {
+  const H264SEIBufferingPeriod *bp = &sei->buffering_period;
+  const H264SEIPictureTiming *pt = &sei->picture_timing;
+  int idx = par->sched_sel_idx;
+
+  au->buffering_period = bp->present && idx < bp->nb_cpb;
+  if (au->buffering_period) {
+    au->initial_cpb_removal_delay =
+        par->vcl ? bp->vcl_initial_cpb_removal_delay[idx]
+                 : bp->nal_initial_cpb_removal_delay[idx];
+    au->initial_cpb_removal_offset =
+        par->vcl ? bp->vcl_initial_cpb_removal_delay_offset[idx]
+                 : bp->nal_initial_cpb_removal_delay_offset[idx];
+  }
+  au->pic_timing = pt->present && pt->cpb_removal_delay >= 0;
+  if (au->pic_timing)
+    au->cpb_removal_delay = pt->cpb_removal_delay;
+}
+
+void ff_hrd_sim_au_from_hevc_sei(HRDSimAU *au, const HRDSimParams *par,
+                                 const HEVCSEI *sei) {
+  const HEVCSEIBufferingPeriod *bp =
+      ff_hevc_sei_get(sei, HEVC_SEI_MSG_BUFFERING_PERIOD);
+  const HEVCSEIPictureTiming *pt =
+      ff_hevc_sei_get(sei, HEVC_SEI_MSG_PICTURE_TIMING);
+  int idx = par->sched_sel_idx;
+
+  au->buffering_period = bp && bp->present && idx < bp->nb_cpb;
+  if (au->buffering_period) {
+    au->initial_cpb_removal_delay = par->vcl
+                                        ? bp->vcl_initial_cpb_removal_delay[idx]
+                                        : bp->nal_initial_cpb_removal_delay[idx];
+    au->initial_cpb_removal_offset =
+        par->vcl ? bp->vcl_initial_cpb_removal_offset[idx]
+                 : bp->nal_initial_cpb_removal_offset[idx];
+  }
+  au->pic_timing = pt && pt->present;
+  if (au->pic_timing)
+    au->cpb_removal_delay = pt->au_cpb_removal_delay;
+}
+
+int ff_hrd_sim_init(HRDSimContext *s, const HRDSimParams *par) {
+  memset(s, 0, sizeof(*s));
+  if (!par->bit_rate || !par->time_scale || !par->num_units_in_tick)
+    return AVERROR(EINVAL);
+
+  s->par = *par;
+  if (s->par.ticks_per_au <= 0)
+    s->par.ticks_per_au = 1;
+  s->tc = (double)par->num_units_in_tick / par->time_scale;
+  s->window = par->window > 0 ? par->window : 1.0;
+  s->report.first_underflow = -1;
+  s->report.first_overflow = -1;
+  return 0;
+}
+
+static int check_fullness(HRDSimContext *s, double fullness) {
+  if (fullness > s->report.max_fullness)
+    s->report.max_fullness = fullness;
+  return fullness > (double)s->par.cpb_size;
+}
+
+int ff_hrd_sim_add_au(HRDSimContext *s, const HRDSimAU *au) {
+  HRDSimReport *r = &s->report;
+  const HRDSimEntry *e;
+  double rate = (double)s->par.bit_rate;
+  double bits = 8.0 * au->size;
+  double t_rn, t_ai, t_af;
+  int ret, overflow = 0;
+
+  /* nominal removal time, C.1.2 */
+  if (!r->nb_au) {
+    if (au->buffering_period)
+      t_rn = au->initial_cpb_removal_delay / 90000.0;
+    else /* no buffering period: assume a full initial delay */
+      t_rn = (double)s->par.cpb_size / rate;
+  } else if (au->pic_timing && s->seen_bp) {
+    t_rn = s->t_rn_bp + s->tc * au->cpb_removal_delay;
+  } else {
+    t_rn = s->t_rn_prev + s->tc * s->par.ticks_per_au;
+  }
+  if (au->buffering_period || !r->nb_au) {
+    s->t_rn_bp = t_rn;
+    s->seen_bp |= au->buffering_period;
+    s->init_delay = au->initial_cpb_removal_delay;
+    s->init_offset = au->initial_cpb_removal_offset;
+  }
+
+  /* initial and final arrival times, C.1.1 */
+  if (!r->nb_au || s->par.cbr) {
+    t_ai = s->t_af_prev;
+  } else {
+    double delay = s->init_delay;
+    if (!au->buffering_period)
+      delay += s->init_offset;
+    t_ai = FFMAX(s->t_af_prev, t_rn - delay / 90000.0);
+  }
+  t_af = t_ai + bits / rate;
+
+  /* remove every AU whose removal time falls before this AU has fully
+   * arrived; the CPB is fullest right before each removal */
+  while ((e = fifo_peek(&s->pending)) && e->time <= t_af) {
+    double arrived = s->bits_in + FFMAX(0.0, e->time - t_ai) * rate;
+    overflow |=
+        check_fullness(s, FFMIN(arrived, s->bits_in + bits) - s->bits_out);
+    s->bits_out += e->bits;
+    fifo_drop(&s->pending);
+  }
+  s->bits_in += bits;
+  overflow |= check_fullness(s, s->bits_in - s->bits_out);
+  if (overflow) {
+    if (r->first_overflow < 0)
+      r->first_overflow = r->nb_au;
+    r->nb_overflow++;
+  }
+
+  if (t_af > t_rn && !s->par.low_delay) {
+    if (r->first_underflow < 0)
+      r->first_underflow = r->nb_au;
+    r->nb_underflow++;
+  }
+
+  ret = fifo_push(&s->pending, FFMAX(t_rn, t_af), bits);
+  if (ret < 0)
+    return ret;
+
+  /* peak bitrate over a window sliding along the removal times */
+  ret = fifo_push(&s->recent, t_rn, bits);
+  if (ret < 0)
+    return ret;
+  s->window_bits += bits;
+  while ((e = fifo_peek(&s->recent)) && e->time <= t_rn - s->window) {
+    s->window_bits -= e->bits;
+    fifo_drop(&s->recent);
+  }
+  if (s->window_bits / s->window > r->peak_bitrate)
+    r->peak_bitrate = s->window_bits / s->window;
+
+  s->t_rn_prev = t_rn;
+  s->t_af_prev = t_af;
+  r->nb_au++;
+  return 0;
+}
+
+void ff_hrd_sim_get_report(const HRDSimContext *s, HRDSimReport *report) {
+  *report = s->report;
+}
+
+void ff_hrd_sim_uninit(HRDSimContext *s) {
+  av_freep(&s->pending.entries);
+  av_freep(&s->recent.entries);
+  memset(s, 0, sizeof(*s));
+}
@@ -0,0 +1,147 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Leaky bucket CPB simulator for H.264 / HEVC conformance checking
+ * (H.264 Annex C.1, HEVC Annex C.2).
+ */
+
+#ifndef AVCODEC_HRD_SIM_H
+#define AVCODEC_HRD_SIM_H
+
+#include <stdint.h>
+
+#include "h264_ps.h"
+#include "h264_sei.h"
+#include "hevc_ps.h"
+#include "hevc_sei.h"
+
+typedef struct HRDSimParams {
+  uint64_t bit_rate; ///< BitRate[SchedSelIdx] in bits per second
+  uint64_t cpb_size; ///< CpbSize[SchedSelIdx] in bits
+  int cbr;           ///< cbr_flag[SchedSelIdx]
+  int low_delay;     ///< low_delay_hrd_flag, late AUs are not underflows
+  int vcl;           ///< use the VCL instead of the NAL HRD SEI values
+  int sched_sel_idx;
+  uint32_t num_units_in_tick;
+  uint32_t time_scale;
+  int ticks_per_au; ///< clock ticks per AU without picture timing SEI
+  double window;    ///< peak bitrate window in seconds, 0 means 1 second
+} HRDSimParams;
+
+/**
+ * Per access unit input. The delays are the values coded in the
+ * buffering period and picture timing SEI of the AU.
+ */
+typedef struct HRDSimAU {
+  int64_t size;         ///< AU size in bytes, including start codes
+  int buffering_period; ///< AU carries a buffering period SEI
+  uint32_t initial_cpb_removal_delay;  ///< 90 kHz units
+  uint32_t initial_cpb_removal_offset; ///< 90 kHz units
+  int pic_timing; ///< cpb_removal_delay below is valid
+  uint32_t cpb_removal_delay; ///< clock ticks since the buffering period AU
+} HRDSimAU;
+
+typedef struct HRDSimReport {
+  int64_t nb_au;
+  int64_t nb_underflow;
+  int64_t nb_overflow;
+  int64_t first_underflow; ///< AU index of the first underflow, -1 if none
+  int64_t first_overflow;  ///< AU index of the first overflow, -1 if none
+  double max_fullness;     ///< bits
+  double peak_bitrate;     ///< bits per second over the sliding window
+} HRDSimReport;
+
+typedef struct HRDSimEntry {
+  double time;
+  double bits;
+} HRDSimEntry;
+
+typedef struct HRDSimFifo {
+  HRDSimEntry *entries;
+  unsigned int nb_alloc;
+  unsigned int head;
+  unsigned int count;
+} HRDSimFifo;
+
+typedef struct HRDSimContext {
+  HRDSimParams par;
+  double tc;     ///< clock tick in seconds
+  double window; ///< peak bitrate window in seconds
+
+  int seen_bp;
+  uint32_t init_delay;
+  uint32_t init_offset;
+  double t_rn_bp;   ///< nominal removal time of the last buffering period AU
+  double t_rn_prev; ///< nominal removal time of the previous AU
+  double t_af_prev; ///< final arrival time of the previous AU
+  double bits_in;   ///< bits that entered the CPB, up to the previous AU
+  double bits_out;  ///< bits removed from the CPB
+
+  HRDSimFifo pending; ///< AUs in the CPB waiting for removal
+  HRDSimFifo recent;  ///< AUs inside the peak bitrate window
+  double window_bits;
+
+  HRDSimReport report;
+} HRDSimContext;
+
+/**
+ * Fill the simulator parameters from the HRD of an H.264 SPS.
+ * The NAL HRD is preferred over the VCL HRD when both are present.
+ *
+ * @return 0 on success, AVERROR(EINVAL) if the SPS lacks HRD or timing info
+ */
+int ff_hrd_sim_params_from_h264_sps(HRDSimParams *par, const SPS *sps,
+                                    int sched_sel_idx);
+
+/**
+ * Fill the simulator parameters from the VUI HRD of an HEVC SPS,
+ * for the highest sub-layer.
+ *
+ * @return 0 on success, AVERROR(EINVAL) if the SPS lacks HRD or timing info
+ */
+int ff_hrd_sim_params_from_hevc_sps(HRDSimParams *par, const HEVCSPS *sps,
+                                    int sched_sel_idx);
+
+/**
+ * Fill the SEI fields of an AU from the H.264 SEI state of that AU.
+ */
+void ff_hrd_sim_au_from_h264_sei(HRDSimAU *au, const HRDSimParams *par,
+                                 const H264SEI *sei);
+
+/**
+ * Fill the SEI fields of an AU from the HEVC SEI state of that AU.
+ */
+void ff_hrd_sim_au_from_hevc_sei(HRDSimAU *au, const HRDSimParams *par,
+                                 const HEVCSEI *sei);
+
+int ff_hrd_sim_init(HRDSimContext *s, const HRDSimParams *par);
+
+/**
+ * Feed one access unit, in decoding order.
+ *
+ * @return 0 on success, a negative AVERROR code on allocation failure
+ */
+int ff_hrd_sim_add_au(HRDSimContext *s, const HRDSimAU *au);
+
+void ff_hrd_sim_get_report(const HRDSimContext *s, HRDSimReport *report);
+
+void ff_hrd_sim_uninit(HRDSimContext *s);
+
+#endif /* AVCODEC_HRD_SIM_H */
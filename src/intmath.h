@@ -32,6 +32,15 @@
 #include "x86/intmath.h"
 #endif
 
+/* No configure step: count leading zeros is a single instruction on these. */
+#ifndef HAVE_FAST_CLZ
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#define HAVE_FAST_CLZ 1
+#else
+#define HAVE_FAST_CLZ 0
+#endif
+#endif
+
 #if HAVE_FAST_CLZ
 #if AV_GCC_VERSION_AT_LEAST(3, 4)
 #ifndef ff_log2
@@ -96,6 +105,9 @@ static av_always_inline av_const int ff_log2_16bit_c(unsigned int v) {
 #ifndef ff_clz
 #define ff_clz(v) __builtin_clz(v)
 #endif
+#ifndef ff_clzll
+#define ff_clzll(v) __builtin_clzll(v)
+#endif
 #endif
 #endif
 
@@ -145,6 +157,22 @@ static av_always_inline av_const unsigned ff_clz_c(unsigned x) {
 }
 #endif
 
+#ifndef ff_clzll
+#define ff_clzll ff_clzll_c
+/**
+ * Leading zero bit count of a 64-bit value, 64 if v is 0.
+ */
+static av_always_inline av_const unsigned ff_clzll_c(uint64_t v) {
+  unsigned n = 0;
+
+  if (!(v >> 32)) {
+    v <<= 32;
+    n += 32;
+  }
+  return n + (v >> 32 ? ff_clz((uint32_t)(v >> 32)) : 32);
+}
+#endif
+
 #if AV_GCC_VERSION_AT_LEAST(3, 4)
 #ifndef av_parity
 #define av_parity __builtin_parity
@@ -0,0 +1,109 @@
+/*
+ * log functions
+ * Copyright (c) 2003 Michel Bardiaux
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * logging functions
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "log.h"
+
+#define LINE_SZ 1024
+
+static atomic_int av_log_level = AV_LOG_INFO;
+/* Most negative context offset set so far, it is never raised again */
+static atomic_int min_context_offset = 0;
+atomic_int ff_log_max_level = AV_LOG_INFO;
+
+static void (*av_log_callback)(void *, int, const char *,
+                               va_list) = av_log_default_callback;
+
+/* Whether the last message of this thread ended its line */
+static _Thread_local int print_prefix = 1;
+
+void av_log_default_callback(void *avcl, int level, const char *fmt,
+                             va_list vl) {
+  const AVClass *avc = avcl ? *(const AVClass **)avcl : NULL;
+  char line[LINE_SZ];
+  int len = 0;
+
+  if (print_prefix && avc)
+    len = snprintf(line, sizeof(line), "[%s @ %p] ", avc->class_name, avcl);
+  vsnprintf(line + len, sizeof(line) - len, fmt, vl);
+  len = strlen(line);
+  print_prefix = len > 0 && line[len - 1] == '\n';
+  fputs(line, stderr);
+}
+
+static void update_max_level(void) {
+  atomic_store(&ff_log_max_level, atomic_load(&av_log_level) -
+                                      atomic_load(&min_context_offset));
+}
+
+int av_log_get_level(void) { return atomic_load(&av_log_level); }
+
+void av_log_set_level(int level) {
+  atomic_store(&av_log_level, level);
+  update_max_level();
+}
+
+void av_log_set_context_offset(void *avcl, int offset) {
+  const AVClass *avc = avcl ? *(const AVClass **)avcl : NULL;
+  int min;
+
+  if (!avc || !avc->log_level_offset_offset)
+    return;
+  *(int *)((uint8_t *)avcl + avc->log_level_offset_offset) = offset;
+
+  min = atomic_load(&min_context_offset);
+  while (offset < min &&
+         !atomic_compare_exchange_weak(&min_context_offset, &min, offset))
+    ;
+  update_max_level();
+}
+
+void av_log_set_callback(void (*callback)(void *, int, const char *,
+                                          va_list)) {
+  av_log_callback = callback;
+}
+
+void av_vlog(void *avcl, int level, const char *fmt, va_list vl) {
+  const AVClass *avc = avcl ? *(const AVClass **)avcl : NULL;
+
+  if (avc && avc->log_level_offset_offset && level >= AV_LOG_FATAL)
+    level += *(int *)((uint8_t *)avcl + avc->log_level_offset_offset);
+  if (level > atomic_load_explicit(&av_log_level, memory_order_relaxed))
+    return;
+  av_log_callback(avcl, level, fmt, vl);
+}
+
+void ff_log(void *avcl, int level, const char *fmt, ...) {
+  va_list vl;
+
+  va_start(vl, fmt);
+  av_vlog(avcl, level, fmt, vl);
+  va_end(vl);
+}
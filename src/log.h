@@ -0,0 +1,135 @@
+/*
+ * copyright (c) 2006 Michael Niedermayer <michaelni@gmx.at>
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVUTIL_LOG_H
+#define AVUTIL_LOG_H
+
+#include <stdarg.h>
+#include <stdatomic.h>
+
+#include "attributes.h"
+
+/**
+ * Describe the context a message is logged for. A context passed to
+ * av_log() is NULL or a struct whose first member is a pointer to an
+ * AVClass (or NULL).
+ */
+typedef struct AVClass {
+  const char *class_name;
+
+  /**
+   * Offset in the context of an int added to the level of the messages
+   * logged for it, 0 if the context has none. A negative offset makes the
+   * context more verbose, a positive one quieter.
+   */
+  int log_level_offset_offset;
+} AVClass;
+
+/**
+ * @addtogroup lavu_log_constants
+ * @{
+ */
+#define AV_LOG_QUIET -8   ///< print no output
+#define AV_LOG_PANIC 0    ///< something went really wrong, about to crash
+#define AV_LOG_FATAL 8    ///< something went wrong, recovery is impossible
+#define AV_LOG_ERROR 16   ///< something went wrong, recovery is possible
+#define AV_LOG_WARNING 24 ///< something somehow does not look correct
+#define AV_LOG_INFO 32    ///< standard information
+#define AV_LOG_VERBOSE 40 ///< detailed information
+#define AV_LOG_DEBUG 48   ///< stuff which is only useful for developers
+#define AV_LOG_TRACE 56   ///< extremely verbose debugging
+/**
+ * @}
+ */
+
+/**
+ * Messages above this level are compiled out. Set by the LOG_DEBUG build
+ * option.
+ */
+#ifndef FF_LOG_MAX_LEVEL
+#define FF_LOG_MAX_LEVEL AV_LOG_TRACE
+#endif
+
+/**
+ * Most verbose level any message may currently be printed at, the global
+ * level or that of a more verbose context. Internal to av_log().
+ */
+extern atomic_int ff_log_max_level;
+
+/**
+ * Send the specified message to the log if the level is less than or equal
+ * to the current level of the context. Messages above the current levels
+ * cost a single branch, messages above FF_LOG_MAX_LEVEL nothing.
+ *
+ * @param avcl  NULL or a context whose first member is a const AVClass *
+ * @param level the importance level of the message, AV_LOG_*
+ * @param ...   printf-compatible format string and its arguments
+ */
+#define av_log(avcl, level, ...)                                               \
+  do {                                                                         \
+    if ((level) <= FF_LOG_MAX_LEVEL &&                                         \
+        (level) <= atomic_load_explicit(&ff_log_max_level,                     \
+                                        memory_order_relaxed))                 \
+      ff_log(avcl, level, __VA_ARGS__);                                        \
+  } while (0)
+
+void ff_log(void *avcl, int level, const char *fmt, ...) av_printf_format(3, 4);
+
+/**
+ * Like av_log(), with a va_list and without the fast path.
+ */
+void av_vlog(void *avcl, int level, const char *fmt, va_list vl);
+
+/**
+ * @return the current global log level
+ */
+int av_log_get_level(void);
+
+/**
+ * Set the global log level. Messages of contexts without a level offset
+ * are printed when their level is at most this.
+ */
+void av_log_set_level(int level);
+
+/**
+ * Set the level offset of a context, see AVClass.log_level_offset_offset.
+ * Use this rather than writing the field, so that av_log() knows that
+ * more verbose messages may now be printed.
+ */
+void av_log_set_context_offset(void *avcl, int offset);
+
+/**
+ * Set the logging callback. It only receives the messages that pass the
+ * level of their context, from any thread that logs, and must be thread
+ * safe.
+ *
+ * @param callback a logging function, or av_log_default_callback
+ */
+void av_log_set_callback(void (*callback)(void *avcl, int level,
+                                          const char *fmt, va_list vl));
+
+/**
+ * Default logging callback. It prints the message to stderr, prefixed
+ * with the class name of the context, in a single write.
+ */
+void av_log_default_callback(void *avcl, int level, const char *fmt,
+                             va_list vl);
+
+#endif /* AVUTIL_LOG_H */
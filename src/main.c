@@ -1,3 +1,12 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "async_reader.h"
+#include "error.h"
+#include "log.h"
+#include "spsc_ring.h"
 #include "video_parser.h"
 
 // /**
@@ -13,7 +22,112 @@
  * Main functions
  *****************************************************************************/
 
-static void help(const char *exe) { printf("Usage: %s <INPUT> \n", exe); }
+static void help(const char *exe) {
+  printf("Usage: %s <INPUT> [<INPUT>...]\n", exe);
+  printf("       %s -    read a single stream from standard input\n", exe);
+}
+
+typedef struct Input {
+  const char *path;
+  ParseContext pc;
+  H263Frame frame; // 图像头在帧之间保留
+} Input;
+
+static void print_picture(const Input *in, const H263Frame *frame,
+                          int prefix) {
+  if (prefix)
+    printf("%s: ", in->path);
+  printf("pkt size:%d x %d\n", frame->hdr.width, frame->hdr.height);
+}
+
+// 把读完的块直接交给分帧器，跨块的帧由 ParseContext 拼接
+static void parse_buffer(Input *in, const FFAsyncReaderBuffer *buf,
+                         int prefix) {
+  const uint8_t *data = buf->data;
+  int size = buf->size;
+  H263Frame *frame = &in->frame;
+
+  while (size > 0) {
+    int ret = ff_h263_split_frame(&in->pc, frame, data, size);
+    if (frame->data)
+      print_picture(in, frame, prefix);
+    // 负值表示起始码开始于上一块，本块从头重新扫描
+    ret = FFMAX(ret, 0);
+    data += ret;
+    size -= ret;
+  }
+
+  if (buf->last) {
+    // 文件结束：输出最后一帧
+    ff_h263_split_frame(&in->pc, frame, buf->data, 0);
+    if (frame->data)
+      print_picture(in, frame, prefix);
+    if (buf->error)
+      printf("ret=%d\n", buf->error);
+    if (prefix)
+      printf("%s: ", in->path);
+    printf("---stream eos---\n");
+  }
+}
+
+#define RING_SIZE (4 << 20)
+#define READ_SIZE (64 << 10)
+
+// 读线程：管道没有偏移，直接 read() 进环形缓冲区
+static void *stdin_thread(void *arg) {
+  FFSPSCRing *ring = arg;
+  uint8_t *dst;
+  int size;
+
+  while ((size = ff_spsc_ring_write_wait(ring, 1, &dst)) > 0) {
+    ssize_t n = read(STDIN_FILENO, dst, FFMIN(size, READ_SIZE));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    ff_spsc_ring_write_commit(ring, n);
+  }
+  ff_spsc_ring_write_eof(ring);
+  return NULL;
+}
+
+// 标准输入：分帧器直接在环形缓冲区的已提交数据上运行，不拷贝
+static int parse_stdin(void) {
+  FFSPSCRing *ring;
+  pthread_t thread;
+  ParseContext pc = {0};
+  H263Packet pkt;
+  const uint8_t *rest;
+  int ret, left;
+
+  if ((ret = ff_spsc_ring_alloc(&ring, RING_SIZE)) < 0)
+    return ret;
+  if (pthread_create(&thread, NULL, stdin_thread, ring)) {
+    ff_spsc_ring_free(&ring);
+    return AVERROR(EAGAIN);
+  }
+
+  for (;;) {
+    memset(&pkt, 0, sizeof(pkt));
+    ret = ff_h263_ring_split_and_parse(&pc, &pkt, ring, 1);
+    if (ret < 0)
+      break;
+    if (pkt.got_pic)
+      printf("pkt size:%d x %d\n", pkt.picture.width, pkt.picture.height);
+    ff_spsc_ring_read_commit(ring, ret);
+  }
+  if (ret == AVERROR_EOF)
+    printf("---stream eos---\n");
+  else
+    printf("ret=%d\n", ret);
+
+  // 出错时排空缓冲区，读线程才能结束
+  while ((left = ff_spsc_ring_read_wait(ring, 1, &rest)) > 0)
+    ff_spsc_ring_read_commit(ring, left);
+  pthread_join(thread, NULL);
+  ff_spsc_ring_free(&ring);
+  return 0;
+}
 
 int main(int argc, char *argv[]) {
   if (argc <= 1) {
@@ -21,30 +135,36 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  // 打开文件
-  FILE *fp = fopen(argv[1], "rb");
-  if (fp == NULL) {
-    perror("Failed to open file");
-    exit(EXIT_FAILURE);
+  if (argc == 2 && !strcmp(argv[1], "-")) {
+    int ret = parse_stdin();
+    if (ret < 0) {
+      av_log(NULL, AV_LOG_ERROR, "Failed to read standard input: %s\n",
+             strerror(AVUNERROR(ret)));
+      exit(EXIT_FAILURE);
+    }
+    return 0;
   }
 
-  // 获取文件大小
-  fseek(fp, 0, SEEK_END);
-  int file_size = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
-
-  // 读取文件内容到缓冲区
-  char *fbuf = (char *)malloc(file_size);
-  if (fbuf == NULL) {
-    perror("Failed to allocate memory");
+  // 异步读取所有输入文件，I/O 与解析重叠
+  int nb_inputs = argc - 1;
+  Input *inputs = av_calloc(nb_inputs, sizeof(*inputs));
+  FFAsyncReader *reader;
+  int ret = inputs ? ff_async_reader_init(&reader, NULL) : AVERROR(ENOMEM);
+  // 返回值是 AVERROR 码，errno 未必有效
+  if (ret < 0) {
+    av_log(NULL, AV_LOG_ERROR, "Failed to create reader: %s\n",
+           strerror(AVUNERROR(ret)));
     exit(EXIT_FAILURE);
   }
-  if (fread(fbuf, file_size, 1, fp) != 1) {
-    perror("Failed to read file");
-    exit(EXIT_FAILURE);
+  for (int i = 0; i < nb_inputs; i++) {
+    inputs[i].path = argv[i + 1];
+    ret = ff_async_reader_add_file(reader, argv[i + 1], &inputs[i]);
+    if (ret < 0) {
+      av_log(NULL, AV_LOG_ERROR, "Failed to add file %s: %s\n", argv[i + 1],
+             strerror(AVUNERROR(ret)));
+      exit(EXIT_FAILURE);
+    }
   }
-  int is_avc = 0;
-  int nal_length_size = 0;
 
   // H264ParamSets param;
   // memset(&param, 0, sizeof(param));
@@ -56,39 +176,18 @@ int main(int argc, char *argv[]) {
   // ff_hevc_decode_extradata((const uint8_t *)buf, file_size, &hevcparam,
   //                          &hevcsei, &is_avc, &nal_length_size, 0, 0, NULL);
 
-  ParseContext pc;
-  H263Packet pkt;
-  memset(&pc, 0, sizeof(pc));
-  memset(&pkt, 0, sizeof(pkt));
-
-  int left = file_size;
-  uint8_t *buf = fbuf;
-  while (left >= 0) {
-    memset(&pkt, 0, sizeof(pkt));
-    int ret = ff_h263_decode_data(&pc, &pkt, buf, left);
-    if (ret > 0) {
-      buf += ret;
-      left -= ret;
-      if (pkt.got_pic)
-        printf("pkt size:%d x %d\n", pkt.picture.width, pkt.picture.height);
-    } else if (ret == 0) { // EOS
-      if (pkt.got_pic)
-        printf("pkt size:%d x %d\n", pkt.picture.width, pkt.picture.height);
-
-      printf("---stream eos---\n");
-      break;
-    }
-    printf("ret=%d\n", ret);
+  FFAsyncReaderBuffer *buf;
+  while ((ret = ff_async_reader_read(reader, &buf, 1)) >= 0) {
+    parse_buffer(buf->opaque, buf, nb_inputs > 1);
+    ff_async_reader_release(reader, buf);
   }
+  if (ret != AVERROR_EOF)
+    printf("ret=%d\n", ret);
 
-  // 关闭文件
-  fclose(fp);
-
-  // 处理文件内容
-  // ...
-
-  // 释放缓冲区
-  free(fbuf);
+  ff_async_reader_free(&reader);
+  for (int i = 0; i < nb_inputs; i++)
+    ff_parse_close(&inputs[i].pc);
+  av_free(inputs);
 
   return 0;
-}
\ No newline at end of file
+}
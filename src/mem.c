@@ -25,24 +25,46 @@
  */
 
 #define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
 
 // #include "config.h"
 
 #include <limits.h>
 #include <stdatomic.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #if HAVE_MALLOC_H
 #include <malloc.h>
 #endif
 
+#ifndef HAVE_MMAP
+#ifdef __linux__
+#define HAVE_MMAP 1
+#else
+#define HAVE_MMAP 0
+#endif
+#endif
+
+#include <unistd.h>
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#endif
+
 // #include "avutil.h"
 #include "common.h"
 #include "dynarray.h"
 #include "error.h"
 #include "intreadwrite.h"
 #include "mem.h"
+#include "memstats.h"
 
 //-----------internal.h---------
 #define FF_MEMORY_POISON 0x2a
@@ -98,7 +120,7 @@ static int size_mult(size_t a, size_t b, size_t *r) {
   return 0;
 }
 
-void *av_malloc(size_t size) {
+static void *mem_alloc(size_t size) {
   void *ptr = NULL;
 
   if (size > atomic_load_explicit(&max_alloc_size, memory_order_relaxed))
@@ -145,7 +167,7 @@ void *av_malloc(size_t size) {
 #endif
   if (!ptr && !size) {
     size = 1;
-    ptr = av_malloc(1);
+    ptr = mem_alloc(1);
   }
 #if CONFIG_MEMORY_POISONING
   if (ptr)
@@ -154,7 +176,7 @@ void *av_malloc(size_t size) {
   return ptr;
 }
 
-void *av_realloc(void *ptr, size_t size) {
+static void *mem_realloc(void *ptr, size_t size) {
   void *ret;
   if (size > atomic_load_explicit(&max_alloc_size, memory_order_relaxed))
     return NULL;
@@ -171,6 +193,72 @@ void *av_realloc(void *ptr, size_t size) {
   return ret;
 }
 
+static void mem_free(void *ptr) {
+#if HAVE_ALIGNED_MALLOC
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+#if CONFIG_MEMORY_ACCOUNTING
+/* Accounted blocks start with their size and owner, in a header keeping
+ * any alignment av_malloc() may provide. */
+typedef struct AccountHeader {
+  size_t size;
+  FFMemOwner owner;
+} AccountHeader;
+
+#define ACCOUNT_HEADER_SIZE FFALIGN(sizeof(AccountHeader), 64)
+
+void *av_malloc(size_t size) {
+  AccountHeader *hdr;
+
+  if (size > SIZE_MAX - ACCOUNT_HEADER_SIZE)
+    return NULL;
+  hdr = mem_alloc(size + ACCOUNT_HEADER_SIZE);
+  if (!hdr)
+    return NULL;
+  hdr->size = size;
+  hdr->owner = ff_mem_account_alloc(size);
+  return (uint8_t *)hdr + ACCOUNT_HEADER_SIZE;
+}
+
+void *av_realloc(void *ptr, size_t size) {
+  AccountHeader *hdr =
+      ptr ? (AccountHeader *)((uint8_t *)ptr - ACCOUNT_HEADER_SIZE) : NULL;
+  size_t old_size = hdr ? hdr->size : 0;
+  FFMemOwner old_owner = hdr ? hdr->owner : (FFMemOwner){0};
+
+  if (size > SIZE_MAX - ACCOUNT_HEADER_SIZE)
+    return NULL;
+  hdr = mem_realloc(hdr, size + ACCOUNT_HEADER_SIZE);
+  if (!hdr)
+    return NULL;
+  if (ptr)
+    ff_mem_account_free(old_owner, old_size);
+  hdr->size = size;
+  hdr->owner = ff_mem_account_alloc(size);
+  return (uint8_t *)hdr + ACCOUNT_HEADER_SIZE;
+}
+
+void av_free(void *ptr) {
+  AccountHeader *hdr;
+
+  if (!ptr)
+    return;
+  hdr = (AccountHeader *)((uint8_t *)ptr - ACCOUNT_HEADER_SIZE);
+  ff_mem_account_free(hdr->owner, hdr->size);
+  mem_free(hdr);
+}
+#else
+void *av_malloc(size_t size) { return mem_alloc(size); }
+
+void *av_realloc(void *ptr, size_t size) { return mem_realloc(ptr, size); }
+
+void av_free(void *ptr) { mem_free(ptr); }
+#endif
+
 void *av_realloc_f(void *ptr, size_t nelem, size_t elsize) {
   size_t size;
   void *r;
@@ -240,14 +328,6 @@ int av_reallocp_array(void *ptr, size_t nmemb, size_t size) {
   return 0;
 }
 
-void av_free(void *ptr) {
-#if HAVE_ALIGNED_MALLOC
-  _aligned_free(ptr);
-#else
-  free(ptr);
-#endif
-}
-
 void av_freep(void *arg) {
   void *val;
 
@@ -556,3 +636,219 @@ void av_fast_mallocz(void *ptr, unsigned int *size, size_t min_size) {
 }
 
 int av_size_mult(size_t a, size_t b, size_t *r) { return size_mult(a, b, r); }
+
+/* Every class block is preceded by its header. Mapped blocks keep it on a
+ * page of its own, so the data stays aligned and the power of 2 sizes of
+ * the buffer pools fill whole huge pages. */
+typedef struct ClassHeader {
+  void *base;
+  size_t map_size; ///< 0 for av_malloc() blocks
+#if CONFIG_MEMORY_ACCOUNTING
+  FFMemOwner owner; ///< of mapped blocks
+#endif
+} ClassHeader;
+
+#define CLASS_HEADER_SIZE FFALIGN(sizeof(ClassHeader), 64)
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+#define LARGE_CLASS_MIN ((size_t)256 << 10)
+
+static atomic_int nb_numa_nodes = 0;
+
+enum AVAllocClass av_alloc_class_for_size(size_t size) {
+  if (size >= HUGE_PAGE_SIZE)
+    return AV_ALLOC_HUGEPAGE;
+  if (size >= LARGE_CLASS_MIN)
+    return AV_ALLOC_LARGE;
+  return AV_ALLOC_SMALL;
+}
+
+#if HAVE_MMAP
+static void bind_node(void *addr, size_t len, int node) {
+#ifdef SYS_mbind
+  unsigned long mask = 1UL << node;
+
+  if (node < 0 || node >= sizeof(mask) * 8 || av_numa_nb_nodes() < 2)
+    return;
+  // A failure only costs the placement.
+  syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1,
+          0);
+#endif
+}
+
+static void place_block(void *data, size_t len, enum AVAllocClass cls,
+                        int node) {
+#ifdef MADV_HUGEPAGE
+  if (cls == AV_ALLOC_HUGEPAGE)
+    madvise(data, len, MADV_HUGEPAGE);
+#endif
+  if (node != AV_NUMA_NODE_ANY)
+    bind_node(data, len, node);
+}
+
+static uint8_t *map_block(size_t size, enum AVAllocClass cls, int node) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t align = cls == AV_ALLOC_HUGEPAGE ? HUGE_PAGE_SIZE : page;
+  size_t len, map_size;
+  uint8_t *base, *start, *data;
+  ClassHeader *hdr;
+
+  if (size > SIZE_MAX - 2 * align)
+    return NULL;
+  len = FFALIGN(size, align);
+  // Map one extra alignment unit to trim the mapping to an aligned start.
+  map_size = len + align;
+  base = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    return NULL;
+  data = (uint8_t *)FFALIGN((uintptr_t)base + page, align);
+  start = data - page;
+  if (start > base)
+    munmap(base, start - base);
+  if (base + map_size > data + len)
+    munmap(data + len, base + map_size - (data + len));
+
+  place_block(data, len, cls, node);
+
+  hdr = (ClassHeader *)(data - CLASS_HEADER_SIZE);
+  hdr->base = start;
+  hdr->map_size = page + len;
+#if CONFIG_MEMORY_ACCOUNTING
+  hdr->owner = ff_mem_account_alloc(hdr->map_size);
+#endif
+  return data;
+}
+#endif
+
+void *av_malloc_class(size_t size, enum AVAllocClass cls, int node) {
+  ClassHeader *hdr;
+  uint8_t *ptr;
+
+  if (size > atomic_load_explicit(&max_alloc_size, memory_order_relaxed))
+    return NULL;
+#if HAVE_MMAP
+  if (cls != AV_ALLOC_SMALL)
+    return map_block(size, cls, node);
+#endif
+
+  if (size > SIZE_MAX - CLASS_HEADER_SIZE)
+    return NULL;
+  ptr = av_malloc(size + CLASS_HEADER_SIZE);
+  if (!ptr)
+    return NULL;
+  hdr = (ClassHeader *)ptr;
+  hdr->base = ptr;
+  hdr->map_size = 0;
+  return ptr + CLASS_HEADER_SIZE;
+}
+
+void av_free_class(void *ptr) {
+  ClassHeader *hdr;
+
+  if (!ptr)
+    return;
+  hdr = (ClassHeader *)((uint8_t *)ptr - CLASS_HEADER_SIZE);
+#if HAVE_MMAP
+  if (hdr->map_size) {
+#if CONFIG_MEMORY_ACCOUNTING
+    ff_mem_account_free(hdr->owner, hdr->map_size);
+#endif
+    munmap(hdr->base, hdr->map_size);
+    return;
+  }
+#endif
+  av_free(hdr->base);
+}
+
+int av_map_file_class(void **ptr, int fd, size_t size, enum AVAllocClass cls,
+                      int node) {
+  uint8_t *data;
+  size_t done = 0;
+
+  *ptr = NULL;
+  if (!size)
+    return AVERROR(EINVAL);
+#if HAVE_MMAP
+  if (cls != AV_ALLOC_SMALL) {
+    size_t len = FFALIGN(size, sysconf(_SC_PAGESIZE));
+    int ret;
+
+    // The file replaces the start of an anonymous block, so the block keeps
+    // its header and av_free_class() unmaps both.
+    if (!(data = map_block(size, cls, node)))
+      return AVERROR(ENOMEM);
+    if (mmap(data, len, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) ==
+        MAP_FAILED) {
+      ret = AVERROR(errno);
+      av_free_class(data);
+      return ret;
+    }
+    place_block(data, len, cls, node);
+    *ptr = data;
+    return 0;
+  }
+#endif
+
+  if (!(data = av_malloc_class(size, cls, node)))
+    return AVERROR(ENOMEM);
+  while (done < size) {
+    ssize_t n = pread(fd, data + done, size - done, done);
+    if (n <= 0 && !(n < 0 && errno == EINTR)) {
+      int ret = n ? AVERROR(errno) : AVERROR_EOF;
+      av_free_class(data);
+      return ret;
+    }
+    if (n > 0)
+      done += n;
+  }
+  *ptr = data;
+  return 0;
+}
+
+int av_numa_nb_nodes(void) {
+  int nb = atomic_load_explicit(&nb_numa_nodes, memory_order_relaxed);
+#ifdef __linux__
+  char line[256];
+  size_t len;
+  FILE *f;
+
+  if (nb)
+    return nb;
+  // The nodes are listed as ranges, e.g. "0-1", the last number is the
+  // highest node.
+  nb = 1;
+  f = fopen("/sys/devices/system/node/possible", "r");
+  if (f) {
+    if (fgets(line, sizeof(line), f)) {
+      len = strcspn(line, "\n");
+      while (len > 0 && line[len - 1] >= '0' && line[len - 1] <= '9')
+        len--;
+      nb = FFMAX(nb, atoi(line + len) + 1);
+    }
+    fclose(f);
+  }
+  atomic_store_explicit(&nb_numa_nodes, nb, memory_order_relaxed);
+#endif
+  return FFMAX(nb, 1);
+}
+
+/* The node is only a placement hint: a thread that moved to another node
+ * keeps the old one for at most this many calls. */
+#define NUMA_NODE_REFRESH 256
+
+int av_numa_node_current(void) {
+#ifdef SYS_getcpu
+  static _Thread_local int node, nb_calls;
+  unsigned int cpu, n;
+
+  // syscall() does not go through the vDSO, keep it off the pool fast path.
+  if (nb_calls-- > 0)
+    return node;
+  nb_calls = NUMA_NODE_REFRESH - 1;
+  if (av_numa_nb_nodes() > 1 && !syscall(SYS_getcpu, &cpu, &n, NULL))
+    node = n;
+  return node;
+#else
+  return 0;
+#endif
+}
@@ -522,6 +522,81 @@ void *av_memdup(const void *p, size_t size);
  */
 void av_memcpy_backptr(uint8_t *dst, int back, int cnt);
 
+/**
+ * @}
+ */
+
+/**
+ * @defgroup lavu_mem_class Allocation Classes
+ * Placement of big, long lived buffers.
+ *
+ * Blocks of the large classes are mapped from the kernel on their own, page
+ * aligned, and can be bound to a NUMA node so that the threads running there
+ * do not fetch them across sockets. On systems without these facilities
+ * every class falls back to av_malloc().
+ *
+ * @{
+ */
+
+enum AVAllocClass {
+  AV_ALLOC_SMALL,    ///< av_malloc()
+  AV_ALLOC_LARGE,    ///< own page aligned mapping
+  AV_ALLOC_HUGEPAGE, ///< own mapping backed by transparent huge pages
+};
+
+/** Leave the placement of a block to the first thread touching it. */
+#define AV_NUMA_NODE_ANY -1
+
+/**
+ * Get the class suited to a block of the given size: huge pages from 2 MiB,
+ * an own mapping from 256 KiB.
+ */
+enum AVAllocClass av_alloc_class_for_size(size_t size);
+
+/**
+ * Allocate a block of an allocation class. The blocks of the large classes
+ * are page aligned and zeroed.
+ *
+ * @param node NUMA node to place the block on, or AV_NUMA_NODE_ANY; only a
+ *             hint, ignored for AV_ALLOC_SMALL
+ * @return Pointer to the block, to be freed with av_free_class(), or `NULL`
+ *         if it cannot be allocated
+ */
+void *av_malloc_class(size_t size, enum AVAllocClass cls,
+                      int node) av_malloc_attrib av_alloc_size(1);
+
+/**
+ * Free a block allocated with av_malloc_class().
+ *
+ * @note `ptr = NULL` is explicitly allowed.
+ */
+void av_free_class(void *ptr);
+
+/**
+ * Map the first size bytes of a file read-only as a block of an allocation
+ * class. The large classes map the file itself, placed like their
+ * allocated blocks; AV_ALLOC_SMALL, and systems without mmap(), read it
+ * into an av_malloc_class() block instead.
+ *
+ * @param ptr set to the block, to be freed with av_free_class()
+ * @param fd  file open for reading, can be closed once mapped
+ * @return 0 on success, a negative AVERROR code on error
+ */
+int av_map_file_class(void **ptr, int fd, size_t size, enum AVAllocClass cls,
+                      int node);
+
+/**
+ * @return the number of NUMA nodes of the system, at least 1
+ */
+int av_numa_nb_nodes(void);
+
+/**
+ * The node is cached per thread and looked up again every 256 calls.
+ *
+ * @return the NUMA node of the CPU the calling thread runs on, 0 if unknown
+ */
+int av_numa_node_current(void);
+
 /**
  * @}
  */
@@ -0,0 +1,181 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "memstats.h"
+
+static const char *const tag_names[FF_MEM_TAG_NB] = {
+    [FF_MEM_TAG_OTHER] = "other",
+    [FF_MEM_TAG_POOL] = "pool",
+    [FF_MEM_TAG_SPLITTER] = "splitter",
+    [FF_MEM_TAG_RBSP] = "rbsp",
+    [FF_MEM_TAG_H264_PS] = "h264_ps",
+    [FF_MEM_TAG_HEVC_PS] = "hevc_ps",
+    [FF_MEM_TAG_SEI] = "sei",
+    [FF_MEM_TAG_H263_PARSE] = "h263_parse",
+};
+
+const char *ff_mem_tag_name(enum FFMemTag tag) {
+  return tag >= 0 && tag < FF_MEM_TAG_NB ? tag_names[tag] : "unknown";
+}
+
+#if CONFIG_MEMORY_ACCOUNTING
+
+static FFMemStats process_stats;
+
+static _Thread_local enum FFMemTag cur_tag;
+static _Thread_local FFMemStats *cur_stream;
+
+/* Not av_mallocz(), the counters are charged to no stream. */
+FFMemStats *ff_mem_stats_alloc(void) {
+  FFMemStats *s = calloc(1, sizeof(*s));
+
+  if (s)
+    atomic_init(&s->refcount, 1);
+  return s;
+}
+
+static void stats_unref(FFMemStats *s) {
+  if (s && atomic_fetch_sub_explicit(&s->refcount, 1,
+                                     memory_order_acq_rel) == 1)
+    free(s);
+}
+
+void ff_mem_stats_unref(FFMemStats **stats) {
+  stats_unref(*stats);
+  *stats = NULL;
+}
+
+static FFMemOwner current_owner(void) {
+  FFMemOwner owner = {cur_tag, cur_stream};
+
+  if (owner.stream)
+    atomic_fetch_add_explicit(&owner.stream->refcount, 1,
+                              memory_order_relaxed);
+  return owner;
+}
+
+enum FFMemTag ff_mem_set_tag(enum FFMemTag tag) {
+  enum FFMemTag prev = cur_tag;
+
+  cur_tag = tag;
+  return prev;
+}
+
+FFMemStats *ff_mem_set_stream(FFMemStats *stats) {
+  FFMemStats *prev = cur_stream;
+
+  cur_stream = stats;
+  return prev;
+}
+
+static void add(FFMemStats *s, int idx, int64_t delta, int count) {
+  int64_t cur = atomic_fetch_add_explicit(&s->current[idx], delta,
+                                          memory_order_relaxed) +
+                delta;
+  int64_t peak;
+
+  if (delta <= 0)
+    return;
+  peak = atomic_load_explicit(&s->peak[idx], memory_order_relaxed);
+  while (cur > peak && !atomic_compare_exchange_weak_explicit(
+                           &s->peak[idx], &peak, cur, memory_order_relaxed,
+                           memory_order_relaxed))
+    ;
+  if (count) {
+    atomic_fetch_add_explicit(&s->nb_allocs[idx], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->allocated[idx], delta,
+                              memory_order_relaxed);
+  }
+}
+
+/* charge a tag, and all tags unless the bytes only move between tags */
+static void charge(FFMemStats *s, enum FFMemTag tag, int64_t delta,
+                   int total) {
+  add(s, tag, delta, 1);
+  if (total)
+    add(s, FF_MEM_TAG_NB, delta, 1);
+}
+
+FFMemOwner ff_mem_account_alloc(int64_t size) {
+  FFMemOwner owner = current_owner();
+
+  charge(&process_stats, owner.tag, size, 1);
+  if (owner.stream)
+    charge(owner.stream, owner.tag, size, 1);
+  return owner;
+}
+
+void ff_mem_account_free(FFMemOwner owner, int64_t size) {
+  charge(&process_stats, owner.tag, -size, 1);
+  if (owner.stream)
+    charge(owner.stream, owner.tag, -size, 1);
+  stats_unref(owner.stream);
+}
+
+FFMemOwner ff_mem_account_pool_get(int64_t size) {
+  FFMemOwner owner = current_owner();
+
+  charge(&process_stats, FF_MEM_TAG_POOL, -size, 0);
+  charge(&process_stats, owner.tag, size, 0);
+  // Idle pool buffers belong to no stream.
+  if (owner.stream)
+    charge(owner.stream, owner.tag, size, 1);
+  return owner;
+}
+
+void ff_mem_account_pool_release(FFMemOwner owner, int64_t size) {
+  charge(&process_stats, owner.tag, -size, 0);
+  charge(&process_stats, FF_MEM_TAG_POOL, size, 0);
+  if (owner.stream)
+    charge(owner.stream, owner.tag, -size, 1);
+  stats_unref(owner.stream);
+}
+
+void ff_mem_stats_read(const FFMemStats *stats,
+                       FFMemCounters counters[FF_MEM_TAG_NB + 1]) {
+  const FFMemStats *s = stats ? stats : &process_stats;
+
+  for (int i = 0; i <= FF_MEM_TAG_NB; i++) {
+    counters[i].current =
+        atomic_load_explicit(&s->current[i], memory_order_relaxed);
+    counters[i].peak = atomic_load_explicit(&s->peak[i], memory_order_relaxed);
+    counters[i].nb_allocs =
+        atomic_load_explicit(&s->nb_allocs[i], memory_order_relaxed);
+    counters[i].allocated =
+        atomic_load_explicit(&s->allocated[i], memory_order_relaxed);
+  }
+}
+
+#else
+
+FFMemStats *ff_mem_stats_alloc(void) { return calloc(1, sizeof(FFMemStats)); }
+
+void ff_mem_stats_unref(FFMemStats **stats) {
+  free(*stats);
+  *stats = NULL;
+}
+
+void ff_mem_stats_read(const FFMemStats *stats,
+                       FFMemCounters counters[FF_MEM_TAG_NB + 1]) {
+  memset(counters, 0, (FF_MEM_TAG_NB + 1) * sizeof(*counters));
+}
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Memory accounting per subsystem and per stream.
+ *
+ * Built with CONFIG_MEMORY_ACCOUNTING, every block of the av_malloc()
+ * family and of av_malloc_class() records its size, the tag of the
+ * subsystem that allocated it and the stream it was charged to. The tag
+ * and the stream being worked on are set per thread by the code entering a
+ * subsystem or a stream.
+ *
+ * Buffers of an AVBufferPool are held by FF_MEM_TAG_POOL while they are
+ * idle in the pool, and move to the tag in effect when they are taken out,
+ * so the tags add up to the memory actually in use.
+ *
+ * A stream is charged for the blocks allocated and the pool buffers taken
+ * while it is set, and credited when they are freed or returned, whatever
+ * stream is set then. Memory shared by several streams is allocated with
+ * no stream set.
+ *
+ * Without CONFIG_MEMORY_ACCOUNTING all counters read as zero.
+ */
+
+#ifndef AVUTIL_MEMSTATS_H
+#define AVUTIL_MEMSTATS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef CONFIG_MEMORY_ACCOUNTING
+#define CONFIG_MEMORY_ACCOUNTING 0
+#endif
+
+enum FFMemTag {
+  FF_MEM_TAG_OTHER,      ///< not in a tagged subsystem
+  FF_MEM_TAG_POOL,       ///< idle buffers of buffer pools
+  FF_MEM_TAG_SPLITTER,   ///< H.264 / HEVC NAL unit arrays
+  FF_MEM_TAG_RBSP,       ///< unescaped NAL unit payloads
+  FF_MEM_TAG_H264_PS,    ///< H.264 SPS / PPS
+  FF_MEM_TAG_HEVC_PS,    ///< HEVC VPS / SPS / PPS
+  FF_MEM_TAG_SEI,        ///< SEI messages
+  FF_MEM_TAG_H263_PARSE, ///< H.263 ParseContext frame buffers
+  FF_MEM_TAG_NB
+};
+
+/**
+ * Counters of a tag or of all of them. The rates are the differences of
+ * nb_allocs and allocated between two reads, over their interval.
+ */
+typedef struct FFMemCounters {
+  int64_t current;   ///< bytes held
+  int64_t peak;      ///< highest value of current
+  int64_t nb_allocs; ///< allocations and pool buffers taken so far
+  int64_t allocated; ///< bytes of these
+} FFMemCounters;
+
+/**
+ * Counters of a stream, allocated with ff_mem_stats_alloc(). Index
+ * FF_MEM_TAG_NB counts all tags together.
+ */
+typedef struct FFMemStats {
+#if CONFIG_MEMORY_ACCOUNTING
+  atomic_int_least64_t current[FF_MEM_TAG_NB + 1];
+  atomic_int_least64_t peak[FF_MEM_TAG_NB + 1];
+  atomic_int_least64_t nb_allocs[FF_MEM_TAG_NB + 1];
+  atomic_int_least64_t allocated[FF_MEM_TAG_NB + 1];
+  /*
+   * One for the owner, plus one per block or pool buffer charged to the
+   * stream, so that the counters outlive the stream until all of its
+   * memory is freed.
+   */
+  atomic_uint refcount;
+#else
+  int unused;
+#endif
+} FFMemStats;
+
+/**
+ * Holder of an accounted block or of a pool buffer taken out of its pool.
+ */
+typedef struct FFMemOwner {
+  enum FFMemTag tag;
+  FFMemStats *stream; ///< referenced, NULL for none
+} FFMemOwner;
+
+/**
+ * Allocate zeroed stream counters.
+ *
+ * @return the counters, NULL on error
+ */
+FFMemStats *ff_mem_stats_alloc(void);
+
+/**
+ * Drop the owner's reference to stream counters. The blocks still charged
+ * to the stream keep crediting it until they are freed.
+ */
+void ff_mem_stats_unref(FFMemStats **stats);
+
+/**
+ * Read counters.
+ *
+ * @param stats the counters of a stream, NULL for the whole process
+ * @param counters one entry per tag, then the sum of all tags
+ */
+void ff_mem_stats_read(const FFMemStats *stats,
+                       FFMemCounters counters[FF_MEM_TAG_NB + 1]);
+
+const char *ff_mem_tag_name(enum FFMemTag tag);
+
+#if CONFIG_MEMORY_ACCOUNTING
+
+/**
+ * Set the tag of the calling thread's allocations.
+ *
+ * @return the previous tag, to be restored when leaving the subsystem
+ */
+enum FFMemTag ff_mem_set_tag(enum FFMemTag tag);
+
+/**
+ * Set the stream charged for the calling thread's allocations.
+ *
+ * @param stats NULL for none
+ * @return the previous stream, to be restored when leaving the stream
+ */
+FFMemStats *ff_mem_set_stream(FFMemStats *stats);
+
+/* Used by the allocators. */
+FFMemOwner ff_mem_account_alloc(int64_t size);
+void ff_mem_account_free(FFMemOwner owner, int64_t size);
+FFMemOwner ff_mem_account_pool_get(int64_t size);
+void ff_mem_account_pool_release(FFMemOwner owner, int64_t size);
+
+#else
+
+static inline enum FFMemTag ff_mem_set_tag(enum FFMemTag tag) {
+  return FF_MEM_TAG_OTHER;
+}
+
+static inline FFMemStats *ff_mem_set_stream(FFMemStats *stats) {
+  return NULL;
+}
+
+#endif
+
+#endif /* AVUTIL_MEMSTATS_H */
@@ -0,0 +1,1068 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE // pthread_setaffinity_np()
+
+#include <errno.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buffer_internal.h"
+#include "common.h"
+#include "defs.h"
+#include "error.h"
+#include "get_bits.h"
+#include "golomb.h"
+#include "h263.h"
+#include "h2645_convert.h"
+#include "h2645_parse.h"
+#include "h264.h"
+#include "h264_ps.h"
+#include "h264_sei.h"
+#include "hevc.h"
+#include "hevc_ps.h"
+#include "hevc_sei.h"
+#include "hrd_sim.h"
+#include "log.h"
+#include "mem.h"
+#include "memstats.h"
+#include "parser_session.h"
+#include "thread.h"
+#include "video_parser.h"
+
+/* Chunks are dispatched to the workers by blocks of this size. */
+#define SUBMIT_BLOCK 256
+
+typedef union StreamPS {
+  H264ParamSets h264;
+  HEVCParamSets hevc;
+  union StreamPS *next; ///< in the free list
+} StreamPS;
+
+typedef struct SessionStream {
+  uint64_t id;
+  enum AVCodecID codec_id;
+  int is_nalff;
+  int nal_length_size;
+  int width, height;
+
+  ParseContext pc;            ///< H.263 only
+  H263PictureHeader h263_hdr; ///< H.263 only
+
+  StreamPS *ps;       ///< H.264 / HEVC parameter sets, NULL while compact
+  uint8_t *ps_annexb; ///< parameter sets as Annex B NAL units while compact
+  int ps_annexb_size;
+  int is_compact;
+
+  int64_t last_used; ///< ms, on the monotonic clock
+  HRDSimContext *hrd; ///< with hrd_check, once a buffering period was seen
+  int hrd_sps_id;     ///< SPS of the simulator parameters
+  FFMemStats *mem;   ///< charged while the worker handles the stream
+  struct SessionStream *hash_next; ///< also the free list link
+  struct SessionStream *lru_prev, *lru_next;
+} SessionStream;
+
+typedef struct SessionWorker {
+  FFParserSession *s;
+  int index;
+  pthread_t thread;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  FFParserSessionChunk *queue; ///< submitted chunks, protected by lock
+  int nb_queued;
+  unsigned int queue_alloc;
+  int exit;
+
+  /* Everything below is only touched by the worker thread. */
+  FFParserSessionChunk *batch;
+  unsigned int batch_alloc;
+  FFParserSessionResult *results;
+  unsigned int results_alloc;
+
+  SessionStream **buckets;
+  int nb_buckets; ///< a power of 2
+  int nb_streams;
+  SessionStream *lru_head; ///< hot streams, least recently used first
+  SessionStream *lru_tail;
+  SessionStream *free_streams;
+  StreamPS *free_ps;
+  int nb_free_ps;
+
+  H2645Packet pkt; ///< shared by all streams of the worker
+  HEVCSEI sei;      ///< of the chunk being parsed, with hrd_check only
+  H264SEI h264_sei; ///< of the chunk being parsed
+
+  atomic_int nb_streams_stat;
+  atomic_int nb_compact_stat;
+} SessionWorker;
+
+struct FFParserSession {
+  const AVClass *class;
+  int log_level_offset;
+
+  FFParserSessionOptions opts;
+  SessionWorker *workers;
+  int nb_threads;
+  int nb_started;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  FFParserSessionResult *results; ///< results[results_start..+nb_results)
+  int results_start;
+  int nb_results;
+  unsigned int results_alloc;
+  int pending; ///< chunks submitted and not yet in results
+};
+
+static const AVClass parser_session_class = {
+    .class_name = "parser_session",
+    .log_level_offset_offset = offsetof(FFParserSession, log_level_offset),
+};
+
+static int64_t now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static uint64_t stream_hash(uint64_t id) {
+  id ^= id >> 33;
+  id *= 0xff51afd7ed558ccdULL;
+  id ^= id >> 33;
+  return id;
+}
+
+static int stream_worker(const FFParserSession *s, uint64_t id) {
+  return (stream_hash(id) >> 32) % s->nb_threads;
+}
+
+static SessionStream **find_stream(SessionWorker *w, uint64_t id) {
+  SessionStream **p;
+
+  if (!w->nb_buckets)
+    return NULL;
+  p = &w->buckets[stream_hash(id) & (w->nb_buckets - 1)];
+  while (*p && (*p)->id != id)
+    p = &(*p)->hash_next;
+  return p;
+}
+
+static int grow_buckets(SessionWorker *w) {
+  int i, nb_buckets = w->nb_buckets ? 2 * w->nb_buckets : 64;
+  SessionStream **buckets = av_calloc(nb_buckets, sizeof(*buckets));
+
+  if (!buckets)
+    return AVERROR(ENOMEM);
+  for (i = 0; i < w->nb_buckets; i++) {
+    SessionStream *st = w->buckets[i];
+
+    while (st) {
+      SessionStream *next = st->hash_next;
+      SessionStream **p = &buckets[stream_hash(st->id) & (nb_buckets - 1)];
+
+      st->hash_next = *p;
+      *p = st;
+      st = next;
+    }
+  }
+  av_free(w->buckets);
+  w->buckets = buckets;
+  w->nb_buckets = nb_buckets;
+  return 0;
+}
+
+static void lru_remove(SessionWorker *w, SessionStream *st) {
+  if (st->lru_prev)
+    st->lru_prev->lru_next = st->lru_next;
+  else
+    w->lru_head = st->lru_next;
+  if (st->lru_next)
+    st->lru_next->lru_prev = st->lru_prev;
+  else
+    w->lru_tail = st->lru_prev;
+  st->lru_prev = st->lru_next = NULL;
+}
+
+static void lru_append(SessionWorker *w, SessionStream *st) {
+  st->lru_prev = w->lru_tail;
+  st->lru_next = NULL;
+  if (w->lru_tail)
+    w->lru_tail->lru_next = st;
+  else
+    w->lru_head = st;
+  w->lru_tail = st;
+}
+
+static StreamPS *get_ps(SessionWorker *w) {
+  StreamPS *ps = w->free_ps;
+  FFMemStats *mem;
+
+  if (ps) {
+    w->free_ps = ps->next;
+    w->nb_free_ps--;
+    memset(ps, 0, sizeof(*ps));
+    return ps;
+  }
+  // Recycled between streams, so charged to none.
+  mem = ff_mem_set_stream(NULL);
+  ps = av_mallocz(sizeof(*ps));
+  ff_mem_set_stream(mem);
+  return ps;
+}
+
+static void release_ps(SessionWorker *w, SessionStream *st) {
+  StreamPS *ps = st->ps;
+
+  if (!ps)
+    return;
+  st->ps = NULL;
+  if (st->codec_id == AV_CODEC_ID_HEVC)
+    ff_hevc_ps_uninit(&ps->hevc);
+  else
+    ff_h264_ps_uninit(&ps->h264);
+  if (w->nb_free_ps < w->s->opts.max_free_states) {
+    ps->next = w->free_ps;
+    w->free_ps = ps;
+    w->nb_free_ps++;
+  } else {
+    FFMemStats *mem = ff_mem_set_stream(NULL);
+
+    av_free(ps);
+    ff_mem_set_stream(mem);
+  }
+}
+
+static void set_size(SessionStream *st, const AVBufferRef *ref) {
+  if (st->codec_id == AV_CODEC_ID_HEVC) {
+    const HEVCSPS *sps = (const HEVCSPS *)ref->data;
+
+    st->width = sps->width - sps->output_window.left_offset -
+                sps->output_window.right_offset;
+    st->height = sps->height - sps->output_window.top_offset -
+                 sps->output_window.bottom_offset;
+  } else {
+    const SPS *sps = (const SPS *)ref->data;
+
+    st->width = 16 * sps->mb_width - sps->crop_left - sps->crop_right;
+    st->height = 16 * sps->mb_height - sps->crop_top - sps->crop_bottom;
+  }
+}
+
+static AVBufferRef **sps_list(SessionStream *st, int *nb) {
+  if (st->codec_id == AV_CODEC_ID_HEVC) {
+    *nb = HEVC_MAX_SPS_COUNT;
+    return st->ps->hevc.sps_list;
+  }
+  *nb = MAX_SPS_COUNT;
+  return st->ps->h264.sps_list;
+}
+
+/**
+ * Parse extradata or compacted parameter sets into the lists of st.
+ */
+static int parse_extradata(SessionWorker *w, SessionStream *st,
+                           const uint8_t *data, int size, int *is_nalff,
+                           int *nal_length_size) {
+  AVBufferRef **list;
+  int i, nb, ret;
+
+  if (st->codec_id == AV_CODEC_ID_HEVC) {
+    ret = ff_hevc_decode_extradata(data, size, &st->ps->hevc, &w->sei,
+                                   is_nalff, nal_length_size, 0, 0, NULL);
+    ff_hevc_reset_sei(&w->sei);
+  } else {
+    ret = ff_h264_decode_extradata(data, size, &st->ps->h264, is_nalff,
+                                   nal_length_size, 0, NULL);
+  }
+  if (ret < 0)
+    return ret;
+
+  list = sps_list(st, &nb);
+  for (i = 0; i < nb; i++) {
+    if (list[i]) {
+      set_size(st, list[i]);
+      break;
+    }
+  }
+  return 0;
+}
+
+static int compact_stream(SessionWorker *w, SessionStream *st) {
+  if (st->codec_id == AV_CODEC_ID_H263) {
+    // Keep only the pending data of the parse context; the overread bytes
+    // of the last frame live past pc.index.
+    if (st->pc.buffer && !st->pc.overread) {
+      if (!st->pc.index)
+        ff_parse_close(&st->pc);
+      else if (st->pc.buffer_size >
+               2 * (st->pc.index + AV_INPUT_BUFFER_PADDING_SIZE))
+        // Move to a smaller size class; on failure keep the large buffer.
+        ff_parse_realloc(&st->pc, st->pc.index + AV_INPUT_BUFFER_PADDING_SIZE);
+    }
+  } else if (st->ps) {
+    int size = ff_h2645_ps_to_annexb(st->codec_id, st->ps, NULL, 0);
+
+    if (size < 0)
+      return size;
+    if (size) {
+      st->ps_annexb = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+      if (!st->ps_annexb)
+        return AVERROR(ENOMEM);
+      st->ps_annexb_size =
+          ff_h2645_ps_to_annexb(st->codec_id, st->ps, st->ps_annexb, size);
+    }
+    release_ps(w, st);
+  }
+  lru_remove(w, st);
+  st->is_compact = 1;
+  atomic_fetch_add(&w->nb_compact_stat, 1);
+  return 0;
+}
+
+static int expand_stream(SessionWorker *w, SessionStream *st) {
+  if (st->codec_id != AV_CODEC_ID_H263) {
+    int is_nalff = 0, nal_length_size = 0;
+
+    st->ps = get_ps(w);
+    if (!st->ps)
+      return AVERROR(ENOMEM);
+    if (st->ps_annexb) {
+      int ret = parse_extradata(w, st, st->ps_annexb, st->ps_annexb_size,
+                                &is_nalff, &nal_length_size);
+      if (ret < 0) {
+        release_ps(w, st);
+        return ret;
+      }
+      av_freep(&st->ps_annexb);
+      st->ps_annexb_size = 0;
+    }
+  }
+  st->is_compact = 0;
+  atomic_fetch_sub(&w->nb_compact_stat, 1);
+  return 0;
+}
+
+/**
+ * Free a stream, already unlinked from its hash bucket.
+ */
+static void free_stream(SessionWorker *w, SessionStream *st) {
+  FFMemStats *mem;
+
+  if (st->is_compact)
+    atomic_fetch_sub(&w->nb_compact_stat, 1);
+  else
+    lru_remove(w, st);
+  mem = ff_mem_set_stream(st->mem);
+  release_ps(w, st);
+  av_freep(&st->ps_annexb);
+  ff_parse_close(&st->pc);
+  if (st->hrd)
+    ff_hrd_sim_uninit(st->hrd);
+  av_freep(&st->hrd);
+  ff_mem_set_stream(mem);
+  // Blocks freed later no longer credit a stream reusing st.
+  ff_mem_stats_unref(&st->mem);
+  memset(st, 0, sizeof(*st));
+  st->hash_next = w->free_streams;
+  w->free_streams = st;
+  w->nb_streams--;
+  atomic_fetch_sub(&w->nb_streams_stat, 1);
+}
+
+static int open_stream(SessionWorker *w, const FFParserSessionChunk *c,
+                       int64_t now) {
+  SessionStream **p = find_stream(w, c->stream_id);
+  SessionStream *st;
+  int ret = 0;
+
+  if (p && *p)
+    return AVERROR(EEXIST);
+  if (c->codec_id != AV_CODEC_ID_H263 && c->codec_id != AV_CODEC_ID_H264 &&
+      c->codec_id != AV_CODEC_ID_HEVC)
+    return AVERROR(EINVAL);
+  if (w->nb_streams >= w->nb_buckets && (ret = grow_buckets(w)) < 0)
+    return ret;
+
+  st = w->free_streams;
+  if (st)
+    w->free_streams = st->hash_next;
+  else if (!(st = av_mallocz(sizeof(*st))))
+    return AVERROR(ENOMEM);
+  st->mem = ff_mem_stats_alloc();
+  if (!st->mem) {
+    st->hash_next = w->free_streams;
+    w->free_streams = st;
+    return AVERROR(ENOMEM);
+  }
+  st->id = c->stream_id;
+  st->codec_id = c->codec_id;
+  st->last_used = now;
+  p = find_stream(w, c->stream_id);
+  st->hash_next = NULL;
+  *p = st;
+  lru_append(w, st);
+  w->nb_streams++;
+  atomic_fetch_add(&w->nb_streams_stat, 1);
+
+  if (c->codec_id != AV_CODEC_ID_H263) {
+    FFMemStats *mem = ff_mem_set_stream(st->mem);
+
+    st->ps = get_ps(w);
+    if (!st->ps)
+      ret = AVERROR(ENOMEM);
+    else if (c->size > 0)
+      ret = parse_extradata(w, st, c->data, c->size, &st->is_nalff,
+                            &st->nal_length_size);
+    ff_mem_set_stream(mem);
+    if (ret < 0) {
+      *p = NULL;
+      free_stream(w, st);
+      return ret;
+    }
+  }
+  return 0;
+}
+
+static void parse_h263(SessionWorker *w, SessionStream *st,
+                       const FFParserSessionChunk *c,
+                       FFParserSessionResult *res) {
+  static const uint8_t empty[1];
+  const uint8_t *buf = c->data;
+  int left = c->size;
+  H263Frame frame;
+
+  if (!left && !st->pc.index)
+    return;
+  frame.hdr = st->h263_hdr;
+  do {
+    int ret;
+
+    ret = ff_h263_split_frame(&st->pc, &frame, left ? buf : empty, left);
+    if (frame.data) {
+      res->nb_pictures++;
+      st->width = frame.hdr.width;
+      st->height = frame.hdr.height;
+    } else if (ret <= 0) {
+      break;
+    }
+    // A negative return is a frame ending in data buffered before buf.
+    ret = FFMAX(ret, 0);
+    buf += ret;
+    left -= ret;
+  } while (left > 0);
+  st->h263_hdr = frame.hdr;
+}
+
+/**
+ * Parse the picture timing SEI kept until now with the SPS a slice of the
+ * access unit names through its PPS.
+ */
+static int h264_picture_timing(SessionWorker *w, SessionStream *st,
+                               GetBitContext gb) {
+  const H264ParamSets *ps = &st->ps->h264;
+  const PPS *pps;
+  unsigned int pps_id;
+
+  get_ue_golomb_long(&gb); // first_mb_in_slice
+  get_ue_golomb_31(&gb);   // slice_type
+  pps_id = get_ue_golomb(&gb);
+  if (pps_id >= MAX_PPS_COUNT || !ps->pps_list[pps_id])
+    return AVERROR_PS_NOT_FOUND;
+  pps = (const PPS *)ps->pps_list[pps_id]->data;
+  if (!ps->sps_list[pps->sps_id])
+    return AVERROR_PS_NOT_FOUND;
+  return ff_h264_sei_process_picture_timing(
+      &w->h264_sei.picture_timing,
+      (const SPS *)ps->sps_list[pps->sps_id]->data, w->s);
+}
+
+/**
+ * Feed the access unit of a chunk to the CPB simulator of the stream,
+ * (re)starting it at a buffering period naming a new SPS.
+ */
+static int hrd_add_au(SessionWorker *w, SessionStream *st, int size,
+                      FFParserSessionResult *res) {
+  const int hevc = st->codec_id == AV_CODEC_ID_HEVC;
+  const HEVCSEIBufferingPeriod *bp = NULL;
+  HRDSimAU au = {.size = size};
+  HRDSimReport prev, cur;
+  AVBufferRef **list;
+  int nb, sps_id = -1, ret;
+
+  if (hevc) {
+    bp = ff_hevc_sei_get(&w->sei, HEVC_SEI_MSG_BUFFERING_PERIOD);
+    if (bp && bp->present)
+      sps_id = bp->seq_parameter_set_id;
+  } else if (w->h264_sei.buffering_period.present) {
+    sps_id = w->h264_sei.buffering_period.seq_parameter_set_id;
+  }
+
+  if (sps_id >= 0 && (!st->hrd || sps_id != st->hrd_sps_id)) {
+    HRDSimParams par;
+
+    list = sps_list(st, &nb);
+    if (sps_id >= nb || !list[sps_id])
+      return AVERROR_PS_NOT_FOUND;
+    ret = hevc ? ff_hrd_sim_params_from_hevc_sps(
+                     &par, (const HEVCSPS *)list[sps_id]->data, 0)
+               : ff_hrd_sim_params_from_h264_sps(
+                     &par, (const SPS *)list[sps_id]->data, 0);
+    if (st->hrd)
+      ff_hrd_sim_uninit(st->hrd);
+    if (ret < 0) {
+      // No HRD in that SPS, nothing to check.
+      av_freep(&st->hrd);
+      return 0;
+    }
+    if (!st->hrd && !(st->hrd = av_mallocz(sizeof(*st->hrd))))
+      return AVERROR(ENOMEM);
+    if ((ret = ff_hrd_sim_init(st->hrd, &par)) < 0) {
+      av_freep(&st->hrd);
+      return ret;
+    }
+    st->hrd_sps_id = sps_id;
+  }
+  if (!st->hrd)
+    return 0;
+
+  if (hevc)
+    ff_hrd_sim_au_from_hevc_sei(&au, &st->hrd->par, &w->sei);
+  else
+    ff_hrd_sim_au_from_h264_sei(&au, &st->hrd->par, &w->h264_sei);
+  ff_hrd_sim_get_report(st->hrd, &prev);
+  if ((ret = ff_hrd_sim_add_au(st->hrd, &au)) < 0)
+    return ret;
+  ff_hrd_sim_get_report(st->hrd, &cur);
+  res->cpb_underflow = cur.nb_underflow > prev.nb_underflow;
+  res->cpb_overflow = cur.nb_overflow > prev.nb_overflow;
+  return 0;
+}
+
+static void parse_h2645(SessionWorker *w, SessionStream *st,
+                        const FFParserSessionChunk *c,
+                        FFParserSessionResult *res) {
+  const int hevc = st->codec_id == AV_CODEC_ID_HEVC;
+  AVBufferRef *old[MAX_SPS_COUNT];
+  AVBufferRef **list;
+  FFMemStats *mem;
+  int i, j, nb, ret;
+
+  // The split buffers are shared by the streams of the worker.
+  mem = ff_mem_set_stream(NULL);
+  ret = ff_h2645_packet_split(&w->pkt, c->data, c->size, w->s, st->is_nalff,
+                              st->nal_length_size, st->codec_id, 1, 0);
+  ff_mem_set_stream(mem);
+  if (ret < 0) {
+    res->ret = ret;
+    return;
+  }
+  list = sps_list(st, &nb);
+  if (!hevc) {
+    ff_h264_sei_reset(&w->h264_sei);
+  } else if (w->s->opts.hrd_check) {
+    // The SEI state is shared by the streams of the worker.
+    ff_hevc_uninit_sei(&w->sei);
+    w->sei.active_seq_parameter_set_id = st->hrd ? st->hrd_sps_id : 0;
+  }
+
+  for (i = 0; i < w->pkt.nb_nals; i++) {
+    H2645NAL *nal = &w->pkt.nals[i];
+    GetBitContext gb = nal->gb;
+
+    if (hevc) {
+      if (nal->nuh_layer_id > 0)
+        continue;
+      if (nal->type <= HEVC_NAL_RASL_R ||
+          (nal->type >= HEVC_NAL_BLA_W_LP && nal->type <= HEVC_NAL_CRA_NUT)) {
+        // first_slice_segment_in_pic_flag
+        res->nb_pictures += get_bits_left(&gb) > 0 && get_bits1(&gb);
+        continue;
+      }
+      if (nal->type == HEVC_NAL_SEI_PREFIX && w->s->opts.hrd_check) {
+        // Only the HRD messages are used; the others do not fail a chunk.
+        ret = ff_hevc_decode_nal_sei(&nal->gb, w->s, &w->sei, &st->ps->hevc,
+                                     nal->type);
+        if (ret == AVERROR(ENOMEM) && !res->ret)
+          res->ret = ret;
+        continue;
+      }
+    } else {
+      // Data partitions B and C do not start with a slice header.
+      if (nal->type == H264_NAL_SLICE || nal->type == H264_NAL_DPA ||
+          nal->type == H264_NAL_IDR_SLICE) {
+        if (w->h264_sei.picture_timing.payload_size) {
+          ret = h264_picture_timing(w, st, gb);
+          if (ret < 0 && ret != AVERROR_PS_NOT_FOUND && !res->ret)
+            res->ret = ret;
+        }
+        // first_mb_in_slice == 0
+        res->nb_pictures += get_bits_left(&gb) > 0 && get_bits1(&gb);
+        continue;
+      }
+      if (nal->type == H264_NAL_SEI) {
+        ret = ff_h264_sei_decode(&w->h264_sei, &nal->gb, &st->ps->h264, w->s);
+        if (ret < 0 && ret != AVERROR_PS_NOT_FOUND && !res->ret)
+          res->ret = ret;
+        continue;
+      }
+    }
+
+    memcpy(old, list, nb * sizeof(*list));
+    switch (nal->type | hevc << 8) {
+    case H264_NAL_SPS:
+      ret = ff_h264_decode_seq_parameter_set(&nal->gb, w->s, &st->ps->h264, 0);
+      break;
+    case H264_NAL_PPS:
+      ret = ff_h264_decode_picture_parameter_set(&nal->gb, w->s, &st->ps->h264,
+                                                 nal->size_bits);
+      break;
+    case HEVC_NAL_VPS | 1 << 8:
+      ret = ff_hevc_decode_nal_vps(&nal->gb, w->s, &st->ps->hevc);
+      break;
+    case HEVC_NAL_SPS | 1 << 8:
+      ret = ff_hevc_decode_nal_sps(&nal->gb, w->s, &st->ps->hevc, 0);
+      break;
+    case HEVC_NAL_PPS | 1 << 8:
+      ret = ff_hevc_decode_nal_pps(&nal->gb, w->s, &st->ps->hevc);
+      break;
+    default:
+      continue;
+    }
+    if (ret < 0) {
+      if (!res->ret)
+        res->ret = ret;
+      continue;
+    }
+    res->ps_changed = 1;
+    for (j = 0; j < nb; j++) {
+      if (list[j] != old[j] && list[j]) {
+        set_size(st, list[j]);
+        break;
+      }
+    }
+  }
+  if (!hevc)
+    res->recovery_frame_cnt = w->h264_sei.recovery_point.recovery_frame_cnt;
+  if (w->s->opts.hrd_check) {
+    ret = hrd_add_au(w, st, c->size, res);
+    if (ret < 0 && ret != AVERROR_PS_NOT_FOUND && !res->ret)
+      res->ret = ret;
+  }
+}
+
+static void stream_memory(SessionStream *st, FFParserSessionResult *res) {
+  FFMemCounters counters[FF_MEM_TAG_NB + 1];
+
+  ff_mem_stats_read(st->mem, counters);
+  res->mem = counters[FF_MEM_TAG_NB];
+}
+
+static void process_chunk(SessionWorker *w, const FFParserSessionChunk *c,
+                          int64_t now, FFParserSessionResult *res) {
+  SessionStream **p, *st;
+  FFMemStats *mem;
+
+  memset(res, 0, sizeof(*res));
+  res->recovery_frame_cnt = -1;
+  res->cpb_underflow = res->cpb_overflow = -1;
+  res->stream_id = c->stream_id;
+  res->command = c->command;
+  res->opaque = c->opaque;
+
+  if (c->command == FF_PARSER_SESSION_OPEN) {
+    res->ret = open_stream(w, c, now);
+    if (res->ret >= 0) {
+      st = *find_stream(w, c->stream_id);
+      res->width = st->width;
+      res->height = st->height;
+      stream_memory(st, res);
+    }
+    return;
+  }
+
+  p = find_stream(w, c->stream_id);
+  st = p ? *p : NULL;
+  if (!st) {
+    res->ret = AVERROR(ENOENT);
+    return;
+  }
+
+  if (c->command == FF_PARSER_SESSION_CLOSE) {
+    *p = st->hash_next;
+    free_stream(w, st);
+    return;
+  }
+  if (c->command != FF_PARSER_SESSION_DATA) {
+    res->ret = AVERROR(EINVAL);
+    return;
+  }
+
+  mem = ff_mem_set_stream(st->mem);
+  if (st->is_compact) {
+    if ((res->ret = expand_stream(w, st)) < 0)
+      goto end;
+  } else {
+    lru_remove(w, st);
+  }
+  lru_append(w, st);
+  st->last_used = now;
+
+  if (st->codec_id == AV_CODEC_ID_H263)
+    parse_h263(w, st, c, res);
+  else if (c->size > 0)
+    parse_h2645(w, st, c, res);
+  res->width = st->width;
+  res->height = st->height;
+end:
+  ff_mem_set_stream(mem);
+  stream_memory(st, res);
+}
+
+static void compact_idle_streams(SessionWorker *w, int64_t now) {
+  int timeout = w->s->opts.idle_timeout_ms;
+
+  while (timeout > 0 && w->lru_head &&
+         now - w->lru_head->last_used >= timeout) {
+    SessionStream *st = w->lru_head;
+    FFMemStats *mem = ff_mem_set_stream(st->mem);
+    int ret = compact_stream(w, st);
+
+    ff_mem_set_stream(mem);
+    if (ret < 0) {
+      // Retry after another timeout.
+      lru_remove(w, st);
+      lru_append(w, st);
+      st->last_used = now;
+    }
+  }
+}
+
+static int post_results(SessionWorker *w, int nb) {
+  FFParserSession *s = w->s;
+  int ret = 0;
+
+  pthread_mutex_lock(&s->lock);
+  if (s->results_start && s->results_start + s->nb_results + nb >
+                              s->results_alloc / sizeof(*s->results)) {
+    memmove(s->results, s->results + s->results_start,
+            s->nb_results * sizeof(*s->results));
+    s->results_start = 0;
+  }
+  if (s->results_start + s->nb_results + nb >
+      s->results_alloc / sizeof(*s->results)) {
+    FFParserSessionResult *results =
+        av_fast_realloc(s->results, &s->results_alloc,
+                        (s->nb_results + nb) * 2 * sizeof(*s->results));
+    if (results)
+      s->results = results;
+    else
+      ret = AVERROR(ENOMEM);
+  }
+  if (ret >= 0) {
+    memcpy(s->results + s->results_start + s->nb_results, w->results,
+           nb * sizeof(*s->results));
+    s->nb_results += nb;
+  }
+  s->pending -= nb;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+  return ret;
+}
+
+static void *worker_thread(void *arg) {
+  SessionWorker *w = arg;
+  FFParserSession *s = w->s;
+
+  for (;;) {
+    FFParserSessionChunk *tmp;
+    unsigned int tmp_alloc;
+    int64_t now;
+    int i, nb;
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->nb_queued && !w->exit) {
+      if (s->opts.idle_timeout_ms > 0 && w->lru_head) {
+        int64_t deadline = w->lru_head->last_used + s->opts.idle_timeout_ms;
+        struct timespec ts = {deadline / 1000, deadline % 1000 * 1000000};
+
+        if (pthread_cond_timedwait(&w->cond, &w->lock, &ts) == ETIMEDOUT)
+          break;
+      } else {
+        pthread_cond_wait(&w->cond, &w->lock);
+      }
+    }
+    if (!w->nb_queued && w->exit) {
+      pthread_mutex_unlock(&w->lock);
+      break;
+    }
+    tmp = w->batch;
+    tmp_alloc = w->batch_alloc;
+    w->batch = w->queue;
+    w->batch_alloc = w->queue_alloc;
+    w->queue = tmp;
+    w->queue_alloc = tmp_alloc;
+    nb = w->nb_queued;
+    w->nb_queued = 0;
+    pthread_mutex_unlock(&w->lock);
+
+    now = now_ms();
+    if (nb) {
+      FFParserSessionResult *results = av_fast_realloc(
+          w->results, &w->results_alloc, nb * sizeof(*w->results));
+      if (!results) {
+        // Nothing can be reported; do not leave pollers waiting.
+        pthread_mutex_lock(&s->lock);
+        s->pending -= nb;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+        continue;
+      }
+      w->results = results;
+      for (i = 0; i < nb; i++)
+        process_chunk(w, &w->batch[i], now, &w->results[i]);
+      post_results(w, nb);
+    }
+    compact_idle_streams(w, now);
+  }
+  return NULL;
+}
+
+int ff_parser_session_submit(FFParserSession *s,
+                             const FFParserSessionChunk *chunks,
+                             int nb_chunks) {
+  uint8_t index[SUBMIT_BLOCK];
+  int i, j, k, n, ret = 0;
+
+  if (nb_chunks < 0)
+    return AVERROR(EINVAL);
+
+  pthread_mutex_lock(&s->lock);
+  s->pending += nb_chunks;
+  pthread_mutex_unlock(&s->lock);
+
+  for (i = 0; i < nb_chunks && ret >= 0; i += n) {
+    uint64_t used = 0;
+
+    n = FFMIN(nb_chunks - i, SUBMIT_BLOCK);
+    for (j = 0; j < n; j++) {
+      index[j] = stream_worker(s, chunks[i + j].stream_id);
+      used |= 1ULL << index[j];
+    }
+    for (k = 0; k < s->nb_threads && ret >= 0; k++) {
+      SessionWorker *w = &s->workers[k];
+      int count = 0;
+
+      if (!(used >> k & 1))
+        continue;
+      for (j = 0; j < n; j++)
+        count += index[j] == k;
+
+      pthread_mutex_lock(&w->lock);
+      if (w->nb_queued + count > w->queue_alloc / sizeof(*w->queue)) {
+        FFParserSessionChunk *queue =
+            av_fast_realloc(w->queue, &w->queue_alloc,
+                            (w->nb_queued + count) * 2 * sizeof(*w->queue));
+        if (queue)
+          w->queue = queue;
+        else
+          ret = AVERROR(ENOMEM);
+      }
+      if (ret >= 0) {
+        for (j = 0; j < n; j++)
+          if (index[j] == k)
+            w->queue[w->nb_queued++] = chunks[i + j];
+        used &= ~(1ULL << k);
+        pthread_cond_signal(&w->cond);
+      }
+      pthread_mutex_unlock(&w->lock);
+    }
+    if (ret < 0) {
+      // Chunks of this block that were not queued and all later ones
+      // produce no result.
+      int lost = nb_chunks - i - n;
+
+      for (j = 0; j < n; j++)
+        lost += used >> index[j] & 1;
+      pthread_mutex_lock(&s->lock);
+      s->pending -= lost;
+      pthread_cond_broadcast(&s->cond);
+      pthread_mutex_unlock(&s->lock);
+    }
+  }
+  return ret;
+}
+
+int ff_parser_session_poll(FFParserSession *s, FFParserSessionResult *results,
+                           int max_results, int wait) {
+  int nb;
+
+  pthread_mutex_lock(&s->lock);
+  while (wait && !s->nb_results && s->pending > 0)
+    pthread_cond_wait(&s->cond, &s->lock);
+  nb = FFMIN(FFMAX(max_results, 0), s->nb_results);
+  memcpy(results, s->results + s->results_start, nb * sizeof(*results));
+  s->results_start += nb;
+  s->nb_results -= nb;
+  if (!s->nb_results)
+    s->results_start = 0;
+  pthread_mutex_unlock(&s->lock);
+  return nb;
+}
+
+void ff_parser_session_stats(FFParserSession *s, int *nb_streams,
+                             int *nb_compact) {
+  int i;
+
+  *nb_streams = *nb_compact = 0;
+  for (i = 0; i < s->nb_threads; i++) {
+    *nb_streams += atomic_load(&s->workers[i].nb_streams_stat);
+    *nb_compact += atomic_load(&s->workers[i].nb_compact_stat);
+  }
+}
+
+int ff_parser_session_init(FFParserSession **ps,
+                           const FFParserSessionOptions *opts) {
+  FFParserSession *s;
+  pthread_condattr_t attr;
+  long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int i;
+
+  if (nb_cpus <= 0)
+    nb_cpus = 1;
+
+  s = av_mallocz(sizeof(*s));
+  if (!s)
+    return AVERROR(ENOMEM);
+  s->class = &parser_session_class;
+  if (opts)
+    s->opts = *opts;
+  else
+    s->opts.max_free_states = 16;
+  s->nb_threads = s->opts.nb_threads > 0 ? s->opts.nb_threads : nb_cpus;
+  s->nb_threads = FFMIN(s->nb_threads, FF_PARSER_SESSION_MAX_THREADS);
+  s->workers = av_calloc(s->nb_threads, sizeof(*s->workers));
+  if (!s->workers) {
+    av_free(s);
+    return AVERROR(ENOMEM);
+  }
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  *ps = s;
+
+  // The idle timeout is waited for on the monotonic clock.
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  for (i = 0; i < s->nb_threads; i++) {
+    SessionWorker *w = &s->workers[i];
+
+    w->s = s;
+    w->index = i;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, &attr);
+  }
+  pthread_condattr_destroy(&attr);
+
+  for (i = 0; i < s->nb_threads; i++) {
+    SessionWorker *w = &s->workers[i];
+    int ret = pthread_create(&w->thread, NULL, worker_thread, w);
+
+    if (ret) {
+      ff_parser_session_free(ps);
+      return AVERROR(ret);
+    }
+    s->nb_started++;
+    if (s->opts.pin_threads) {
+      cpu_set_t set;
+
+      CPU_ZERO(&set);
+      CPU_SET(i % nb_cpus, &set);
+      pthread_setaffinity_np(w->thread, sizeof(set), &set);
+    }
+  }
+  return s->nb_threads;
+}
+
+void ff_parser_session_free(FFParserSession **ps) {
+  FFParserSession *s = *ps;
+  int i, j;
+
+  if (!s)
+    return;
+
+  for (i = 0; i < s->nb_started; i++) {
+    SessionWorker *w = &s->workers[i];
+
+    pthread_mutex_lock(&w->lock);
+    w->exit = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+  }
+
+  for (i = 0; i < s->nb_threads; i++) {
+    SessionWorker *w = &s->workers[i];
+
+    for (j = 0; j < w->nb_buckets; j++) {
+      while (w->buckets[j]) {
+        SessionStream *st = w->buckets[j];
+
+        w->buckets[j] = st->hash_next;
+        free_stream(w, st);
+      }
+    }
+    while (w->free_streams) {
+      SessionStream *st = w->free_streams;
+
+      w->free_streams = st->hash_next;
+      av_free(st);
+    }
+    while (w->free_ps) {
+      StreamPS *sps = w->free_ps;
+
+      w->free_ps = sps->next;
+      av_free(sps);
+    }
+    ff_h2645_packet_uninit(&w->pkt);
+    ff_hevc_uninit_sei(&w->sei);
+    ff_h264_sei_uninit(&w->h264_sei);
+    av_free(w->buckets);
+    av_free(w->queue);
+    av_free(w->batch);
+    av_free(w->results);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+  }
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->cond);
+  av_free(s->workers);
+  av_free(s->results);
+  av_freep(ps);
+
+  // The streams returned their buffers to the process-wide pools.
+  ff_buffer_pool_trim_size();
+  ff_h264_ps_pool_trim();
+  ff_hevc_ps_pool_trim();
+  ff_hevc_sei_pool_trim();
+}
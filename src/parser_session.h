@@ -0,0 +1,156 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Parser sessions for many concurrent streams.
+ *
+ * Each stream is owned by one worker thread, chosen from its id, so its
+ * parser state is only ever touched by that thread and stays in the caches
+ * of one core. Chunks are queued in batches and their results polled in
+ * batches.
+ *
+ * Streams and their parameter set lists are recycled through per worker
+ * free lists, and the NAL unit split buffers are shared by all the streams
+ * of a worker. Once a stream has been idle for idle_timeout_ms, its
+ * parameter sets go back to the pool and the stream keeps a compact form:
+ * the parameter sets as Annex B NAL units, or for H.263 the pending data of
+ * its parse context only. The lists are rebuilt from that on the next
+ * chunk.
+ */
+
+#ifndef AVCODEC_PARSER_SESSION_H
+#define AVCODEC_PARSER_SESSION_H
+
+#include <stdint.h>
+
+#include "codec_id.h"
+#include "memstats.h"
+
+#define FF_PARSER_SESSION_MAX_THREADS 64
+
+enum FFParserSessionCommand {
+  FF_PARSER_SESSION_OPEN,  ///< create a stream, data is its extradata
+  FF_PARSER_SESSION_DATA,  ///< parse data, size 0 flushes an H.263 stream
+  FF_PARSER_SESSION_CLOSE, ///< free a stream
+};
+
+typedef struct FFParserSessionOptions {
+  int nb_threads;      ///< worker threads, 0 for one per CPU
+  int pin_threads;     ///< bind worker i to CPU i modulo the CPU count
+  int idle_timeout_ms; ///< compact streams idle for that long, 0 to never
+  int max_free_states; ///< per worker cap of recycled stream states
+  /**
+   * Run the CPB of the HRD of H.264 / HEVC streams through the leaky
+   * bucket simulator of hrd_sim.h. Each DATA chunk is then one access
+   * unit. The simulation of a stream starts at its first buffering period
+   * SEI naming an SPS with HRD parameters, and restarts when a buffering
+   * period names another SPS.
+   */
+  int hrd_check;
+} FFParserSessionOptions;
+
+typedef struct FFParserSessionChunk {
+  uint64_t stream_id;
+  enum FFParserSessionCommand command;
+  enum AVCodecID codec_id; ///< H263, H264 or HEVC, for OPEN only
+  /**
+   * Not copied; must stay valid until the result of the chunk is polled,
+   * and be followed by AV_INPUT_BUFFER_PADDING_SIZE readable bytes.
+   * H.264 / HEVC data may be Annex B or use the NAL unit length size of
+   * the avcC / hvcC extradata given at OPEN.
+   */
+  const uint8_t *data;
+  int size;
+  void *opaque; ///< returned in the result
+} FFParserSessionChunk;
+
+typedef struct FFParserSessionResult {
+  uint64_t stream_id;
+  enum FFParserSessionCommand command;
+  void *opaque;
+  int ret;           ///< 0 or a negative AVERROR code
+  int nb_pictures;   ///< pictures started in the chunk
+  int ps_changed;    ///< parameter sets were parsed from the chunk
+  int width, height; ///< of the latest SPS or H.263 picture, 0 if none
+  /**
+   * recovery_frame_cnt of an H.264 recovery point SEI in the chunk, -1 if
+   * none
+   */
+  int recovery_frame_cnt;
+  /**
+   * With hrd_check, 1 if the access unit of the chunk underflowed or
+   * overflowed the CPB, 0 if not; -1 while the stream is not simulated
+   */
+  int cpb_underflow, cpb_overflow;
+  /**
+   * Memory held by the stream after the chunk, all tags together; zero
+   * without CONFIG_MEMORY_ACCOUNTING. Blocks shared by the streams of a
+   * worker, like the NAL unit split buffers, are charged to none.
+   */
+  FFMemCounters mem;
+} FFParserSessionResult;
+
+/**
+ * A session is also the logging context of its streams, so their messages
+ * can be made more verbose with av_log_set_context_offset().
+ */
+typedef struct FFParserSession FFParserSession;
+
+/**
+ * @param opts NULL for the defaults
+ * @return the number of worker threads, a negative AVERROR code on error
+ */
+int ff_parser_session_init(FFParserSession **s,
+                           const FFParserSessionOptions *opts);
+
+/**
+ * Process every queued chunk, close every stream, stop the workers and
+ * free the session. Results that were not polled are dropped. The idle
+ * buffers of the process-wide pools are freed.
+ */
+void ff_parser_session_free(FFParserSession **s);
+
+/**
+ * Queue chunks. Chunks of one stream are processed in submission order,
+ * and produce one result each.
+ *
+ * @return 0 on success, a negative AVERROR code on error; chunks that were
+ *         queued before the error still produce results
+ */
+int ff_parser_session_submit(FFParserSession *s,
+                             const FFParserSessionChunk *chunks, int nb_chunks);
+
+/**
+ * Get the results of processed chunks.
+ *
+ * @param wait if nonzero and chunks are pending, block until at least one
+ *             result is available
+ * @return the number of results written, up to max_results
+ */
+int ff_parser_session_poll(FFParserSession *s, FFParserSessionResult *results,
+                           int max_results, int wait);
+
+/**
+ * Get the number of open streams and how many of them are compact. The
+ * counts are updated by the workers and may lag behind.
+ */
+void ff_parser_session_stats(FFParserSession *s, int *nb_streams,
+                             int *nb_compact);
+
+#endif /* AVCODEC_PARSER_SESSION_H */
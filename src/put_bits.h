@@ -219,7 +219,7 @@ static inline void put_bits_no_assert(PutBitContext *s, int n, BitBuf value) {
       AV_WBBUF(s->buf_ptr, bit_buf);
       s->buf_ptr += sizeof(BitBuf);
     } else {
-      printf("Internal error, put_bits buffer too small\n");
+      av_log(NULL, AV_LOG_ERROR, "Internal error, put_bits buffer too small\n");
       av_assert2(0);
     }
     bit_left += BUF_BITS - n;
@@ -255,7 +255,7 @@ static inline void put_bits_le(PutBitContext *s, int n, BitBuf value) {
       AV_WLBUF(s->buf_ptr, bit_buf);
       s->buf_ptr += sizeof(BitBuf);
     } else {
-      printf("Internal error, put_bits buffer too small\n");
+      av_log(NULL, AV_LOG_ERROR, "Internal error, put_bits buffer too small\n");
       av_assert2(0);
     }
     bit_buf = value >> bit_left;
@@ -305,7 +305,7 @@ static void av_unused put_bits32(PutBitContext *s, uint32_t value) {
     AV_WBBUF(s->buf_ptr, bit_buf);
     s->buf_ptr += sizeof(BitBuf);
   } else {
-    printf("Internal error, put_bits buffer too small\n");
+    av_log(NULL, AV_LOG_ERROR, "Internal error, put_bits buffer too small\n");
     av_assert2(0);
   }
   bit_buf = value;
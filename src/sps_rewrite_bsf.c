@@ -0,0 +1,504 @@
+/*
+ * H.264 / HEVC SPS VUI rewriting
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "defs.h"
+#include "error.h"
+#include "golomb.h"
+#include "h264.h"
+#include "h264data.h"
+#include "hevc.h"
+#include "intmath.h"
+#include "intreadwrite.h"
+#include "mem.h"
+#include "put_bits.h"
+#include "sps_rewrite_bsf.h"
+
+/**
+ * Copy the bits [from, to) of the RBSP read by gb.
+ */
+static void copy_bits(PutBitContext *pb, const GetBitContext *gb, int from,
+                      int to) {
+  GetBitContext src = *gb;
+  int n = to - from;
+
+  init_get_bits(&src, gb->buffer, gb->size_in_bits);
+  skip_bits_long(&src, from);
+  for (; n >= 32; n -= 32)
+    put_bits32(pb, get_bits_long(&src, 32));
+  if (n)
+    put_bits(pb, n, get_bits_long(&src, n));
+}
+
+static void put_sar(PutBitContext *pb, AVRational sar) {
+  int i;
+
+  if (!sar.num || !sar.den) {
+    put_bits(pb, 1, 0); // aspect_ratio_info_present_flag
+    return;
+  }
+  put_bits(pb, 1, 1);
+  for (i = 1; i < FF_ARRAY_ELEMS(ff_h264_pixel_aspect); i++) {
+    if (sar.num == ff_h264_pixel_aspect[i].num &&
+        sar.den == ff_h264_pixel_aspect[i].den) {
+      put_bits(pb, 8, i);
+      return;
+    }
+  }
+  put_bits(pb, 8, 255); // EXTENDED_SAR
+  put_bits(pb, 16, sar.num);
+  put_bits(pb, 16, sar.den);
+}
+
+/**
+ * Write video_signal_type_present_flag and what follows it, from the
+ * values in the SPS with those of p overriding them.
+ */
+static void put_video_signal(PutBitContext *pb, GetBitContext *gb, int present,
+                             const SPSRewriteParams *p) {
+  int video_format = 5, full_range = 0, desc = 0;
+  int primaries = AVCOL_PRI_UNSPECIFIED, trc = AVCOL_TRC_UNSPECIFIED;
+  int matrix = AVCOL_SPC_UNSPECIFIED;
+
+  if (present && get_bits1(gb)) {
+    video_format = get_bits(gb, 3);
+    full_range = get_bits1(gb);
+    if ((desc = get_bits1(gb))) {
+      primaries = get_bits(gb, 8);
+      trc = get_bits(gb, 8);
+      matrix = get_bits(gb, 8);
+    }
+  }
+  if (p->full_range >= 0)
+    full_range = p->full_range;
+  if (p->color_primaries >= 0)
+    primaries = p->color_primaries;
+  if (p->color_trc >= 0)
+    trc = p->color_trc;
+  if (p->colorspace >= 0)
+    matrix = p->colorspace;
+
+  put_bits(pb, 1, 1);
+  put_bits(pb, 3, video_format);
+  put_bits(pb, 1, full_range);
+  put_bits(pb, 1, 1);
+  put_bits(pb, 8, primaries);
+  put_bits(pb, 8, trc);
+  put_bits(pb, 8, matrix);
+}
+
+/**
+ * Rewrite the VUI of an SPS RBSP. Sections of the VUI that are not changed
+ * are copied, as is everything after the timing info.
+ */
+static int rewrite_vui(enum AVCodecID codec_id, const uint8_t *data,
+                       int data_size, int vui_flag_pos,
+                       const SPSRewriteParams *p, uint8_t *rbsp, int size) {
+  const int hevc = codec_id == AV_CODEC_ID_HEVC;
+  GetBitContext gb;
+  PutBitContext pb;
+  int i, pos, stop, present, timing;
+
+  // Everything up to the rbsp_stop_one_bit is copied or rewritten.
+  for (i = data_size - 1; i >= 0 && !data[i]; i--)
+    ;
+  if (i < 0)
+    return AVERROR_INVALIDDATA;
+  stop = 8 * i + 7 - ff_ctz(data[i]);
+  if (vui_flag_pos <= 0 || vui_flag_pos >= stop)
+    return AVERROR_INVALIDDATA;
+  if (size < data_size + SPS_REWRITE_MAX_GROWTH)
+    return AVERROR(ENOSPC);
+
+  // The parser read this far already, its reads stay within the padding.
+  init_get_bits(&gb, data, stop);
+  init_put_bits(&pb, rbsp, size);
+
+  copy_bits(&pb, &gb, 0, vui_flag_pos);
+  skip_bits_long(&gb, vui_flag_pos);
+  present = get_bits1(&gb);
+  put_bits(&pb, 1, 1);
+
+  // aspect_ratio_info
+  pos = get_bits_count(&gb);
+  if (present && get_bits1(&gb)) {
+    if (get_bits(&gb, 8) == 255)
+      skip_bits_long(&gb, 32);
+  }
+  if (p->flags & SPS_REWRITE_SAR)
+    put_sar(&pb, p->sar);
+  else if (present)
+    copy_bits(&pb, &gb, pos, get_bits_count(&gb));
+  else
+    put_bits(&pb, 1, 0);
+
+  // overscan_info
+  pos = get_bits_count(&gb);
+  if (present && get_bits1(&gb))
+    skip_bits1(&gb);
+  if (present)
+    copy_bits(&pb, &gb, pos, get_bits_count(&gb));
+  else
+    put_bits(&pb, 1, 0);
+
+  // video_signal_type
+  pos = get_bits_count(&gb);
+  if (p->flags & SPS_REWRITE_COLOUR) {
+    put_video_signal(&pb, &gb, present, p);
+  } else if (present) {
+    if (get_bits1(&gb)) {
+      skip_bits(&gb, 4); // video_format, video_full_range_flag
+      if (get_bits1(&gb))
+        skip_bits_long(&gb, 24); // colour description
+    }
+    copy_bits(&pb, &gb, pos, get_bits_count(&gb));
+  } else {
+    put_bits(&pb, 1, 0);
+  }
+
+  // chroma_loc_info, and up to default_display_window() for HEVC
+  pos = get_bits_count(&gb);
+  if (present) {
+    if (get_bits1(&gb)) {
+      get_ue_golomb_long(&gb);
+      get_ue_golomb_long(&gb);
+    }
+    if (hevc) {
+      skip_bits(&gb, 3); // neutral_chroma, field_seq, frame_field_info
+      // decode_vui() reads these two differently on some broken streams.
+      if (get_bits_left(&gb) >= 68 && show_bits_long(&gb, 21) == 0x100000)
+        return AVERROR_PATCHWELCOME;
+      if (get_bits1(&gb))
+        for (i = 0; i < 4; i++)
+          get_ue_golomb_long(&gb);
+    }
+    copy_bits(&pb, &gb, pos, get_bits_count(&gb));
+  } else {
+    put_bits(&pb, hevc ? 5 : 1, 0);
+  }
+
+  // timing_info; the HEVC poc_proportional_to_timing_flag and HRD that
+  // follow are part of the copied remainder.
+  pos = get_bits_count(&gb);
+  timing = present && get_bits1(&gb);
+  if (timing) {
+    if (hevc && get_bits_left(&gb) < 66)
+      return AVERROR_PATCHWELCOME;
+    skip_bits_long(&gb, 64);
+    if (!hevc)
+      skip_bits1(&gb); // fixed_frame_rate_flag
+  }
+  if (p->flags & SPS_REWRITE_TIMING) {
+    put_bits(&pb, 1, 1);
+    put_bits32(&pb, p->num_units_in_tick);
+    put_bits32(&pb, p->time_scale);
+    if (!hevc)
+      put_bits(&pb, 1, p->fixed_frame_rate_flag);
+    else if (!timing)
+      put_bits(&pb, 2, 0); // poc_proportional_to_timing, hrd_parameters
+  } else if (present) {
+    copy_bits(&pb, &gb, pos, get_bits_count(&gb));
+  } else {
+    put_bits(&pb, 1, 0);
+  }
+
+  if (!present) {
+    // H.264: nal_hrd, vcl_hrd, pic_struct_present, bitstream_restriction
+    // HEVC: bitstream_restriction
+    put_bits(&pb, hevc ? 1 : 4, 0);
+  }
+
+  if (get_bits_count(&gb) > stop)
+    return AVERROR_INVALIDDATA;
+  copy_bits(&pb, &gb, get_bits_count(&gb), stop);
+
+  put_bits(&pb, 1, 1); // rbsp_stop_one_bit
+  flush_put_bits(&pb);
+  return put_bytes_output(&pb);
+}
+
+int ff_h264_rewrite_sps_vui(const SPS *sps, const SPSRewriteParams *p,
+                            uint8_t *rbsp, int size) {
+  if (sps->data_size > sizeof(sps->data) - AV_INPUT_BUFFER_PADDING_SIZE)
+    return AVERROR_PATCHWELCOME;
+  return rewrite_vui(AV_CODEC_ID_H264, sps->data, sps->data_size,
+                     sps->vui_flag_pos, p, rbsp, size);
+}
+
+int ff_hevc_rewrite_sps_vui(const HEVCSPS *sps, const SPSRewriteParams *p,
+                            uint8_t *rbsp, int size) {
+  if (sps->data_size > sizeof(sps->data) - AV_INPUT_BUFFER_PADDING_SIZE)
+    return AVERROR_PATCHWELCOME;
+  return rewrite_vui(AV_CODEC_ID_HEVC, sps->data, sps->data_size,
+                     sps->vui_flag_pos, p, rbsp, size);
+}
+
+int ff_sps_rewrite_bsf_init(SPSRewriteBSFContext *s, enum AVCodecID codec_id,
+                            const SPSRewriteParams *p) {
+  if (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC)
+    return AVERROR(EINVAL);
+  if ((p->flags & SPS_REWRITE_SAR) &&
+      (p->sar.num < 0 || p->sar.den < 0 || p->sar.num > UINT16_MAX ||
+       p->sar.den > UINT16_MAX))
+    return AVERROR(EINVAL);
+  if ((p->flags & SPS_REWRITE_COLOUR) &&
+      (p->full_range > 1 || p->color_primaries > 255 || p->color_trc > 255 ||
+       p->colorspace > 255))
+    return AVERROR(EINVAL);
+  if ((p->flags & SPS_REWRITE_TIMING) && (!p->num_units_in_tick ||
+                                          !p->time_scale))
+    return AVERROR(EINVAL);
+
+  memset(s, 0, sizeof(*s));
+  s->codec_id = codec_id;
+  s->params = *p;
+  return 0;
+}
+
+static int add_segment(SPSRewriteBSFContext *s, const uint8_t *data, int size,
+                       int offset) {
+  if (offset < 0 && s->nb_segs && s->seg_offset[s->nb_segs - 1] < 0 &&
+      s->segs[s->nb_segs - 1].data + s->segs[s->nb_segs - 1].size == data) {
+    s->segs[s->nb_segs - 1].size += size;
+    return 0;
+  }
+  if (s->nb_segs >= s->segs_alloc / sizeof(*s->segs)) {
+    SPSRewriteBSFSegment *segs;
+    int *seg_offset;
+
+    segs = av_fast_realloc(s->segs, &s->segs_alloc,
+                           (s->nb_segs + 1) * 2 * sizeof(*s->segs));
+    if (!segs)
+      return AVERROR(ENOMEM);
+    s->segs = segs;
+    seg_offset = av_fast_realloc(s->seg_offset, &s->seg_offset_alloc,
+                                 (s->nb_segs + 1) * 2 * sizeof(*s->seg_offset));
+    if (!seg_offset)
+      return AVERROR(ENOMEM);
+    s->seg_offset = seg_offset;
+  }
+  s->segs[s->nb_segs].data = data;
+  s->segs[s->nb_segs].size = size;
+  s->seg_offset[s->nb_segs] = offset;
+  s->nb_segs++;
+  return 0;
+}
+
+/**
+ * Parse a VPS or SPS NAL unit into the parameter sets of the context.
+ *
+ * @param seg the NAL unit with its start code
+ * @return the parsed SPS, NULL if it is not one or could not be parsed
+ */
+static const void *parse_ps(SPSRewriteBSFContext *s, const uint8_t *seg,
+                            int seg_size) {
+  H2645NAL *nal;
+  int i;
+
+  if (ff_h2645_packet_split(&s->pkt, seg, seg_size, NULL, 0, 0, s->codec_id,
+                            0, 0) < 0 ||
+      s->pkt.nb_nals != 1)
+    return NULL;
+  nal = &s->pkt.nals[0];
+
+  if (s->codec_id == AV_CODEC_ID_H264) {
+    if (nal->type != H264_NAL_SPS ||
+        ff_h264_decode_seq_parameter_set(&nal->gb, NULL, &s->h264_ps, 0) < 0)
+      return NULL;
+    for (i = 0; i < MAX_SPS_COUNT; i++) {
+      const SPS *sps;
+
+      if (!s->h264_ps.sps_list[i])
+        continue;
+      sps = (const SPS *)s->h264_ps.sps_list[i]->data;
+      if (sps->data_size == nal->size &&
+          !memcmp(sps->data, nal->data, nal->size))
+        return sps;
+    }
+  } else if (nal->type == HEVC_NAL_VPS) {
+    ff_hevc_decode_nal_vps(&nal->gb, NULL, &s->hevc_ps);
+  } else if (nal->type == HEVC_NAL_SPS) {
+    if (ff_hevc_decode_nal_sps(&nal->gb, NULL, &s->hevc_ps, 0) < 0)
+      return NULL;
+    for (i = 0; i < HEVC_MAX_SPS_COUNT; i++) {
+      const HEVCSPS *sps;
+
+      if (!s->hevc_ps.sps_list[i])
+        continue;
+      sps = (const HEVCSPS *)s->hevc_ps.sps_list[i]->data;
+      if (sps->data_size == nal->size &&
+          !memcmp(sps->data, nal->data, nal->size))
+        return sps;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Rewrite an SPS NAL unit into s->last_out.
+ *
+ * @param seg the NAL unit with its start code
+ * @param nal the NAL unit, after the start code
+ * @return 1 if s->last_out holds the rewrite, 0 to pass the NAL unit
+ *         through, a negative AVERROR code on error
+ */
+static int rewrite_sps(SPSRewriteBSFContext *s, const uint8_t *seg,
+                       int seg_size, const uint8_t *nal, int size) {
+  const void *sps;
+  int ret, data_size;
+
+  if (s->last_out_size && size == s->last_in_size &&
+      !memcmp(nal, s->last_in, size))
+    return 1;
+
+  sps = parse_ps(s, seg, seg_size);
+  if (!sps)
+    return 0;
+  data_size = s->codec_id == AV_CODEC_ID_HEVC
+                  ? ((const HEVCSPS *)sps)->data_size
+                  : (int)((const SPS *)sps)->data_size;
+
+  av_fast_malloc(&s->rbsp, &s->rbsp_alloc,
+                 data_size + SPS_REWRITE_MAX_GROWTH);
+  if (!s->rbsp)
+    return AVERROR(ENOMEM);
+  ret = s->codec_id == AV_CODEC_ID_HEVC
+            ? ff_hevc_rewrite_sps_vui(sps, &s->params, s->rbsp,
+                                      data_size + SPS_REWRITE_MAX_GROWTH)
+            : ff_h264_rewrite_sps_vui(sps, &s->params, s->rbsp,
+                                      data_size + SPS_REWRITE_MAX_GROWTH);
+  if (ret < 0)
+    return ret == AVERROR(ENOMEM) ? ret : 0;
+
+  data_size = ret;
+  if ((ret = ff_h2645_escaped_size(s->rbsp, data_size)) < 0)
+    return ret;
+  s->last_out_size = 0;
+  av_fast_malloc(&s->last_out, &s->last_out_alloc, 4 + ret);
+  av_fast_malloc(&s->last_in, &s->last_in_alloc, size);
+  if (!s->last_out || !s->last_in)
+    return AVERROR(ENOMEM);
+  AV_WB32(s->last_out, 1);
+  s->last_out_size = 4 + ff_h2645_escape_rbsp(s->last_out + 4, s->rbsp,
+                                              data_size);
+  memcpy(s->last_in, nal, size);
+  s->last_in_size = size;
+  return 1;
+}
+
+int ff_sps_rewrite_bsf_filter(SPSRewriteBSFContext *s, const uint8_t *buf,
+                              int size) {
+  const uint8_t *end = buf + size;
+  const uint8_t *sc = ff_h2645_find_start_code(buf, end);
+  const uint8_t *seg = sc > buf && sc < end && !sc[-1] ? sc - 1 : sc;
+  int i, ret, total = 0;
+
+  s->nb_segs = 0;
+  s->rewrite_size = 0;
+
+  if (seg > buf) {
+    if ((ret = add_segment(s, buf, seg - buf, -1)) < 0)
+      return ret;
+  }
+
+  while (sc < end) {
+    const uint8_t *nal = sc + 3;
+    const uint8_t *next = ff_h2645_find_start_code(nal, end);
+    const uint8_t *nal_end = next;
+    const uint8_t *seg_end = next;
+    int type = -1;
+
+    if (seg_end < end && seg_end > nal && !seg_end[-1])
+      seg_end--; // zero_byte of a 4 byte start code
+    while (nal_end > nal && !nal_end[-1])
+      nal_end--;
+
+    if (s->codec_id == AV_CODEC_ID_HEVC) {
+      // base layer only
+      if (nal_end - nal >= 2 && !(((nal[0] & 1) << 5) | (nal[1] >> 3)))
+        type = (nal[0] >> 1) & 0x3F;
+    } else if (nal_end > nal) {
+      type = nal[0] & 0x1F;
+    }
+
+    ret = 0;
+    if (type == (s->codec_id == AV_CODEC_ID_HEVC ? HEVC_NAL_SPS
+                                                 : H264_NAL_SPS)) {
+      ret = rewrite_sps(s, sc, nal_end - sc, nal, nal_end - nal);
+      if (ret < 0)
+        return ret;
+    } else if (s->codec_id == AV_CODEC_ID_HEVC && type == HEVC_NAL_VPS) {
+      parse_ps(s, sc, nal_end - sc);
+    }
+    if (ret > 0) {
+      uint8_t *rewrite = av_fast_realloc(s->rewrite, &s->rewrite_alloc,
+                                         s->rewrite_size + s->last_out_size);
+      if (!rewrite)
+        return AVERROR(ENOMEM);
+      s->rewrite = rewrite;
+      memcpy(rewrite + s->rewrite_size, s->last_out, s->last_out_size);
+      ret = add_segment(s, NULL, s->last_out_size, s->rewrite_size);
+      s->rewrite_size += s->last_out_size;
+    } else {
+      ret = add_segment(s, seg, seg_end - seg, -1);
+    }
+    if (ret < 0)
+      return ret;
+
+    seg = seg_end;
+    sc = next;
+  }
+
+  for (i = 0; i < s->nb_segs; i++) {
+    if (s->seg_offset[i] >= 0)
+      s->segs[i].data = s->rewrite + s->seg_offset[i];
+    total += s->segs[i].size;
+  }
+  return total;
+}
+
+int ff_sps_rewrite_bsf_write(const SPSRewriteBSFContext *s, uint8_t *dst,
+                             int size) {
+  int i, pos = 0;
+
+  for (i = 0; i < s->nb_segs; i++) {
+    if (s->segs[i].size > size - pos)
+      return AVERROR(ENOSPC);
+    memcpy(dst + pos, s->segs[i].data, s->segs[i].size);
+    pos += s->segs[i].size;
+  }
+  return pos;
+}
+
+void ff_sps_rewrite_bsf_uninit(SPSRewriteBSFContext *s) {
+  ff_h264_ps_uninit(&s->h264_ps);
+  ff_hevc_ps_uninit(&s->hevc_ps);
+  ff_h2645_packet_uninit(&s->pkt);
+  av_freep(&s->rbsp);
+  av_freep(&s->last_in);
+  av_freep(&s->last_out);
+  av_freep(&s->rewrite);
+  av_freep(&s->segs);
+  av_freep(&s->seg_offset);
+  s->rbsp_alloc = s->last_in_alloc = s->last_out_alloc = s->rewrite_alloc = 0;
+  s->segs_alloc = s->seg_offset_alloc = 0;
+  s->last_in_size = s->last_out_size = s->rewrite_size = s->nb_segs = 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Patch the sample aspect ratio, colour description and timing info of the
+ * VUI of H.264 / HEVC SPS, without touching the rest of the stream.
+ *
+ * Only the VUI fields being changed are rewritten; the SPS bits before and
+ * after them are copied unchanged. Like the HDR10+ filter, the output
+ * access unit is a list of segments pointing into the input packet, so
+ * slice data is never copied.
+ */
+
+#ifndef AVCODEC_SPS_REWRITE_BSF_H
+#define AVCODEC_SPS_REWRITE_BSF_H
+
+#include <stdint.h>
+
+#include "codec_id.h"
+#include "h2645_parse.h"
+#include "h264_ps.h"
+#include "hevc_ps.h"
+#include "rational.h"
+
+#define SPS_REWRITE_SAR (1 << 0)
+#define SPS_REWRITE_COLOUR (1 << 1)
+#define SPS_REWRITE_TIMING (1 << 2)
+
+/* Upper bound of the growth of a rewritten SPS RBSP, in bytes */
+#define SPS_REWRITE_MAX_GROWTH 32
+
+typedef struct SPSRewriteParams {
+  int flags; ///< SPS_REWRITE_*
+
+  AVRational sar; ///< 0/0 for unspecified
+
+  int full_range;      ///< video_full_range_flag, -1 to keep
+  int color_primaries; ///< -1 to keep
+  int color_trc;       ///< -1 to keep
+  int colorspace;      ///< matrix_coefficients, -1 to keep
+
+  uint32_t num_units_in_tick;
+  uint32_t time_scale;
+  int fixed_frame_rate_flag; ///< H.264 only
+} SPSRewriteParams;
+
+/**
+ * Write the RBSP of sps with its VUI patched. The output has the layout of
+ * sps->data, NAL header included.
+ *
+ * @param size must be at least sps->data_size + SPS_REWRITE_MAX_GROWTH
+ * @return the size of the RBSP, AVERROR_PATCHWELCOME if the VUI can not be
+ *         rewritten, another negative AVERROR code on error
+ */
+int ff_h264_rewrite_sps_vui(const SPS *sps, const SPSRewriteParams *p,
+                            uint8_t *rbsp, int size);
+int ff_hevc_rewrite_sps_vui(const HEVCSPS *sps, const SPSRewriteParams *p,
+                            uint8_t *rbsp, int size);
+
+typedef struct SPSRewriteBSFSegment {
+  const uint8_t *data;
+  int size;
+} SPSRewriteBSFSegment;
+
+typedef struct SPSRewriteBSFContext {
+  enum AVCodecID codec_id;
+  SPSRewriteParams params;
+
+  H264ParamSets h264_ps;
+  HEVCParamSets hevc_ps;
+  H2645Packet pkt; ///< a single parameter set NAL unit
+
+  uint8_t *rbsp; ///< rewritten RBSP
+  unsigned int rbsp_alloc;
+
+  /* The same SPS is usually repeated at every IRAP. */
+  uint8_t *last_in; ///< last SPS NAL unit rewritten, as found in the stream
+  int last_in_size;
+  unsigned int last_in_alloc;
+  uint8_t *last_out; ///< its rewrite, with a start code
+  int last_out_size;
+  unsigned int last_out_alloc;
+
+  uint8_t *rewrite; ///< rewritten SPS of the last filtered access unit
+  int rewrite_size;
+  unsigned int rewrite_alloc;
+
+  SPSRewriteBSFSegment *segs; ///< output of the last filtered access unit
+  int *seg_offset; ///< offset in rewrite for rewritten SPS, -1 otherwise
+  int nb_segs;
+  unsigned int segs_alloc;
+  unsigned int seg_offset_alloc;
+} SPSRewriteBSFContext;
+
+int ff_sps_rewrite_bsf_init(SPSRewriteBSFContext *s, enum AVCodecID codec_id,
+                            const SPSRewriteParams *p);
+
+/**
+ * Filter one Annex B access unit. On success s->segs holds the output
+ * access unit; it refers to buf and stays valid until the next call.
+ * SPS that can not be parsed or rewritten are passed through.
+ *
+ * @return the size of the output access unit, a negative AVERROR code on
+ *         error
+ */
+int ff_sps_rewrite_bsf_filter(SPSRewriteBSFContext *s, const uint8_t *buf,
+                              int size);
+
+/**
+ * Gather the segments of the last filtered access unit into dst.
+ *
+ * @return the number of bytes written, AVERROR(ENOSPC) if dst is too small
+ */
+int ff_sps_rewrite_bsf_write(const SPSRewriteBSFContext *s, uint8_t *dst,
+                             int size);
+
+void ff_sps_rewrite_bsf_uninit(SPSRewriteBSFContext *s);
+
+#endif /* AVCODEC_SPS_REWRITE_BSF_H */
@@ -0,0 +1,246 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "defs.h"
+#include "error.h"
+#include "mem.h"
+#include "spsc_ring.h"
+
+#define RING_MAX_SIZE (1 << 30)
+
+/* Fields written by different sides are kept this far apart, so they never
+ * share a cache line. */
+#define CACHE_LINE 64
+
+struct FFSPSCRing {
+  uint8_t *buf;      ///< size bytes, mapped twice
+  unsigned int size; ///< power of 2
+  int capacity;      ///< size minus the padding
+
+  /* Positions count bytes modulo 2^32 and only ever increase, so
+   * write_pos - read_pos is the fill level even across the wrap. */
+
+  /* written by the producer */
+  uint8_t pad0[CACHE_LINE];
+  atomic_uint write_pos;
+  atomic_uint read_wake;     ///< futex of a sleeping consumer
+  atomic_int writer_waiting; ///< the producer sleeps on write_wake
+  atomic_int eof;
+
+  /* written by the consumer */
+  uint8_t pad1[CACHE_LINE];
+  atomic_uint read_pos;
+  atomic_uint write_wake;    ///< futex of a sleeping producer
+  atomic_int reader_waiting; ///< the consumer sleeps on read_wake
+  uint8_t pad2[CACHE_LINE];
+};
+
+static void futex_wait(atomic_uint *addr, unsigned int val) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Wake the other side if it sleeps. The caller just published a position
+ * with a sequentially consistent store, and a sleeper sets its flag before
+ * it checks that position, so either the sleeper sees the new position or
+ * the flag is seen here. Bumping the futex word makes a concurrent
+ * futex_wait() return.
+ */
+static void wake(atomic_int *waiting, atomic_uint *futex) {
+  if (atomic_load(waiting)) {
+    atomic_fetch_add(futex, 1);
+    futex_wake(futex);
+  }
+}
+
+int ff_spsc_ring_alloc(FFSPSCRing **pring, int min_size) {
+  FFSPSCRing *ring;
+  long page_size = sysconf(_SC_PAGESIZE);
+  unsigned int size = page_size > 0 ? page_size : 4096;
+  uint8_t *base;
+  int fd, ret;
+
+  if (min_size <= 0 || min_size > RING_MAX_SIZE - AV_INPUT_BUFFER_PADDING_SIZE)
+    return AVERROR(EINVAL);
+  while (size < min_size + AV_INPUT_BUFFER_PADDING_SIZE)
+    size <<= 1;
+
+  ring = av_mallocz(sizeof(*ring));
+  if (!ring)
+    return AVERROR(ENOMEM);
+
+  fd = memfd_create("spsc_ring", MFD_CLOEXEC);
+  if (fd < 0 || ftruncate(fd, size) < 0)
+    goto fail;
+  // Reserve the address range, then map the file twice over it.
+  base = mmap(NULL, 2 * (size_t)size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+              -1, 0);
+  if (base == MAP_FAILED)
+    goto fail;
+  if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) ==
+          MAP_FAILED ||
+      mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+           fd, 0) == MAP_FAILED) {
+    ret = AVERROR(errno);
+    munmap(base, 2 * (size_t)size);
+    goto end;
+  }
+  close(fd);
+
+  ring->buf = base;
+  ring->size = size;
+  // A range starting anywhere in the first mapping and its padding then
+  // always end within the second.
+  ring->capacity = size - AV_INPUT_BUFFER_PADDING_SIZE;
+  *pring = ring;
+  return ring->capacity;
+
+fail:
+  ret = AVERROR(errno);
+end:
+  if (fd >= 0)
+    close(fd);
+  av_free(ring);
+  return ret;
+}
+
+void ff_spsc_ring_free(FFSPSCRing **pring) {
+  FFSPSCRing *ring = *pring;
+
+  if (!ring)
+    return;
+  munmap(ring->buf, 2 * (size_t)ring->size);
+  av_freep(pring);
+}
+
+int ff_spsc_ring_capacity(const FFSPSCRing *ring) { return ring->capacity; }
+
+int ff_spsc_ring_eof(FFSPSCRing *ring) {
+  return atomic_load_explicit(&ring->eof, memory_order_acquire);
+}
+
+static int write_space(FFSPSCRing *ring, unsigned int wpos, uint8_t **data) {
+  unsigned int rpos =
+      atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+
+  *data = ring->buf + (wpos & (ring->size - 1));
+  return ring->capacity - (int)(wpos - rpos);
+}
+
+int ff_spsc_ring_write_reserve(FFSPSCRing *ring, uint8_t **data) {
+  unsigned int wpos =
+      atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+
+  return write_space(ring, wpos, data);
+}
+
+int ff_spsc_ring_write_wait(FFSPSCRing *ring, int min_size, uint8_t **data) {
+  unsigned int wpos =
+      atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+  int space;
+
+  if (min_size > ring->capacity)
+    return AVERROR(EINVAL);
+  while ((space = write_space(ring, wpos, data)) < min_size) {
+    unsigned int seq = atomic_load(&ring->write_wake);
+
+    atomic_store(&ring->writer_waiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (write_space(ring, wpos, data) < min_size)
+      futex_wait(&ring->write_wake, seq);
+    atomic_store(&ring->writer_waiting, 0);
+  }
+  return space;
+}
+
+void ff_spsc_ring_write_commit(FFSPSCRing *ring, int size) {
+  unsigned int wpos =
+      atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+
+  atomic_store(&ring->write_pos, wpos + size);
+  wake(&ring->reader_waiting, &ring->read_wake);
+}
+
+void ff_spsc_ring_write_eof(FFSPSCRing *ring) {
+  atomic_store(&ring->eof, 1);
+  wake(&ring->reader_waiting, &ring->read_wake);
+}
+
+static int read_avail(FFSPSCRing *ring, unsigned int rpos,
+                      const uint8_t **data, int *eof) {
+  // Load eof first: everything committed before it is then seen as well.
+  unsigned int wpos;
+
+  *eof = atomic_load_explicit(&ring->eof, memory_order_acquire);
+  wpos = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+  *data = ring->buf + (rpos & (ring->size - 1));
+  if (wpos == rpos && *eof)
+    return AVERROR_EOF;
+  return wpos - rpos;
+}
+
+int ff_spsc_ring_read_reserve(FFSPSCRing *ring, const uint8_t **data) {
+  unsigned int rpos =
+      atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+  int eof;
+
+  return read_avail(ring, rpos, data, &eof);
+}
+
+int ff_spsc_ring_read_wait(FFSPSCRing *ring, int min_size,
+                           const uint8_t **data) {
+  unsigned int rpos =
+      atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+  int avail, eof;
+
+  if (min_size > ring->capacity)
+    return AVERROR(EINVAL);
+  while ((avail = read_avail(ring, rpos, data, &eof)) >= 0 &&
+         avail < min_size && !eof) {
+    unsigned int seq = atomic_load(&ring->read_wake);
+
+    atomic_store(&ring->reader_waiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    avail = read_avail(ring, rpos, data, &eof);
+    if (avail >= 0 && avail < min_size && !eof)
+      futex_wait(&ring->read_wake, seq);
+    atomic_store(&ring->reader_waiting, 0);
+  }
+  return avail;
+}
+
+void ff_spsc_ring_read_commit(FFSPSCRing *ring, int size) {
+  unsigned int rpos =
+      atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+
+  atomic_store(&ring->read_pos, rpos + size);
+  wake(&ring->writer_waiting, &ring->write_wake);
+}
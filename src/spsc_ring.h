@@ -0,0 +1,116 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Lock-free single producer / single consumer byte ring.
+ *
+ * The ring memory is mapped twice back to back, so both the free space and
+ * the committed data are always one contiguous range, wrap-around included.
+ * The producer reads from a file or socket straight into the free space,
+ * and the consumer runs the splitters straight on the committed data, with
+ * no staging copy on either side.
+ *
+ * Reserve and commit only touch two atomic positions. The wait functions
+ * sleep on a futex when the ring is empty or full, and a commit only makes
+ * a system call when the other side is sleeping.
+ */
+
+#ifndef AVCODEC_SPSC_RING_H
+#define AVCODEC_SPSC_RING_H
+
+#include <stdint.h>
+
+typedef struct FFSPSCRing FFSPSCRing;
+
+/**
+ * Allocate a ring of at least size bytes. The size is rounded up to a power
+ * of 2 multiple of the page size, at most 1 GiB.
+ *
+ * @return the capacity of the ring, a negative AVERROR code on error
+ */
+int ff_spsc_ring_alloc(FFSPSCRing **ring, int size);
+
+void ff_spsc_ring_free(FFSPSCRing **ring);
+
+int ff_spsc_ring_capacity(const FFSPSCRing *ring);
+
+/**
+ * @return nonzero once the producer signalled the end of the stream; every
+ *         byte it committed is then visible to the consumer
+ */
+int ff_spsc_ring_eof(FFSPSCRing *ring);
+
+/**
+ * Get the free space of the ring. Producer only; does not block.
+ *
+ * @return the number of bytes that can be written to *data
+ */
+int ff_spsc_ring_write_reserve(FFSPSCRing *ring, uint8_t **data);
+
+/**
+ * Like ff_spsc_ring_write_reserve(), but block until at least min_size
+ * bytes are free.
+ *
+ * @return the number of bytes that can be written to *data,
+ *         AVERROR(EINVAL) if min_size exceeds the capacity
+ */
+int ff_spsc_ring_write_wait(FFSPSCRing *ring, int min_size, uint8_t **data);
+
+/**
+ * Make the first size bytes of the last reservation visible to the
+ * consumer.
+ */
+void ff_spsc_ring_write_commit(FFSPSCRing *ring, int size);
+
+/**
+ * Signal the end of the stream to the consumer. Nothing may be committed
+ * afterwards.
+ */
+void ff_spsc_ring_write_eof(FFSPSCRing *ring);
+
+/**
+ * Get the committed data of the ring. Consumer only; does not block.
+ *
+ * *data is followed by AV_INPUT_BUFFER_PADDING_SIZE readable bytes, but
+ * they are not zeroed and may be written by the producer concurrently.
+ * The data stays valid and unchanged until it is released by
+ * ff_spsc_ring_read_commit().
+ *
+ * @return the number of bytes at *data, AVERROR_EOF if the ring is empty
+ *         and the producer signalled the end of the stream
+ */
+int ff_spsc_ring_read_reserve(FFSPSCRing *ring, const uint8_t **data);
+
+/**
+ * Like ff_spsc_ring_read_reserve(), but block until at least min_size
+ * bytes are committed or the end of the stream is reached.
+ *
+ * @return the number of bytes at *data, less than min_size only at the end
+ *         of the stream, AVERROR_EOF if no data is left,
+ *         AVERROR(EINVAL) if min_size exceeds the capacity
+ */
+int ff_spsc_ring_read_wait(FFSPSCRing *ring, int min_size,
+                           const uint8_t **data);
+
+/**
+ * Release the first size bytes of the committed data to the producer.
+ */
+void ff_spsc_ring_read_commit(FFSPSCRing *ring, int size);
+
+#endif /* AVCODEC_SPSC_RING_H */
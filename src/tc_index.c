@@ -0,0 +1,306 @@
+/*
+ * Timecode index
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "intreadwrite.h"
+#include "macros.h"
+#include "mem.h"
+#include "tc_index.h"
+
+#define TC_INDEX_MAGIC MKTAG('T', 'C', 'I', 'X')
+#define TC_INDEX_VERSION 1
+
+/*
+ * Entry layout:
+ *   0  key: ((hours * 60 + minutes) * 60 + seconds) << 9 | frames
+ *   4  pic_struct, 0xFF if absent
+ *   5  flags
+ *   6  reserved
+ *   8  AU byte offset
+ * The key orders entries by timecode label, independently of the frame
+ * rate and of drop frame counting.
+ */
+
+static uint32_t tc_key(const TCIndexTimecode *tc) {
+  return (uint32_t)((tc->hours * 60 + tc->minutes) * 60 + tc->seconds) << 9 |
+         tc->frames;
+}
+
+static int tc_valid(const TCIndexTimecode *tc) {
+  return tc->hours >= 0 && tc->hours < 24 && tc->minutes >= 0 &&
+         tc->minutes < 60 && tc->seconds >= 0 && tc->seconds < 60 &&
+         tc->frames >= 0 && tc->frames < 512;
+}
+
+void ff_tc_index_builder_init(TCIndexBuilder *b) {
+  memset(b, 0, sizeof(*b));
+  b->sorted = 1;
+}
+
+/* Grow the table by half, moving big tables to their own mappings. */
+static int grow_buf(TCIndexBuilder *b, size_t min_size) {
+  size_t size = min_size + min_size / 2;
+  uint8_t *buf;
+
+  if (min_size <= b->buf_alloc)
+    return 0;
+  buf = av_malloc_class(size, av_alloc_class_for_size(size), AV_NUMA_NODE_ANY);
+  if (!buf)
+    return AVERROR(ENOMEM);
+  if (b->buf)
+    memcpy(buf, b->buf,
+           TC_INDEX_HEADER_SIZE + b->nb_entries * TC_INDEX_ENTRY_SIZE);
+  av_free_class(b->buf);
+  b->buf = buf;
+  b->buf_alloc = size;
+  return 0;
+}
+
+int ff_tc_index_add(TCIndexBuilder *b, const TCIndexEntry *e) {
+  size_t pos = TC_INDEX_HEADER_SIZE + b->nb_entries * TC_INDEX_ENTRY_SIZE;
+  uint8_t *p;
+  uint32_t key;
+  int ret;
+
+  if (!tc_valid(&e->tc) || e->offset < 0)
+    return AVERROR(EINVAL);
+  if (pos + TC_INDEX_ENTRY_SIZE > UINT_MAX)
+    return AVERROR(ENOMEM);
+  if ((ret = grow_buf(b, pos + TC_INDEX_ENTRY_SIZE)) < 0)
+    return ret;
+
+  key = tc_key(&e->tc);
+  p = b->buf + pos;
+  AV_WL32(p, key);
+  p[4] = e->pic_struct < 0 ? 0xFF : e->pic_struct;
+  p[5] = e->flags;
+  AV_WL16(p + 6, 0);
+  AV_WL64(p + 8, e->offset);
+
+  if (b->nb_entries && key < AV_RL32(p - TC_INDEX_ENTRY_SIZE))
+    b->sorted = 0;
+  b->nb_entries++;
+  return 0;
+}
+
+int ff_tc_index_add_hevc_au(TCIndexBuilder *b, int64_t offset,
+                            const HEVCSEI *sei) {
+  const HEVCSEITimeCode *tc = ff_hevc_sei_get(sei, HEVC_SEI_MSG_TIMECODE);
+  const HEVCSEIPictureTiming *pt =
+      ff_hevc_sei_get(sei, HEVC_SEI_MSG_PICTURE_TIMING);
+  TCIndexEntry e = {.offset = offset, .pic_struct = -1};
+
+  if (pt)
+    e.pic_struct = pt->picture_struct;
+
+  // The first clock timestamp is the one of the frame or first field.
+  if (tc && tc->num_clock_ts && tc->clock_timestamp_flag[0]) {
+    e.tc = b->last;
+    e.tc.frames = tc->n_frames[0];
+    if (tc->full_timestamp_flag[0] || tc->seconds_flag[0])
+      e.tc.seconds = tc->seconds_value[0];
+    if (tc->full_timestamp_flag[0] || tc->minutes_flag[0])
+      e.tc.minutes = tc->minutes_value[0];
+    if (tc->full_timestamp_flag[0] || tc->hours_flag[0])
+      e.tc.hours = tc->hours_value[0];
+    if (tc->cnt_dropped_flag[0])
+      e.flags |= TC_INDEX_FLAG_DROP_FRAME;
+    if (tc->discontinuity_flag[0])
+      e.flags |= TC_INDEX_FLAG_DISCONTINUITY;
+    b->last = e.tc;
+    b->have_last = 1;
+  } else if (b->have_last) {
+    e.tc = b->last;
+    e.flags |= TC_INDEX_FLAG_INHERITED;
+  } else {
+    return 0;
+  }
+
+  return ff_tc_index_add(b, &e);
+}
+
+static int compare_entries(const void *a, const void *b) {
+  const uint8_t *ea = a, *eb = b;
+  uint32_t ka = AV_RL32(ea), kb = AV_RL32(eb);
+  uint64_t oa, ob;
+
+  if (ka != kb)
+    return ka < kb ? -1 : 1;
+  oa = AV_RL64(ea + 8);
+  ob = AV_RL64(eb + 8);
+  return (oa > ob) - (oa < ob);
+}
+
+void ff_tc_index_finish(TCIndexBuilder *b, TCIndex *idx) {
+  memset(idx, 0, sizeof(*idx));
+  if (!b->nb_entries)
+    return;
+
+  if (!b->sorted) {
+    qsort(b->buf + TC_INDEX_HEADER_SIZE, b->nb_entries, TC_INDEX_ENTRY_SIZE,
+          compare_entries);
+    b->sorted = 1;
+  }
+  idx->entries = b->buf + TC_INDEX_HEADER_SIZE;
+  idx->nb_entries = b->nb_entries;
+}
+
+int ff_tc_index_write(TCIndexBuilder *b, const char *path) {
+  uint8_t header[TC_INDEX_HEADER_SIZE];
+  TCIndex idx;
+  FILE *f;
+  int ret = 0;
+
+  ff_tc_index_finish(b, &idx);
+
+  AV_WL32(header, TC_INDEX_MAGIC);
+  AV_WL32(header + 4, TC_INDEX_VERSION);
+  AV_WL64(header + 8, b->nb_entries);
+
+  f = fopen(path, "wb");
+  if (!f)
+    return AVERROR(errno);
+  if (fwrite(header, sizeof(header), 1, f) != 1 ||
+      (b->nb_entries &&
+       fwrite(idx.entries, TC_INDEX_ENTRY_SIZE, b->nb_entries, f) !=
+           b->nb_entries))
+    ret = AVERROR(EIO);
+  if (fclose(f) && !ret)
+    ret = AVERROR(errno);
+  return ret;
+}
+
+void ff_tc_index_builder_uninit(TCIndexBuilder *b) {
+  av_free_class(b->buf);
+  b->buf = NULL;
+  b->buf_alloc = 0;
+  b->nb_entries = 0;
+}
+
+int ff_tc_index_map(TCIndex *idx, const char *path) {
+  struct stat st;
+  uint8_t *map;
+  void *block;
+  uint64_t nb_entries;
+  int fd, ret = 0;
+
+  memset(idx, 0, sizeof(*idx));
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return AVERROR(errno);
+  if (fstat(fd, &st) < 0) {
+    ret = AVERROR(errno);
+    goto end;
+  }
+  if (st.st_size < TC_INDEX_HEADER_SIZE) {
+    ret = AVERROR_INVALIDDATA;
+    goto end;
+  }
+
+  ret = av_map_file_class(&block, fd, st.st_size,
+                          av_alloc_class_for_size(st.st_size),
+                          AV_NUMA_NODE_ANY);
+  if (ret < 0)
+    goto end;
+  map = block;
+
+  nb_entries = AV_RL64(map + 8);
+  if (AV_RL32(map) != TC_INDEX_MAGIC || AV_RL32(map + 4) != TC_INDEX_VERSION ||
+      nb_entries > (st.st_size - TC_INDEX_HEADER_SIZE) / TC_INDEX_ENTRY_SIZE) {
+    av_free_class(map);
+    ret = AVERROR_INVALIDDATA;
+    goto end;
+  }
+
+  idx->map = map;
+  idx->map_size = st.st_size;
+  idx->entries = map + TC_INDEX_HEADER_SIZE;
+  idx->nb_entries = nb_entries;
+
+end:
+  close(fd);
+  return ret;
+}
+
+void ff_tc_index_unmap(TCIndex *idx) {
+  av_free_class(idx->map);
+  memset(idx, 0, sizeof(*idx));
+}
+
+void ff_tc_index_get(const TCIndex *idx, size_t i, TCIndexEntry *e) {
+  const uint8_t *p = idx->entries + i * TC_INDEX_ENTRY_SIZE;
+  uint32_t key = AV_RL32(p);
+  uint32_t secs = key >> 9;
+
+  e->tc.frames = key & 0x1FF;
+  e->tc.seconds = secs % 60;
+  e->tc.minutes = secs / 60 % 60;
+  e->tc.hours = secs / 3600;
+  e->pic_struct = p[4] == 0xFF ? -1 : p[4];
+  e->flags = p[5];
+  e->offset = AV_RL64(p + 8);
+}
+
+int64_t ff_tc_index_lookup(const TCIndex *idx, const TCIndexTimecode *tc,
+                           TCIndexEntry *e) {
+  size_t lo = 0, hi = idx->nb_entries;
+  uint32_t key, found;
+
+  if (!tc_valid(tc))
+    return AVERROR(EINVAL);
+  key = tc_key(tc);
+
+  // First entry with a key greater than the target.
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (AV_RL32(idx->entries + mid * TC_INDEX_ENTRY_SIZE) <= key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (!lo)
+    return AVERROR(ENOENT);
+
+  // Back to the first AU carrying that timecode.
+  found = AV_RL32(idx->entries + (lo - 1) * TC_INDEX_ENTRY_SIZE);
+  hi = lo - 1;
+  lo = 0;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (AV_RL32(idx->entries + mid * TC_INDEX_ENTRY_SIZE) < found)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (e)
+    ff_tc_index_get(idx, lo, e);
+  return lo;
+}
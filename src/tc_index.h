@@ -0,0 +1,126 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Timecode index: maps the SMPTE timecode of each access unit to its byte
+ * offset, for seeking by timecode.
+ *
+ * The on-disk table is a 16 byte header ("TCIX", version, entry count)
+ * followed by fixed size little-endian entries sorted by timecode, so a
+ * mapped file is searched in place without being loaded.
+ */
+
+#ifndef AVCODEC_TC_INDEX_H
+#define AVCODEC_TC_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hevc_sei.h"
+
+#define TC_INDEX_HEADER_SIZE 16
+#define TC_INDEX_ENTRY_SIZE 16
+
+#define TC_INDEX_FLAG_DROP_FRAME (1 << 0) ///< cnt_dropped_flag was set
+#define TC_INDEX_FLAG_DISCONTINUITY (1 << 1)
+#define TC_INDEX_FLAG_INHERITED (1 << 2) ///< AU without timecode SEI
+
+typedef struct TCIndexTimecode {
+  int hours;
+  int minutes;
+  int seconds;
+  int frames;
+} TCIndexTimecode;
+
+typedef struct TCIndexEntry {
+  int64_t offset; ///< byte offset of the access unit
+  TCIndexTimecode tc;
+  int pic_struct; ///< pic_struct of the picture timing SEI, -1 if absent
+  int flags;      ///< TC_INDEX_FLAG_*
+} TCIndexEntry;
+
+/**
+ * Read-only view of a sorted table, in memory or mapped from a file.
+ */
+typedef struct TCIndex {
+  const uint8_t *entries;
+  size_t nb_entries;
+
+  void *map;      ///< allocation class block owned by ff_tc_index_map()
+  size_t map_size; ///< size of the mapped file
+} TCIndex;
+
+typedef struct TCIndexBuilder {
+  uint8_t *buf; ///< header followed by the serialized entries, a class block
+  size_t buf_alloc;
+  size_t nb_entries;
+  int sorted;
+
+  TCIndexTimecode last; ///< for partial and missing timecodes
+  int have_last;
+} TCIndexBuilder;
+
+void ff_tc_index_builder_init(TCIndexBuilder *b);
+
+/**
+ * Add an entry. Entries may be added in any order.
+ */
+int ff_tc_index_add(TCIndexBuilder *b, const TCIndexEntry *e);
+
+/**
+ * Add the access unit at offset, with the timecode and picture timing of
+ * its SEI. Fields missing from a partial timecode and AUs without timecode
+ * SEI inherit the last timecode seen; AUs before the first timecode are
+ * skipped.
+ */
+int ff_tc_index_add_hevc_au(TCIndexBuilder *b, int64_t offset,
+                            const HEVCSEI *sei);
+
+/**
+ * Sort the table and return a view of it, valid until the next change to
+ * the builder.
+ */
+void ff_tc_index_finish(TCIndexBuilder *b, TCIndex *idx);
+
+/**
+ * Write the sorted table to path.
+ */
+int ff_tc_index_write(TCIndexBuilder *b, const char *path);
+
+void ff_tc_index_builder_uninit(TCIndexBuilder *b);
+
+/**
+ * Map a table written by ff_tc_index_write(). Tables from 256 KiB on are
+ * mapped in place, smaller ones are read, see av_map_file_class().
+ */
+int ff_tc_index_map(TCIndex *idx, const char *path);
+
+void ff_tc_index_unmap(TCIndex *idx);
+
+void ff_tc_index_get(const TCIndex *idx, size_t i, TCIndexEntry *e);
+
+/**
+ * Find the first access unit of the last timecode not after tc.
+ *
+ * @return the entry index, AVERROR(ENOENT) if tc precedes every entry
+ */
+int64_t ff_tc_index_lookup(const TCIndex *idx, const TCIndexTimecode *tc,
+                           TCIndexEntry *e);
+
+#endif /* AVCODEC_TC_INDEX_H */
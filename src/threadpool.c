@@ -0,0 +1,345 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "error.h"
+#include "mem.h"
+#include "thread.h"
+#include "threadpool.h"
+
+struct FFThreadTask {
+  int (*func)(void *arg);
+  void *arg;
+  int ret;
+  int detached;
+  atomic_int done;
+};
+
+typedef struct TaskDeque {
+  pthread_mutex_t lock;
+  FFThreadTask **tasks; ///< ring buffer, its size is a power of 2
+  unsigned int size;
+  unsigned int top;    ///< next task to steal
+  unsigned int bottom; ///< next free slot
+} TaskDeque;
+
+typedef struct ThreadWorker {
+  FFThreadPool *pool;
+  int index;
+  pthread_t thread;
+} ThreadWorker;
+
+struct FFThreadPool {
+  ThreadWorker *workers;
+  TaskDeque *deques;
+  int nb_threads;
+  int nb_started;
+
+  atomic_int queued;      ///< tasks in the deques
+  atomic_int nb_sleeping; ///< workers waiting on work_cond
+  atomic_int nb_waiters;  ///< threads waiting on done_cond
+  atomic_uint next_deque; ///< deque for tasks submitted from outside
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  atomic_int pending; ///< tasks submitted and not completed
+  int err;            ///< first error of a detached task
+  int exit;
+};
+
+/* The worker running on the current thread, if any */
+static _Thread_local ThreadWorker *current_worker;
+
+static int deque_push(TaskDeque *d, FFThreadTask *task) {
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom - d->top == d->size) {
+    unsigned int size = d->size ? 2 * d->size : 16;
+    FFThreadTask **tasks = av_malloc_array(size, sizeof(*tasks));
+    unsigned int i;
+
+    if (!tasks) {
+      pthread_mutex_unlock(&d->lock);
+      return AVERROR(ENOMEM);
+    }
+    for (i = d->top; i != d->bottom; i++)
+      tasks[i & (size - 1)] = d->tasks[i & (d->size - 1)];
+    av_free(d->tasks);
+    d->tasks = tasks;
+    d->size = size;
+  }
+  d->tasks[d->bottom++ & (d->size - 1)] = task;
+  pthread_mutex_unlock(&d->lock);
+  return 0;
+}
+
+static FFThreadTask *deque_pop(TaskDeque *d, int steal) {
+  FFThreadTask *task = NULL;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom != d->top)
+    task = steal ? d->tasks[d->top++ & (d->size - 1)]
+                 : d->tasks[--d->bottom & (d->size - 1)];
+  pthread_mutex_unlock(&d->lock);
+  return task;
+}
+
+/**
+ * Take a task from the deque of the current worker, else steal one.
+ */
+static FFThreadTask *take_task(FFThreadPool *pool) {
+  ThreadWorker *w = current_worker && current_worker->pool == pool
+                        ? current_worker
+                        : NULL;
+  FFThreadTask *task = NULL;
+  int i, start;
+
+  if (atomic_load(&pool->queued) <= 0)
+    return NULL;
+  if (w)
+    task = deque_pop(&pool->deques[w->index], 0);
+  start = w ? w->index + 1 : 0;
+  for (i = 0; !task && i < pool->nb_threads; i++)
+    task = deque_pop(&pool->deques[(start + i) % pool->nb_threads], 1);
+  if (task)
+    atomic_fetch_sub(&pool->queued, 1);
+  return task;
+}
+
+static void run_task(FFThreadPool *pool, FFThreadTask *task) {
+  int detached = task->detached;
+  int ret = task->func(task->arg);
+
+  // Once done is set, the task belongs to its waiter.
+  pthread_mutex_lock(&pool->lock);
+  if (detached) {
+    if (ret < 0 && !pool->err)
+      pool->err = ret;
+  } else {
+    task->ret = ret;
+    atomic_store(&task->done, 1);
+  }
+  atomic_fetch_sub(&pool->pending, 1);
+  if (atomic_load(&pool->nb_waiters))
+    pthread_cond_broadcast(&pool->done_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  if (detached)
+    av_free(task);
+}
+
+static void *worker_thread(void *arg) {
+  ThreadWorker *w = arg;
+  FFThreadPool *pool = w->pool;
+
+  current_worker = w;
+  for (;;) {
+    FFThreadTask *task = take_task(pool);
+    int exit;
+
+    if (task) {
+      run_task(pool, task);
+      continue;
+    }
+
+    // A submitter reads nb_sleeping after it bumps queued, so either it
+    // sees this worker sleeping or the worker sees its task.
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->nb_sleeping, 1);
+    while (atomic_load(&pool->queued) <= 0 && !pool->exit)
+      pthread_cond_wait(&pool->work_cond, &pool->lock);
+    atomic_fetch_sub(&pool->nb_sleeping, 1);
+    exit = pool->exit;
+    pthread_mutex_unlock(&pool->lock);
+    if (exit)
+      break;
+  }
+  current_worker = NULL;
+  return NULL;
+}
+
+/**
+ * Run queued tasks until done() is true.
+ */
+static void help_until(FFThreadPool *pool, int (*done)(FFThreadPool *, void *),
+                       void *opaque) {
+  while (!done(pool, opaque)) {
+    FFThreadTask *task = take_task(pool);
+
+    if (task) {
+      run_task(pool, task);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->nb_waiters, 1);
+    while (!done(pool, opaque) && atomic_load(&pool->queued) <= 0)
+      pthread_cond_wait(&pool->done_cond, &pool->lock);
+    atomic_fetch_sub(&pool->nb_waiters, 1);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+static int task_done(FFThreadPool *pool, void *opaque) {
+  return atomic_load(&((FFThreadTask *)opaque)->done);
+}
+
+static int pool_done(FFThreadPool *pool, void *opaque) {
+  return !atomic_load(&pool->pending);
+}
+
+int ff_threadpool_submit(FFThreadPool *pool, int (*func)(void *arg), void *arg,
+                         FFThreadTask **ptask) {
+  ThreadWorker *w = current_worker && current_worker->pool == pool
+                        ? current_worker
+                        : NULL;
+  FFThreadTask *task = av_malloc(sizeof(*task));
+  int index, ret;
+
+  if (!task)
+    return AVERROR(ENOMEM);
+  task->func = func;
+  task->arg = arg;
+  task->ret = 0;
+  task->detached = !ptask;
+  atomic_init(&task->done, 0);
+
+  atomic_fetch_add(&pool->pending, 1);
+  index = w ? w->index
+            : atomic_fetch_add(&pool->next_deque, 1) % pool->nb_threads;
+  if ((ret = deque_push(&pool->deques[index], task)) < 0) {
+    atomic_fetch_sub(&pool->pending, 1);
+    av_free(task);
+    return ret;
+  }
+
+  atomic_fetch_add(&pool->queued, 1);
+  if (atomic_load(&pool->nb_sleeping) || atomic_load(&pool->nb_waiters)) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_cond);
+    if (atomic_load(&pool->nb_waiters))
+      pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  if (ptask)
+    *ptask = task;
+  return 0;
+}
+
+int ff_threadpool_task_wait(FFThreadPool *pool, FFThreadTask **ptask) {
+  FFThreadTask *task = *ptask;
+  int ret;
+
+  if (!task)
+    return AVERROR(EINVAL);
+  help_until(pool, task_done, task);
+  ret = task->ret;
+  av_freep(ptask);
+  return ret;
+}
+
+int ff_threadpool_wait(FFThreadPool *pool) {
+  int err;
+
+  if (current_worker && current_worker->pool == pool)
+    return AVERROR(EINVAL);
+  help_until(pool, pool_done, NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  err = pool->err;
+  pool->err = 0;
+  pthread_mutex_unlock(&pool->lock);
+  return err;
+}
+
+int ff_threadpool_init(FFThreadPool **ppool, int nb_threads) {
+  FFThreadPool *pool;
+  int i;
+
+  if (nb_threads <= 0) {
+    long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nb_threads = nb_cpus > 0 ? nb_cpus : 1;
+  }
+  nb_threads = FFMIN(nb_threads, FF_THREADPOOL_MAX_THREADS);
+
+  pool = av_mallocz(sizeof(*pool));
+  if (!pool)
+    return AVERROR(ENOMEM);
+  pool->workers = av_calloc(nb_threads, sizeof(*pool->workers));
+  pool->deques = av_calloc(nb_threads, sizeof(*pool->deques));
+  if (!pool->workers || !pool->deques) {
+    av_free(pool->workers);
+    av_free(pool->deques);
+    av_free(pool);
+    return AVERROR(ENOMEM);
+  }
+  pool->nb_threads = nb_threads;
+  for (i = 0; i < nb_threads; i++)
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  *ppool = pool;
+
+  for (i = 0; i < nb_threads; i++) {
+    ThreadWorker *w = &pool->workers[i];
+    int ret;
+
+    w->pool = pool;
+    w->index = i;
+    if ((ret = pthread_create(&w->thread, NULL, worker_thread, w))) {
+      ff_threadpool_free(ppool);
+      return AVERROR(ret);
+    }
+    pool->nb_started++;
+  }
+  return nb_threads;
+}
+
+void ff_threadpool_free(FFThreadPool **ppool) {
+  FFThreadPool *pool = *ppool;
+  int i;
+
+  if (!pool)
+    return;
+
+  if (pool->nb_started == pool->nb_threads)
+    ff_threadpool_wait(pool);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->exit = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i < pool->nb_started; i++)
+    pthread_join(pool->workers[i].thread, NULL);
+
+  for (i = 0; i < pool->nb_threads; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    av_free(pool->deques[i].tasks);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_cond_destroy(&pool->done_cond);
+  av_free(pool->workers);
+  av_free(pool->deques);
+  av_freep(ppool);
+}
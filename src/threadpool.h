@@ -0,0 +1,79 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Work stealing thread pool.
+ *
+ * Every worker owns a deque of tasks. Tasks submitted from a worker go to
+ * the bottom of its own deque and are run most recent first; idle workers
+ * steal from the top of the other deques. Tasks submitted from outside the
+ * pool are spread over the deques.
+ *
+ * A thread waiting on a task or on the pool runs queued tasks meanwhile, so
+ * tasks may submit and wait on other tasks without deadlocking.
+ */
+
+#ifndef AVUTIL_THREADPOOL_H
+#define AVUTIL_THREADPOOL_H
+
+#define FF_THREADPOOL_MAX_THREADS 64
+
+typedef struct FFThreadPool FFThreadPool;
+typedef struct FFThreadTask FFThreadTask;
+
+/**
+ * Create a thread pool.
+ *
+ * @param nb_threads number of worker threads, 0 for one per CPU
+ * @return the number of worker threads, a negative AVERROR code on error
+ */
+int ff_threadpool_init(FFThreadPool **pool, int nb_threads);
+
+/**
+ * Wait for every submitted task, then stop the workers and free the pool.
+ */
+void ff_threadpool_free(FFThreadPool **pool);
+
+/**
+ * Queue func(arg) to run on the pool.
+ *
+ * @param task if not NULL, set to a future of the task that must be passed
+ *             to ff_threadpool_task_wait(); if NULL the task is detached
+ * @return 0 on success, a negative AVERROR code on error
+ */
+int ff_threadpool_submit(FFThreadPool *pool, int (*func)(void *arg), void *arg,
+                         FFThreadTask **task);
+
+/**
+ * Wait for a task to complete and free it.
+ *
+ * @return the return value of the task function
+ */
+int ff_threadpool_task_wait(FFThreadPool *pool, FFThreadTask **task);
+
+/**
+ * Wait for every task submitted so far, detached ones included. Must not be
+ * called from a task of the pool.
+ *
+ * @return the first negative return value of a detached task since the last
+ *         call, 0 if there was none
+ */
+int ff_threadpool_wait(FFThreadPool *pool);
+
+#endif /* AVUTIL_THREADPOOL_H */
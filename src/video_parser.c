@@ -29,26 +29,29 @@ static int decode_extradata_ps(const uint8_t *data, int size, H264ParamSets *ps,
     switch (nal->type) {
     case H264_NAL_SPS: {
       GetBitContext tmp_gb = nal->gb;
-      ret = ff_h264_decode_seq_parameter_set(&tmp_gb, ps, 0);
+      ret = ff_h264_decode_seq_parameter_set(&tmp_gb, logctx, ps, 0);
       if (ret >= 0)
         break;
-      printf("SPS decoding failure, trying again with the complete NAL\n");
+      av_log(logctx, AV_LOG_DEBUG,
+             "SPS decoding failure, trying again with the complete NAL\n");
       init_get_bits8(&tmp_gb, nal->raw_data + 1, nal->raw_size - 1);
-      ret = ff_h264_decode_seq_parameter_set(&tmp_gb, ps, 0);
+      ret = ff_h264_decode_seq_parameter_set(&tmp_gb, logctx, ps, 0);
       if (ret >= 0)
         break;
-      ret = ff_h264_decode_seq_parameter_set(&nal->gb, ps, 1);
+      ret = ff_h264_decode_seq_parameter_set(&nal->gb, logctx, ps, 1);
       if (ret < 0)
         goto fail;
       break;
     }
     case H264_NAL_PPS:
-      ret = ff_h264_decode_picture_parameter_set(&nal->gb, ps, nal->size_bits);
+      ret = ff_h264_decode_picture_parameter_set(&nal->gb, logctx, ps,
+                                                 nal->size_bits);
       if (ret < 0)
         goto fail;
       break;
     default:
-      printf("Ignoring NAL type %d in extradata\n", nal->type);
+      av_log(logctx, AV_LOG_DEBUG, "Ignoring NAL type %d in extradata\n",
+             nal->type);
       break;
     }
   }
@@ -69,33 +72,21 @@ static int decode_extradata_ps_mp4(const uint8_t *buf, int buf_size,
 
   ret = decode_extradata_ps(buf, buf_size, ps, 1, logctx);
   if (ret < 0 /*&& !(err_recognition & AV_EF_EXPLODE)*/) {
-    GetByteContext gbc;
-    PutByteContext pbc;
     uint8_t *escaped_buf;
     int escaped_buf_size;
 
-    printf("SPS decoding failure, trying again after escaping the NAL\n");
+    av_log(logctx, AV_LOG_WARNING,
+           "SPS decoding failure, trying again after escaping the NAL\n");
 
-    if (buf_size / 2 >= (INT16_MAX - AV_INPUT_BUFFER_PADDING_SIZE) / 3)
+    escaped_buf_size = ff_h2645_escaped_size(buf, buf_size);
+    if (escaped_buf_size < 0 ||
+        escaped_buf_size >= INT16_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
       return AVERROR(ERANGE);
-    escaped_buf_size = buf_size * 3 / 2 + AV_INPUT_BUFFER_PADDING_SIZE;
-    escaped_buf = av_mallocz(escaped_buf_size);
+    escaped_buf = av_mallocz(escaped_buf_size + AV_INPUT_BUFFER_PADDING_SIZE);
     if (!escaped_buf)
       return AVERROR(ENOMEM);
 
-    bytestream2_init(&gbc, buf, buf_size);
-    bytestream2_init_writer(&pbc, escaped_buf, escaped_buf_size);
-
-    while (bytestream2_get_bytes_left(&gbc)) {
-      if (bytestream2_get_bytes_left(&gbc) >= 3 &&
-          bytestream2_peek_be24(&gbc) <= 3) {
-        bytestream2_put_be24(&pbc, 3);
-        bytestream2_skip(&gbc, 2);
-      } else
-        bytestream2_put_byte(&pbc, bytestream2_get_byte(&gbc));
-    }
-
-    escaped_buf_size = bytestream2_tell_p(&pbc);
+    ff_h2645_escape_rbsp(escaped_buf, buf, buf_size);
     AV_WB16(escaped_buf, escaped_buf_size - 2);
 
     (void)decode_extradata_ps(escaped_buf, escaped_buf_size, ps, 1, logctx);
@@ -121,7 +112,7 @@ int ff_h264_decode_extradata(const uint8_t *data, int size, H264ParamSets *ps,
     *is_avc = 1;
 
     if (size < 7) {
-      printf("avcC %d too short\n", size);
+      av_log(logctx, AV_LOG_ERROR, "avcC %d too short\n", size);
       return AVERROR_INVALIDDATA;
     }
 
@@ -134,7 +125,7 @@ int ff_h264_decode_extradata(const uint8_t *data, int size, H264ParamSets *ps,
         return AVERROR_INVALIDDATA;
       ret = decode_extradata_ps_mp4(p, nalsize, ps, err_recognition, logctx);
       if (ret < 0) {
-        printf("Decoding sps %d from avcC failed\n", i);
+        av_log(logctx, AV_LOG_ERROR, "Decoding sps %d from avcC failed\n", i);
         return ret;
       }
       p += nalsize;
@@ -147,7 +138,7 @@ int ff_h264_decode_extradata(const uint8_t *data, int size, H264ParamSets *ps,
         return AVERROR_INVALIDDATA;
       ret = decode_extradata_ps_mp4(p, nalsize, ps, err_recognition, logctx);
       if (ret < 0) {
-        printf("Decoding pps %d from avcC failed\n", i);
+        av_log(logctx, AV_LOG_ERROR, "Decoding pps %d from avcC failed\n", i);
         return ret;
       }
       p += nalsize;
@@ -189,17 +180,17 @@ static int hevc_decode_nal_units(const uint8_t *buf, int buf_size,
     /* ignore everything except parameter sets and VCL NALUs */
     switch (nal->type) {
     case HEVC_NAL_VPS:
-      ret = ff_hevc_decode_nal_vps(&nal->gb, ps);
+      ret = ff_hevc_decode_nal_vps(&nal->gb, logctx, ps);
       if (ret < 0)
         goto done;
       break;
     case HEVC_NAL_SPS:
-      ret = ff_hevc_decode_nal_sps(&nal->gb, ps, apply_defdispwin);
+      ret = ff_hevc_decode_nal_sps(&nal->gb, logctx, ps, apply_defdispwin);
       if (ret < 0)
         goto done;
       break;
     case HEVC_NAL_PPS:
-      ret = ff_hevc_decode_nal_pps(&nal->gb, ps);
+      ret = ff_hevc_decode_nal_pps(&nal->gb, logctx, ps);
       if (ret < 0)
         goto done;
       break;
@@ -210,7 +201,8 @@ static int hevc_decode_nal_units(const uint8_t *buf, int buf_size,
         goto done;
       break;
     default:
-      printf("Ignoring NAL type %d in extradata\n", nal->type);
+      av_log(logctx, AV_LOG_DEBUG, "Ignoring NAL type %d in extradata\n",
+             nal->type);
       break;
     }
   }
@@ -258,7 +250,7 @@ int ff_hevc_decode_extradata(const uint8_t *data, int size, HEVCParamSets *ps,
         // +2 for the nal size field
         int nalsize = bytestream2_peek_be16(&gb) + 2;
         if (bytestream2_get_bytes_left(&gb) < nalsize) {
-          printf("Invalid NAL unit size in extradata.\n");
+          av_log(logctx, AV_LOG_ERROR, "Invalid NAL unit size in extradata.\n");
           return AVERROR_INVALIDDATA;
         }
 
@@ -266,7 +258,8 @@ int ff_hevc_decode_extradata(const uint8_t *data, int size, HEVCParamSets *ps,
                                     *nal_length_size, err_recognition,
                                     apply_defdispwin, logctx);
         if (ret < 0) {
-          printf("Decoding nal unit %d %d from hvcC failed\n", type, i);
+          av_log(logctx, AV_LOG_ERROR,
+                 "Decoding nal unit %d %d from hvcC failed\n", type, i);
           return ret;
         }
         bytestream2_skip(&gb, nalsize);
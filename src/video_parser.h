@@ -1,5 +1,5 @@
-#ifndef AVUTIL_THREAD_H
-#define AVUTIL_THREAD_H
+#ifndef AVCODEC_VIDEO_PARSER_H
+#define AVCODEC_VIDEO_PARSER_H
 
 #include "bytestream.h"
 #include "get_bits.h"
@@ -21,4 +21,4 @@ int ff_hevc_decode_extradata(const uint8_t *data, int size, HEVCParamSets *ps,
                              HEVCSEI *sei, int *is_nalff, int *nal_length_size,
                              int err_recognition, int apply_defdispwin,
                              void *logctx);
-#endif
\ No newline at end of file
+#endif /* AVCODEC_VIDEO_PARSER_H */
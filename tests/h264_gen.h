@@ -0,0 +1,172 @@
+/*
+ * Synthetic H.264 NAL units for the tests
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef TESTS_H264_GEN_H
+#define TESTS_H264_GEN_H
+
+#include <stdint.h>
+
+#include "golomb.h"
+#include "h2645_parse.h"
+#include "intreadwrite.h"
+#include "put_bits.h"
+
+typedef struct GenSPS {
+  int id;
+  int vui;                   ///< write VUI with timing information
+  int hrd;                   ///< NAL HRD with the lengths below
+  int cpb_len, dpb_len, init_len;
+  int pic_struct;            ///< pic_struct_present_flag
+  uint32_t bit_rate_minus1, cpb_size_minus1;
+  uint32_t tick, scale;      ///< 0 for 1 / 50
+} GenSPS;
+
+/**
+ * Close the RBSP in pb and write it to out as an escaped Annex B NAL unit.
+ *
+ * @return the size written, start code included
+ */
+static inline int gen_finish(PutBitContext *pb, uint8_t *rbsp, uint8_t *out) {
+  int size;
+
+  put_bits(pb, 1, 1); // rbsp_stop_one_bit
+  align_put_bits(pb);
+  flush_put_bits(pb);
+  size = put_bytes_output(pb);
+  AV_WB32(out, 1);
+  return 4 + ff_h2645_escape_rbsp(out + 4, rbsp, size);
+}
+
+/* Baseline 176x144 SPS. */
+static inline int gen_sps(uint8_t *out, const GenSPS *g) {
+  uint8_t rbsp[256];
+  PutBitContext pb;
+
+  init_put_bits(&pb, rbsp, sizeof(rbsp));
+  put_bits(&pb, 8, 0x67);
+  put_bits(&pb, 8, 66); // profile_idc
+  put_bits(&pb, 8, 0);  // constraint flags
+  put_bits(&pb, 8, 30); // level_idc
+  set_ue_golomb(&pb, g->id);
+  set_ue_golomb(&pb, 0); // log2_max_frame_num_minus4
+  set_ue_golomb(&pb, 2); // pic_order_cnt_type
+  set_ue_golomb(&pb, 1); // max_num_ref_frames
+  put_bits(&pb, 1, 0);   // gaps_in_frame_num_value_allowed_flag
+  set_ue_golomb(&pb, 10);
+  set_ue_golomb(&pb, 8);
+  put_bits(&pb, 1, 1); // frame_mbs_only_flag
+  put_bits(&pb, 1, 1); // direct_8x8_inference_flag
+  put_bits(&pb, 1, 0); // frame_cropping_flag
+  put_bits(&pb, 1, g->vui);
+  if (g->vui) {
+    put_bits(&pb, 1, 0); // aspect_ratio_info_present_flag
+    put_bits(&pb, 1, 0); // overscan_info_present_flag
+    put_bits(&pb, 1, 0); // video_signal_type_present_flag
+    put_bits(&pb, 1, 0); // chroma_loc_info_present_flag
+    put_bits(&pb, 1, 1); // timing_info_present_flag
+    put_bits32(&pb, g->tick ? g->tick : 1);
+    put_bits32(&pb, g->scale ? g->scale : 50);
+    put_bits(&pb, 1, 1); // fixed_frame_rate_flag
+    put_bits(&pb, 1, g->hrd);
+    if (g->hrd) {
+      set_ue_golomb(&pb, 0); // cpb_cnt_minus1
+      put_bits(&pb, 4, 0);   // bit_rate_scale
+      put_bits(&pb, 4, 0);   // cpb_size_scale
+      set_ue_golomb_long(&pb, g->bit_rate_minus1);
+      set_ue_golomb_long(&pb, g->cpb_size_minus1);
+      put_bits(&pb, 1, 0); // cbr_flag
+      put_bits(&pb, 5, g->init_len - 1);
+      put_bits(&pb, 5, g->cpb_len - 1);
+      put_bits(&pb, 5, g->dpb_len - 1);
+      put_bits(&pb, 5, 0); // time_offset_length
+    }
+    put_bits(&pb, 1, 0); // vcl_hrd_parameters_present_flag
+    if (g->hrd)
+      put_bits(&pb, 1, 0); // low_delay_hrd_flag
+    put_bits(&pb, 1, g->pic_struct);
+    put_bits(&pb, 1, 0); // bitstream_restriction_flag
+  }
+  return gen_finish(&pb, rbsp, out);
+}
+
+static inline int gen_pps(uint8_t *out, int pps_id, int sps_id) {
+  uint8_t rbsp[64];
+  PutBitContext pb;
+
+  init_put_bits(&pb, rbsp, sizeof(rbsp));
+  put_bits(&pb, 8, 0x68);
+  set_ue_golomb(&pb, pps_id);
+  set_ue_golomb(&pb, sps_id);
+  put_bits(&pb, 1, 0);   // entropy_coding_mode_flag
+  put_bits(&pb, 1, 0);   // bottom_field_pic_order_in_frame_present_flag
+  set_ue_golomb(&pb, 0); // num_slice_groups_minus1
+  set_ue_golomb(&pb, 0); // num_ref_idx_l0_default_active_minus1
+  set_ue_golomb(&pb, 0); // num_ref_idx_l1_default_active_minus1
+  put_bits(&pb, 1, 0);   // weighted_pred_flag
+  put_bits(&pb, 2, 0);   // weighted_bipred_idc
+  set_se_golomb(&pb, 0); // pic_init_qp_minus26
+  set_se_golomb(&pb, 0); // pic_init_qs_minus26
+  set_se_golomb(&pb, 0); // chroma_qp_index_offset
+  put_bits(&pb, 1, 1);   // deblocking_filter_control_present_flag
+  put_bits(&pb, 1, 0);   // constrained_intra_pred_flag
+  put_bits(&pb, 1, 0);   // redundant_pic_cnt_present_flag
+  return gen_finish(&pb, rbsp, out);
+}
+
+/* Append a payload written in pp to the SEI RBSP in pb. */
+static inline void gen_sei_msg(PutBitContext *pb, int type, PutBitContext *pp) {
+  int size, i;
+
+  align_put_bits(pp);
+  flush_put_bits(pp);
+  size = put_bytes_output(pp);
+  put_bits(pb, 8, type);
+  put_bits(pb, 8, size);
+  for (i = 0; i < size; i++)
+    put_bits(pb, 8, pp->buf[i]);
+}
+
+/* SEI with a buffering period if bp_sps >= 0, then a picture timing. */
+static inline int gen_sei(uint8_t *out, const GenSPS *g, int bp_sps,
+                          uint32_t init_delay, uint32_t cpb_delay) {
+  uint8_t rbsp[128], pl[32];
+  PutBitContext pb, pp;
+
+  init_put_bits(&pb, rbsp, sizeof(rbsp));
+  put_bits(&pb, 8, 0x06);
+  if (bp_sps >= 0) {
+    init_put_bits(&pp, pl, sizeof(pl));
+    set_ue_golomb(&pp, bp_sps);
+    put_bits64(&pp, g->init_len, init_delay);
+    put_bits64(&pp, g->init_len, 0); // initial_cpb_removal_delay_offset
+    gen_sei_msg(&pb, 0, &pp);
+  }
+  init_put_bits(&pp, pl, sizeof(pl));
+  put_bits64(&pp, g->cpb_len, cpb_delay);
+  put_bits64(&pp, g->dpb_len, 0); // dpb_output_delay
+  if (g->pic_struct) {
+    put_bits(&pp, 4, 0); // pic_struct
+    put_bits(&pp, 1, 0); // clock_timestamp_flag
+  }
+  gen_sei_msg(&pb, 1, &pp);
+  return gen_finish(&pb, rbsp, out);
+}
+
+#endif /* TESTS_H264_GEN_H */
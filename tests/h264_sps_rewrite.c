@@ -0,0 +1,89 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * An SPS read from the raw NAL unit, as the retry of decode_extradata_ps()
+ * does, starts its GetBitContext after the NAL header. Its VUI must be
+ * rewritten exactly like the one of the same SPS read the normal way.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "h264_gen.h"
+#include "h264_ps.h"
+#include "sps_rewrite_bsf.h"
+
+int main(void) {
+  // No zero runs, so the raw NAL unit is also its RBSP.
+  const GenSPS g = {.id = 3, .vui = 1, .tick = 0x11111111,
+                    .scale = 0x22222222};
+  const SPSRewriteParams p = {.flags = SPS_REWRITE_SAR, .sar = {4, 3}};
+  uint8_t nal[256 + AV_INPUT_BUFFER_PADDING_SIZE] = {0};
+  uint8_t out[2][256 + SPS_REWRITE_MAX_GROWTH];
+  H264ParamSets ps[2] = {0};
+  H2645Packet pkt = {0};
+  GetBitContext gb;
+  const SPS *sps[2];
+  int size, ret[2], i, err = 1;
+
+  size = gen_sps(nal, &g);
+  if (ff_h2645_packet_split(&pkt, nal, size, NULL, 0, 0, AV_CODEC_ID_H264, 1,
+                            0) < 0 ||
+      pkt.nb_nals != 1 || pkt.nals[0].raw_size != pkt.nals[0].size) {
+    printf("bad test SPS\n");
+    goto end;
+  }
+
+  gb = pkt.nals[0].gb;
+  if (ff_h264_decode_seq_parameter_set(&gb, NULL, &ps[0], 0) < 0) {
+    printf("SPS not decoded\n");
+    goto end;
+  }
+  init_get_bits8(&gb, pkt.nals[0].raw_data + 1, pkt.nals[0].raw_size - 1);
+  if (ff_h264_decode_seq_parameter_set(&gb, NULL, &ps[1], 0) < 0) {
+    printf("SPS not decoded from the raw NAL unit\n");
+    goto end;
+  }
+
+  for (i = 0; i < 2; i++) {
+    sps[i] = (const SPS *)ps[i].sps_list[g.id]->data;
+    ret[i] = ff_h264_rewrite_sps_vui(sps[i], &p, out[i], sizeof(out[i]));
+  }
+  if (sps[0]->data_size != sps[1]->data_size ||
+      memcmp(sps[0]->data, sps[1]->data, sps[0]->data_size)) {
+    printf("stored SPS differ\n");
+    goto end;
+  }
+  if (sps[0]->vui_flag_pos != sps[1]->vui_flag_pos) {
+    printf("vui_flag_pos %d, %d from the raw NAL unit\n",
+           sps[0]->vui_flag_pos, sps[1]->vui_flag_pos);
+    goto end;
+  }
+  if (ret[0] <= 0 || ret[0] != ret[1] || memcmp(out[0], out[1], ret[0])) {
+    printf("rewrites differ: %d, %d\n", ret[0], ret[1]);
+    goto end;
+  }
+  err = 0;
+
+end:
+  ff_h2645_packet_uninit(&pkt);
+  ff_h264_ps_uninit(&ps[0]);
+  ff_h264_ps_uninit(&ps[1]);
+  return err;
+}
@@ -0,0 +1,156 @@
+/*
+ * Synthetic HEVC NAL units for the tests
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef TESTS_HEVC_GEN_H
+#define TESTS_HEVC_GEN_H
+
+#include "h264_gen.h"
+#include "hevc.h"
+
+static inline void gen_hevc_header(PutBitContext *pb, int type) {
+  put_bits(pb, 16, type << 9 | 1); // nuh_layer_id 0, nuh_temporal_id_plus1 1
+}
+
+/* Main profile, level 3.1, one sub-layer */
+static inline void gen_hevc_ptl(PutBitContext *pb) {
+  put_bits(pb, 2, 0);             // general_profile_space
+  put_bits(pb, 1, 0);             // general_tier_flag
+  put_bits(pb, 5, 1);             // general_profile_idc
+  put_bits32(pb, 0x60000000);     // general_profile_compatibility_flag[1, 2]
+  put_bits(pb, 4, 0x9);           // progressive_source, frame_only_constraint
+  put_bits64(pb, 43, 0);          // general_reserved_zero_43bits
+  put_bits(pb, 1, 0);             // general_inbld_flag
+  put_bits(pb, 8, 93);            // general_level_idc
+}
+
+static inline void gen_hevc_dpb(PutBitContext *pb) {
+  put_bits(pb, 1, 1);    // sub_layer_ordering_info_present_flag
+  set_ue_golomb(pb, 4);  // max_dec_pic_buffering_minus1
+  set_ue_golomb(pb, 0);  // max_num_reorder_pics
+  set_ue_golomb(pb, 0);  // max_latency_increase_plus1
+}
+
+static inline int gen_hevc_vps(uint8_t *out) {
+  uint8_t rbsp[64];
+  PutBitContext pb;
+
+  init_put_bits(&pb, rbsp, sizeof(rbsp));
+  gen_hevc_header(&pb, HEVC_NAL_VPS);
+  put_bits(&pb, 4, 0);      // vps_video_parameter_set_id
+  put_bits(&pb, 2, 3);      // vps_reserved_three_2bits
+  put_bits(&pb, 6, 0);      // vps_max_layers_minus1
+  put_bits(&pb, 3, 0);      // vps_max_sub_layers_minus1
+  put_bits(&pb, 1, 1);      // vps_temporal_id_nesting_flag
+  put_bits(&pb, 16, 0xffff);
+  gen_hevc_ptl(&pb);
+  gen_hevc_dpb(&pb);
+  put_bits(&pb, 6, 0);      // vps_max_layer_id
+  set_ue_golomb(&pb, 0);    // vps_num_layer_sets_minus1
+  put_bits(&pb, 1, 0);      // vps_timing_info_present_flag
+  put_bits(&pb, 1, 0);      // vps_extension_flag
+  return gen_finish(&pb, rbsp, out);
+}
+
+/* 176x144 4:2:0 8-bit SPS with 16x16 CTBs and VUI timing information. */
+static inline int gen_hevc_sps(uint8_t *out) {
+  uint8_t rbsp[128];
+  PutBitContext pb;
+
+  init_put_bits(&pb, rbsp, sizeof(rbsp));
+  gen_hevc_header(&pb, HEVC_NAL_SPS);
+  put_bits(&pb, 4, 0);     // sps_video_parameter_set_id
+  put_bits(&pb, 3, 0);     // sps_max_sub_layers_minus1
+  put_bits(&pb, 1, 1);     // sps_temporal_id_nesting_flag
+  gen_hevc_ptl(&pb);
+  set_ue_golomb(&pb, 0);   // sps_seq_parameter_set_id
+  set_ue_golomb(&pb, 1);   // chroma_format_idc
+  set_ue_golomb(&pb, 176);
+  set_ue_golomb(&pb, 144);
+  put_bits(&pb, 1, 0);     // conformance_window_flag
+  set_ue_golomb(&pb, 0);   // bit_depth_luma_minus8
+  set_ue_golomb(&pb, 0);   // bit_depth_chroma_minus8
+  set_ue_golomb(&pb, 4);   // log2_max_pic_order_cnt_lsb_minus4
+  gen_hevc_dpb(&pb);
+  set_ue_golomb(&pb, 0);   // log2_min_luma_coding_block_size_minus3
+  set_ue_golomb(&pb, 1);   // log2_diff_max_min_luma_coding_block_size
+  set_ue_golomb(&pb, 0);   // log2_min_luma_transform_block_size_minus2
+  set_ue_golomb(&pb, 2);   // log2_diff_max_min_luma_transform_block_size
+  set_ue_golomb(&pb, 1);   // max_transform_hierarchy_depth_inter
+  set_ue_golomb(&pb, 1);   // max_transform_hierarchy_depth_intra
+  put_bits(&pb, 1, 0);     // scaling_list_enabled_flag
+  put_bits(&pb, 1, 1);     // amp_enabled_flag
+  put_bits(&pb, 1, 1);     // sample_adaptive_offset_enabled_flag
+  put_bits(&pb, 1, 0);     // pcm_enabled_flag
+  set_ue_golomb(&pb, 1);   // num_short_term_ref_pic_sets
+  set_ue_golomb(&pb, 1);   // num_negative_pics
+  set_ue_golomb(&pb, 0);   // num_positive_pics
+  set_ue_golomb(&pb, 0);   // delta_poc_s0_minus1
+  put_bits(&pb, 1, 1);     // used_by_curr_pic_s0_flag
+  put_bits(&pb, 1, 0);     // long_term_ref_pics_present_flag
+  put_bits(&pb, 1, 1);     // sps_temporal_mvp_enabled_flag
+  put_bits(&pb, 1, 1);     // strong_intra_smoothing_enabled_flag
+  put_bits(&pb, 1, 1);     // vui_parameters_present_flag
+  put_bits(&pb, 8, 0);     // no SAR, overscan, signal type, ..., display window
+  put_bits(&pb, 1, 1);     // vui_timing_info_present_flag
+  put_bits32(&pb, 1);
+  put_bits32(&pb, 25);
+  put_bits(&pb, 1, 0);     // vui_poc_proportional_to_timing_flag
+  put_bits(&pb, 1, 0);     // vui_hrd_parameters_present_flag
+  put_bits(&pb, 1, 0);     // bitstream_restriction_flag
+  put_bits(&pb, 1, 0);     // sps_extension_present_flag
+  return gen_finish(&pb, rbsp, out);
+}
+
+/* PPS of gen_hevc_sps() with 2x2 tiles of explicit sizes. */
+static inline int gen_hevc_pps(uint8_t *out) {
+  uint8_t rbsp[64];
+  PutBitContext pb;
+
+  init_put_bits(&pb, rbsp, sizeof(rbsp));
+  gen_hevc_header(&pb, HEVC_NAL_PPS);
+  set_ue_golomb(&pb, 0);   // pps_pic_parameter_set_id
+  set_ue_golomb(&pb, 0);   // pps_seq_parameter_set_id
+  put_bits(&pb, 7, 0);     // dependent slices ... cabac_init_present_flag
+  set_ue_golomb(&pb, 0);   // num_ref_idx_l0_default_active_minus1
+  set_ue_golomb(&pb, 0);   // num_ref_idx_l1_default_active_minus1
+  set_se_golomb(&pb, 0);   // init_qp_minus26
+  put_bits(&pb, 3, 0);     // constrained_intra_pred ... cu_qp_delta_enabled
+  set_se_golomb(&pb, 0);   // pps_cb_qp_offset
+  set_se_golomb(&pb, 0);   // pps_cr_qp_offset
+  put_bits(&pb, 4, 0);     // slice chroma qp offsets ... transquant bypass
+  put_bits(&pb, 1, 1);     // tiles_enabled_flag
+  put_bits(&pb, 1, 0);     // entropy_coding_sync_enabled_flag
+  set_ue_golomb(&pb, 1);   // num_tile_columns_minus1
+  set_ue_golomb(&pb, 1);   // num_tile_rows_minus1
+  put_bits(&pb, 1, 0);     // uniform_spacing_flag
+  set_ue_golomb(&pb, 4);   // column_width_minus1[0]
+  set_ue_golomb(&pb, 3);   // row_height_minus1[0]
+  put_bits(&pb, 1, 1);     // loop_filter_across_tiles_enabled_flag
+  put_bits(&pb, 1, 1);     // pps_loop_filter_across_slices_enabled_flag
+  put_bits(&pb, 1, 0);     // deblocking_filter_control_present_flag
+  put_bits(&pb, 1, 0);     // pps_scaling_list_data_present_flag
+  put_bits(&pb, 1, 0);     // lists_modification_present_flag
+  set_ue_golomb(&pb, 0);   // log2_parallel_merge_level_minus2
+  put_bits(&pb, 1, 0);     // slice_segment_header_extension_present_flag
+  put_bits(&pb, 1, 0);     // pps_extension_present_flag
+  return gen_finish(&pb, rbsp, out);
+}
+
+#endif /* TESTS_HEVC_GEN_H */
@@ -0,0 +1,478 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Parameter sets and SEI are read unchecked when the padding after the NAL
+ * unit covers the worst-case overread of their parser, and by the checked
+ * twin otherwise. Both must decode valid NAL units the same way, and on
+ * truncated or hostile NAL units the unchecked one must stay within its
+ * budget. Run under ASan with an iteration count argument for a longer run.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "h264_ps.h"
+#include "h264_sei.h"
+#include "hevc_gen.h"
+#include "hevc_ps.h"
+#include "hevc_sei.h"
+#include "log.h"
+
+typedef int (*ParseFunc)(GetBitContext *gb);
+
+typedef struct Body {
+  uint8_t data[512];
+  int size;
+} Body;
+
+static const GenSPS gen = {.id = 1, .vui = 1, .hrd = 1, .cpb_len = 20,
+                           .dpb_len = 10, .init_len = 24, .pic_struct = 1,
+                           .bit_rate_minus1 = 999, .cpb_size_minus1 = 999};
+
+static H264ParamSets h264_ps, h264_sps_ps;
+static H264SEI h264_sei;
+static HEVCParamSets hevc_ps;
+static HEVCSEI hevc_sei;
+
+static uint32_t rng = 0x2545f491;
+
+static uint32_t rnd(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static int split(H2645Packet *pkt, const uint8_t *buf, int size,
+                 enum AVCodecID codec_id, int small_padding) {
+  return ff_h2645_packet_split(pkt, buf, size, NULL, 0, 0, codec_id,
+                               small_padding, 0);
+}
+
+/* The RBSP after the NAL header of the single NAL unit in buf. */
+static int get_body(Body *b, const uint8_t *buf, int size,
+                    enum AVCodecID codec_id) {
+  int hdr = codec_id == AV_CODEC_ID_HEVC ? 2 : 1;
+  H2645Packet pkt = {0};
+  int ret = -1;
+
+  if (split(&pkt, buf, size, codec_id, 0) >= 0 && pkt.nb_nals == 1 &&
+      pkt.nals[0].size - hdr <= (int)sizeof(b->data)) {
+    b->size = pkt.nals[0].size - hdr;
+    memcpy(b->data, pkt.nals[0].data + hdr, b->size);
+    ret = 0;
+  }
+  ff_h2645_packet_uninit(&pkt);
+  return ret;
+}
+
+/* SEI RBSP of random messages of the given types, headers kept valid. */
+static void gen_hostile_sei(Body *b, const int *types, int nb_types) {
+  int nb = 1 + rnd() % 3, i, j, size;
+
+  b->size = 0;
+  for (i = 0; i < nb; i++) {
+    size = 1 + rnd() % 200;
+    if (b->size + 2 + size + 1 > (int)sizeof(b->data))
+      break;
+    b->data[b->size++] = types[rnd() % nb_types];
+    b->data[b->size++] = size;
+    for (j = 0; j < size; j++)
+      b->data[b->size++] = rnd() & 1 ? rnd() : 0;
+  }
+  b->data[b->size++] = 0x80;
+}
+
+/* Truncate, damage or replace the valid body. */
+static void mutate(Body *b, const Body *valid) {
+  int i;
+
+  switch (rnd() % 3) {
+  case 0:
+    *b = *valid;
+    b->size = 1 + rnd() % valid->size;
+    break;
+  case 1:
+    *b = *valid;
+    for (i = 1 + rnd() % 8; i > 0; i--)
+      b->data[rnd() % b->size] ^= 1 << (rnd() % 8);
+    break;
+  default:
+    // long runs of zeros make the longest Exp-Golomb codes
+    b->size = 1 + rnd() % 64;
+    for (i = 0; i < b->size; i++)
+      b->data[i] = rnd() % 4 ? 0 : rnd();
+    break;
+  }
+}
+
+/* Parse b unchecked in a buffer padded exactly by budget, random bytes. */
+static int run_trusted(ParseFunc parse, const Body *b, int64_t budget,
+                       const char *name) {
+  int padding = budget / 8 + 17, i, err = 0;
+  uint8_t *buf = malloc(b->size + padding);
+  GetBitContext gb;
+
+  if (!buf)
+    return 1;
+  memcpy(buf, b->data, b->size);
+  for (i = 0; i < padding; i++)
+    buf[b->size + i] = rnd();
+  init_get_bits8(&gb, buf, b->size);
+  gb.padding = padding;
+  if (!get_bits_trusted(&gb, budget)) {
+    printf("%s: padded buffer not trusted\n", name);
+    err = 1;
+  } else {
+    parse(&gb);
+    if (-get_bits_left(&gb) > budget) {
+      printf("%s: read %d bits past the end, budget %lld\n", name,
+             -get_bits_left(&gb), (long long)budget);
+      err = 1;
+    }
+  }
+  free(buf);
+  return err;
+}
+
+/* Parse b with the checked reader, in a buffer with the minimum padding. */
+static int run_checked(ParseFunc parse, const Body *b, int64_t budget,
+                       const char *name) {
+  uint8_t *buf = malloc(b->size + AV_INPUT_BUFFER_PADDING_SIZE);
+  GetBitContext gb;
+  int err = 0;
+
+  if (!buf)
+    return 1;
+  memcpy(buf, b->data, b->size);
+  memset(buf + b->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  init_get_bits8(&gb, buf, b->size);
+  if (get_bits_trusted(&gb, budget)) {
+    printf("%s: minimal padding trusted\n", name);
+    err = 1;
+  } else {
+    parse(&gb);
+  }
+  free(buf);
+  return err;
+}
+
+static int fuzz(ParseFunc parse, const Body *valid, const int *sei_types,
+                int nb_sei_types, int64_t budget, const char *name, int iter) {
+  Body b;
+  int i;
+
+  for (i = 0; i < iter; i++) {
+    if (sei_types)
+      gen_hostile_sei(&b, sei_types, nb_sei_types);
+    else
+      mutate(&b, valid);
+    if (run_trusted(parse, &b, budget, name) ||
+        run_checked(parse, &b, budget, name))
+      return 1;
+  }
+  return 0;
+}
+
+static int parse_h264_sps(GetBitContext *gb) {
+  return ff_h264_decode_seq_parameter_set(gb, NULL, &h264_sps_ps, 0);
+}
+
+static int parse_h264_pps(GetBitContext *gb) {
+  return ff_h264_decode_picture_parameter_set(gb, NULL, &h264_ps,
+                                              gb->size_in_bits);
+}
+
+static int parse_h264_sei(GetBitContext *gb) {
+  ff_h264_sei_reset(&h264_sei);
+  return ff_h264_sei_decode(&h264_sei, gb, &h264_ps, NULL);
+}
+
+static int parse_hevc_vps(GetBitContext *gb) {
+  return ff_hevc_decode_nal_vps(gb, NULL, &hevc_ps);
+}
+
+static int parse_hevc_sps(GetBitContext *gb) {
+  HEVCSPS sps = {0};
+  unsigned int sps_id;
+
+  return ff_hevc_parse_sps(&sps, gb, &sps_id, 0, NULL, NULL);
+}
+
+static int parse_hevc_pps(GetBitContext *gb) {
+  return ff_hevc_decode_nal_pps(gb, NULL, &hevc_ps);
+}
+
+static int parse_hevc_sei(GetBitContext *gb) {
+  ff_hevc_reset_sei(&hevc_sei);
+  return ff_hevc_decode_nal_sei(gb, NULL, &hevc_sei, &hevc_ps,
+                                rnd() & 1 ? HEVC_NAL_SEI_SUFFIX
+                                          : HEVC_NAL_SEI_PREFIX);
+}
+
+static int64_t h264_budget(int type) {
+  return type == H264_NAL_SPS   ? H264_SPS_MAX_OVERREAD_BITS
+         : type == H264_NAL_PPS ? H264_PPS_MAX_OVERREAD_BITS
+                                : H264_SEI_MAX_OVERREAD_BITS;
+}
+
+static int64_t hevc_budget(int type) {
+  return type == HEVC_NAL_VPS   ? HEVC_VPS_MAX_OVERREAD_BITS
+         : type == HEVC_NAL_SPS ? HEVC_SPS_MAX_OVERREAD_BITS
+                                : HEVC_PPS_MAX_OVERREAD_BITS;
+}
+
+/*
+ * Decode the same H.264 packet from a small padded split, whose NAL units are
+ * read checked unless copied to a large enough RBSP buffer, and from a large
+ * padded one, read unchecked; the results must not differ.
+ */
+static int test_h264_valid(const uint8_t *buf, int size) {
+  H264ParamSets ps[2] = {0};
+  H264SEI sei[2] = {0};
+  const SPS *sps[2];
+  const PPS *pps[2];
+  int i, j, ret, trusted, nb_checked = 0, err = 1;
+
+  for (i = 0; i < 2; i++) {
+    H2645Packet pkt = {0};
+
+    ff_h264_sei_reset(&sei[i]);
+    if (split(&pkt, buf, size, AV_CODEC_ID_H264, i) < 0 || pkt.nb_nals != 3) {
+      printf("bad test H.264 packet\n");
+      ff_h2645_packet_uninit(&pkt);
+      goto end;
+    }
+    for (j = 0; j < pkt.nb_nals; j++) {
+      H2645NAL *nal = &pkt.nals[j];
+
+      trusted = get_bits_trusted(&nal->gb, h264_budget(nal->type));
+      nb_checked += !trusted;
+      if (i ? trusted && nal->data == nal->raw_data : !trusted) {
+        printf("H.264 NAL %d trusted: %d with small_padding %d\n", nal->type,
+               trusted, i);
+        ret = -1;
+      } else if (nal->type == H264_NAL_SPS) {
+        ret = ff_h264_decode_seq_parameter_set(&nal->gb, NULL, &ps[i], 0);
+      } else if (nal->type == H264_NAL_PPS) {
+        ret = ff_h264_decode_picture_parameter_set(&nal->gb, NULL, &ps[i],
+                                                   nal->size_bits);
+      } else {
+        ret = ff_h264_sei_decode(&sei[i], &nal->gb, &ps[i], NULL);
+      }
+      if (ret < 0) {
+        printf("H.264 NAL %d not decoded with small_padding %d\n", nal->type,
+               i);
+        ff_h2645_packet_uninit(&pkt);
+        goto end;
+      }
+    }
+    ff_h2645_packet_uninit(&pkt);
+    sps[i] = (const SPS *)ps[i].sps_list[gen.id]->data;
+    pps[i] = (const PPS *)ps[i].pps_list[0]->data;
+  }
+  if (!nb_checked) {
+    printf("no H.264 NAL read checked\n");
+    goto end;
+  }
+
+  if (memcmp(sps[0], sps[1], offsetof(SPS, data)) ||
+      sps[0]->data_size != sps[1]->data_size ||
+      memcmp(sps[0]->data, sps[1]->data, sps[0]->data_size)) {
+    printf("H.264 SPS differ\n");
+    goto end;
+  }
+  if (memcmp(pps[0], pps[1], offsetof(PPS, data)) ||
+      pps[0]->data_size != pps[1]->data_size ||
+      memcmp(pps[0]->data, pps[1]->data, pps[0]->data_size)) {
+    printf("H.264 PPS differ\n");
+    goto end;
+  }
+  if (!sei[0].buffering_period.present || !sei[0].picture_timing.present ||
+      memcmp(&sei[0].buffering_period, &sei[1].buffering_period,
+             sizeof(sei[0].buffering_period)) ||
+      memcmp(&sei[0].picture_timing, &sei[1].picture_timing,
+             sizeof(sei[0].picture_timing))) {
+    printf("H.264 SEI differ\n");
+    goto end;
+  }
+  err = 0;
+
+end:
+  for (i = 0; i < 2; i++) {
+    ff_h264_ps_uninit(&ps[i]);
+    ff_h264_sei_uninit(&sei[i]);
+  }
+  return err;
+}
+
+static int test_hevc_valid(const uint8_t *buf, int size) {
+  HEVCParamSets ps[2] = {0};
+  const HEVCSPS *sps[2];
+  const HEVCPPS *pps[2];
+  int i, j, ret, trusted, nb_checked = 0, nb_ctbs, err = 1;
+
+  for (i = 0; i < 2; i++) {
+    H2645Packet pkt = {0};
+
+    if (split(&pkt, buf, size, AV_CODEC_ID_HEVC, i) < 0 || pkt.nb_nals != 3) {
+      printf("bad test HEVC packet\n");
+      ff_h2645_packet_uninit(&pkt);
+      goto end;
+    }
+    for (j = 0; j < pkt.nb_nals; j++) {
+      H2645NAL *nal = &pkt.nals[j];
+
+      trusted = get_bits_trusted(&nal->gb, hevc_budget(nal->type));
+      nb_checked += !trusted;
+      if (i ? trusted && nal->data == nal->raw_data : !trusted) {
+        printf("HEVC NAL %d trusted: %d with small_padding %d\n", nal->type,
+               trusted, i);
+        ret = -1;
+      } else if (nal->type == HEVC_NAL_VPS) {
+        ret = ff_hevc_decode_nal_vps(&nal->gb, NULL, &ps[i]);
+      } else if (nal->type == HEVC_NAL_SPS) {
+        ret = ff_hevc_decode_nal_sps(&nal->gb, NULL, &ps[i], 0);
+      } else {
+        ret = ff_hevc_decode_nal_pps(&nal->gb, NULL, &ps[i]);
+      }
+      if (ret < 0) {
+        printf("HEVC NAL %d not decoded with small_padding %d\n", nal->type,
+               i);
+        ff_h2645_packet_uninit(&pkt);
+        goto end;
+      }
+    }
+    ff_h2645_packet_uninit(&pkt);
+    sps[i] = (const HEVCSPS *)ps[i].sps_list[0]->data;
+    pps[i] = (const HEVCPPS *)ps[i].pps_list[0]->data;
+  }
+  if (!nb_checked) {
+    printf("no HEVC NAL read checked\n");
+    goto end;
+  }
+
+  if (memcmp(sps[0], sps[1], offsetof(HEVCSPS, data))) {
+    printf("HEVC SPS differ\n");
+    goto end;
+  }
+  nb_ctbs = sps[0]->ctb_width * sps[0]->ctb_height;
+  if (pps[0]->num_tile_columns != 2 || pps[0]->num_tile_rows != 2 ||
+      pps[0]->column_width[0] != 5 || pps[0]->row_height[0] != 4 ||
+      pps[1]->num_tile_columns != 2 || pps[1]->num_tile_rows != 2 ||
+      memcmp(pps[0]->column_width, pps[1]->column_width,
+             2 * sizeof(*pps[0]->column_width)) ||
+      memcmp(pps[0]->row_height, pps[1]->row_height,
+             2 * sizeof(*pps[0]->row_height)) ||
+      memcmp(pps[0]->ctb_addr_rs_to_ts, pps[1]->ctb_addr_rs_to_ts,
+             nb_ctbs * sizeof(*pps[0]->ctb_addr_rs_to_ts)) ||
+      memcmp(pps[0]->tile_id, pps[1]->tile_id,
+             nb_ctbs * sizeof(*pps[0]->tile_id))) {
+    printf("HEVC PPS tiles differ\n");
+    goto end;
+  }
+  err = 0;
+
+end:
+  for (i = 0; i < 2; i++)
+    ff_hevc_ps_uninit(&ps[i]);
+  return err;
+}
+
+int main(int argc, char **argv) {
+  static const int h264_sei_types[] = {0, 1, 4, 5, 6, 45, 47, 137, 144, 147};
+  static const int hevc_sei_types[] = {0,   1,   4,   5,   6,   19,  45, 47,
+                                       129, 132, 136, 137, 144, 147, 148};
+  int iter = argc > 1 ? atoi(argv[1]) : 300;
+  uint8_t buf[1024];
+  Body sps, pps, vps, hsps, hpps;
+  int size, n, err = 1;
+
+  av_log_set_level(AV_LOG_QUIET);
+  ff_h264_sei_reset(&h264_sei);
+  ff_hevc_reset_sei(&hevc_sei);
+
+  size = gen_sps(buf, &gen);
+  n = gen_pps(buf + size, 0, gen.id);
+  if (get_body(&sps, buf, size, AV_CODEC_ID_H264) < 0 ||
+      get_body(&pps, buf + size, n, AV_CODEC_ID_H264) < 0)
+    goto end;
+  size += n;
+  size += gen_sei(buf + size, &gen, gen.id, 90000, 777);
+  if (test_h264_valid(buf, size))
+    goto end;
+
+  size = gen_hevc_vps(buf);
+  if (get_body(&vps, buf, size, AV_CODEC_ID_HEVC) < 0)
+    goto end;
+  n = gen_hevc_sps(buf + size);
+  if (get_body(&hsps, buf + size, n, AV_CODEC_ID_HEVC) < 0)
+    goto end;
+  size += n;
+  n = gen_hevc_pps(buf + size);
+  if (get_body(&hpps, buf + size, n, AV_CODEC_ID_HEVC) < 0)
+    goto end;
+  size += n;
+  if (test_hevc_valid(buf, size))
+    goto end;
+
+  // the PPS and SEI fuzzing refer to valid parameter sets
+  {
+    GetBitContext gb;
+
+    init_get_bits8(&gb, sps.data, sps.size);
+    if (ff_h264_decode_seq_parameter_set(&gb, NULL, &h264_ps, 0) < 0)
+      goto end;
+    init_get_bits8(&gb, vps.data, vps.size);
+    if (parse_hevc_vps(&gb) < 0)
+      goto end;
+    init_get_bits8(&gb, hsps.data, hsps.size);
+    if (ff_hevc_decode_nal_sps(&gb, NULL, &hevc_ps, 0) < 0)
+      goto end;
+  }
+
+  if (fuzz(parse_h264_sps, &sps, NULL, 0, H264_SPS_MAX_OVERREAD_BITS,
+           "H.264 SPS", iter) ||
+      fuzz(parse_h264_pps, &pps, NULL, 0, H264_PPS_MAX_OVERREAD_BITS,
+           "H.264 PPS", iter) ||
+      fuzz(parse_h264_sei, NULL, h264_sei_types, FF_ARRAY_ELEMS(h264_sei_types),
+           H264_SEI_MAX_OVERREAD_BITS, "H.264 SEI", iter) ||
+      fuzz(parse_hevc_sps, &hsps, NULL, 0, HEVC_SPS_MAX_OVERREAD_BITS,
+           "HEVC SPS", iter) ||
+      fuzz(parse_hevc_pps, &hpps, NULL, 0, HEVC_PPS_MAX_OVERREAD_BITS,
+           "HEVC PPS", iter) ||
+      fuzz(parse_hevc_sei, NULL, hevc_sei_types, FF_ARRAY_ELEMS(hevc_sei_types),
+           HEVC_SEI_MAX_OVERREAD_BITS, "HEVC SEI", iter) ||
+      fuzz(parse_hevc_vps, &vps, NULL, 0, HEVC_VPS_MAX_OVERREAD_BITS,
+           "HEVC VPS", iter))
+    goto end;
+  err = 0;
+
+end:
+  if (err)
+    printf("failed\n");
+  ff_h264_ps_uninit(&h264_ps);
+  ff_h264_ps_uninit(&h264_sps_ps);
+  ff_h264_sei_uninit(&h264_sei);
+  ff_hevc_ps_uninit(&hevc_ps);
+  ff_hevc_uninit_sei(&hevc_sei);
+  return err;
+}